@@ -5,17 +5,16 @@
 #include "BasicProcessing.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "Tracer.h"
 
 struct AvifReader::avif_cache {
 	avifDecoder* decoder;
 	avifRGBImage rgb;
-	uint8_t* data;
+	const uint8_t* data;
 	size_t data_size;
 	void* transform;
 };
 
-AvifReader::avif_cache AvifReader::cache = { 0 };
-
 void* AvifReader::ReadImage(int& width,
 	int& height,
 	int& nchannels,
@@ -25,6 +24,7 @@ void* AvifReader::ReadImage(int& width,
 	int& frame_time,
 	void*& exif_chunk,
 	bool& outOfMemory,
+	avif_cache*& cache,
 	const void* buffer,
 	int sizebytes)
 {
@@ -37,87 +37,98 @@ void* AvifReader::ReadImage(int& width,
 	avifResult result;
 	int nthreads = 256; // sets maximum number of active threads allowed for libavif, default is 1
 
-	// Cache animations
-	if (cache.decoder == NULL) {
-		cache.data = (uint8_t*)malloc(sizebytes);
-		if (cache.data == NULL) {
+	// Keep the decoder of animations
+	if (cache == NULL) {
+		cache = new(std::nothrow) avif_cache();
+		if (cache == NULL) {
 			outOfMemory = true;
 			return NULL;
 		}
-		memcpy(cache.data, buffer, sizebytes);
-		cache.decoder = avifDecoderCreate();
-		cache.decoder->maxThreads = nthreads;
-		cache.decoder->strictFlags = AVIF_STRICT_DISABLED;
-		result = avifDecoderSetIOMemory(cache.decoder, cache.data, sizebytes);
+		// The decoder reads from the buffer of the caller, it must stay valid until DeleteCache() is called
+		cache->data = (const uint8_t*)buffer;
+		cache->decoder = avifDecoderCreate();
+		cache->decoder->maxThreads = nthreads;
+		cache->decoder->strictFlags = AVIF_STRICT_DISABLED;
+		result = avifDecoderSetIOMemory(cache->decoder, cache->data, sizebytes);
 		if (result != AVIF_RESULT_OK) {
-			DeleteCache();
+			DeleteCache(cache);
+			cache = NULL;
 			return NULL;
 		}
-		result = avifDecoderParse(cache.decoder);
+		CTraceSpan parseSpan(TRACE_Parse);
+		result = avifDecoderParse(cache->decoder);
+		parseSpan.End();
 		if (result != AVIF_RESULT_OK) {
-			DeleteCache();
+			DeleteCache(cache);
+			cache = NULL;
 			return NULL;
 		}
-		cache.rgb = { 0 };
+		cache->rgb = { 0 };
 		
-		cache.data_size = sizebytes;
+		cache->data_size = sizebytes;
 	}
 	
 	// Decode a frame
-	result = avifDecoderNthImage(cache.decoder, frame_index);
+	CTraceSpan decodeSpan(TRACE_Decode);
+	result = avifDecoderNthImage(cache->decoder, frame_index);
+	decodeSpan.End();
 	if (result != AVIF_RESULT_OK) {
-		DeleteCache();
+		DeleteCache(cache);
+		cache = NULL;
 		return NULL;
 	}
-	avifRGBImageSetDefaults(&cache.rgb, cache.decoder->image);
-	cache.rgb.depth = 8;
-	cache.rgb.format = AVIF_RGB_FORMAT_BGRA;
-	cache.rgb.maxThreads = nthreads;
+	avifRGBImageSetDefaults(&cache->rgb, cache->decoder->image);
+	cache->rgb.depth = 8;
+	cache->rgb.format = AVIF_RGB_FORMAT_BGRA;
+	cache->rgb.maxThreads = nthreads;
 
-	width = cache.rgb.width;
-	height = cache.rgb.height;
-	has_animation = cache.decoder->imageCount > 1;
-	frame_count = cache.decoder->imageCount;
-	frame_time = (int)(cache.decoder->imageTiming.duration * 1000.0);
+	width = cache->rgb.width;
+	height = cache->rgb.height;
+	has_animation = cache->decoder->imageCount > 1;
+	frame_count = cache->decoder->imageCount;
+	frame_time = (int)(cache->decoder->imageTiming.duration * 1000.0);
 
 	size_t size = width * nchannels * height;
-	cache.rgb.pixels = new(std::nothrow) unsigned char[size];
-	if (cache.rgb.pixels == NULL) {
+	cache->rgb.pixels = new(std::nothrow) unsigned char[size];
+	if (cache->rgb.pixels == NULL) {
 		outOfMemory = true;
 		return NULL;
 	}
-	cache.rgb.rowBytes = width * nchannels;
-	result = avifImageYUVToRGB(cache.decoder->image, &cache.rgb);
+	cache->rgb.rowBytes = width * nchannels;
+	CTraceSpan convertSpan(TRACE_ColorConvert, IF_Unknown, (__int64)width * height);
+	result = avifImageYUVToRGB(cache->decoder->image, &cache->rgb);
+	convertSpan.End();
 	if (result != AVIF_RESULT_OK) {
-		delete[] cache.rgb.pixels;
-		DeleteCache();
+		delete[] cache->rgb.pixels;
+		DeleteCache(cache);
+		cache = NULL;
 		return NULL;
 	}
 
 	// Handle clap, irot and imir boxes
-	avifTransformFlags flags = cache.decoder->image->transformFlags;
+	avifTransformFlags flags = cache->decoder->image->transformFlags;
 	if (flags & AVIF_TRANSFORM_CLAP) {
-		avifCleanApertureBox* clap = &cache.decoder->image->clap;
+		avifCleanApertureBox* clap = &cache->decoder->image->clap;
 		avifCropRect crop;
 		avifDiagnostics diag;
-		if (avifCropRectConvertCleanApertureBox(&crop, clap, width, height, cache.decoder->image->yuvFormat, &diag)) {
+		if (avifCropRectConvertCleanApertureBox(&crop, clap, width, height, cache->decoder->image->yuvFormat, &diag)) {
 			POINT point = { crop.x, crop.y };
 			SIZE sz = { crop.width, crop.height };
-			void* pixels = CBasicProcessing::Crop32bpp(width, height, cache.rgb.pixels, CRect(point, sz));
+			void* pixels = CBasicProcessing::Crop32bpp(width, height, cache->rgb.pixels, CRect(point, sz));
 			if (pixels != NULL) {
-				delete[] cache.rgb.pixels;
-				cache.rgb.pixels = (uint8_t*)pixels;
+				delete[] cache->rgb.pixels;
+				cache->rgb.pixels = (uint8_t*)pixels;
 				width = crop.width;
 				height = crop.height;
 			}
 		}
 	}
 	if (flags & AVIF_TRANSFORM_IROT) {
-		int angle = 360 - cache.decoder->image->irot.angle * 90;
-		void* pixels = CBasicProcessing::Rotate32bpp(width, height, cache.rgb.pixels, angle);
+		int angle = 360 - cache->decoder->image->irot.angle * 90;
+		void* pixels = CBasicProcessing::Rotate32bpp(width, height, cache->rgb.pixels, angle);
 		if (pixels != NULL) {
-			delete[] cache.rgb.pixels;
-			cache.rgb.pixels = (uint8_t*)pixels;
+			delete[] cache->rgb.pixels;
+			cache->rgb.pixels = (uint8_t*)pixels;
 			if (angle != 180) {
 				int temp = width;
 				width = height;
@@ -126,19 +137,19 @@ void* AvifReader::ReadImage(int& width,
 		}
 	}
 	if (flags & AVIF_TRANSFORM_IMIR) {
-		void* pixels = CBasicProcessing::Mirror32bpp(width, height, cache.rgb.pixels, cache.decoder->image->imir.axis);
+		void* pixels = CBasicProcessing::Mirror32bpp(width, height, cache->rgb.pixels, cache->decoder->image->imir.axis);
 		if (pixels != NULL) {
-			delete[] cache.rgb.pixels;
-			cache.rgb.pixels = (uint8_t*)pixels;
+			delete[] cache->rgb.pixels;
+			cache->rgb.pixels = (uint8_t*)pixels;
 		}
 	}
 
-	avifRWData icc = cache.decoder->image->icc;
-	if (cache.transform == NULL)
-		cache.transform = ICCProfileTransform::CreateTransform(icc.data, icc.size, ICCProfileTransform::FORMAT_BGRA);
-	ICCProfileTransform::DoTransform(cache.transform, cache.rgb.pixels, cache.rgb.pixels, width, height);
+	avifRWData icc = cache->decoder->image->icc;
+	if (cache->transform == NULL)
+		cache->transform = ICCProfileTransform::CreateTransform(icc.data, icc.size, ICCProfileTransform::FORMAT_BGRA);
+	ICCProfileTransform::DoTransform(cache->transform, cache->rgb.pixels, cache->rgb.pixels, width, height);
 
-	avifRWData exif = cache.decoder->image->exif;
+	avifRWData exif = cache->decoder->image->exif;
 	if (exif.size > 8 && exif.size < 65528 && exif.data != NULL) {
 		exif_chunk = malloc(exif.size + 10);
 		if (exif_chunk != NULL) {
@@ -148,17 +159,20 @@ void* AvifReader::ReadImage(int& width,
 		}
 	}
 
-	void* pPixelData = cache.rgb.pixels;
-	if (!has_animation)
-		DeleteCache();
+	void* pPixelData = cache->rgb.pixels;
+	if (!has_animation) {
+		DeleteCache(cache);
+		cache = NULL;
+	}
 
 	return pPixelData;
 }
 
-void AvifReader::DeleteCache() {
-	if (cache.decoder)
-		avifDecoderDestroy(cache.decoder);
-	free(cache.data);
-	ICCProfileTransform::DeleteTransform(cache.transform);
-	cache = { 0 };
+void AvifReader::DeleteCache(avif_cache* cache) {
+	if (cache != NULL) {
+		if (cache->decoder)
+			avifDecoderDestroy(cache->decoder);
+		ICCProfileTransform::DeleteTransform(cache->transform);
+		delete cache;
+	}
 }
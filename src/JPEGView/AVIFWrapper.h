@@ -6,7 +6,12 @@
 class AvifReader
 {
 public:
+	// Decoder state of an animation, kept from one frame to the next
+	struct avif_cache;
+
 	// Returns data in 4 byte BGRA
+	// If cache is NULL, the image is read from the buffer. For animations, a new decoder state is created in cache,
+	// the other frames are read by passing this state again (buffer and sizebytes are ignored then).
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -16,12 +21,11 @@ public:
 		int& frame_time, // frame duration in milliseconds
 		void*& exif_chunk, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
+		avif_cache*& cache, // decoder state of an animation, must be deleted by the caller with DeleteCache()
 		const void* buffer, // memory address containing jxl compressed data.
 		int sizebytes); // size of jxl compressed data
 
-	static void DeleteCache();
-
-private:
-	struct avif_cache;
-	static avif_cache cache;
+	// Deletes the decoder state of an animation. The buffer passed to ReadImage() of an animation
+	// is not copied, it must stay valid until this method is called.
+	static void DeleteCache(avif_cache* cache);
 };
@@ -0,0 +1,65 @@
+#include "StdAfx.h"
+#include "AnimationDecoder.h"
+#include "MappedFile.h"
+#include <gdiplus.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CAnimationDecoder::CAnimationDecoder(LPCTSTR sFileName, EImageFormat eImageFormat, CMappedFile* pMappedFile) {
+	m_sFileName = sFileName;
+	m_eImageFormat = eImageFormat;
+	NextFrameIndex = 0;
+	FrameSize = CSize(0, 0);
+	MappedFile = pMappedFile;
+	WebpCache = NULL;
+#ifndef WINXP
+	PngCache = NULL;
+	JxlCache = NULL;
+	AvifCache = NULL;
+#endif
+	GDIPlusBitmap = NULL;
+}
+
+CAnimationDecoder::~CAnimationDecoder() {
+	WebpReaderWriter::DeleteCache(WebpCache);
+#ifndef WINXP
+	PngReader::DeleteCache(PngCache);
+	JxlReader::DeleteCache(JxlCache);
+	if (AvifCache != NULL) {
+		// prevent crashing when libavif/dav1d fail or missing
+		UINT nPrevErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS);
+		try {
+			AvifReader::DeleteCache(AvifCache);
+		} catch (...) {}
+		SetErrorMode(nPrevErrorMode);
+	}
+#endif
+	delete GDIPlusBitmap;
+	// the decoders read from the file, close it last
+	delete MappedFile;
+}
+
+bool CAnimationDecoder::IsEmpty() const {
+#ifndef WINXP
+	if (PngCache != NULL || JxlCache != NULL || AvifCache != NULL) {
+		return false;
+	}
+#endif
+	return WebpCache == NULL && GDIPlusBitmap == NULL;
+}
+
+bool CAnimationDecoder::CanDecodeFrame(int nFrameIndex) const {
+#ifndef WINXP
+	if (AvifCache != NULL) {
+		return true;
+	}
+#endif
+	return GDIPlusBitmap != NULL || nFrameIndex == NextFrameIndex;
+}
+
+__int64 CAnimationDecoder::GetMemoryFootprint() const {
+	// the decoders keep about two frames with 4 bytes per pixel, the composed canvas and the previous or the decoded frame
+	return (__int64)FrameSize.cx * FrameSize.cy * 8;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ImageProcessingTypes.h"
+#include "WEBPWrapper.h"
+#include "PNGWrapper.h"
+#ifndef WINXP
+#include "JXLWrapper.h"
+#include "AVIFWrapper.h"
+#endif
+
+class CMappedFile;
+namespace Gdiplus {
+	class Bitmap;
+}
+
+// Decoder state of an animated image that is kept from one frame to the next, decoding the next frame continues
+// where the last frame ended instead of parsing the file again.
+// The state belongs to one file. It is owned by the image of the last decoded frame (see CJPEGImage::DetachAnimationDecoder())
+// and handed over to the load request of the following frame, so several animations can be decoded at the same time
+// on different threads and switching between two animated files does not restart their animations.
+class CAnimationDecoder
+{
+public:
+	// Ownership of the mapped file (can be NULL) goes to this class
+	CAnimationDecoder(LPCTSTR sFileName, EImageFormat eImageFormat, CMappedFile* pMappedFile);
+	// Deletes the decoder state and closes the file
+	~CAnimationDecoder();
+
+	// File name with path and image format of the animation
+	LPCTSTR FileName() const { return m_sFileName; }
+	EImageFormat GetImageFormat() const { return m_eImageFormat; }
+
+	// True if no decoder state is kept, e.g. because the image is not animated
+	bool IsEmpty() const;
+
+	// True if the decoder can continue with the frame of the given index. The WebP, PNG and JPEG XL decoders
+	// only return the frames in sequence, the AVIF and GDI+ decoders can decode any frame.
+	bool CanDecodeFrame(int nFrameIndex) const;
+
+	// Approximate number of bytes of memory used by the decoder state
+	__int64 GetMemoryFootprint() const;
+
+	// Index of the frame that is decoded next by the sequential decoders
+	int NextFrameIndex;
+	// Size of the frames in pixels
+	CSize FrameSize;
+	// File the decoders read the frames from, the data is not copied by the decoders. Can be NULL.
+	CMappedFile* MappedFile;
+	// Format specific decoder state, NULL if not used
+	WebpReaderWriter::webp_cache* WebpCache;
+#ifndef WINXP
+	PngReader::png_cache* PngCache;
+	JxlReader::jxl_cache* JxlCache;
+	AvifReader::avif_cache* AvifCache;
+#endif
+	// GDI+ bitmap of an animated GIF, GDI+ reads the frames from the file
+	Gdiplus::Bitmap* GDIPlusBitmap;
+
+private:
+	CString m_sFileName;
+	EImageFormat m_eImageFormat;
+
+	// not copyable
+	CAnimationDecoder(const CAnimationDecoder&);
+	CAnimationDecoder& operator=(const CAnimationDecoder&);
+};
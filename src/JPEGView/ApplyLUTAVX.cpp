@@ -0,0 +1,102 @@
+#include "StdAfx.h"
+#include "ApplyLUTAVX.h"
+
+#ifdef _WIN64
+
+#define ALPHA_OPAQUE 0xFF000000
+
+// Looks up the eight int32 indices in the int32 table
+static inline __m256i Lookup(const int32* pTable, __m256i index) {
+	return _mm256_i32gather_epi32((const int*)pTable, index, 4);
+}
+
+// Applies the saturation matrix, the channels are replaced by the saturated channels in the range 0..255
+static inline void ApplySaturation(const int32* pSatLUTs, __m256i& blue, __m256i& green, __m256i& red) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i maxValue = _mm256_set1_epi32(255 << 16);
+	__m256i redByRed = Lookup(pSatLUTs, red);
+	__m256i redByGreen = Lookup(pSatLUTs + 768, red);
+	__m256i greenByRed = Lookup(pSatLUTs + 256, green);
+	__m256i greenByGreen = Lookup(pSatLUTs + 1024, green);
+	__m256i blueByRed = Lookup(pSatLUTs + 512, blue);
+	__m256i blueByBlue = Lookup(pSatLUTs + 1280, blue);
+	__m256i newRed = _mm256_add_epi32(_mm256_add_epi32(redByRed, greenByRed), blueByRed);
+	__m256i newGreen = _mm256_add_epi32(_mm256_add_epi32(redByGreen, greenByGreen), blueByRed);
+	__m256i newBlue = _mm256_add_epi32(_mm256_add_epi32(redByGreen, greenByRed), blueByBlue);
+	red = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(newRed, zero), maxValue), 16);
+	green = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(newGreen, zero), maxValue), 16);
+	blue = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(newBlue, zero), maxValue), 16);
+}
+
+// Splits eight BGRA pixels into the three channels
+static inline void Unpack(const uint32* pSource, __m256i& blue, __m256i& green, __m256i& red) {
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i pixels = _mm256_loadu_si256((const __m256i*)pSource);
+	blue = _mm256_and_si256(pixels, mask);
+	green = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask);
+	red = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask);
+}
+
+// Combines the three channels in the range 0..255 to eight opaque BGRA pixels
+static inline void Pack(uint32* pTarget, __m256i blue, __m256i green, __m256i red) {
+	__m256i pixels = _mm256_or_si256(_mm256_or_si256(blue, _mm256_slli_epi32(green, 8)),
+		_mm256_or_si256(_mm256_slli_epi32(red, 16), _mm256_set1_epi32((int)ALPHA_OPAQUE)));
+	_mm256_storeu_si256((__m256i*)pTarget, pixels);
+}
+
+// Adds the LDC mask, weighted by the LDC response LUT, to the channel and clamps to 0..255
+static inline __m256i ApplyMask(__m256i channel, __m256i mask, const int32* pMulLUT) {
+	__m256i weighted = _mm256_srai_epi32(_mm256_mullo_epi32(mask, Lookup(pMulLUT, channel)), 14);
+	return _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(channel, weighted), _mm256_setzero_si256()), _mm256_set1_epi32(255));
+}
+
+int ApplyLUT32bpp_AVX(int nNumPixels, const uint32* pSource, const int32* pSatLUTs, const int32* pLUT32, uint32* pTarget) {
+	int nNumBlocks = nNumPixels >> 3;
+	for (int i = 0; i < nNumBlocks; i++) {
+		__m256i blue, green, red;
+		Unpack(pSource, blue, green, red);
+		if (pSatLUTs != NULL) {
+			ApplySaturation(pSatLUTs, blue, green, red);
+		}
+		Pack(pTarget, Lookup(pLUT32, blue), Lookup(pLUT32 + 256, green), Lookup(pLUT32 + 512, red));
+		pSource += 8;
+		pTarget += 8;
+	}
+	return nNumBlocks << 3;
+}
+
+int ApplyLDCRow32bpp_AVX(int nWidth, uint32 nStartX, uint32 nIncrementX, const int32* pMaskRow,
+	const uint32* pSource, const int32* pSatLUTs, const int32* pLUT32, const int32* pMulLUT, uint32* pTarget) {
+
+	int nNumBlocks = nWidth >> 3;
+	__m256i curX = _mm256_add_epi32(_mm256_set1_epi32(nStartX), _mm256_mullo_epi32(_mm256_set1_epi32(nIncrementX), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	const __m256i incrementX = _mm256_set1_epi32(nIncrementX * 8);
+	const __m256i fracMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i maskOffset = _mm256_set1_epi32(127);
+	for (int i = 0; i < nNumBlocks; i++) {
+		// linear interpolation of the vertically interpolated mask
+		__m256i curXTrunc = _mm256_srli_epi32(curX, 16);
+		__m256i curXFrac = _mm256_and_si256(curX, fracMask);
+		__m256i left = Lookup(pMaskRow, curXTrunc);
+		__m256i right = Lookup(pMaskRow + 1, curXTrunc);
+		__m256i mask = _mm256_add_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(curXFrac, _mm256_sub_epi32(right, left)), 16), left);
+		mask = _mm256_sub_epi32(mask, maskOffset);
+
+		__m256i blue, green, red;
+		Unpack(pSource, blue, green, red);
+		if (pSatLUTs != NULL) {
+			ApplySaturation(pSatLUTs, blue, green, red);
+		}
+		blue = ApplyMask(Lookup(pLUT32, blue), mask, pMulLUT);
+		green = ApplyMask(Lookup(pLUT32 + 256, green), mask, pMulLUT);
+		red = ApplyMask(Lookup(pLUT32 + 512, red), mask, pMulLUT);
+		Pack(pTarget, blue, green, red);
+
+		curX = _mm256_add_epi32(curX, incrementX);
+		pSource += 8;
+		pTarget += 8;
+	}
+	return nNumBlocks << 3;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+// Used by BasicProcessing.cpp: Applies the saturation LUTs (can be NULL) and the three channel LUT to nNumPixels 32 bpp pixels using AVX2.
+// pLUT32 is the three channel LUT widened to int32 for the gather instructions.
+// Returns the number of pixels processed, a multiple of 8. The caller processes the remaining pixels.
+// Own compilation unit to be able to compile this with AVX compiler flag.
+int ApplyLUT32bpp_AVX(int nNumPixels, const uint32* pSource, const int32* pSatLUTs, const int32* pLUT32, uint32* pTarget);
+
+// Used by BasicProcessing.cpp: Applies the LDC, the saturation LUTs (can be NULL) and the three channel LUT to one row of 32 bpp pixels using AVX2.
+// pMaskRow is the row of the LDC map already interpolated vertically, nStartX and nIncrementX are 16.16 fixed point positions in this row.
+// Returns the number of pixels processed, a multiple of 8. The caller processes the remaining pixels.
+int ApplyLDCRow32bpp_AVX(int nWidth, uint32 nStartX, uint32 nIncrementX, const int32* pMaskRow,
+	const uint32* pSource, const int32* pSatLUTs, const int32* pLUT32, const int32* pMulLUT, uint32* pTarget);
@@ -0,0 +1,218 @@
+#include "StdAfx.h"
+#include "AsyncResampler.h"
+#include "ProcessingThreadPool.h"
+#include "Helpers.h"
+#include "Tracer.h"
+#include <process.h>
+#include <math.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// CResampleParams
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CResampleParams::CResampleParams() {
+	SourcePixels = NULL;
+	SourceChannels = 0;
+	UpSample = false;
+	Sharpen = 0.0;
+	Filter = Filter_Downsampling_Best_Quality;
+	UseSIMD = false;
+	SIMD = CBasicProcessing::SSE;
+}
+
+bool CResampleParams::operator==(const CResampleParams& other) const {
+	return FullTargetSize == other.FullTargetSize && TargetOffset == other.TargetOffset && ClippingSize == other.ClippingSize &&
+		UpSample == other.UpSample && fabs(Sharpen - other.Sharpen) <= 1e-2 && Filter == other.Filter &&
+		UseSIMD == other.UseSIMD && (!UseSIMD || SIMD == other.SIMD);
+}
+
+void* CResampleParams::Resample() const {
+	if (UseSIMD) {
+		if (UpSample) {
+			return CBasicProcessing::SampleUp_HQ_SIMD(FullTargetSize, TargetOffset, ClippingSize,
+				SourceSize, SourcePixels, SourceChannels, SIMD);
+		} else {
+			return CBasicProcessing::SampleDown_HQ_SIMD(FullTargetSize, TargetOffset, ClippingSize,
+				SourceSize, SourcePixels, SourceChannels, Sharpen, Filter, SIMD);
+		}
+	} else {
+		if (UpSample) {
+			return CBasicProcessing::SampleUp_HQ(FullTargetSize, TargetOffset, ClippingSize,
+				SourceSize, SourcePixels, SourceChannels);
+		} else {
+			return CBasicProcessing::SampleDown_HQ(FullTargetSize, TargetOffset, ClippingSize,
+				SourceSize, SourcePixels, SourceChannels, Sharpen, Filter);
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// CAsyncResampler - Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CAsyncResampler* CAsyncResampler::sm_instance;
+
+CAsyncResampler& CAsyncResampler::This() {
+	if (sm_instance == NULL) {
+		sm_instance = new CAsyncResampler();
+	}
+	return *sm_instance;
+}
+
+CAsyncResampler::CAsyncResampler() : m_csState{ 0 } {
+	::InitializeCriticalSection(&m_csState);
+	m_hWakeUp = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hIdle = ::CreateEvent(NULL, TRUE, TRUE, NULL);
+	m_bTerminate = false;
+	m_bCancel = false;
+	m_bPending = false;
+	m_pPendingOwner = NULL;
+	m_bRunning = false;
+	m_pRunningOwner = NULL;
+	m_hNotifyWnd = NULL;
+	m_nMessage = 0;
+	m_pResult = NULL;
+	m_pResultOwner = NULL;
+	m_hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadFunc, this, 0, NULL);
+}
+
+CAsyncResampler::~CAsyncResampler() {
+	m_bTerminate = true;
+	m_bCancel = true;
+	if (m_hThread != NULL) {
+		::SetEvent(m_hWakeUp);
+		::WaitForSingleObject(m_hThread, INFINITE);
+		::CloseHandle(m_hThread);
+	}
+	delete[] m_pResult;
+	::CloseHandle(m_hWakeUp);
+	::CloseHandle(m_hIdle);
+	::DeleteCriticalSection(&m_csState);
+}
+
+void CAsyncResampler::Start(const void* pOwner, const CResampleParams& params, HWND hNotifyWnd, UINT nMessage) {
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csState);
+		m_bCancel = m_bRunning;
+		m_bPending = true;
+		m_pPendingOwner = pOwner;
+		m_pendingParams = params;
+		m_hNotifyWnd = hNotifyWnd;
+		m_nMessage = nMessage;
+		delete[] m_pResult;
+		m_pResult = NULL;
+	}
+	::SetEvent(m_hWakeUp);
+}
+
+void CAsyncResampler::Cancel(const void* pOwner, bool bWait) {
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csState);
+		if (m_bRunning && m_pRunningOwner == pOwner) {
+			m_bCancel = true;
+		}
+		if (m_bPending && m_pPendingOwner == pOwner) {
+			m_bPending = false;
+		}
+		if (m_pResult != NULL && m_pResultOwner == pOwner) {
+			delete[] m_pResult;
+			m_pResult = NULL;
+		}
+	}
+	if (bWait) {
+		// the thread may start the pending resampling of another owner meanwhile, then this waits for that one too
+		while (IsRunningFor(pOwner)) {
+			::WaitForSingleObject(m_hIdle, INFINITE);
+		}
+	}
+}
+
+bool CAsyncResampler::IsStartedWith(const void* pOwner, const CResampleParams& params) {
+	Helpers::CAutoCriticalSection criticalSection(m_csState);
+	return (m_bPending && m_pPendingOwner == pOwner && m_pendingParams == params) ||
+		(m_bRunning && !m_bCancel && m_pRunningOwner == pOwner && m_runningParams == params);
+}
+
+bool CAsyncResampler::HasResult(const void* pOwner, const CResampleParams& params) {
+	Helpers::CAutoCriticalSection criticalSection(m_csState);
+	return m_pResult != NULL && m_pResultOwner == pOwner && m_resultParams == params;
+}
+
+void* CAsyncResampler::TakeResult(const void* pOwner, const CResampleParams& params) {
+	Helpers::CAutoCriticalSection criticalSection(m_csState);
+	if (m_pResult == NULL || m_pResultOwner != pOwner || m_resultParams != params) {
+		return NULL;
+	}
+	void* pResult = m_pResult;
+	m_pResult = NULL;
+	return pResult;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// CAsyncResampler - Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int __stdcall CAsyncResampler::ThreadFunc(void* arg) {
+	CAsyncResampler* pThis = (CAsyncResampler*)arg;
+	// The resampling is done for the display, it preempts the processing of read ahead images
+	CProcessingThreadPool::SetPriorityOfThread(CProcessingThreadPool::Priority_Paint);
+	CProcessingThreadPool::SetCancelFlagOfThread(&pThis->m_bCancel);
+	while (true) {
+		::WaitForSingleObject(pThis->m_hWakeUp, INFINITE);
+		if (pThis->m_bTerminate) {
+			break;
+		}
+		pThis->ProcessPending();
+	}
+	return 0;
+}
+
+void CAsyncResampler::ProcessPending() {
+	CResampleParams params;
+	const void* pOwner;
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csState);
+		if (!m_bPending) {
+			return;
+		}
+		params = m_pendingParams;
+		pOwner = m_pPendingOwner;
+		m_bPending = false;
+		m_bRunning = true;
+		m_bCancel = false;
+		m_pRunningOwner = pOwner;
+		m_runningParams = params;
+		::ResetEvent(m_hIdle);
+	}
+
+	CTraceSpan resampleSpan(TRACE_Resample, IF_Unknown, (__int64)params.ClippingSize.cx * params.ClippingSize.cy);
+	void* pResult = params.Resample();
+	resampleSpan.End();
+
+	HWND hNotifyWnd = NULL;
+	UINT nMessage = 0;
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csState);
+		m_bRunning = false;
+		m_pRunningOwner = NULL;
+		if (m_bCancel || pResult == NULL) {
+			delete[] pResult;
+		} else {
+			delete[] m_pResult;
+			m_pResult = pResult;
+			m_pResultOwner = pOwner;
+			m_resultParams = params;
+			hNotifyWnd = m_hNotifyWnd;
+			nMessage = m_nMessage;
+		}
+		::SetEvent(m_hIdle);
+	}
+	if (hNotifyWnd != NULL) {
+		::PostMessage(hNotifyWnd, nMessage, 0, 0);
+	}
+}
+
+bool CAsyncResampler::IsRunningFor(const void* pOwner) {
+	Helpers::CAutoCriticalSection criticalSection(m_csState);
+	return m_bRunning && m_pRunningOwner == pOwner;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "BasicProcessing.h"
+
+// Input of a high quality resampling of (a section of) an image. All data is contained, so the resampling
+// does not depend on the image object and can run on any thread.
+class CResampleParams {
+public:
+	CResampleParams();
+
+	// Target: full size of the resampled image, section to resample
+	CSize FullTargetSize;
+	CPoint TargetOffset;
+	CSize ClippingSize;
+	// Source pixels, either the original pixels or a pyramid level
+	const void* SourcePixels;
+	CSize SourceSize;
+	int SourceChannels;
+	// Algorithm
+	bool UpSample;
+	double Sharpen;
+	EFilterType Filter;
+	bool UseSIMD;
+	CBasicProcessing::SIMDArchitecture SIMD;
+
+	// True if both parameters resample the same section to the same target size with the same algorithm.
+	// The source is not compared, it can be a different level of the pyramid.
+	bool operator==(const CResampleParams& other) const;
+	bool operator!=(const CResampleParams& other) const { return !(*this == other); }
+
+	// Resamples with these parameters, returns a new 32 bpp DIB or NULL if out of memory or cancelled
+	void* Resample() const;
+};
+
+// High quality resampling for the display on a background thread.
+// While the resampling is running, the display shows a fast point sampled DIB. When the resampling is finished,
+// a message is posted to the window to paint again, the painting then takes the result instead of resampling.
+// Starting a new resampling cancels the running one after the strip currently processed, so fast zooming
+// never waits on stale work.
+// One thread is shared by all images, only the displayed image needs resampling. The requests and the result are
+// keyed by the owner (the image), so an image only gets its own result and only cancels its own resampling.
+class CAsyncResampler
+{
+public:
+	// Singleton instance, the thread is created on first use
+	static CAsyncResampler& This();
+
+	// Cancels the running resampling and stops the thread
+	~CAsyncResampler();
+
+	// Starts resampling for the given owner, a running or pending resampling is cancelled, also of other owners.
+	// The source pixels of the parameters must be valid until Cancel(pOwner, true) is called or the resampling has finished.
+	// When the result is ready, nMessage is posted to hNotifyWnd.
+	void Start(const void* pOwner, const CResampleParams& params, HWND hNotifyWnd, UINT nMessage);
+
+	// Cancels the running and pending resampling of the owner and discards its result. If bWait is true, the method waits until the
+	// thread does no longer access the source pixels of the owner, this must be done before the source pixels are freed or modified.
+	void Cancel(const void* pOwner, bool bWait);
+
+	// True if a resampling with the given parameters is pending or running for the owner
+	bool IsStartedWith(const void* pOwner, const CResampleParams& params);
+
+	// True if the result of a resampling with the given parameters is ready for the owner
+	bool HasResult(const void* pOwner, const CResampleParams& params);
+
+	// Gets the result if it matches the owner and the given parameters, the caller takes ownership of the pixels. NULL if no such result.
+	void* TakeResult(const void* pOwner, const CResampleParams& params);
+
+private:
+	static CAsyncResampler* sm_instance;
+
+	CRITICAL_SECTION m_csState; // protects all members below, except the thread handle
+	HANDLE m_hThread;
+	HANDLE m_hWakeUp; // auto reset event waking up the thread when a resampling is pending
+	HANDLE m_hIdle; // manual reset event, set when the thread is not resampling
+	volatile bool m_bTerminate;
+	volatile bool m_bCancel; // cancels the running resampling
+	bool m_bPending;
+	const void* m_pPendingOwner;
+	CResampleParams m_pendingParams;
+	bool m_bRunning;
+	const void* m_pRunningOwner;
+	CResampleParams m_runningParams;
+	HWND m_hNotifyWnd;
+	UINT m_nMessage;
+	void* m_pResult;
+	const void* m_pResultOwner;
+	CResampleParams m_resultParams;
+
+	CAsyncResampler();
+	static unsigned int __stdcall ThreadFunc(void* arg);
+	void ProcessPending();
+	bool IsRunningFor(const void* pOwner);
+
+	CAsyncResampler(const CAsyncResampler&);
+	CAsyncResampler& operator=(const CAsyncResampler&);
+};
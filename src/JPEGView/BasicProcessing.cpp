@@ -7,6 +7,9 @@
 #include "ProcessingThreadPool.h"
 #ifdef _WIN64
 #include "ApplyFilterAVX.h"
+#include "ApplyLUTAVX.h"
+#include "BicubicAVX.h"
+#include "UnsharpMaskAVX.h"
 #endif
 #include <math.h>
 
@@ -43,21 +46,32 @@ static void* SampleUp_HQ_AVX_Core(CSize fullTargetSize, CPoint fullTargetOffset,
 	CSize sourceSize, const void* pIJLPixels, int nChannels,
 	uint8* pTarget);
 
+static void ApplyLUT32bpp_Core(int nNumPixels, const uint32* pSource, const int32* pSatLUTs, const uint8* pLUT,
+	bool bUseAVX, uint32* pTarget);
+
 static void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize dibSize,
 	CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
-	float fBlackPt, float fWhitePt, float fBlackPtSteepness, uint32* pTarget);
+	float fBlackPt, float fWhitePt, float fBlackPtSteepness, bool bUseAVX, uint32* pTarget);
 
 static int16* GaussFilter16bpp1Channel_Core(CSize fullSize, CPoint offset, CSize rect, int nTargetWidth, double dRadius,
-	const int16* pSourcePixels, int16* pTargetPixels);
+	const int16* pSourcePixels, int16* pTargetPixels, bool bUseAVX);
 
 static void* UnsharpMask_Core(CSize fullSize, CPoint offset, CSize rect, double dAmount, const int16* pThresholdLUT,
-	const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels);
+	const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels, bool bUseAVX);
+
+// Maps the target pixel (i, j) to the source position (FirstX + i * IncrementX1 + j * IncrementX2, FirstY + i * IncrementY1 + j * IncrementY2),
+// all values in 16.16 fixed point format
+struct CRotationMapping {
+	int32 FirstX, FirstY;
+	int32 IncrementX1, IncrementY1;
+	int32 IncrementX2, IncrementY2;
+};
 
-static void* RotateHQ_Core(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize,
-	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor);
+static void* RotateHQ_Core(const CRotationMapping& mapping, CPoint targetOffset, CSize targetSize, CSize sourceSize,
+	const void* pSourcePixels, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX);
 
-static void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize,
-	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor);
+static void* TrapezoidHQ_Core(int nWidth, int nHeight, const int* pTableY, const int* pStartX, const int* pIncrementX, CSize sourceSize,
+	const void* pSourcePixels, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX);
 
 //---------------------------------------------------------------------------------------------
 
@@ -116,12 +130,36 @@ public:
 	CBasicProcessing::SIMDArchitecture SIMD;
 };
 
+// Request for applying the saturation LUTs (optional) and the three channel LUT
+class CRequestLUT : public CProcessingRequest {
+public:
+	CRequestLUT(const void* pSourcePixels, CSize size, void* pTargetPixels,
+		const int32* pSatLUTs, const uint8* pLUT, bool bUseAVX)
+		: CProcessingRequest(pSourcePixels, size, pTargetPixels, size, CPoint(0, 0), size) {
+		SatLUTs = pSatLUTs;
+		LUT = pLUT;
+		UseAVX = bUseAVX;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		ApplyLUT32bpp_Core(ClippedTargetSize.cx * sizeY,
+			(const uint32*)SourcePixels + ClippedTargetSize.cx * offsetY,
+			SatLUTs, LUT, UseAVX,
+			(uint32*)TargetPixels + ClippedTargetSize.cx * offsetY);
+		return true;
+	}
+
+	const int32* SatLUTs;
+	const uint8* LUT;
+	bool UseAVX;
+};
+
 class CRequestLDC : public CProcessingRequest {
 public:
 	CRequestLDC(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels,
 		CSize fullTargetSize, CPoint fullTargetOffset,
 		CSize ldcMapSize, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
-		float fBlackPt, float fWhitePt, float fBlackPtSteepness)
+		float fBlackPt, float fWhitePt, float fBlackPtSteepness, bool bUseAVX)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, fullTargetSize, fullTargetOffset, sourceSize) {
 		LDCMapSize = ldcMapSize;
 		SatLUTs = pSatLUTs;
@@ -130,6 +168,7 @@ public:
 		BlackPt = fBlackPt;
 		WhitePt = fWhitePt;
 		BlackPtSteepness = fBlackPtSteepness;
+		UseAVX = bUseAVX;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
@@ -139,7 +178,7 @@ public:
 			LDCMapSize,
 			(const uint32*)SourcePixels + ClippedTargetSize.cx * offsetY,
 			SatLUTs, LUT, LDCMap,
-			BlackPt, WhitePt, BlackPtSteepness,
+			BlackPt, WhitePt, BlackPtSteepness, UseAVX,
 			(uint32*)TargetPixels + ClippedTargetSize.cx * offsetY);
 	}
 
@@ -150,13 +189,15 @@ public:
 	float BlackPt;
 	float WhitePt;
 	float BlackPtSteepness;
+	bool UseAVX;
 };
 
 class CRequestGauss : public CProcessingRequest {
 public:
-	CRequestGauss(const int16* pSourcePixels, CSize fullSize, CPoint offset, CSize rect, double dRadius, int16* pTargetPixels)
+	CRequestGauss(const int16* pSourcePixels, CSize fullSize, CPoint offset, CSize rect, double dRadius, int16* pTargetPixels, bool bUseAVX)
 		: CProcessingRequest(pSourcePixels, fullSize, pTargetPixels, rect, offset, rect) {
 		Radius = dRadius;
+		UseAVX = bUseAVX;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
@@ -166,16 +207,18 @@ public:
 			FullTargetSize.cy,
 			Radius,
 			(int16*)SourcePixels,
-			(int16*)TargetPixels + offsetY);
+			(int16*)TargetPixels + offsetY,
+			UseAVX);
 	}
 
 	double Radius;
+	bool UseAVX;
 };
 
 class CRequestUnsharpMask : public CProcessingRequest {
 public:
 	CRequestUnsharpMask(const void* pSourcePixels, CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold,
-		const int16* pThresholdLUT, const int16* pGrayImage, const int16* pSmoothedGrayImage, void* pTargetPixels, int nChannels)
+		const int16* pThresholdLUT, const int16* pGrayImage, const int16* pSmoothedGrayImage, void* pTargetPixels, int nChannels, bool bUseAVX)
 		: CProcessingRequest(pSourcePixels, fullSize, pTargetPixels, rect, offset, rect) {
 		Amount = dAmount;
 		Threshold = dThreshold;
@@ -183,6 +226,7 @@ public:
 		GrayImage = pGrayImage;
 		SmoothedGrayImage = pSmoothedGrayImage;
 		Channels = nChannels;
+		UseAVX = bUseAVX;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
@@ -192,7 +236,7 @@ public:
 			Amount,
 			ThresholdLUT, GrayImage, SmoothedGrayImage,
 			SourcePixels, TargetPixels,
-			Channels);
+			Channels, UseAVX);
 	}
 
 	double Amount;
@@ -201,48 +245,57 @@ public:
 	const int16* GrayImage;
 	const int16* SmoothedGrayImage;
 	int Channels;
+	bool UseAVX;
 };
 
 class CRequestRotate : public CProcessingRequest {
 public:
-	CRequestRotate(const void* pSourcePixels, CPoint targetOffset, CSize targetSize, double dRotation,
-		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor)
+	CRequestRotate(const void* pSourcePixels, CPoint targetOffset, CSize targetSize, const CRotationMapping& mapping,
+		CSize sourceSize, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, targetOffset, targetSize) {
-		Rotation = dRotation;
+		Mapping = mapping;
 		Channels = nChannels;
-		BackColor = backColor;
+		BackColor = nBackColor;
+		UseAVX = bUseAVX;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
-		return NULL != RotateHQ_Core(CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
-			CSize(FullTargetSize.cx, sizeY), Rotation, SourceSize, SourcePixels,
-			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor);
+		return NULL != RotateHQ_Core(Mapping, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
+			CSize(FullTargetSize.cx, sizeY), SourceSize, SourcePixels,
+			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor, UseAVX);
 	}
 
-	double Rotation;
+	CRotationMapping Mapping;
 	int Channels;
-	COLORREF BackColor;
+	uint32 BackColor;
+	bool UseAVX;
 };
 
+// Request for trapezoid correction, the source row and x-positions of each target row are precalculated
 class CRequestTrapezoid : public CProcessingRequest {
 public:
-	CRequestTrapezoid(const void* pSourcePixels, CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid,
-		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor)
-		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, targetOffset, targetSize) {
-		Trapezoid = trapezoid;
+	CRequestTrapezoid(const void* pSourcePixels, CSize targetSize, const int* pTableY, const int* pStartX, const int* pIncrementX,
+		CSize sourceSize, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX)
+		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, CPoint(0, 0), targetSize) {
+		TableY = pTableY;
+		StartX = pStartX;
+		IncrementX = pIncrementX;
 		Channels = nChannels;
-		BackColor = backColor;
+		BackColor = nBackColor;
+		UseAVX = bUseAVX;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
-		return NULL != TrapezoidHQ_Core(CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
-			CSize(FullTargetSize.cx, sizeY), Trapezoid, SourceSize, SourcePixels,
-			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor);
+		return NULL != TrapezoidHQ_Core(FullTargetSize.cx, sizeY, TableY + offsetY, StartX + offsetY, IncrementX + offsetY,
+			SourceSize, SourcePixels, (uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor, UseAVX);
 	}
 
-	CTrapezoid Trapezoid;
+	const int* TableY;
+	const int* StartX;
+	const int* IncrementX;
 	int Channels;
-	COLORREF BackColor;
+	uint32 BackColor;
+	bool UseAVX;
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -339,39 +392,33 @@ int16* CBasicProcessing::Create1Channel16bppGrayscaleImage(int nWidth, int nHeig
 	return pNewImage;
 }
 
-void* CBasicProcessing::Apply3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT) {
-	if (pDIBPixels == NULL || pLUT == NULL) {
-		return NULL;
-	}
+static void ApplyLUT32bpp_Core(int nNumPixels, const uint32* pSource, const int32* pSatLUTs, const uint8* pLUT,
+	bool bUseAVX, uint32* pTarget) {
 
-	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
-	if (pTarget == NULL) return NULL;
-	const uint32* pSrc = (uint32*)pDIBPixels;
+	const uint32* pSrc = pSource;
 	uint32* pTgt = pTarget;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
+	int nStart = 0;
+#ifdef _WIN64
+	if (bUseAVX) {
+		int32 LUT32[768];
+		for (int i = 0; i < 768; i++) {
+			LUT32[i] = pLUT[i];
+		}
+		nStart = ApplyLUT32bpp_AVX(nNumPixels, pSrc, pSatLUTs, LUT32, pTgt);
+		pSrc += nStart; pTgt += nStart;
+	}
+#endif
+	if (pSatLUTs == NULL) {
+		for (int i = nStart; i < nNumPixels; i++) {
 			uint32 nSrcPixels = *pSrc;
 			*pTgt = pLUT[nSrcPixels & 0xFF] + pLUT[256 + ((nSrcPixels >> 8) & 0xFF)] * 256 + 
 				pLUT[512 + ((nSrcPixels >> 16) & 0xFF)] * 65536 + ALPHA_OPAQUE;
 			pTgt++; pSrc++;
 		}
-	}
-	return pTarget;
-}
-
-void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT) {
-	if (pDIBPixels == NULL || pSatLUTs == NULL || pLUT == NULL) {
-		return NULL;
-	}
-
-	const int cnScaler = 1 << 16;
-	const int cnMax = 255 * cnScaler;
-	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
-	if (pTarget == NULL) return NULL;
-	const uint32* pSrc = (uint32*)pDIBPixels;
-	uint32* pTgt = pTarget;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
+	} else {
+		const int cnScaler = 1 << 16;
+		const int cnMax = 255 * cnScaler;
+		for (int i = nStart; i < nNumPixels; i++) {
 			uint32 nSrcPixels = *pSrc;
 			int32 nSrcBlue = nSrcPixels & 0xFF;
 			int32 nSrcGreen = (nSrcPixels >> 8) & 0xFF;
@@ -384,9 +431,49 @@ void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeig
 			pTgt++; pSrc++;
 		}
 	}
+}
+
+static void* ApplyLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, bool bUseAVX) {
+	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
+	if (pTarget == NULL) return NULL;
+	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
+	CRequestLUT request(pDIBPixels, CSize(nWidth, nHeight), pTarget, pSatLUTs, pLUT, bUseAVX);
+	if (!threadPool.Process(&request)) {
+		delete[] pTarget;
+		return NULL;
+	}
 	return pTarget;
 }
 
+void* CBasicProcessing::Apply3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT) {
+	if (pDIBPixels == NULL || pLUT == NULL) {
+		return NULL;
+	}
+	return ApplyLUT32bpp(nWidth, nHeight, pDIBPixels, NULL, pLUT, false);
+}
+
+void* CBasicProcessing::Apply3ChannelLUT32bpp_SIMD(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT, SIMDArchitecture simd) {
+	if (pDIBPixels == NULL || pLUT == NULL) {
+		return NULL;
+	}
+	return ApplyLUT32bpp(nWidth, nHeight, pDIBPixels, NULL, pLUT, simd == AVX2);
+}
+
+void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT) {
+	if (pDIBPixels == NULL || pSatLUTs == NULL || pLUT == NULL) {
+		return NULL;
+	}
+	return ApplyLUT32bpp(nWidth, nHeight, pDIBPixels, pSatLUTs, pLUT, false);
+}
+
+void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp_SIMD(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT,
+	SIMDArchitecture simd) {
+	if (pDIBPixels == NULL || pSatLUTs == NULL || pLUT == NULL) {
+		return NULL;
+	}
+	return ApplyLUT32bpp(nWidth, nHeight, pDIBPixels, pSatLUTs, pLUT, simd == AVX2);
+}
+
 // Create the LDC response LUT between black and white points. This LUT makes sure
 // that neither black nor white point is altered by the LDC.
 static int32* CreateMulLUT(float fBlackPt, float fWhitePt, float fBlackPtSteepness) {
@@ -427,7 +514,7 @@ static int32* CreateMulLUT(float fBlackPt, float fWhitePt, float fBlackPtSteepne
 
 void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize dibSize,
 									  CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
-									  float fBlackPt, float fWhitePt, float fBlackPtSteepness, uint32* pTarget) {
+									  float fBlackPt, float fWhitePt, float fBlackPtSteepness, bool bUseAVX, uint32* pTarget) {
 
 	uint32 nIncrementX, nIncrementY;
 	nIncrementX = (ldcMapSize.cx == 1) ? 0 : (uint32)((65536*(uint32)(ldcMapSize.cx - 1))/(fullTargetSize.cx - 1) - 1);
@@ -441,13 +528,38 @@ void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize di
 	const int32* pMulLUT = CreateMulLUT(fBlackPt, fWhitePt, fBlackPtSteepness);
 	const uint32* pSrc = (uint32*)pDIBPixels;
 	uint32* pTgt = pTarget;
+#ifdef _WIN64
+	// The AVX code interpolates the LDC map horizontally in a row already interpolated vertically
+	int32 LUT32[768];
+	int32* pMaskRow = NULL;
+	if (bUseAVX) {
+		for (int i = 0; i < 768; i++) {
+			LUT32[i] = pLUT[i];
+		}
+		pMaskRow = new(std::nothrow) int32[ldcMapSize.cx + 1];
+	}
+#endif
 	for (int j = 0; j < dibSize.cy; j++) {
 		uint32 nCurYTrunc = nCurY >> 16;
 		uint32 nCurYFrac = nCurY & 0xFFFF;
 		const uint8* pLDCMapSrc = pLDCMap + ldcMapSize.cx * nCurYTrunc;
 		uint32 nCurX = nStartX;
+		int nStart = 0;
+#ifdef _WIN64
+		if (pMaskRow != NULL) {
+			for (int i = 0; i < ldcMapSize.cx; i++) {
+				uint32 nMaskTop = pLDCMapSrc[i];
+				uint32 nMaskBottom = pLDCMapSrc[i + ldcMapSize.cx];
+				pMaskRow[i] = ((int)nCurYFrac*(int)(nMaskBottom - nMaskTop) >> 16) + nMaskTop;
+			}
+			pMaskRow[ldcMapSize.cx] = pMaskRow[ldcMapSize.cx - 1]; // only read with weight zero
+			nStart = ApplyLDCRow32bpp_AVX(dibSize.cx, nStartX, nIncrementX, pMaskRow, pSrc, pSatLUTs, LUT32, pMulLUT, pTgt);
+			pSrc += nStart; pTgt += nStart;
+			nCurX += nStart*nIncrementX;
+		}
+#endif
 		if (pSatLUTs == NULL) {
-			for (int i = 0; i < dibSize.cx; i++) {
+			for (int i = nStart; i < dibSize.cx; i++) {
 				// perform bilinear interpolation of mask
 				uint32 nCurXTrunc = nCurX >> 16;
 				uint32 nCurXFrac = nCurX & 0xFFFF;
@@ -472,7 +584,7 @@ void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize di
 				nCurX += nIncrementX;
 			}
 		} else {
-			for (int i = 0; i < dibSize.cx; i++) {
+			for (int i = nStart; i < dibSize.cx; i++) {
 				// perform bilinear interpolation of mask
 				uint32 nCurXTrunc = nCurX >> 16;
 				uint32 nCurXFrac = nCurX & 0xFFFF;
@@ -506,32 +618,49 @@ void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize di
 		}
 		nCurY += nIncrementY;
 	}
+#ifdef _WIN64
+	delete[] pMaskRow;
+#endif
 	delete[] pMulLUT;
 	return pTarget;
 }
 
-void* CBasicProcessing::ApplyLDC32bpp(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+static void* ApplyLDC32bpp_Strips(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 									  CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
-									  float fBlackPt, float fWhitePt, float fBlackPtSteepness) {
+									  float fBlackPt, float fWhitePt, float fBlackPtSteepness, bool bUseAVX) {
 
 	if (pDIBPixels == NULL || pLUT == NULL || pLDCMap == NULL) {
 	  return NULL;
 	}
 	if (fullTargetSize.cx <= 2 || fullTargetSize.cy <= 2) {
 		// cannot apply to tiny images
-		return Apply3ChannelLUT32bpp(clippedTargetSize.cx, clippedTargetSize.cy, pDIBPixels, pLUT);
+		return ApplyLUT32bpp(clippedTargetSize.cx, clippedTargetSize.cy, pDIBPixels, NULL, pLUT, bUseAVX);
 	}
 
 	uint32* pTarget = new(std::nothrow) uint32[clippedTargetSize.cx * clippedTargetSize.cy];
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestLDC request(pDIBPixels, clippedTargetSize, pTarget, fullTargetSize, fullTargetOffset,
-		ldcMapSize, pSatLUTs, pLUT, pLDCMap, fBlackPt, fWhitePt, fBlackPtSteepness);
+		ldcMapSize, pSatLUTs, pLUT, pLDCMap, fBlackPt, fWhitePt, fBlackPtSteepness, bUseAVX);
 	bool bSuccess = threadPool.Process(&request);
 
 	return bSuccess ? pTarget : NULL;
 }
 
+void* CBasicProcessing::ApplyLDC32bpp(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+									  CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
+									  float fBlackPt, float fWhitePt, float fBlackPtSteepness) {
+	return ApplyLDC32bpp_Strips(fullTargetSize, fullTargetOffset, clippedTargetSize, ldcMapSize, pDIBPixels,
+		pSatLUTs, pLUT, pLDCMap, fBlackPt, fWhitePt, fBlackPtSteepness, false);
+}
+
+void* CBasicProcessing::ApplyLDC32bpp_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+									  CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
+									  float fBlackPt, float fWhitePt, float fBlackPtSteepness, SIMDArchitecture simd) {
+	return ApplyLDC32bpp_Strips(fullTargetSize, fullTargetOffset, clippedTargetSize, ldcMapSize, pDIBPixels,
+		pSatLUTs, pLUT, pLDCMap, fBlackPt, fWhitePt, fBlackPtSteepness, simd == AVX2);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Dimming of part of image and drawing of rectangles
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -795,19 +924,23 @@ void* CBasicProcessing::Convert3To4Channels(int nWidth, int nHeight, const void*
 	if (pIJLPixels == NULL) {
 		return NULL;
 	}
-	int nPadSrc = Helpers::DoPadding(nWidth*3, 4) - nWidth*3;
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTarget = pNewDIB;
+	Convert3To4Channels(nWidth, nHeight, pIJLPixels, pNewDIB);
+	return pNewDIB;
+}
+
+void CBasicProcessing::Convert3To4Channels(int nWidth, int nHeight, const void* pIJLPixels, void* pTarget) {
+	int nPadSrc = Helpers::DoPadding(nWidth*3, 4) - nWidth*3;
+	uint32* pTgt = (uint32*)pTarget;
 	const uint8* pSource = (uint8*)pIJLPixels;
 	for (int j = 0; j < nHeight; j++) {
 		for (int i = 0; i < nWidth; i++) {
-			*pTarget++ = pSource[0] + pSource[1] * 256 + pSource[2] * 65536 + ALPHA_OPAQUE;
+			*pTgt++ = pSource[0] + pSource[1] * 256 + pSource[2] * 65536 + ALPHA_OPAQUE;
 			pSource += 3;
 		}
 		pSource += nPadSrc;
 	}
-	return pNewDIB;
 }
 
 void* CBasicProcessing::ConvertGdiplus32bppRGB(int nWidth, int nHeight, int nStride, const void* pGdiplusPixels) {
@@ -932,6 +1065,37 @@ static void RotateInplace(double& dX, double& dY, double dAngle) {
 	dY = dYr;
 }
 
+// Mapping for a rotation around the image center. dScaleX and dScaleY are the number of source pixels per target pixel.
+static CRotationMapping GetRotationMapping(CSize sourceSize, double dScaleX, double dScaleY, double dRotation) {
+	double dFirstX = -(sourceSize.cx - 1) * 0.5;
+	double dFirstY = -(sourceSize.cy - 1) * 0.5;
+	double dIncX1 = dFirstX + dScaleX;
+	double dIncY1 = dFirstY;
+	double dIncX2 = dFirstX;
+	double dIncY2 = dFirstY + dScaleY;
+	RotateInplace(dFirstX, dFirstY, -dRotation);
+	RotateInplace(dIncX1, dIncY1, -dRotation);
+	RotateInplace(dIncX2, dIncY2, -dRotation);
+	dIncX1 = dIncX1 - dFirstX;
+	dIncY1 = dIncY1 - dFirstY;
+	dIncX2 = dIncX2 - dFirstX;
+	dIncY2 = dIncY2 - dFirstY;
+
+	CRotationMapping mapping;
+	mapping.FirstX = Helpers::RoundToInt(65536 * (dFirstX + (sourceSize.cx - 1) * 0.5));
+	mapping.FirstY = Helpers::RoundToInt(65536 * (dFirstY + (sourceSize.cy - 1) * 0.5));
+	mapping.IncrementX1 = Helpers::RoundToInt(65536 * dIncX1);
+	mapping.IncrementY1 = Helpers::RoundToInt(65536 * dIncY1);
+	mapping.IncrementX2 = Helpers::RoundToInt(65536 * dIncX2);
+	mapping.IncrementY2 = Helpers::RoundToInt(65536 * dIncY2);
+	return mapping;
+}
+
+// Source pixels per target pixel for the rotation of a zoomed image, as used by the point sampling
+static double GetZoomedRotationScale(int nSourceSize, int nTargetSize) {
+	return (nTargetSize == 1) ? 0 : (double)nSourceSize/(nTargetSize - 1);
+}
+
 void* CBasicProcessing::PointSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
 	CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor) {
 	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
@@ -947,26 +1111,14 @@ void* CBasicProcessing::PointSampleWithRotation(CSize fullTargetSize, CPoint ful
 	if (pDIB == NULL) return NULL;
 
 	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
-	double dFirstX = -(sourceSize.cx - 1) * 0.5;
-	double dFirstY = -(sourceSize.cy - 1) * 0.5;
-	double dIncX1 = dFirstX + ((fullTargetSize.cx == 1) ? 0 : (double)(sourceSize.cx)/(fullTargetSize.cx - 1));
-	double dIncY1 = dFirstY;
-	double dIncX2 = dFirstX;
-	double dIncY2 = dFirstY + ((fullTargetSize.cy == 1) ? 0 : (double)(sourceSize.cy)/(fullTargetSize.cy - 1));
-	RotateInplace(dFirstX, dFirstY, -dRotation);
-	RotateInplace(dIncX1, dIncY1, -dRotation);
-	RotateInplace(dIncX2, dIncY2, -dRotation);
-	dIncX1 = dIncX1 - dFirstX;
-	dIncY1 = dIncY1 - dFirstY;
-	dIncX2 = dIncX2 - dFirstX;
-	dIncY2 = dIncY2 - dFirstY;
-
-	int32 nFirstX = Helpers::RoundToInt(65536 * (dFirstX + (sourceSize.cx - 1) * 0.5));
-	int32 nFirstY = Helpers::RoundToInt(65536 * (dFirstY + (sourceSize.cy - 1) * 0.5));
-	int32 nIncrementX1 = Helpers::RoundToInt(65536 * dIncX1);
-	int32 nIncrementY1 = Helpers::RoundToInt(65536 * dIncY1);
-	int32 nIncrementX2 = Helpers::RoundToInt(65536 * dIncX2);
-	int32 nIncrementY2 = Helpers::RoundToInt(65536 * dIncY2);
+	CRotationMapping mapping = GetRotationMapping(sourceSize, GetZoomedRotationScale(sourceSize.cx, fullTargetSize.cx),
+		GetZoomedRotationScale(sourceSize.cy, fullTargetSize.cy), dRotation);
+	int32 nFirstX = mapping.FirstX;
+	int32 nFirstY = mapping.FirstY;
+	int32 nIncrementX1 = mapping.IncrementX1;
+	int32 nIncrementY1 = mapping.IncrementY1;
+	int32 nIncrementX2 = mapping.IncrementX2;
+	int32 nIncrementY2 = mapping.IncrementY2;
 
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
 	const uint8* pSrc = NULL;
@@ -1243,87 +1395,122 @@ static void InterpolateBicubicBorder(const uint8* pSource, uint8* pDest, int16*
 	if (nChannels == 3) *pDest = 0xFF;
 }
 
-void* RotateHQ_Core(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, 
-									  const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor){
-
-	double dFirstX = -(sourceSize.cx - 1) * 0.5;
-	double dFirstY = -(sourceSize.cy - 1) * 0.5;
-	double dIncX1 = dFirstX + ((targetSize.cx == 1) ? 0 : 1);
-	double dIncY1 = dFirstY;
-	double dIncX2 = dFirstX;
-	double dIncY2 = dFirstY + ((targetSize.cy == 1) ? 0 : 1);
-	RotateInplace(dFirstX, dFirstY, -dRotation);
-	RotateInplace(dIncX1, dIncY1, -dRotation);
-	RotateInplace(dIncX2, dIncY2, -dRotation);
-	dIncX1 = dIncX1 - dFirstX;
-	dIncY1 = dIncY1 - dFirstY;
-	dIncX2 = dIncX2 - dFirstX;
-	dIncY2 = dIncY2 - dFirstY;
+// Checks if the 4x4 neighbourhood of the source position (16.16 fixed point) is inside the source image
+static inline bool IsInnerPosition(int32 nX, int32 nY, CSize sourceSize) {
+	int32 nRealX = nX >> 16;
+	int32 nRealY = nY >> 16;
+	return nRealX > 0 && nRealX < sourceSize.cx - 2 && nRealY > 0 && nRealY < sourceSize.cy - 2;
+}
 
-	int32 nFirstX = Helpers::RoundToInt(65536 * (dFirstX + (sourceSize.cx - 1) * 0.5));
-	int32 nFirstY = Helpers::RoundToInt(65536 * (dFirstY + (sourceSize.cy - 1) * 0.5));
-	int32 nIncrementX1 = Helpers::RoundToInt(65536 * dIncX1);
-	int32 nIncrementY1 = Helpers::RoundToInt(65536 * dIncY1);
-	int32 nIncrementX2 = Helpers::RoundToInt(65536 * dIncX2);
-	int32 nIncrementY2 = Helpers::RoundToInt(65536 * dIncY2);
+void* RotateHQ_Core(const CRotationMapping& mapping, CPoint targetOffset, CSize targetSize, CSize sourceSize,
+					const void* pSourcePixels, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX) {
 
 	int16* pKernels = new int16[NUM_KERNELS_BICUBIC * 4];
 	CResizeFilter::GetBicubicFilterKernels(NUM_KERNELS_BICUBIC, pKernels);
 
-	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
 	const uint8* pSrc = NULL;
 	uint8* pDst = (uint8*)pTargetPixels;
-	int32 nX = nFirstX + targetOffset.x * nIncrementX1 + targetOffset.y * nIncrementX2;
-	int32 nY = nFirstY + targetOffset.x * nIncrementY1 + targetOffset.y * nIncrementY2;
+	int32 nIncrementX1 = mapping.IncrementX1;
+	int32 nIncrementY1 = mapping.IncrementY1;
+	int32 nX = mapping.FirstX + targetOffset.x * nIncrementX1 + targetOffset.y * mapping.IncrementX2;
+	int32 nY = mapping.FirstY + targetOffset.x * nIncrementY1 + targetOffset.y * mapping.IncrementY2;
 	for (int j = 0; j < targetSize.cy; j++) {
+		// the pixels from nStartAVX to nEndAVX - 1 are processed by the AVX code, their neighbourhood is inside the source image
+		int nStartAVX = 0, nEndAVX = 0;
+#ifdef _WIN64
+		if (bUseAVX) {
+			int nEnd = targetSize.cx;
+			while (nStartAVX < nEnd && !IsInnerPosition(nX + nStartAVX * nIncrementX1, nY + nStartAVX * nIncrementY1, sourceSize)) nStartAVX++;
+			while (nEnd > nStartAVX && !IsInnerPosition(nX + (nEnd - 1) * nIncrementX1, nY + (nEnd - 1) * nIncrementY1, sourceSize)) nEnd--;
+			nEndAVX = nStartAVX + RotateRowHQ_AVX(nEnd - nStartAVX, nX + nStartAVX * nIncrementX1, nY + nStartAVX * nIncrementY1,
+				nIncrementX1, nIncrementY1, (const uint8*)pSourcePixels, nPaddedSourceWidth, nChannels, pKernels, (uint32*)pDst + nStartAVX);
+		}
+#endif
 		int nCurX = nX;
 		int nCurY = nY;
 		for (int i = 0; i < targetSize.cx; i++) {
-			int32 nCurRealX = nCurX >> 16;
-			int32 nCurRealY = nCurY >> 16;
-			int32 nFracX = nCurX & 0xFFFF;
-			int32 nFracY = nCurY & 0xFFFF;
-			if (nCurRealX >= -1 && nCurRealX <= sourceSize.cx && nCurRealY >= -1 && nCurRealY <= sourceSize.cy) {
-				pSrc = (uint8*)pSourcePixels + nPaddedSourceWidth * nCurRealY + nCurRealX * nChannels;
-				if (nCurRealX > 0 && nCurRealX < sourceSize.cx - 2 && nCurRealY > 0 && nCurRealY < sourceSize.cy - 2) {
-					InterpolateBicubic(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nPaddedSourceWidth, nChannels);
+			if (i < nStartAVX || i >= nEndAVX) {
+				int32 nCurRealX = nCurX >> 16;
+				int32 nCurRealY = nCurY >> 16;
+				int32 nFracX = nCurX & 0xFFFF;
+				int32 nFracY = nCurY & 0xFFFF;
+				if (nCurRealX >= -1 && nCurRealX <= sourceSize.cx && nCurRealY >= -1 && nCurRealY <= sourceSize.cy) {
+					pSrc = (uint8*)pSourcePixels + nPaddedSourceWidth * nCurRealY + nCurRealX * nChannels;
+					if (nCurRealX > 0 && nCurRealX < sourceSize.cx - 2 && nCurRealY > 0 && nCurRealY < sourceSize.cy - 2) {
+						InterpolateBicubic(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nPaddedSourceWidth, nChannels);
+					} else {
+						int nXFrom = (nCurRealX > 0) ? -1 : -nCurRealX;
+						int nXTo = (nCurRealX < sourceSize.cx - 2) ? 2 : sourceSize.cx - nCurRealX - 1;
+						int nYFrom = (nCurRealY > 0) ? -1 : -nCurRealY;
+						int nYTo = (nCurRealY < sourceSize.cy - 2) ? 2 : sourceSize.cy - nCurRealY - 1;
+						InterpolateBicubicBorder(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nXFrom, nXTo, nYFrom, nYTo, nPaddedSourceWidth, nChannels, nBackColor);
+					}
 				} else {
-					int nXFrom = (nCurRealX > 0) ? -1 : -nCurRealX;
-					int nXTo = (nCurRealX < sourceSize.cx - 2) ? 2 : sourceSize.cx - nCurRealX - 1;
-					int nYFrom = (nCurRealY > 0) ? -1 : -nCurRealY;
-					int nYTo = (nCurRealY < sourceSize.cy - 2) ? 2 : sourceSize.cy - nCurRealY - 1;
-					InterpolateBicubicBorder(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nXFrom, nXTo, nYFrom, nYTo, nPaddedSourceWidth, nChannels, nBackColor);
+					*((uint32*)pDst + i) = nBackColor;
 				}
-			} else {
-				*((uint32*)pDst + i) = nBackColor;
 			}
 			nCurX += nIncrementX1;
 			nCurY += nIncrementY1;
 		}
 		pDst += targetSize.cx*4;
-		nX += nIncrementX2;
-		nY += nIncrementY2;
+		nX += mapping.IncrementX2;
+		nY += mapping.IncrementY2;
 	}
 	delete[] pKernels;
 	return pTargetPixels;
 }
 
-void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, const void* pSourcePixels, int nChannels, COLORREF backColor) {
-	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
-		return NULL;
-	}
-
+// Rotates on the thread pool, the caller has checked the parameters
+static void* RotateHQ_Strips(const CRotationMapping& mapping, CPoint targetOffset, CSize targetSize, CSize sourceSize,
+							 const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseAVX) {
 	uint8* pTargetPixels = new(std::nothrow) uint8[targetSize.cx * 4 * targetSize.cy];
 	if (pTargetPixels == NULL) return NULL;
 
+	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	CRequestRotate request(pSourcePixels, targetOffset, targetSize, dRotation, sourceSize, pTargetPixels, nChannels, backColor);
+	CRequestRotate request(pSourcePixels, targetOffset, targetSize, mapping, sourceSize, pTargetPixels, nChannels, nBackColor, bUseAVX);
 	bool bSuccess = threadPool.Process(&request);
 
 	return bSuccess ? pTargetPixels : NULL;
 }
 
+void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, const void* pSourcePixels, int nChannels, COLORREF backColor) {
+	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	CRotationMapping mapping = GetRotationMapping(sourceSize, (targetSize.cx == 1) ? 0 : 1, (targetSize.cy == 1) ? 0 : 1, dRotation);
+	return RotateHQ_Strips(mapping, targetOffset, targetSize, sourceSize, pSourcePixels, nChannels, backColor, false);
+}
+
+void* CBasicProcessing::RotateHQ_SIMD(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, const void* pSourcePixels,
+									  int nChannels, COLORREF backColor, SIMDArchitecture simd) {
+	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	CRotationMapping mapping = GetRotationMapping(sourceSize, (targetSize.cx == 1) ? 0 : 1, (targetSize.cy == 1) ? 0 : 1, dRotation);
+	return RotateHQ_Strips(mapping, targetOffset, targetSize, sourceSize, pSourcePixels, nChannels, backColor, simd == AVX2);
+}
+
+void* CBasicProcessing::BicubicSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+	CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor, SIMDArchitecture simd) {
+	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
+		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
+		fullTargetOffset.x < 0 || fullTargetOffset.y < 0 ||
+		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
+		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
+		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	// same mapping as PointSampleWithRotation()
+	CRotationMapping mapping = GetRotationMapping(sourceSize, GetZoomedRotationScale(sourceSize.cx, fullTargetSize.cx),
+		GetZoomedRotationScale(sourceSize.cy, fullTargetSize.cy), dRotation);
+	return RotateHQ_Strips(mapping, fullTargetOffset, clippedTargetSize, sourceSize, pPixels, nChannels, backColor, simd == AVX2);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // High quality trapezoid correction using bicubic sampling
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1399,40 +1586,58 @@ static void InterpolateBicubicY(const uint8* pSourcePixels, int nChannelsSource,
 	}
 }
 
-void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
-										 const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor) {
+// Checks if the 4 pixels neighbourhood of the source x-position (16.16 fixed point) is inside the line
+static inline bool IsInnerPositionX(int32 nX, int nSourceWidth) {
+	int32 nRealX = nX >> 16;
+	return nRealX > 0 && nRealX < nSourceWidth - 2;
+}
 
-	float fTx1 = (float)trapezoid.x1s;
-	float fTx2 = (float)trapezoid.x1e;
-	float fIncrementTx1 = ((float)(trapezoid.x2s - trapezoid.x1s))/trapezoid.Height();
-	float fIncrementTx2 = ((float)(trapezoid.x2e - trapezoid.x1e))/trapezoid.Height();
+void* TrapezoidHQ_Core(int nWidth, int nHeight, const int* pTableY, const int* pStartX, const int* pIncrementX, CSize sourceSize,
+					   const void* pSourcePixels, void* pTargetPixels, int nChannels, uint32 nBackColor, bool bUseAVX) {
 
-	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
 	uint8* pDst = (uint8*)pTargetPixels;
-	fTx1 = fTx1 + targetOffset.y*fIncrementTx1;
-	fTx2 = fTx2 + targetOffset.y*fIncrementTx2;
-	int nSourceSizeXFP16 = (sourceSize.cx - 1) << 16;
-
-	int* pTableY = CalculateTrapezoidYIntersectionTable(trapezoid, targetSize.cy, sourceSize.cy, trapezoid.Height() + 1, targetOffset.y);
-	uint16* pLine = new uint16[sourceSize.cx * 3];
+	uint16* pLine = new uint16[sourceSize.cx * 3 + 2]; // the AVX code accesses two values behind the line
 	
 	int16* pKernels = new int16[NUM_KERNELS_BICUBIC * 4];
 	CResizeFilter::GetBicubicFilterKernels(NUM_KERNELS_BICUBIC, pKernels);
 
-	for (int j = 0; j < targetSize.cy; j++) {
-		float fTxDiffInv = 1.0f/(fTx2 - fTx1);
-		int nIncrementX = (int)(nSourceSizeXFP16 * fTxDiffInv);
-		int nStartX = (int)(nSourceSizeXFP16 * (targetOffset.x - fTx1) * fTxDiffInv);
-		int nCurX = nStartX;
+	for (int j = 0; j < nHeight; j++) {
+		int nIncrementX = pIncrementX[j];
+		int nStartX = pStartX[j];
 		int nCurY = pTableY[j] >> 16;
 		int nCurYFrac = pTableY[j] & 0xFFFF;
-		InterpolateBicubicY((uint8*)pSourcePixels + nPaddedSourceWidth * nCurY, nChannels, nPaddedSourceWidth, pLine, sourceSize.cx,
-			pKernels, nCurY, nCurYFrac, trapezoid.Height() + 1);
-		for (int i = 0; i < targetSize.cx; i++) {
+		const uint8* pSourceRow = (uint8*)pSourcePixels + nPaddedSourceWidth * nCurY;
+		// the pixels from nStartAVX to nEndAVX - 1 are processed by the AVX code, their neighbourhood is inside the line
+		int nStartAVX = 0, nEndAVX = 0;
+		bool bLineDone = false;
+#ifdef _WIN64
+		if (bUseAVX && nCurY > 0 && nCurY < sourceSize.cy - 2) {
+			InterpolateBicubicRowY_AVX(pSourceRow, nChannels, nPaddedSourceWidth, pLine, sourceSize.cx,
+				&(pKernels[4*(nCurYFrac >> (16 - NUM_KERNELS_LOG2))]));
+			bLineDone = true;
+		}
+#endif
+		if (!bLineDone) {
+			InterpolateBicubicY(pSourceRow, nChannels, nPaddedSourceWidth, pLine, sourceSize.cx,
+				pKernels, nCurY, nCurYFrac, sourceSize.cy);
+		}
+#ifdef _WIN64
+		if (bUseAVX) {
+			int nEnd = nWidth;
+			while (nStartAVX < nEnd && !IsInnerPositionX(nStartX + nStartAVX * nIncrementX, sourceSize.cx)) nStartAVX++;
+			while (nEnd > nStartAVX && !IsInnerPositionX(nStartX + (nEnd - 1) * nIncrementX, sourceSize.cx)) nEnd--;
+			nEndAVX = nStartAVX + InterpolateBicubicRowX_AVX(nEnd - nStartAVX, nStartX + nStartAVX * nIncrementX, nIncrementX,
+				pLine, pKernels, (uint32*)pDst + nStartAVX);
+		}
+#endif
+		int nCurX = nStartX;
+		for (int i = 0; i < nWidth; i++) {
 			int nCurXInt = nCurX >> 16;
 			int nCurXFrac = nCurX & 0xFFFF;
-			if (nCurXInt >= -1 && nCurXInt <= sourceSize.cx) {
+			if (i >= nStartAVX && i < nEndAVX) {
+				// done by AVX code
+			} else if (nCurXInt >= -1 && nCurXInt <= sourceSize.cx) {
 				const uint16* pSourceLineStart = pLine + nCurXInt*3;
 				if (nCurXInt > 0 && nCurXInt < sourceSize.cx - 2) {
 					InterpolateBicubicX(pSourceLineStart, pDst + i*4, pKernels, nCurXFrac);
@@ -1448,33 +1653,107 @@ void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid&
 			nCurX += nIncrementX;
 		}
 
-		pDst += targetSize.cx*4;
-		fTx1 += fIncrementTx1;
-		fTx2 += fIncrementTx2;
+		pDst += nWidth*4;
 	}
 
-	delete[] pTableY;
 	delete[] pLine;
+	delete[] pKernels;
 
 	return pTargetPixels;
 }
 
-void* CBasicProcessing::TrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
-									const void* pSourcePixels, int nChannels, COLORREF backColor) {
-	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
-		return NULL;
-	}
-
+// Trapezoid correction on the thread pool. pTableY contains the source row of each target row, pStartX and pIncrementX
+// the source x-position of the first pixel and the increment per pixel, all in 16.16 fixed point format.
+static void* TrapezoidHQ_Strips(CSize targetSize, const int* pTableY, const int* pStartX, const int* pIncrementX, CSize sourceSize,
+								const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseAVX) {
 	uint8* pTargetPixels = new(std::nothrow) uint8[targetSize.cx * 4 * targetSize.cy];
 	if (pTargetPixels == NULL) return NULL;
 
+	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	CRequestTrapezoid request(pSourcePixels, targetOffset, targetSize, trapezoid, sourceSize, pTargetPixels, nChannels, backColor);
+	CRequestTrapezoid request(pSourcePixels, targetSize, pTableY, pStartX, pIncrementX, sourceSize, pTargetPixels, nChannels, nBackColor, bUseAVX);
 	bool bSuccess = threadPool.Process(&request);
 
 	return bSuccess ? pTargetPixels : NULL;
 }
 
+static void* DoTrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
+							const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseAVX) {
+	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	int* pStartX = new(std::nothrow) int[targetSize.cy * 2];
+	if (pStartX == NULL) return NULL;
+	int* pIncrementX = pStartX + targetSize.cy;
+	int* pTableY = CalculateTrapezoidYIntersectionTable(trapezoid, targetSize.cy, sourceSize.cy, trapezoid.Height() + 1, targetOffset.y);
+
+	float fIncrementTx1 = ((float)(trapezoid.x2s - trapezoid.x1s))/trapezoid.Height();
+	float fIncrementTx2 = ((float)(trapezoid.x2e - trapezoid.x1e))/trapezoid.Height();
+	int nSourceSizeXFP16 = (sourceSize.cx - 1) << 16;
+	for (int j = 0; j < targetSize.cy; j++) {
+		float fTx1 = trapezoid.x1s + (targetOffset.y + j)*fIncrementTx1;
+		float fTx2 = trapezoid.x1e + (targetOffset.y + j)*fIncrementTx2;
+		float fTxDiffInv = 1.0f/(fTx2 - fTx1);
+		pIncrementX[j] = (int)(nSourceSizeXFP16 * fTxDiffInv);
+		pStartX[j] = (int)(nSourceSizeXFP16 * (targetOffset.x - fTx1) * fTxDiffInv);
+	}
+
+	void* pTargetPixels = TrapezoidHQ_Strips(targetSize, pTableY, pStartX, pIncrementX, sourceSize, pSourcePixels, nChannels, backColor, bUseAVX);
+	delete[] pTableY;
+	delete[] pStartX;
+	return pTargetPixels;
+}
+
+void* CBasicProcessing::TrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
+									const void* pSourcePixels, int nChannels, COLORREF backColor) {
+	return DoTrapezoidHQ(targetOffset, targetSize, trapezoid, sourceSize, pSourcePixels, nChannels, backColor, false);
+}
+
+void* CBasicProcessing::TrapezoidHQ_SIMD(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
+										 const void* pSourcePixels, int nChannels, COLORREF backColor, SIMDArchitecture simd) {
+	return DoTrapezoidHQ(targetOffset, targetSize, trapezoid, sourceSize, pSourcePixels, nChannels, backColor, simd == AVX2);
+}
+
+void* CBasicProcessing::BicubicSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
+	CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor, SIMDArchitecture simd) {
+	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
+		(fullTargetTrapezoid.x1e - fullTargetTrapezoid.x1s) <= 0  ||
+		(fullTargetTrapezoid.x2e - fullTargetTrapezoid.x2s) <= 0  ||
+		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
+		fullTargetOffset.x < 0 || fullTargetOffset.y < 0 ||
+		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
+		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
+		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	int* pStartX = new(std::nothrow) int[clippedTargetSize.cy * 2];
+	if (pStartX == NULL) return NULL;
+	int* pIncrementX = pStartX + clippedTargetSize.cy;
+	int* pTableY = CalculateTrapezoidYIntersectionTable(fullTargetTrapezoid, clippedTargetSize.cy, sourceSize.cy, fullTargetSize.cy, fullTargetOffset.y);
+
+	// same mapping as PointSampleTrapezoid()
+	float fTx1 = (fullTargetTrapezoid.x1s - fullTargetTrapezoid.x2s)*0.5f;
+	float fTx2 = fTx1 + fullTargetTrapezoid.x1e - fullTargetTrapezoid.x1s;
+	float fIncrementTx1 = ((float)(fullTargetTrapezoid.x2s - fullTargetTrapezoid.x1s))/fullTargetTrapezoid.Height();
+	float fIncrementTx2 = ((float)(fullTargetTrapezoid.x2e - fullTargetTrapezoid.x1e))/fullTargetTrapezoid.Height();
+	fTx1 = fTx1 + fullTargetOffset.y*fIncrementTx1;
+	fTx2 = fTx2 + fullTargetOffset.y*fIncrementTx2;
+	int nSourceSizeXFP16 = sourceSize.cx << 16;
+	for (int j = 0; j < clippedTargetSize.cy; j++) {
+		pIncrementX[j] = (int)(nSourceSizeXFP16/(fTx2 - fTx1 + 1)) + 1;
+		pStartX[j] = (int)((fullTargetOffset.x - fTx1)*pIncrementX[j]);
+		fTx1 += fIncrementTx1;
+		fTx2 += fIncrementTx2;
+	}
+
+	void* pTargetPixels = TrapezoidHQ_Strips(clippedTargetSize, pTableY, pStartX, pIncrementX, sourceSize, pPixels, nChannels, backColor, simd == AVX2);
+	delete[] pTableY;
+	delete[] pStartX;
+	return pTargetPixels;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Helper methods for high quality resizing (C++ implementation)
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1584,13 +1863,21 @@ static void ApplyFilter1C16bpp(int nSourceWidth, int nTargetWidth,
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 int16* GaussFilter16bpp1Channel_Core(CSize fullSize, CPoint offset, CSize rect, int nTargetWidth, double dRadius, 
-													  const int16* pSourcePixels, int16* pTargetPixels) {
+													  const int16* pSourcePixels, int16* pTargetPixels, bool bUseAVX) {
 	CGaussFilter filterX(fullSize.cx, dRadius);
-	ApplyFilter1C16bpp(fullSize.cx, nTargetWidth, offset.x, offset.y, rect.cx, rect.cy, filterX.GetFilterKernels(), pSourcePixels, pTargetPixels);
+	int nRowsAVX = 0;
+#ifdef _WIN64
+	if (bUseAVX) {
+		nRowsAVX = ApplyFilter1C16bpp_AVX(fullSize.cx, nTargetWidth, offset.x, offset.y, rect.cx, rect.cy, filterX.GetFilterKernels(), pSourcePixels, pTargetPixels);
+	}
+#endif
+	ApplyFilter1C16bpp(fullSize.cx, nTargetWidth, offset.x, offset.y + nRowsAVX, rect.cx, rect.cy - nRowsAVX, filterX.GetFilterKernels(),
+		pSourcePixels, pTargetPixels + nRowsAVX);
 	return pTargetPixels;
 }
 
-int16* CBasicProcessing::GaussFilter16bpp1Channel(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels) {
+// Gauss filter on the thread pool, in x-direction and then in y-direction. Both passes rotate the image.
+static int16* GaussFilter16bpp1Channel_Strips(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels, bool bUseAVX) {
 	if (pPixels == NULL) {
 		return NULL;
 	}
@@ -1599,7 +1886,7 @@ int16* CBasicProcessing::GaussFilter16bpp1Channel(CSize fullSize, CPoint offset,
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	int16* pIntermediate = new(std::nothrow) int16[rect.cx * rect.cy];
 	if (pIntermediate == NULL) return NULL;
-	CRequestGauss requestX(pPixels, fullSize, offset, rect, dRadius, pIntermediate);
+	CRequestGauss requestX(pPixels, fullSize, offset, rect, dRadius, pIntermediate, bUseAVX);
 	if (!threadPool.Process(&requestX)) {
 		delete[] pIntermediate;
 		return NULL;
@@ -1611,13 +1898,22 @@ int16* CBasicProcessing::GaussFilter16bpp1Channel(CSize fullSize, CPoint offset,
 		delete[] pIntermediate;
 		return NULL;
 	}
-	CRequestGauss requestY(pIntermediate, CSize(rect.cy, rect.cx), CPoint(0, 0), CSize(rect.cy, rect.cx), dRadius, pTargetPixels);
+	CRequestGauss requestY(pIntermediate, CSize(rect.cy, rect.cx), CPoint(0, 0), CSize(rect.cy, rect.cx), dRadius, pTargetPixels, bUseAVX);
 	bool bSuccess = threadPool.Process(&requestY);
 	delete[] pIntermediate;
 
 	return bSuccess ? pTargetPixels : NULL;
 }
 
+int16* CBasicProcessing::GaussFilter16bpp1Channel(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels) {
+	return GaussFilter16bpp1Channel_Strips(fullSize, offset, rect, dRadius, pPixels, false);
+}
+
+int16* CBasicProcessing::GaussFilter16bpp1Channel_SIMD(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels,
+													   SIMDArchitecture simd) {
+	return GaussFilter16bpp1Channel_Strips(fullSize, offset, rect, dRadius, pPixels, simd == AVX2);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Bicubic resize (C++ implementation)
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -2566,9 +2862,12 @@ void* CBasicProcessing::SampleDown_HQ_SIMD(CSize fullTargetSize, CPoint fullTarg
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
 		nChannels, dSharpen, eFilter, simd);
-	bool bSuccess = threadPool.Process(&request);
+	if (!threadPool.Process(&request)) {
+		delete[] pTarget;
+		return NULL;
+	}
 
-	return bSuccess ? pTarget : NULL;
+	return pTarget;
 }
 
 void* CBasicProcessing::SampleUp_HQ_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
@@ -2583,9 +2882,12 @@ void* CBasicProcessing::SampleUp_HQ_SIMD(CSize fullTargetSize, CPoint fullTarget
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
 		nChannels, 0.0, Filter_Upsampling_Bicubic, simd);
-	bool bSuccess = threadPool.Process(&request);
+	if (!threadPool.Process(&request)) {
+		delete[] pTarget;
+		return NULL;
+	}
 
-	return bSuccess ? pTarget : NULL;
+	return pTarget;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -2604,9 +2906,11 @@ static double TransferFunc(double dX, double dThreshold, double dMaxPos) {
 	}
 }
 
-// Calculates a threshold LUT for sharpening, nNumEntriesPerSide*2 entries.
+// Calculates a threshold LUT for sharpening, nNumEntriesPerSide*2 + 1 entries.
+// The last entry is zero padding only, the AVX code gathers 32 bit values and thus reads one entry behind the highest index.
 static int16* CalculateThresholdLUT(int nNumEntriesPerSide, double dThreshold8bit, int16* & pLUTCenter) {
-	int16* pLUT = new int16[nNumEntriesPerSide*2];
+	int16* pLUT = new int16[nNumEntriesPerSide*2 + 1];
+	pLUT[nNumEntriesPerSide*2] = 0;
 	const double dMin = -1.0 * (1 << 14); // Minimal value of LUT
 	const double dMax =  0.6 * (1 << 14); // Maximal value of LUT
 	const double cdPosXMaxValue = 0.2; // x-position where minimal respective maximal value is reached (normalized to 0, 1)
@@ -2627,7 +2931,8 @@ static int16* CalculateThresholdLUT(int nNumEntriesPerSide, double dThreshold8bi
 }
 
 void* UnsharpMask_Core(CSize fullSize, CPoint offset, CSize rect, double dAmount, const int16* pThresholdLUT,
-										 const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels) {
+										 const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels,
+										 bool bUseAVX) {
 	int nDIBLineLen = Helpers::DoPadding(fullSize.cx * nChannels, 4);
 	int nAmount = (int)(dAmount * (1 << 12) + 0.5);
 
@@ -2640,7 +2945,17 @@ void* UnsharpMask_Core(CSize fullSize, CPoint offset, CSize rect, double dAmount
 		uint8* pTargetPixelLine = (uint8*)pTargetPixels + nStartOffsetDIB;
 		uint8* pSourcePixelLine = (uint8*)pSourcePixels + nStartOffsetDIB;
 
-		for (int i = 0; i < rect.cx; i++) {
+		int nStartX = 0;
+#ifdef _WIN64
+		if (bUseAVX) {
+			nStartX = UnsharpMaskRow_AVX(rect.cx, pGrayPtr, pSmoothPtr, pThresholdLUT, nAmount, pSourcePixelLine, pTargetPixelLine, nChannels);
+			pGrayPtr += nStartX;
+			pSmoothPtr += nStartX;
+			pSourcePixelLine += nStartX * nChannels;
+			pTargetPixelLine += nStartX * nChannels;
+		}
+#endif
+		for (int i = nStartX; i < rect.cx; i++) {
 			int nDiff = pThresholdLUT[(*pGrayPtr++ - *pSmoothPtr++) >> 4]; // Note: LUT contains 2^11 entries, subtraction of two 14 bit values can be 15 bit
 			int nSharpen = (nDiff * nAmount) >> 18; // nAmount 12 bit, nDiff 14 bit, shift back to 8 bit
 			int nBlue = pSourcePixelLine[0];
@@ -2663,8 +2978,10 @@ void* UnsharpMask_Core(CSize fullSize, CPoint offset, CSize rect, double dAmount
 	return pTargetPixels;
 }
 
-void* CBasicProcessing::UnsharpMask(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
-									const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels) {
+// Unsharp mask on the thread pool
+static void* UnsharpMask_Strips(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
+								const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels,
+								bool bUseAVX) {
 	if (pSourcePixels == NULL || pTargetPixels == NULL || pGrayImage == NULL || pSmoothedGrayImage == NULL) {
 		return NULL;
 	}
@@ -2672,13 +2989,25 @@ void* CBasicProcessing::UnsharpMask(CSize fullSize, CPoint offset, CSize rect, d
 	int16* pThresholdLUTBase = CalculateThresholdLUT(1024, dThreshold, pThresholdLUT);
 
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	CRequestUnsharpMask request(pSourcePixels, fullSize, offset, rect, dAmount, dThreshold, pThresholdLUT, pGrayImage, pSmoothedGrayImage, pTargetPixels, nChannels);
+	CRequestUnsharpMask request(pSourcePixels, fullSize, offset, rect, dAmount, dThreshold, pThresholdLUT, pGrayImage, pSmoothedGrayImage, pTargetPixels, nChannels, bUseAVX);
 	bool bSuccess = threadPool.Process(&request);
 
 	delete[] pThresholdLUTBase;
 	return bSuccess ? pTargetPixels : NULL;
 }
 
+void* CBasicProcessing::UnsharpMask(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
+									const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels) {
+	return UnsharpMask_Strips(fullSize, offset, rect, dAmount, dThreshold, pGrayImage, pSmoothedGrayImage, pSourcePixels, pTargetPixels, nChannels, false);
+}
+
+void* CBasicProcessing::UnsharpMask_SIMD(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
+										 const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels,
+										 SIMDArchitecture simd) {
+	return UnsharpMask_Strips(fullSize, offset, rect, dAmount, dThreshold, pGrayImage, pSmoothedGrayImage, pSourcePixels, pTargetPixels, nChannels,
+		simd == AVX2);
+}
+
 
 LPCTSTR CBasicProcessing::TimingInfo() {
 	return s_TimingInfo;
@@ -43,6 +43,8 @@ public:
 
 	// Convert from a 3 channel image (24 bpp, BGR) to a 4 channel image (32 bpp DIB, BGRA)
 	static void* Convert3To4Channels(int nWidth, int nHeight, const void* pIJLPixels);
+	// Same as above, converts into the given target buffer of nWidth * nHeight * 4 bytes
+	static void Convert3To4Channels(int nWidth, int nHeight, const void* pIJLPixels, void* pTarget);
 
 	// Convert from GDI+ 32 bpp RGBA format to 32 bpp BGRA DIB format
 	static void* ConvertGdiplus32bppRGB(int nWidth, int nHeight, int nStride, const void* pGdiplusPixels);
@@ -93,11 +95,18 @@ public:
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	static void* Apply3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* Apply3ChannelLUT32bpp_SIMD(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT, SIMDArchitecture simd);
+
 	// Apply the specified saturation LUTs (as returned by CreateColorSaturationLUTs() method) and then a 
 	// three channel LUT (256*B, 256*G, 256*R, see above for details) to a 32 bpp BGRA DIB
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	static void* ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* ApplySaturationAnd3ChannelLUT32bpp_SIMD(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT,
+		SIMDArchitecture simd);
+
 	// Dim out a rectangle in the given 32 bpp BGRA DIB.
 	// Notice that dimming is done by modifying the BGR values, the A channel is set to fixed value 0xFF.
 	// fDimValue is the value to multiply with the B, G and R values (between 0.0 and 1.0)
@@ -133,6 +142,11 @@ public:
 		CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap, 
 		float fBlackPt, float fWhitePt, float fBlackPtSteepness);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* ApplyLDC32bpp_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+		CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap, 
+		float fBlackPt, float fWhitePt, float fBlackPtSteepness, SIMDArchitecture simd);
+
 	// Resize 32 or 24 bpp BGR(A) image using point sampling (i.e. no interpolation).
 	// Point sampling is fast but produces a lot of aliasing artifacts.
 	// Notice that the A channel is kept unchanged for 32 bpp images.
@@ -157,6 +171,12 @@ public:
 	static void* PointSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
 		CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor);
 
+	// Same as above but using bicubic interpolation, used for the preview of the rotation.
+	// There is no low pass filtering, thus the image shows some aliasing when zooming out.
+	// Notice that the A channel is processed for 32 bpp images.
+	static void* BicubicSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
+		CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor, SIMDArchitecture simd);
+
 	// Resample 32 or 24 bpp BGR(A) image using point sampling (i.e. no interpolation) and map to trapezoid.
 	// Notice that the A channel is kept unchanged for 32 bpp images.
 	// Notice that the returned image is always 32 bpp!
@@ -168,6 +188,12 @@ public:
 	static void* PointSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
 		CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor);
 
+	// Same as above but using bicubic interpolation, used for the preview of the perspective correction.
+	// There is no low pass filtering, thus the image shows some aliasing when zooming out.
+	// Notice that the A channel is not processed and set to fixed value 0xFF.
+	static void* BicubicSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
+		CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor, SIMDArchitecture simd);
+
 	// High quality downsampling of 32 or 24 bpp BGR(A) image to target size, using a set of down-sampling kernels that
 	// do some sharpening during down-sampling if desired. 
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
@@ -212,6 +238,10 @@ public:
 	static void* RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, 
 		const void* pSourcePixels, int nChannels, COLORREF backColor);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* RotateHQ_SIMD(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, 
+		const void* pSourcePixels, int nChannels, COLORREF backColor, SIMDArchitecture simd);
+
 	// Trapezoid correction (used for perspective correction) using bicubic interpolation of 32 or 24 bpp BGR(A) image.
 	// This method is used for perspective correction.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
@@ -227,10 +257,18 @@ public:
 	static void* TrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
 		const void* pSourcePixels, int nChannels, COLORREF backColor);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* TrapezoidHQ_SIMD(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
+		const void* pSourcePixels, int nChannels, COLORREF backColor, SIMDArchitecture simd);
+
 	// Gauss filtering of a 16 bpp 1 channel image. In the image with size fullSize, the rectangle rect at position offset is filtered.
 	// The returned image has size 'rect'.
 	static int16* GaussFilter16bpp1Channel(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static int16* GaussFilter16bpp1Channel_SIMD(CSize fullSize, CPoint offset, CSize rect, double dRadius, const int16* pPixels,
+		SIMDArchitecture simd);
+
 	// Apply unsharp masking to the given source 32 or 24 bpp BGR(A) image and store result in pTargetPixels.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	// fullSize: Size of source image, target image and grayscale images (all must have the same size)
@@ -245,6 +283,11 @@ public:
 	static void* UnsharpMask(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
 		const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels);
 
+	// Same as above, using the given SIMD architecture. Only AVX2 has an own implementation, the result is identical.
+	static void* UnsharpMask_SIMD(CSize fullSize, CPoint offset, CSize rect, double dAmount, double dThreshold, 
+		const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels,
+		SIMDArchitecture simd);
+
 	// Debug: Gives some timing info of the last resize operation
 	static LPCTSTR TimingInfo();
 
@@ -0,0 +1,368 @@
+#include "StdAfx.h"
+#include "Benchmark.h"
+#include "BasicProcessing.h"
+#include "ProcessingThreadPool.h"
+#include "Helpers.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#define ALPHA_OPAQUE 0xFF000000
+
+// Kernels measured by the benchmark
+enum EBenchmarkKernel {
+	BK_SampleDown_HQ,
+	BK_SampleUp_HQ,
+	BK_PointSample,
+	BK_Apply3ChannelLUT32bpp,
+	BK_ApplySaturationAnd3ChannelLUT32bpp,
+	BK_ApplyLDC32bpp,
+	BK_GaussFilter16bpp1Channel,
+	BK_UnsharpMask,
+	BK_RotateHQ,
+	BK_TrapezoidHQ,
+	BK_NumKernels
+};
+
+static const LPCTSTR s_KernelNames[BK_NumKernels] = {
+	_T("SampleDown_HQ"),
+	_T("SampleUp_HQ"),
+	_T("PointSample"),
+	_T("Apply3ChannelLUT32bpp"),
+	_T("ApplySaturationAnd3ChannelLUT32bpp"),
+	_T("ApplyLDC32bpp"),
+	_T("GaussFilter16bpp1Channel"),
+	_T("UnsharpMask"),
+	_T("RotateHQ"),
+	_T("TrapezoidHQ")
+};
+
+// Scalar C++ implementation, used in addition to the CBasicProcessing::SIMDArchitecture values
+static const int SIMD_None = -1;
+
+// Zoom factors used for the resampling kernels
+static const double s_ZoomDown[] = { 0.125, 0.25, 0.5, 0.8 };
+static const double s_ZoomUp[] = { 1.5, 2.0, 4.0 };
+
+// The resampled images are clipped to this window size, as in the viewer
+static const CSize s_ViewportSize(3840, 2160);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// One measurement
+struct CBenchmarkResult {
+	EBenchmarkKernel Kernel;
+	int SIMD;
+	int SizeMP;
+	double Zoom;
+	int Threads;
+	double TimeMs;
+	double MPPerSecond;
+};
+
+// Synthetic 32 bpp test image with the auxiliary data the kernels need
+class CBenchmarkImage {
+public:
+	CBenchmarkImage(int nSizeMP) {
+		// 4:3 aspect ratio as typical for camera images
+		Size.cx = (int)(sqrt(nSizeMP * 1000000.0 * 4 / 3) + 0.5);
+		Size.cy = Size.cx * 3 / 4;
+		LDCMapSize = CSize(256, 192);
+		Pixels = new(std::nothrow) uint32[Size.cx * Size.cy];
+		LDCMap = new(std::nothrow) uint8[LDCMapSize.cx * LDCMapSize.cy];
+		SaturationLUTs = CBasicProcessing::CreateColorSaturationLUTs(1.4);
+		GrayImage = NULL;
+		SmoothGrayImage = NULL;
+		if (Pixels == NULL || LDCMap == NULL || SaturationLUTs == NULL) {
+			return;
+		}
+
+		// Gradients with some pseudo random noise, deterministic for reproducible results
+		uint32 nRandom = 12345;
+		uint32* pPixel = Pixels;
+		for (int j = 0; j < Size.cy; j++) {
+			for (int i = 0; i < Size.cx; i++) {
+				nRandom = nRandom * 1103515245 + 12345;
+				uint32 nNoise = (nRandom >> 16) & 0x1F;
+				uint32 nBlue = min(255u, (uint32)(i * 255 / Size.cx) + nNoise);
+				uint32 nGreen = min(255u, (uint32)(j * 255 / Size.cy) + nNoise);
+				uint32 nRed = ((i ^ j) & 0xFF);
+				*pPixel++ = nBlue + (nGreen << 8) + (nRed << 16) + ALPHA_OPAQUE;
+			}
+		}
+		for (int i = 0; i < LDCMapSize.cx * LDCMapSize.cy; i++) {
+			nRandom = nRandom * 1103515245 + 12345;
+			LDCMap[i] = (uint8)(nRandom >> 24);
+		}
+		for (int c = 0; c < 3; c++) {
+			for (int i = 0; i < 256; i++) {
+				LUT[c * 256 + i] = (uint8)(255 * pow(i / 255.0, 0.8 + 0.1 * c) + 0.5);
+			}
+		}
+		GrayImage = CBasicProcessing::Create1Channel16bppGrayscaleImage(Size.cx, Size.cy, Pixels, 4);
+		if (GrayImage != NULL) {
+			SmoothGrayImage = CBasicProcessing::GaussFilter16bpp1Channel(Size, CPoint(0, 0), Size, 2.0, GrayImage);
+		}
+	}
+
+	~CBenchmarkImage() {
+		delete[] Pixels;
+		delete[] LDCMap;
+		delete[] SaturationLUTs;
+		delete[] GrayImage;
+		delete[] SmoothGrayImage;
+	}
+
+	bool IsValid() const { return Pixels != NULL && LDCMap != NULL && SaturationLUTs != NULL && GrayImage != NULL && SmoothGrayImage != NULL; }
+
+	CSize Size;
+	CSize LDCMapSize;
+	uint32* Pixels;
+	uint8* LDCMap;
+	int32* SaturationLUTs;
+	int16* GrayImage;
+	int16* SmoothGrayImage;
+	uint8 LUT[768];
+};
+
+static bool IsResamplingKernel(EBenchmarkKernel eKernel) {
+	return eKernel == BK_SampleDown_HQ || eKernel == BK_SampleUp_HQ || eKernel == BK_PointSample;
+}
+
+static bool UsesThreadPool(EBenchmarkKernel eKernel, int nSIMD) {
+	switch (eKernel) {
+		case BK_SampleDown_HQ:
+		case BK_SampleUp_HQ:
+			return nSIMD != SIMD_None;
+		case BK_Apply3ChannelLUT32bpp:
+		case BK_ApplySaturationAnd3ChannelLUT32bpp:
+		case BK_ApplyLDC32bpp:
+		case BK_GaussFilter16bpp1Channel:
+		case BK_UnsharpMask:
+		case BK_RotateHQ:
+		case BK_TrapezoidHQ:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// SIMD architectures supported by this CPU and build
+static std::vector<int> GetSupportedSIMD() {
+	std::vector<int> simd;
+	simd.push_back(SIMD_None);
+	Helpers::CPUType cpu = Helpers::ProbeCPU();
+#ifndef _WIN64
+	// MMX is only implemented for 32 bit, 64 bit always uses at least SSE
+	if (cpu >= Helpers::CPU_MMX) simd.push_back(CBasicProcessing::MMX);
+#endif
+	if (cpu >= Helpers::CPU_SSE) simd.push_back(CBasicProcessing::SSE);
+#ifdef _WIN64
+	// AVX2 is only implemented for 64 bit
+	if (cpu >= Helpers::CPU_AVX2) simd.push_back(CBasicProcessing::AVX2);
+#endif
+	return simd;
+}
+
+static LPCTSTR SIMDName(int nSIMD) {
+	switch (nSIMD) {
+		case CBasicProcessing::MMX: return _T("MMX");
+		case CBasicProcessing::SSE: return _T("SSE");
+		case CBasicProcessing::AVX2: return _T("AVX2");
+		default: return _T("Generic");
+	}
+}
+
+// Runs the kernel once, returns the time in ms or a negative value if the kernel failed.
+// dSourceMP receives the number of source megapixels processed.
+static double RunKernel(EBenchmarkKernel eKernel, int nSIMD, double dZoom, const CBenchmarkImage& image, double& dSourceMP) {
+	CSize size = image.Size;
+	CSize fullTargetSize((int)(size.cx * dZoom + 0.5), (int)(size.cy * dZoom + 0.5));
+	CSize clippedSize(min(fullTargetSize.cx, s_ViewportSize.cx), min(fullTargetSize.cy, s_ViewportSize.cy));
+	CPoint offset((fullTargetSize.cx - clippedSize.cx) / 2, (fullTargetSize.cy - clippedSize.cy) / 2);
+	dSourceMP = size.cx * (double)size.cy / 1000000;
+	if (IsResamplingKernel(eKernel)) {
+		dSourceMP = dSourceMP * ((double)clippedSize.cx * clippedSize.cy) / ((double)fullTargetSize.cx * fullTargetSize.cy);
+	}
+	CBasicProcessing::SIMDArchitecture simd = (CBasicProcessing::SIMDArchitecture)nSIMD;
+
+	void* pResult = NULL;
+	int16* pResult16 = NULL;
+	double dStartTime = Helpers::GetExactTickCount();
+	switch (eKernel) {
+		case BK_SampleDown_HQ:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::SampleDown_HQ(fullTargetSize, offset, clippedSize, size, image.Pixels, 4, 0.3, Filter_Downsampling_Best_Quality) :
+				CBasicProcessing::SampleDown_HQ_SIMD(fullTargetSize, offset, clippedSize, size, image.Pixels, 4, 0.3, Filter_Downsampling_Best_Quality, simd);
+			break;
+		case BK_SampleUp_HQ:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::SampleUp_HQ(fullTargetSize, offset, clippedSize, size, image.Pixels, 4) :
+				CBasicProcessing::SampleUp_HQ_SIMD(fullTargetSize, offset, clippedSize, size, image.Pixels, 4, simd);
+			break;
+		case BK_PointSample:
+			pResult = CBasicProcessing::PointSample(fullTargetSize, offset, clippedSize, size, image.Pixels, 4);
+			break;
+		case BK_Apply3ChannelLUT32bpp:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::Apply3ChannelLUT32bpp(size.cx, size.cy, image.Pixels, image.LUT) :
+				CBasicProcessing::Apply3ChannelLUT32bpp_SIMD(size.cx, size.cy, image.Pixels, image.LUT, simd);
+			break;
+		case BK_ApplySaturationAnd3ChannelLUT32bpp:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(size.cx, size.cy, image.Pixels, image.SaturationLUTs, image.LUT) :
+				CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp_SIMD(size.cx, size.cy, image.Pixels, image.SaturationLUTs, image.LUT, simd);
+			break;
+		case BK_ApplyLDC32bpp:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::ApplyLDC32bpp(size, CPoint(0, 0), size, image.LDCMapSize, image.Pixels,
+					NULL, image.LUT, image.LDCMap, 0.05f, 0.95f, 0.5f) :
+				CBasicProcessing::ApplyLDC32bpp_SIMD(size, CPoint(0, 0), size, image.LDCMapSize, image.Pixels,
+					NULL, image.LUT, image.LDCMap, 0.05f, 0.95f, 0.5f, simd);
+			break;
+		case BK_GaussFilter16bpp1Channel:
+			pResult16 = (nSIMD == SIMD_None) ?
+				CBasicProcessing::GaussFilter16bpp1Channel(size, CPoint(0, 0), size, 2.0, image.GrayImage) :
+				CBasicProcessing::GaussFilter16bpp1Channel_SIMD(size, CPoint(0, 0), size, 2.0, image.GrayImage, simd);
+			break;
+		case BK_UnsharpMask:
+			pResult = new(std::nothrow) uint32[size.cx * size.cy];
+			if (pResult != NULL) {
+				dStartTime = Helpers::GetExactTickCount();
+				void* pSharpened = (nSIMD == SIMD_None) ?
+					CBasicProcessing::UnsharpMask(size, CPoint(0, 0), size, 1.0, 4.0, image.GrayImage, image.SmoothGrayImage, image.Pixels, pResult, 4) :
+					CBasicProcessing::UnsharpMask_SIMD(size, CPoint(0, 0), size, 1.0, 4.0, image.GrayImage, image.SmoothGrayImage, image.Pixels, pResult, 4, simd);
+				if (pSharpened == NULL) {
+					delete[] pResult;
+					pResult = NULL;
+				}
+			}
+			break;
+		case BK_RotateHQ:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::RotateHQ(CPoint(0, 0), size, 5 * 3.141592653 / 180, size, image.Pixels, 4, RGB(0, 0, 0)) :
+				CBasicProcessing::RotateHQ_SIMD(CPoint(0, 0), size, 5 * 3.141592653 / 180, size, image.Pixels, 4, RGB(0, 0, 0), simd);
+			break;
+		case BK_TrapezoidHQ:
+			pResult = (nSIMD == SIMD_None) ?
+				CBasicProcessing::TrapezoidHQ(CPoint(0, 0), size, CTrapezoid(0, size.cx - 1, 0, size.cx / 10, size.cx - 1 - size.cx / 10, size.cy - 1),
+					size, image.Pixels, 4, RGB(0, 0, 0)) :
+				CBasicProcessing::TrapezoidHQ_SIMD(CPoint(0, 0), size, CTrapezoid(0, size.cx - 1, 0, size.cx / 10, size.cx - 1 - size.cx / 10, size.cy - 1),
+					size, image.Pixels, 4, RGB(0, 0, 0), simd);
+			break;
+	}
+	double dTime = Helpers::GetExactTickCount() - dStartTime;
+
+	bool bSuccess = pResult != NULL || pResult16 != NULL;
+	delete[] pResult;
+	delete[] pResult16;
+	return bSuccess ? dTime : -1.0;
+}
+
+static void Measure(std::vector<CBenchmarkResult>& results, EBenchmarkKernel eKernel, int nSIMD, int nSizeMP, double dZoom,
+					int nThreads, int nRepeat, const CBenchmarkImage& image) {
+	CProcessingThreadPool::This().SetMaxNumberOfThreads(nThreads);
+	double dBestTime = -1.0;
+	double dSourceMP = 0.0;
+	for (int i = 0; i < nRepeat; i++) {
+		double dTime = RunKernel(eKernel, nSIMD, dZoom, image, dSourceMP);
+		if (dTime < 0) {
+			dBestTime = -1.0;
+			break;
+		}
+		if (dBestTime < 0 || dTime < dBestTime) {
+			dBestTime = dTime;
+		}
+	}
+
+	CBenchmarkResult result;
+	result.Kernel = eKernel;
+	result.SIMD = nSIMD;
+	result.SizeMP = nSizeMP;
+	result.Zoom = dZoom;
+	result.Threads = nThreads;
+	result.TimeMs = dBestTime;
+	result.MPPerSecond = (dBestTime > 0) ? dSourceMP * 1000 / dBestTime : 0.0;
+	results.push_back(result);
+
+	if (dBestTime < 0) {
+		_tprintf(_T("%-36s %-8s %5d MP  zoom %5.3f  %2d threads: failed (out of memory)\n"),
+			s_KernelNames[eKernel], SIMDName(nSIMD), nSizeMP, dZoom, nThreads);
+	} else {
+		_tprintf(_T("%-36s %-8s %5d MP  zoom %5.3f  %2d threads: %9.1f ms %9.1f MP/s\n"),
+			s_KernelNames[eKernel], SIMDName(nSIMD), nSizeMP, dZoom, nThreads, dBestTime, result.MPPerSecond);
+	}
+	fflush(stdout);
+}
+
+static bool WriteJSON(LPCTSTR sJSONFile, const std::vector<CBenchmarkResult>& results) {
+	FILE* pFile = NULL;
+	if (_tfopen_s(&pFile, sJSONFile, _T("wt")) != 0 || pFile == NULL) {
+		return false;
+	}
+	Helpers::CPUType cpu = Helpers::ProbeCPU();
+	fprintf(pFile, "{\n  \"cpu\": \"%S\",\n  \"threads\": %d,\n  \"results\": [\n",
+		SIMDName((cpu == Helpers::CPU_AVX2) ? CBasicProcessing::AVX2 : (cpu == Helpers::CPU_SSE) ? CBasicProcessing::SSE :
+			(cpu == Helpers::CPU_MMX) ? CBasicProcessing::MMX : SIMD_None),
+		CProcessingThreadPool::This().NumberOfThreads());
+	for (size_t i = 0; i < results.size(); i++) {
+		const CBenchmarkResult& r = results[i];
+		fprintf(pFile, "    { \"kernel\": \"%S\", \"simd\": \"%S\", \"sizeMP\": %d, \"zoom\": %.3f, \"threads\": %d, \"timeMs\": %.3f, \"mpPerSecond\": %.2f }%s\n",
+			s_KernelNames[r.Kernel], SIMDName(r.SIMD), r.SizeMP, r.Zoom, r.Threads, r.TimeMs, r.MPPerSecond,
+			(i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(pFile, "  ]\n}\n");
+	fclose(pFile);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Public interface
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CBenchmark::Run(const int* nSizesMP, int nNumSizes, int nRepeat, LPCTSTR sJSONFile) {
+	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
+	threadPool.SetMaxNumberOfThreads(0);
+	int nMaxThreads = threadPool.NumberOfThreads();
+	std::vector<int> simdList = GetSupportedSIMD();
+	std::vector<CBenchmarkResult> results;
+
+	for (int nSize = 0; nSize < nNumSizes; nSize++) {
+		int nSizeMP = nSizesMP[nSize];
+		CBenchmarkImage image(nSizeMP);
+		if (!image.IsValid()) {
+			_tprintf(_T("%d MP: skipped, not enough memory for the test image\n"), nSizeMP);
+			continue;
+		}
+		for (int nKernel = 0; nKernel < BK_NumKernels; nKernel++) {
+			EBenchmarkKernel eKernel = (EBenchmarkKernel)nKernel;
+			bool bHasSIMD = eKernel == BK_SampleDown_HQ || eKernel == BK_SampleUp_HQ || eKernel == BK_Apply3ChannelLUT32bpp ||
+				eKernel == BK_ApplySaturationAnd3ChannelLUT32bpp || eKernel == BK_ApplyLDC32bpp || eKernel == BK_RotateHQ || eKernel == BK_TrapezoidHQ ||
+				eKernel == BK_GaussFilter16bpp1Channel || eKernel == BK_UnsharpMask;
+			std::vector<double> zoomList;
+			if (eKernel == BK_SampleDown_HQ || eKernel == BK_PointSample) {
+				zoomList.insert(zoomList.end(), s_ZoomDown, s_ZoomDown + sizeof(s_ZoomDown) / sizeof(double));
+			}
+			if (eKernel == BK_SampleUp_HQ || eKernel == BK_PointSample) {
+				zoomList.insert(zoomList.end(), s_ZoomUp, s_ZoomUp + sizeof(s_ZoomUp) / sizeof(double));
+			}
+			if (zoomList.empty()) {
+				zoomList.push_back(1.0);
+			}
+			for (size_t nSIMD = 0; nSIMD < (bHasSIMD ? simdList.size() : 1); nSIMD++) {
+				for (size_t nZoom = 0; nZoom < zoomList.size(); nZoom++) {
+					int nThreadsToTest = UsesThreadPool(eKernel, simdList[nSIMD]) ? nMaxThreads : 1;
+					for (int nThreads = 1; nThreads <= nThreadsToTest; nThreads++) {
+						Measure(results, eKernel, simdList[nSIMD], nSizeMP, zoomList[nZoom], nThreads, nRepeat, image);
+					}
+				}
+			}
+		}
+	}
+
+	threadPool.SetMaxNumberOfThreads(0);
+
+	return (sJSONFile == NULL) ? true : WriteJSON(sJSONFile, results);
+}
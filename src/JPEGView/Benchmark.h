@@ -0,0 +1,19 @@
+#pragma once
+
+// Micro-benchmark of the CBasicProcessing kernels.
+// Each kernel is run on synthetic images of the given sizes with all zoom factors, all SIMD architectures supported
+// by the CPU and with 1..N threads of the processing thread pool. The throughput is reported in megapixels (of the
+// processed source area) per second on stdout and optionally written to a JSON file for regression tracking.
+// Invoked by the command line tool: JPEGView.exe /cli benchmark [-sizes 1,12,50,200] [-repeat n] [-json file]
+class CBenchmark
+{
+public:
+	// nSizesMP: image sizes in megapixels, nNumSizes entries
+	// nRepeat: number of runs per measurement, the fastest run is reported
+	// sJSONFile: output file for JSON results, can be NULL
+	// Returns false if the JSON file could not be written
+	static bool Run(const int* nSizesMP, int nNumSizes, int nRepeat, LPCTSTR sJSONFile);
+
+private:
+	CBenchmark(void);
+};
@@ -0,0 +1,180 @@
+#include "StdAfx.h"
+#include "BicubicAVX.h"
+
+#ifdef _WIN64
+
+#define ALPHA_OPAQUE 0xFF000000
+#define FP_HALF 8192
+
+// The kernel index is the 16 bit fractional part shifted right by this value (NUM_KERNELS_LOG2 is 6)
+#define KERNEL_INDEX_SHIFT 10
+
+// Sign extended elements 0..3 of the filter kernel selected by the fractional part in each lane
+static inline void GetKernels(const int16* pKernels, __m256i frac, __m256i kernel[4]) {
+	__m256i index = _mm256_slli_epi32(_mm256_srli_epi32(frac, KERNEL_INDEX_SHIFT), 1); // 4 int16 are 2 int32
+	__m256i kernel01 = _mm256_i32gather_epi32((const int*)pKernels, index, 4);
+	__m256i kernel23 = _mm256_i32gather_epi32((const int*)pKernels + 1, index, 4);
+	kernel[0] = _mm256_srai_epi32(_mm256_slli_epi32(kernel01, 16), 16);
+	kernel[1] = _mm256_srai_epi32(kernel01, 16);
+	kernel[2] = _mm256_srai_epi32(_mm256_slli_epi32(kernel23, 16), 16);
+	kernel[3] = _mm256_srai_epi32(kernel23, 16);
+}
+
+static inline __m256i Clamp(__m256i value, int nMax) {
+	return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(nMax));
+}
+
+int RotateRowHQ_AVX(int nNumPixels, int32 nStartX, int32 nStartY, int32 nIncrementX, int32 nIncrementY,
+	const uint8* pSourcePixels, int nPaddedSourceWidth, int nChannels, const int16* pKernels, uint32* pTarget) {
+
+	const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i fracMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i half = _mm256_set1_epi32(FP_HALF);
+	const __m256i stride = _mm256_set1_epi32(nPaddedSourceWidth);
+	const __m256i channels = _mm256_set1_epi32(nChannels);
+	const __m256i incrementX = _mm256_set1_epi32(nIncrementX * 8);
+	const __m256i incrementY = _mm256_set1_epi32(nIncrementY * 8);
+	// selects byte c of each pixel
+	__m256i selectChannel[4];
+	for (int c = 0; c < 4; c++) {
+		int32 nSel = 0x80808000 | c;
+		selectChannel[c] = _mm256_setr_epi32(nSel, nSel + 4, nSel + 8, nSel + 12, nSel, nSel + 4, nSel + 8, nSel + 12);
+	}
+	__m256i curX = _mm256_add_epi32(_mm256_set1_epi32(nStartX), _mm256_mullo_epi32(_mm256_set1_epi32(nIncrementX), laneIndex));
+	__m256i curY = _mm256_add_epi32(_mm256_set1_epi32(nStartY), _mm256_mullo_epi32(_mm256_set1_epi32(nIncrementY), laneIndex));
+
+	int nNumBlocks = nNumPixels >> 3;
+	for (int n = 0; n < nNumBlocks; n++) {
+		__m256i kernelX[4], kernelY[4];
+		GetKernels(pKernels, _mm256_and_si256(curX, fracMask), kernelX);
+		GetKernels(pKernels, _mm256_and_si256(curY, fracMask), kernelY);
+		// byte offset of the first pixel of the 4x4 neighbourhood
+		__m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(curY, 16), stride),
+			_mm256_mullo_epi32(_mm256_srai_epi32(curX, 16), channels));
+		offset = _mm256_sub_epi32(offset, _mm256_add_epi32(stride, channels));
+
+		__m256i sum[4] = { half, half, half, half };
+		for (int r = 0; r < 4; r++) {
+			__m256i pixels[4];
+			if (nChannels == 4) {
+				for (int k = 0; k < 4; k++) {
+					pixels[k] = _mm256_i32gather_epi32((const int*)pSourcePixels, _mm256_add_epi32(offset, _mm256_set1_epi32(4 * k)), 1);
+				}
+			} else {
+				// 3 channels: read the dword ending with the pixel to not read behind the last pixel of the image
+				pixels[0] = _mm256_i32gather_epi32((const int*)pSourcePixels, offset, 1);
+				for (int k = 1; k < 4; k++) {
+					pixels[k] = _mm256_srli_epi32(_mm256_i32gather_epi32((const int*)pSourcePixels, _mm256_add_epi32(offset, _mm256_set1_epi32(3 * k - 1)), 1), 8);
+				}
+			}
+			for (int c = 0; c < nChannels; c++) {
+				__m256i sumX = half;
+				for (int k = 0; k < 4; k++) {
+					sumX = _mm256_add_epi32(sumX, _mm256_mullo_epi32(_mm256_shuffle_epi8(pixels[k], selectChannel[c]), kernelX[k]));
+				}
+				sum[c] = _mm256_add_epi32(sum[c], _mm256_mullo_epi32(_mm256_srai_epi32(sumX, 14), kernelY[r]));
+			}
+			offset = _mm256_add_epi32(offset, stride);
+		}
+
+		__m256i result = _mm256_or_si256(Clamp(_mm256_srai_epi32(sum[0], 14), 255),
+			_mm256_slli_epi32(Clamp(_mm256_srai_epi32(sum[1], 14), 255), 8));
+		result = _mm256_or_si256(result, _mm256_slli_epi32(Clamp(_mm256_srai_epi32(sum[2], 14), 255), 16));
+		if (nChannels == 4) {
+			result = _mm256_or_si256(result, _mm256_slli_epi32(Clamp(_mm256_srai_epi32(sum[3], 14), 255), 24));
+		} else {
+			result = _mm256_or_si256(result, _mm256_set1_epi32((int)ALPHA_OPAQUE));
+		}
+		_mm256_storeu_si256((__m256i*)pTarget, result);
+
+		curX = _mm256_add_epi32(curX, incrementX);
+		curY = _mm256_add_epi32(curY, incrementY);
+		pTarget += 8;
+	}
+	return nNumBlocks << 3;
+}
+
+// Vertical filtering of 8 consecutive bytes, the results are saturated to 16 bit
+static inline __m128i InterpolateY8(const uint8* pSource, int nPaddedSourceWidth, const __m256i kernelY[4]) {
+	__m256i sum = _mm256_set1_epi32(FP_HALF);
+	pSource -= nPaddedSourceWidth;
+	for (int r = 0; r < 4; r++) {
+		__m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)pSource));
+		sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(values, kernelY[r]));
+		pSource += nPaddedSourceWidth;
+	}
+	sum = _mm256_srai_epi32(sum, 6);
+	__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(sum, sum), 0x08);
+	return _mm256_castsi256_si128(packed);
+}
+
+void InterpolateBicubicRowY_AVX(const uint8* pSourcePixels, int nChannelsSource, int nPaddedSourceWidth, uint16* pTarget,
+	int nPixelsPerLine, const int16* pKernelY) {
+
+	__m256i kernelY[4];
+	for (int r = 0; r < 4; r++) {
+		kernelY[r] = _mm256_set1_epi32(pKernelY[r]);
+	}
+	int nStart = 0;
+	if (nChannelsSource == 3) {
+		int nNumValues = nPixelsPerLine * 3;
+		for (; nStart + 8 <= nNumValues; nStart += 8) {
+			_mm_storeu_si128((__m128i*)(pTarget + nStart), InterpolateY8(pSourcePixels + nStart, nPaddedSourceWidth, kernelY));
+		}
+		nStart /= 3;
+	} else {
+		// two pixels per iteration, the alpha channel is dropped
+		const __m128i dropAlpha = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+		for (; nStart + 2 <= nPixelsPerLine; nStart += 2) {
+			__m128i values = _mm_shuffle_epi8(InterpolateY8(pSourcePixels + nStart * 4, nPaddedSourceWidth, kernelY), dropAlpha);
+			_mm_storeu_si128((__m128i*)(pTarget + nStart * 3), values); // the last 2 values are overwritten by the next iteration
+		}
+	}
+
+	// remaining pixels, same as InterpolateBicubicY() in BasicProcessing.cpp
+	int nPaddedSourceWidth2 = nPaddedSourceWidth * 2;
+	for (int i = nStart; i < nPixelsPerLine; i++) {
+		const uint8* pSrc = pSourcePixels + i * nChannelsSource;
+		for (int c = 0; c < 3; c++) {
+			int32 nSum = pSrc[-nPaddedSourceWidth + c] * pKernelY[0] + pSrc[c] * pKernelY[1] +
+				pSrc[nPaddedSourceWidth + c] * pKernelY[2] + pSrc[nPaddedSourceWidth2 + c] * pKernelY[3] + FP_HALF;
+			nSum = nSum >> 6;
+			pTarget[i * 3 + c] = (uint16)min(65535, max(0, nSum));
+		}
+	}
+}
+
+int InterpolateBicubicRowX_AVX(int nNumPixels, int32 nStartX, int32 nIncrementX, const uint16* pLine, const int16* pKernels, uint32* pTarget) {
+	const __m256i fracMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i half = _mm256_set1_epi32(FP_HALF);
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256i incrementX = _mm256_set1_epi32(nIncrementX * 8);
+	__m256i curX = _mm256_add_epi32(_mm256_set1_epi32(nStartX), _mm256_mullo_epi32(_mm256_set1_epi32(nIncrementX), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+	int nNumBlocks = nNumPixels >> 3;
+	for (int n = 0; n < nNumBlocks; n++) {
+		__m256i kernelX[4];
+		GetKernels(pKernels, _mm256_and_si256(curX, fracMask), kernelX);
+		// index of the first value of the 4 pixels
+		__m256i index = _mm256_sub_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(curX, 16), three), three);
+		__m256i sum[3] = { half, half, half };
+		for (int k = 0; k < 4; k++) {
+			__m256i blueGreen = _mm256_i32gather_epi32((const int*)pLine, index, 2);
+			__m256i red = _mm256_i32gather_epi32((const int*)pLine, _mm256_add_epi32(index, _mm256_set1_epi32(2)), 2);
+			sum[0] = _mm256_add_epi32(sum[0], _mm256_mullo_epi32(_mm256_and_si256(blueGreen, fracMask), kernelX[k]));
+			sum[1] = _mm256_add_epi32(sum[1], _mm256_mullo_epi32(_mm256_srli_epi32(blueGreen, 16), kernelX[k]));
+			sum[2] = _mm256_add_epi32(sum[2], _mm256_mullo_epi32(_mm256_and_si256(red, fracMask), kernelX[k]));
+			index = _mm256_add_epi32(index, three);
+		}
+		__m256i result = _mm256_or_si256(Clamp(_mm256_srai_epi32(sum[0], 22), 255),
+			_mm256_slli_epi32(Clamp(_mm256_srai_epi32(sum[1], 22), 255), 8));
+		result = _mm256_or_si256(result, _mm256_slli_epi32(Clamp(_mm256_srai_epi32(sum[2], 22), 255), 16));
+		_mm256_storeu_si256((__m256i*)pTarget, _mm256_or_si256(result, _mm256_set1_epi32((int)ALPHA_OPAQUE)));
+
+		curX = _mm256_add_epi32(curX, incrementX);
+		pTarget += 8;
+	}
+	return nNumBlocks << 3;
+}
+
+#endif
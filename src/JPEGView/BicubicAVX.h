@@ -0,0 +1,24 @@
+#pragma once
+
+// Used by BasicProcessing.cpp: Bicubic sampling for rotation and trapezoid correction using AVX2.
+// Own compilation unit to be able to compile this with AVX compiler flag.
+// pKernels are the NUM_KERNELS_BICUBIC bicubic filter kernels of BasicProcessing.cpp, each of length 4, selected by
+// the upper 6 bits of the 16 bit fractional part of the source position. Results are identical to the C++ implementation.
+
+// Samples nNumPixels pixels of a rotated target row. The source position of pixel i is (nStartX + i * nIncrementX, nStartY + i * nIncrementY)
+// in 16.16 fixed point, all positions must have a distance of at least one pixel to the border of the source image
+// (the 4x4 kernel support is inside the image). Returns the number of pixels processed, a multiple of 8.
+// The caller processes the remaining pixels.
+int RotateRowHQ_AVX(int nNumPixels, int32 nStartX, int32 nStartY, int32 nIncrementX, int32 nIncrementY,
+	const uint8* pSourcePixels, int nPaddedSourceWidth, int nChannels, const int16* pKernels, uint32* pTarget);
+
+// Interpolates one line in y-direction with the kernel pKernelY (4 elements) into a 3 channel, 16 bpp line.
+// pSourcePixels points to the source row, the rows above and the two rows below must be inside the image.
+// pTarget must have space for two additional uint16 values.
+void InterpolateBicubicRowY_AVX(const uint8* pSourcePixels, int nChannelsSource, int nPaddedSourceWidth, uint16* pTarget,
+	int nPixelsPerLine, const int16* pKernelY);
+
+// Interpolates nNumPixels pixels in x-direction from the 3 channel, 16 bpp line created by InterpolateBicubicRowY_AVX().
+// The position of pixel i is nStartX + i * nIncrementX in 16.16 fixed point, the kernel support must be inside the line.
+// Returns the number of pixels processed, a multiple of 8. The caller processes the remaining pixels.
+int InterpolateBicubicRowX_AVX(int nNumPixels, int32 nStartX, int32 nIncrementX, const uint16* pLine, const int16* pKernels, uint32* pTarget);
@@ -0,0 +1,92 @@
+#pragma once
+
+// Sequential reader on a block of memory, normally the mapped view of a file (see CMappedFile).
+// Replaces the many small ReadFile()/fread() calls of the header parsers, the bytes are read directly from memory.
+// The position can be moved beyond the end as with a file pointer. Reads beyond the end fail, return zero and
+// set the failed flag, which stays set. Values can be read in little endian (Intel) or big endian (Motorola) byte order.
+class CByteStream
+{
+public:
+	CByteStream(const void* pData, __int64 nSize) {
+		m_pData = (const uint8*)pData;
+		m_nSize = nSize;
+		m_nPos = 0;
+		m_bFailed = false;
+	}
+
+	// True if a read or seek failed
+	bool Failed() const { return m_bFailed; }
+
+	__int64 Size() const { return m_nSize; }
+	__int64 Tell() const { return m_nPos; }
+	__int64 Remaining() const { return max(0, m_nSize - m_nPos); }
+
+	// Moves the position to the given offset from the start, respectively by the given offset from the current position.
+	// Returns false if the new position would be negative, the position is not changed in this case.
+	bool Seek(__int64 nPos) {
+		if (nPos < 0) {
+			m_bFailed = true;
+			return false;
+		}
+		m_nPos = nPos;
+		return true;
+	}
+	bool Skip(__int64 nOffset) { return Seek(m_nPos + nOffset); }
+
+	// Returns a pointer to the next nBytes bytes and advances the position, NULL if there are less bytes left.
+	// The data is not copied, the pointer is valid as long as the memory block is valid.
+	const uint8* GetBytes(__int64 nBytes) {
+		if (nBytes < 0 || nBytes > Remaining()) {
+			m_bFailed = true;
+			return NULL;
+		}
+		const uint8* pBytes = m_pData + m_nPos;
+		m_nPos += nBytes;
+		return pBytes;
+	}
+
+	// Copies the next nBytes bytes to pTarget, returns false if there are less bytes left
+	bool Read(void* pTarget, __int64 nBytes) {
+		const uint8* pBytes = GetBytes(nBytes);
+		if (pBytes == NULL) {
+			return false;
+		}
+		memcpy(pTarget, pBytes, (size_t)nBytes);
+		return true;
+	}
+
+	uint8 ReadUInt8() {
+		const uint8* p = GetBytes(1);
+		return (p == NULL) ? 0 : p[0];
+	}
+
+	// Little endian byte order
+	uint16 ReadUInt16() {
+		const uint8* p = GetBytes(2);
+		return (p == NULL) ? 0 : (uint16)(p[0] | (p[1] << 8));
+	}
+	uint32 ReadUInt32() {
+		const uint8* p = GetBytes(4);
+		return (p == NULL) ? 0 : p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+	}
+
+	// Big endian byte order
+	uint16 ReadUInt16BE() {
+		const uint8* p = GetBytes(2);
+		return (p == NULL) ? 0 : (uint16)((p[0] << 8) | p[1]);
+	}
+	uint32 ReadUInt32BE() {
+		const uint8* p = GetBytes(4);
+		return (p == NULL) ? 0 : ((uint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+	unsigned __int64 ReadUInt64BE() {
+		unsigned __int64 nHigh = ReadUInt32BE();
+		return (nHigh << 32) | ReadUInt32BE();
+	}
+
+private:
+	const uint8* m_pData;
+	__int64 m_nSize;
+	__int64 m_nPos;
+	bool m_bFailed;
+};
@@ -0,0 +1,290 @@
+#include "StdAfx.h"
+#include "CommandLineTool.h"
+#include "ImagePipeline.h"
+#include "Benchmark.h"
+#include "ConformanceCheck.h"
+#include "PrefetchPlanner.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
+#include "JPEGImage.h"
+#include "Helpers.h"
+#include <gdiplus.h>
+#include <shellapi.h>
+#include <stdio.h>
+
+// Exit codes of the command line tool
+enum {
+	EXIT_OK = 0,
+	EXIT_USAGE = 1,
+	EXIT_DECODE_FAILED = 2,
+	EXIT_PROCESSING_FAILED = 3
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// JPEGView is a GUI application, use the console of the calling process for output (if any)
+static void AttachToParentConsole() {
+	if (::AttachConsole(ATTACH_PARENT_PROCESS)) {
+		FILE* pFile;
+		_tfreopen_s(&pFile, _T("CONOUT$"), _T("w"), stdout);
+		_tfreopen_s(&pFile, _T("CONOUT$"), _T("w"), stderr);
+	}
+}
+
+static void PrintUsage() {
+	_ftprintf(stderr, _T("Usage:\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli decode <file>\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli resize <file> <output file> <width> <height> [point|noaliasing|sharpenlow|sharpenmedium]\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli process <file> <output file> [<width> <height>]\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli benchmark [-sizes <MP,MP,...>] [-repeat <n>] [-json <output file>]\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli conformance [-tolerance <n>] [<image file> ...]\n"));
+	_ftprintf(stderr, _T("  JPEGView /cli prefetch-replay <trace file> [-readahead <n>]\n"));
+	_ftprintf(stderr, _T("All commands accept -trace <output file> to write the timing of the load and render stages as Chrome trace JSON\n"));
+}
+
+// Removes the '-trace <file>' option from the arguments, returns the file or NULL if the option is not given
+static LPCTSTR ExtractTraceOption(int& nArgs, LPWSTR* pArgs) {
+	for (int i = 2; i < nArgs - 1; i++) {
+		if (_tcsicmp(pArgs[i], _T("-trace")) == 0) {
+			LPCTSTR sTraceFile = pArgs[i + 1];
+			for (int j = i + 2; j < nArgs; j++) {
+				pArgs[j - 2] = pArgs[j];
+			}
+			nArgs -= 2;
+			return sTraceFile;
+		}
+	}
+	return NULL;
+}
+
+static bool ParseResizeFilter(LPCTSTR sFilter, EResizeFilter& eFilter) {
+	if (_tcsicmp(sFilter, _T("point")) == 0) {
+		eFilter = Resize_PointFilter;
+	} else if (_tcsicmp(sFilter, _T("noaliasing")) == 0) {
+		eFilter = Resize_NoAliasing;
+	} else if (_tcsicmp(sFilter, _T("sharpenlow")) == 0) {
+		eFilter = Resize_SharpenLow;
+	} else if (_tcsicmp(sFilter, _T("sharpenmedium")) == 0) {
+		eFilter = Resize_SharpenMedium;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static CJPEGImage* DecodeAndReport(CImagePipeline& pipeline, LPCTSTR sFileName) {
+	bool bOutOfMemory = false;
+	CJPEGImage* pImage = pipeline.Decode(sFileName, bOutOfMemory);
+	if (pImage == NULL) {
+		_ftprintf(stderr, _T("%s: %s\n"), sFileName, bOutOfMemory ? _T("out of memory") : _T("cannot decode image"));
+		return NULL;
+	}
+	_tprintf(_T("%s: %d x %d, %d channels, decoded in %.1f ms\n"), sFileName, pImage->OrigWidth(), pImage->OrigHeight(),
+		pImage->OriginalChannels(), pipeline.LastDecodeTime());
+	return pImage;
+}
+
+static int RunBenchmark(int nArgs, LPWSTR* pArgs) {
+	const int MAX_SIZES = 16;
+	int nSizesMP[MAX_SIZES] = { 1, 12, 50, 200 };
+	int nNumSizes = 4;
+	int nRepeat = 3;
+	LPCTSTR sJSONFile = NULL;
+	for (int i = 3; i < nArgs; i++) {
+		bool bHasValue = i + 1 < nArgs;
+		if (_tcsicmp(pArgs[i], _T("-sizes")) == 0 && bHasValue) {
+			nNumSizes = 0;
+			LPCTSTR sSize = pArgs[++i];
+			while (sSize != NULL && nNumSizes < MAX_SIZES) {
+				int nSize = _ttoi(sSize);
+				if (nSize > 0) nSizesMP[nNumSizes++] = nSize;
+				sSize = _tcschr(sSize, _T(','));
+				if (sSize != NULL) sSize++;
+			}
+		} else if (_tcsicmp(pArgs[i], _T("-repeat")) == 0 && bHasValue) {
+			nRepeat = max(1, _ttoi(pArgs[++i]));
+		} else if (_tcsicmp(pArgs[i], _T("-json")) == 0 && bHasValue) {
+			sJSONFile = pArgs[++i];
+		} else {
+			PrintUsage();
+			return EXIT_USAGE;
+		}
+	}
+	if (nNumSizes == 0) {
+		PrintUsage();
+		return EXIT_USAGE;
+	}
+	if (!CBenchmark::Run(nSizesMP, nNumSizes, nRepeat, sJSONFile)) {
+		_ftprintf(stderr, _T("%s: cannot write benchmark results\n"), sJSONFile);
+		return EXIT_PROCESSING_FAILED;
+	}
+	return EXIT_OK;
+}
+
+static int RunConformanceCheck(int nArgs, LPWSTR* pArgs) {
+	int nTolerance = 2;
+	int nFirstFile = 3;
+	if (nArgs > 4 && _tcsicmp(pArgs[3], _T("-tolerance")) == 0) {
+		nTolerance = max(0, _ttoi(pArgs[4]));
+		nFirstFile = 5;
+	}
+	bool bSuccess = CConformanceCheck::Run((LPCTSTR*)(pArgs + nFirstFile), max(0, nArgs - nFirstFile), nTolerance);
+	return bSuccess ? EXIT_OK : EXIT_PROCESSING_FAILED;
+}
+
+// Replays a navigation trace through the prefetch planner and reports its hit rate. Each line of the trace contains the
+// index of the image in the file list and the time in milliseconds, optionally after a prefix ending with ':'
+// (as written to the debug output by the debug build: 'Navigate: <index> <time>').
+static int RunPrefetchReplay(int nArgs, LPWSTR* pArgs) {
+	if (nArgs < 4) {
+		PrintUsage();
+		return EXIT_USAGE;
+	}
+	int nReadAhead = 2;
+	if (nArgs > 5 && _tcsicmp(pArgs[4], _T("-readahead")) == 0) {
+		nReadAhead = max(0, _ttoi(pArgs[5]));
+	}
+	FILE* pFile;
+	if (_tfopen_s(&pFile, pArgs[3], _T("rt")) != 0) {
+		_ftprintf(stderr, _T("%s: cannot read trace\n"), pArgs[3]);
+		return EXIT_PROCESSING_FAILED;
+	}
+	CPrefetchPlanner planner(nReadAhead);
+	CPrefetchPlanner::CPrefetch prefetches[CPrefetchPlanner::MAX_PREFETCHES];
+	__int64 nPlanned = 0;
+	int nNavigations = 0;
+	TCHAR line[256];
+	while (_fgetts(line, 256, pFile) != NULL) {
+		LPCTSTR sValues = _tcsrchr(line, _T(':'));
+		sValues = (sValues == NULL) ? line : sValues + 1;
+		int nIndex;
+		double dTime;
+		if (_stscanf_s(sValues, _T("%d %lf"), &nIndex, &dTime) == 2) {
+			planner.OnNavigate(nIndex, dTime);
+			nPlanned += planner.Plan(prefetches, CPrefetchPlanner::MAX_PREFETCHES);
+			nNavigations++;
+		}
+	}
+	fclose(pFile);
+	_tprintf(_T("%d navigations, %d hits, %d misses, hit rate %.1f %%, %.1f images read ahead per navigation\n"), nNavigations,
+		planner.Hits(), planner.Misses(), planner.HitRate(), (nNavigations == 0) ? 0.0 : (double)nPlanned / nNavigations);
+	return EXIT_OK;
+}
+
+static int RunCommand(int nArgs, LPWSTR* pArgs) {
+	// pArgs[0] is the executable, pArgs[1] is '/cli'
+	if (nArgs >= 3 && _tcsicmp(pArgs[2], _T("benchmark")) == 0) {
+		return RunBenchmark(nArgs, pArgs);
+	}
+	if (nArgs >= 3 && _tcsicmp(pArgs[2], _T("conformance")) == 0) {
+		return RunConformanceCheck(nArgs, pArgs);
+	}
+	if (nArgs >= 3 && _tcsicmp(pArgs[2], _T("prefetch-replay")) == 0) {
+		return RunPrefetchReplay(nArgs, pArgs);
+	}
+	if (nArgs < 4) {
+		PrintUsage();
+		return EXIT_USAGE;
+	}
+	LPCTSTR sCommand = pArgs[2];
+	LPCTSTR sInputFile = pArgs[3];
+	bool bDecode = _tcsicmp(sCommand, _T("decode")) == 0;
+	bool bResize = _tcsicmp(sCommand, _T("resize")) == 0;
+	bool bProcess = _tcsicmp(sCommand, _T("process")) == 0;
+	if (!(bDecode || bResize || bProcess) || (bResize && nArgs < 7) || (bProcess && nArgs < 5)) {
+		PrintUsage();
+		return EXIT_USAGE;
+	}
+
+	EResizeFilter eFilter = Resize_SharpenLow;
+	if (bResize && nArgs > 7 && !ParseResizeFilter(pArgs[7], eFilter)) {
+		PrintUsage();
+		return EXIT_USAGE;
+	}
+	CSize newSize(0, 0);
+	if (nArgs > 6) {
+		newSize = CSize(_ttoi(pArgs[5]), _ttoi(pArgs[6]));
+	}
+
+	CImagePipeline pipeline;
+	CJPEGImage* pImage = DecodeAndReport(pipeline, sInputFile);
+	if (pImage == NULL) {
+		return EXIT_DECODE_FAILED;
+	}
+
+	int nExitCode = EXIT_OK;
+	if (!bDecode) {
+		LPCTSTR sOutputFile = pArgs[4];
+		if ((newSize.cx > 0 || newSize.cy > 0) && !pipeline.Resize(pImage, newSize, eFilter)) {
+			_ftprintf(stderr, _T("%s: resizing failed\n"), sInputFile);
+			nExitCode = EXIT_PROCESSING_FAILED;
+		} else {
+			if (newSize.cx > 0 || newSize.cy > 0) {
+				_tprintf(_T("%s: resized to %d x %d in %.1f ms\n"), sInputFile, pImage->OrigWidth(), pImage->OrigHeight(), pipeline.LastResizeTime());
+			}
+			// 'resize' only resizes, 'process' applies the processing configured in the INI file
+			CImageProcessingParams params = bProcess ? CImagePipeline::DefaultProcessingParams() :
+				CImageProcessingParams(0.0, 1.0, 1.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0);
+			EProcessingFlags eFlags = bProcess ? CImagePipeline::DefaultProcessingFlags() : PFLAG_HighQualityResampling;
+			if (!pipeline.Save(sOutputFile, pImage, params, eFlags)) {
+				_ftprintf(stderr, _T("%s: saving failed\n"), sOutputFile);
+				nExitCode = EXIT_PROCESSING_FAILED;
+			} else {
+				_tprintf(_T("%s: processed and saved in %.1f ms\n"), sOutputFile, pipeline.LastSaveTime());
+			}
+		}
+	}
+
+	delete pImage;
+	return nExitCode;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Public interface
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CCommandLineTool::IsCommandLineToolRequested(LPCTSTR sCommandLine) {
+	return _tcsnicmp(sCommandLine, _T("/cli"), 4) == 0 && (sCommandLine[4] == 0 || sCommandLine[4] == _T(' '));
+}
+
+int CCommandLineTool::Run() {
+	AttachToParentConsole();
+
+	int nArgs = 0;
+	LPWSTR* pArgs = ::CommandLineToArgvW(::GetCommandLineW(), &nArgs);
+	if (pArgs == NULL) {
+		return EXIT_USAGE;
+	}
+
+	// GDI+ is used for some of the decoders and to save some formats
+	Gdiplus::GdiplusStartupInput gdiplusStartupInput;
+	ULONG_PTR gdiplusToken;
+	Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+
+	LPCTSTR sTraceFile = ExtractTraceOption(nArgs, pArgs);
+	if (sTraceFile != NULL) {
+		CTracer::Enable();
+	}
+
+	CProcessingThreadPool::This().CreateThreadPoolThreads();
+
+	int nExitCode;
+	try {
+		nExitCode = RunCommand(nArgs, pArgs);
+	} catch (...) {
+		_ftprintf(stderr, _T("Unhandled exception\n"));
+		nExitCode = EXIT_PROCESSING_FAILED;
+	}
+
+	if (sTraceFile != NULL && !CTracer::WriteChromeTrace(sTraceFile)) {
+		_ftprintf(stderr, _T("%s: cannot write trace file\n"), sTraceFile);
+	}
+
+	CProcessingThreadPool::This().StopAllThreads();
+	Gdiplus::GdiplusShutdown(gdiplusToken);
+	::LocalFree(pArgs);
+
+	return nExitCode;
+}
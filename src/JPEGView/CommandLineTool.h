@@ -0,0 +1,24 @@
+#pragma once
+
+// Command line interface to the headless image pipeline (see CImagePipeline). Invoked with
+//   JPEGView.exe /cli decode <file>
+//   JPEGView.exe /cli resize <file> <output file> <width> <height> [point|noaliasing|sharpenlow|sharpenmedium]
+//   JPEGView.exe /cli process <file> <output file> [<width> <height>]
+//   JPEGView.exe /cli benchmark [-sizes <MP,MP,...>] [-repeat <n>] [-json <output file>]
+//   JPEGView.exe /cli conformance [-tolerance <n>] [<image file> ...]
+//   JPEGView.exe /cli prefetch-replay <trace file> [-readahead <n>]
+// All commands accept '-trace <output file>' to write the timing of the load and render stages as Chrome trace JSON (see CTracer).
+// Width or height can be zero to keep the aspect ratio. 'process' applies the image processing as configured in the INI file.
+// No window is created, results and timings are written to the console of the calling process.
+class CCommandLineTool
+{
+public:
+	// Returns if the command line requests the command line tool instead of the viewer
+	static bool IsCommandLineToolRequested(LPCTSTR sCommandLine);
+
+	// Runs the command given on the command line, returns the process exit code (0 on success)
+	static int Run();
+
+private:
+	CCommandLineTool(void);
+};
@@ -0,0 +1,394 @@
+#include "StdAfx.h"
+#include "ConformanceCheck.h"
+#include "BasicProcessing.h"
+#include "ImagePipeline.h"
+#include "JPEGImage.h"
+#include "Helpers.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#define ALPHA_OPAQUE 0xFF000000
+
+// Zoom factors checked, including extreme ones
+static const double s_ZoomDown[] = { 0.01, 0.1, 0.33, 0.5, 0.77, 0.99, 1.0 };
+static const double s_ZoomUp[] = { 1.01, 1.5, 2.0, 3.3, 8.0 };
+
+// Sizes of the synthetic images: tiny, odd and not multiple of the SIMD width
+static const CSize s_SyntheticSizes[] = { CSize(1, 1), CSize(2, 3), CSize(7, 5), CSize(17, 13), CSize(33, 1), CSize(1, 33),
+	CSize(333, 251), CSize(1001, 667), CSize(2048, 1536) };
+
+// The resampled images are clipped to this size to keep the check fast for large zoom factors
+static const CSize s_MaxClippingSize(1024, 1024);
+
+static const EFilterType s_DownsamplingFilters[] = { Filter_Downsampling_Best_Quality, Filter_Downsampling_No_Aliasing, Filter_Downsampling_Narrow };
+static const LPCTSTR s_DownsamplingFilterNames[] = { _T("BestQuality"), _T("NoAliasing"), _T("Narrow") };
+
+// Color correction kernels checked, these must be identical to the reference
+enum EColorCorrection { CC_LUT, CC_SaturationLUT, CC_LDC, CC_LDCSaturation, CC_NumKernels };
+static const LPCTSTR s_ColorCorrectionNames[] = { _T("LUT"), _T("Saturation+LUT"), _T("LDC"), _T("LDC+Saturation") };
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// Deviation of one variant to the reference
+struct CDeviation {
+	int Max[3]; // B, G, R
+	double Mean[3];
+};
+
+// Synthetic 32 bpp test image with gradients, hard edges and noise. The caller gets ownership.
+static uint32* CreateSyntheticImage(CSize size) {
+	uint32* pPixels = new(std::nothrow) uint32[size.cx * size.cy];
+	if (pPixels == NULL) {
+		return NULL;
+	}
+	uint32 nRandom = 4711;
+	uint32* pPixel = pPixels;
+	for (int j = 0; j < size.cy; j++) {
+		for (int i = 0; i < size.cx; i++) {
+			nRandom = nRandom * 1103515245 + 12345;
+			uint32 nBlue = (uint32)(i * 255 / size.cx);
+			uint32 nGreen = ((i / 8 + j / 8) & 1) ? 255 : 0; // checkerboard, hard edges produce filter overshoots
+			uint32 nRed = (nRandom >> 16) & 0xFF;
+			*pPixel++ = nBlue + (nGreen << 8) + (nRed << 16) + ALPHA_OPAQUE;
+		}
+	}
+	return pPixels;
+}
+
+// Converts the synthetic image to 24 bpp with the DIB row padding, the padding bytes are zero. The caller gets ownership.
+static uint8* CreateSynthetic24bppImage(CSize size, const uint32* pPixels) {
+	int nSize = Helpers::DoPadding(size.cx * 3, 4) * size.cy;
+	uint8* p24bppPixels = new(std::nothrow) uint8[nSize];
+	if (p24bppPixels == NULL) {
+		return NULL;
+	}
+	memset(p24bppPixels, 0, nSize);
+	CBasicProcessing::Convert32bppTo24bppDIB(size.cx, size.cy, p24bppPixels, pPixels, false);
+	return p24bppPixels;
+}
+
+static std::vector<CBasicProcessing::SIMDArchitecture> GetSupportedSIMD() {
+	std::vector<CBasicProcessing::SIMDArchitecture> simd;
+	Helpers::CPUType cpu = Helpers::ProbeCPU();
+#ifndef _WIN64
+	if (cpu >= Helpers::CPU_MMX) simd.push_back(CBasicProcessing::MMX);
+#endif
+	if (cpu >= Helpers::CPU_SSE) simd.push_back(CBasicProcessing::SSE);
+#ifdef _WIN64
+	if (cpu >= Helpers::CPU_AVX2) simd.push_back(CBasicProcessing::AVX2);
+#endif
+	return simd;
+}
+
+static LPCTSTR SIMDName(CBasicProcessing::SIMDArchitecture simd) {
+	return (simd == CBasicProcessing::MMX) ? _T("MMX") : (simd == CBasicProcessing::SSE) ? _T("SSE") : _T("AVX2");
+}
+
+// Both images have nChannels (3 or 4) and padded rows
+static CDeviation CalculateDeviation(const void* pReference, const void* pPixels, CSize size, int nChannels) {
+	CDeviation deviation = { { 0, 0, 0 }, { 0.0, 0.0, 0.0 } };
+	int nPaddedWidth = Helpers::DoPadding(size.cx * nChannels, 4);
+	double dSum[3] = { 0.0, 0.0, 0.0 };
+	int nNumPixels = size.cx * size.cy;
+	for (int j = 0; j < size.cy; j++) {
+		const uint8* pRef = (const uint8*)pReference + j * nPaddedWidth;
+		const uint8* pPix = (const uint8*)pPixels + j * nPaddedWidth;
+		for (int i = 0; i < size.cx; i++) {
+			for (int c = 0; c < 3; c++) {
+				int nDiff = abs((int)pRef[c] - (int)pPix[c]);
+				deviation.Max[c] = max(deviation.Max[c], nDiff);
+				dSum[c] += nDiff;
+			}
+			pRef += nChannels;
+			pPix += nChannels;
+		}
+	}
+	for (int c = 0; c < 3; c++) {
+		deviation.Mean[c] = (nNumPixels > 0) ? dSum[c] / nNumPixels : 0.0;
+	}
+	return deviation;
+}
+
+// Compares all SIMD variants to the scalar reference for one image, zoom factor and filter.
+// Returns false if a variant deviates more than the tolerance or fails while the reference does not.
+static bool CheckVariants(LPCTSTR sImageName, CSize sourceSize, const void* pPixels, int nChannels, double dZoom,
+						  int nFilter, int nTolerance, const std::vector<CBasicProcessing::SIMDArchitecture>& simdList) {
+	bool bUpSample = dZoom > 1.0;
+	CSize fullTargetSize(max(1, (int)(sourceSize.cx * dZoom + 0.5)), max(1, (int)(sourceSize.cy * dZoom + 0.5)));
+	if (bUpSample && (fullTargetSize.cx < sourceSize.cx || fullTargetSize.cy < sourceSize.cy)) {
+		return true; // rounding of tiny images, not an upsampling
+	}
+	if (!bUpSample && (fullTargetSize.cx > sourceSize.cx || fullTargetSize.cy > sourceSize.cy)) {
+		return true;
+	}
+	CSize clippedSize(min(fullTargetSize.cx, s_MaxClippingSize.cx), min(fullTargetSize.cy, s_MaxClippingSize.cy));
+	CPoint offset((fullTargetSize.cx - clippedSize.cx) / 2, (fullTargetSize.cy - clippedSize.cy) / 2);
+	EFilterType eFilter = bUpSample ? Filter_Upsampling_Bicubic : s_DownsamplingFilters[nFilter];
+	LPCTSTR sFilterName = bUpSample ? _T("Bicubic") : s_DownsamplingFilterNames[nFilter];
+	const double dSharpen = 0.3;
+
+	void* pReference = bUpSample ?
+		CBasicProcessing::SampleUp_HQ(fullTargetSize, offset, clippedSize, sourceSize, pPixels, nChannels) :
+		CBasicProcessing::SampleDown_HQ(fullTargetSize, offset, clippedSize, sourceSize, pPixels, nChannels, dSharpen, eFilter);
+
+	bool bSuccess = true;
+	for (size_t i = 0; i < simdList.size(); i++) {
+		void* pResult = bUpSample ?
+			CBasicProcessing::SampleUp_HQ_SIMD(fullTargetSize, offset, clippedSize, sourceSize, pPixels, nChannels, simdList[i]) :
+			CBasicProcessing::SampleDown_HQ_SIMD(fullTargetSize, offset, clippedSize, sourceSize, pPixels, nChannels, dSharpen, eFilter, simdList[i]);
+		if (pReference == NULL || pResult == NULL) {
+			if (pReference != pResult) {
+				_tprintf(_T("FAIL %s %dx%d zoom %.2f %s %s: %s returned no image\n"), sImageName, sourceSize.cx, sourceSize.cy,
+					dZoom, sFilterName, SIMDName(simdList[i]), (pResult == NULL) ? _T("SIMD variant") : _T("reference"));
+				bSuccess = false;
+			}
+		} else {
+			CDeviation deviation = CalculateDeviation(pReference, pResult, clippedSize, 4);
+			bool bPassed = deviation.Max[0] <= nTolerance && deviation.Max[1] <= nTolerance && deviation.Max[2] <= nTolerance;
+			_tprintf(_T("%s %s %dx%d zoom %.2f %s %s: max %d/%d/%d mean %.3f/%.3f/%.3f (BGR)\n"), bPassed ? _T("ok  ") : _T("FAIL"),
+				sImageName, sourceSize.cx, sourceSize.cy, dZoom, sFilterName, SIMDName(simdList[i]),
+				deviation.Max[0], deviation.Max[1], deviation.Max[2], deviation.Mean[0], deviation.Mean[1], deviation.Mean[2]);
+			bSuccess = bSuccess && bPassed;
+		}
+		delete[] pResult;
+	}
+	delete[] pReference;
+	return bSuccess;
+}
+
+// Applies one of the color correction kernels, the scalar reference if bReference is true
+static void* ApplyColorCorrection(EColorCorrection eKernel, CSize size, const uint32* pPixels, const int32* pSatLUTs, const uint8* pLUT,
+								  CSize ldcMapSize, const uint8* pLDCMap, bool bReference, CBasicProcessing::SIMDArchitecture simd) {
+	const int32* pLDCSatLUTs = (eKernel == CC_LDCSaturation) ? pSatLUTs : NULL;
+	switch (eKernel) {
+		case CC_LUT:
+			return bReference ? CBasicProcessing::Apply3ChannelLUT32bpp(size.cx, size.cy, pPixels, pLUT) :
+				CBasicProcessing::Apply3ChannelLUT32bpp_SIMD(size.cx, size.cy, pPixels, pLUT, simd);
+		case CC_SaturationLUT:
+			return bReference ? CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(size.cx, size.cy, pPixels, pSatLUTs, pLUT) :
+				CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp_SIMD(size.cx, size.cy, pPixels, pSatLUTs, pLUT, simd);
+		default:
+			return bReference ?
+				CBasicProcessing::ApplyLDC32bpp(size, CPoint(0, 0), size, ldcMapSize, pPixels, pLDCSatLUTs, pLUT, pLDCMap, 0.05f, 0.95f, 0.5f) :
+				CBasicProcessing::ApplyLDC32bpp_SIMD(size, CPoint(0, 0), size, ldcMapSize, pPixels, pLDCSatLUTs, pLUT, pLDCMap, 0.05f, 0.95f, 0.5f, simd);
+	}
+}
+
+// Compares the SIMD variants of the LUT, saturation and LDC kernels to the scalar reference.
+// Integer arithmetic only, thus the variants must be identical to the reference.
+static bool CheckColorCorrection(CSize size, const uint32* pPixels, const std::vector<CBasicProcessing::SIMDArchitecture>& simdList) {
+	uint8 LUT[768];
+	for (int c = 0; c < 3; c++) {
+		for (int i = 0; i < 256; i++) {
+			LUT[c * 256 + i] = (uint8)(255 * pow(i / 255.0, 0.7 + 0.2 * c) + 0.5);
+		}
+	}
+	// strong saturation to get out of range values that need clamping
+	int32* pSatLUTs = CBasicProcessing::CreateColorSaturationLUTs(1.8);
+	CSize ldcMapSize(max(2, size.cx / 7), max(2, size.cy / 7));
+	uint8* pLDCMap = new(std::nothrow) uint8[ldcMapSize.cx * ldcMapSize.cy];
+	if (pSatLUTs == NULL || pLDCMap == NULL) {
+		delete[] pSatLUTs;
+		delete[] pLDCMap;
+		_tprintf(_T("FAIL synthetic %dx%d color correction: out of memory\n"), size.cx, size.cy);
+		return false;
+	}
+	uint32 nRandom = 815;
+	for (int i = 0; i < ldcMapSize.cx * ldcMapSize.cy; i++) {
+		nRandom = nRandom * 1103515245 + 12345;
+		pLDCMap[i] = (uint8)(nRandom >> 24);
+	}
+
+	bool bSuccess = true;
+	for (int nKernel = 0; nKernel < CC_NumKernels; nKernel++) {
+		EColorCorrection eKernel = (EColorCorrection)nKernel;
+		void* pReference = ApplyColorCorrection(eKernel, size, pPixels, pSatLUTs, LUT, ldcMapSize, pLDCMap, true, CBasicProcessing::SSE);
+		for (size_t i = 0; i < simdList.size(); i++) {
+			void* pResult = ApplyColorCorrection(eKernel, size, pPixels, pSatLUTs, LUT, ldcMapSize, pLDCMap, false, simdList[i]);
+			if (pReference == NULL || pResult == NULL) {
+				if (pReference != pResult) {
+					_tprintf(_T("FAIL synthetic %dx%d %s %s: %s returned no image\n"), size.cx, size.cy, s_ColorCorrectionNames[eKernel],
+						SIMDName(simdList[i]), (pResult == NULL) ? _T("SIMD variant") : _T("reference"));
+					bSuccess = false;
+				}
+			} else {
+				CDeviation deviation = CalculateDeviation(pReference, pResult, size, 4);
+				bool bPassed = deviation.Max[0] == 0 && deviation.Max[1] == 0 && deviation.Max[2] == 0;
+				_tprintf(_T("%s synthetic %dx%d %s %s: max %d/%d/%d mean %.3f/%.3f/%.3f (BGR)\n"), bPassed ? _T("ok  ") : _T("FAIL"),
+					size.cx, size.cy, s_ColorCorrectionNames[eKernel], SIMDName(simdList[i]),
+					deviation.Max[0], deviation.Max[1], deviation.Max[2], deviation.Mean[0], deviation.Mean[1], deviation.Mean[2]);
+				bSuccess = bSuccess && bPassed;
+			}
+			delete[] pResult;
+		}
+		delete[] pReference;
+	}
+	delete[] pSatLUTs;
+	delete[] pLDCMap;
+	fflush(stdout);
+	return bSuccess;
+}
+
+// Compares the SIMD variants of the high quality rotation and trapezoid correction to the scalar reference.
+// Both use fixed point bicubic interpolation, thus the variants must be identical to the reference.
+// The source has 3 or 4 channels, the result is always 32 bpp.
+static bool CheckRotationAndTrapezoid(CSize size, const void* pPixels, int nChannels, const std::vector<CBasicProcessing::SIMDArchitecture>& simdList) {
+	const double dRotation = 17 * 3.141592653 / 180;
+	CTrapezoid trapezoid(0, size.cx - 1, 0, size.cx / 5, size.cx - 1 - size.cx / 7, size.cy - 1);
+	bool bSuccess = true;
+	for (int nKernel = 0; nKernel < 2; nKernel++) {
+		LPCTSTR sKernelName = (nKernel == 0) ? _T("RotateHQ") : _T("TrapezoidHQ");
+		int nBPP = nChannels * 8;
+		void* pReference = (nKernel == 0) ?
+			CBasicProcessing::RotateHQ(CPoint(0, 0), size, dRotation, size, pPixels, nChannels, RGB(10, 20, 30)) :
+			CBasicProcessing::TrapezoidHQ(CPoint(0, 0), size, trapezoid, size, pPixels, nChannels, RGB(10, 20, 30));
+		for (size_t i = 0; i < simdList.size(); i++) {
+			void* pResult = (nKernel == 0) ?
+				CBasicProcessing::RotateHQ_SIMD(CPoint(0, 0), size, dRotation, size, pPixels, nChannels, RGB(10, 20, 30), simdList[i]) :
+				CBasicProcessing::TrapezoidHQ_SIMD(CPoint(0, 0), size, trapezoid, size, pPixels, nChannels, RGB(10, 20, 30), simdList[i]);
+			if (pReference == NULL || pResult == NULL) {
+				if (pReference != pResult) {
+					_tprintf(_T("FAIL synthetic %dx%d %s %dbpp %s: %s returned no image\n"), size.cx, size.cy, sKernelName, nBPP,
+						SIMDName(simdList[i]), (pResult == NULL) ? _T("SIMD variant") : _T("reference"));
+					bSuccess = false;
+				}
+			} else {
+				CDeviation deviation = CalculateDeviation(pReference, pResult, size, 4);
+				bool bPassed = deviation.Max[0] == 0 && deviation.Max[1] == 0 && deviation.Max[2] == 0;
+				_tprintf(_T("%s synthetic %dx%d %s %dbpp %s: max %d/%d/%d mean %.3f/%.3f/%.3f (BGR)\n"), bPassed ? _T("ok  ") : _T("FAIL"),
+					size.cx, size.cy, sKernelName, nBPP, SIMDName(simdList[i]),
+					deviation.Max[0], deviation.Max[1], deviation.Max[2], deviation.Mean[0], deviation.Mean[1], deviation.Mean[2]);
+				bSuccess = bSuccess && bPassed;
+			}
+			delete[] pResult;
+		}
+		delete[] pReference;
+	}
+	fflush(stdout);
+	return bSuccess;
+}
+
+// Compares the SIMD variants of the Gauss filter and the unsharp mask to the scalar reference.
+// Integer arithmetic only, thus the variants must be identical to the reference.
+// 3 channel images are sharpened in place as done by CJPEGImage, 4 channel images into a separate target.
+static bool CheckUnsharpMask(CSize size, const void* pPixels, int nChannels, const std::vector<CBasicProcessing::SIMDArchitecture>& simdList) {
+	static const double s_Radii[] = { 0.5, 1.5, 5.0 };
+	bool bInPlace = nChannels == 3;
+	int nBPP = nChannels * 8;
+	int nSize = Helpers::DoPadding(size.cx * nChannels, 4) * size.cy;
+	int16* pGray = CBasicProcessing::Create1Channel16bppGrayscaleImage(size.cx, size.cy, pPixels, nChannels);
+	uint8* pReference = new(std::nothrow) uint8[nSize];
+	uint8* pResult = new(std::nothrow) uint8[nSize];
+	bool bAllocated = pGray != NULL && pReference != NULL && pResult != NULL;
+	if (!bAllocated) {
+		_tprintf(_T("FAIL synthetic %dx%d unsharp mask %dbpp: out of memory\n"), size.cx, size.cy, nBPP);
+	}
+	bool bSuccess = bAllocated;
+	for (int nRadius = 0; bAllocated && nRadius < sizeof(s_Radii) / sizeof(double); nRadius++) {
+		int16* pSmoothedReference = CBasicProcessing::GaussFilter16bpp1Channel(size, CPoint(0, 0), size, s_Radii[nRadius], pGray);
+		// the buffers are reset for each run, the padding bytes must stay untouched
+		memcpy(pReference, pPixels, nSize);
+		bool bReference = pSmoothedReference != NULL && 
+			CBasicProcessing::UnsharpMask(size, CPoint(0, 0), size, 2.0, 1.0, pGray, pSmoothedReference,
+				bInPlace ? pReference : pPixels, pReference, nChannels) != NULL;
+		for (size_t i = 0; i < simdList.size(); i++) {
+			int16* pSmoothed = CBasicProcessing::GaussFilter16bpp1Channel_SIMD(size, CPoint(0, 0), size, s_Radii[nRadius], pGray, simdList[i]);
+			memcpy(pResult, pPixels, nSize);
+			bool bResult = pSmoothed != NULL && pSmoothedReference != NULL &&
+				CBasicProcessing::UnsharpMask_SIMD(size, CPoint(0, 0), size, 2.0, 1.0, pGray, pSmoothedReference,
+					bInPlace ? pResult : pPixels, pResult, nChannels, simdList[i]) != NULL;
+			if (!bReference || !bResult) {
+				_tprintf(_T("FAIL synthetic %dx%d unsharp mask %dbpp radius %.1f %s: no image\n"), size.cx, size.cy, nBPP, s_Radii[nRadius], SIMDName(simdList[i]));
+				bSuccess = false;
+			} else {
+				bool bGaussPassed = memcmp(pSmoothedReference, pSmoothed, size.cx * size.cy * sizeof(int16)) == 0;
+				CDeviation deviation = CalculateDeviation(pReference, pResult, size, nChannels);
+				bool bPassed = bGaussPassed && deviation.Max[0] == 0 && deviation.Max[1] == 0 && deviation.Max[2] == 0 &&
+					(!bInPlace || memcmp(pReference, pResult, nSize) == 0);
+				_tprintf(_T("%s synthetic %dx%d unsharp mask %dbpp radius %.1f %s: Gauss %s, max %d/%d/%d (BGR)\n"), bPassed ? _T("ok  ") : _T("FAIL"),
+					size.cx, size.cy, nBPP, s_Radii[nRadius], SIMDName(simdList[i]), bGaussPassed ? _T("identical") : _T("differs"),
+					deviation.Max[0], deviation.Max[1], deviation.Max[2]);
+				bSuccess = bSuccess && bPassed;
+			}
+			delete[] pSmoothed;
+		}
+		delete[] pSmoothedReference;
+	}
+	delete[] pGray;
+	delete[] pReference;
+	delete[] pResult;
+	fflush(stdout);
+	return bSuccess;
+}
+
+static bool CheckImage(LPCTSTR sImageName, CSize size, const void* pPixels, int nChannels, int nTolerance,
+					   const std::vector<CBasicProcessing::SIMDArchitecture>& simdList) {
+	bool bSuccess = true;
+	for (int nZoom = 0; nZoom < sizeof(s_ZoomDown) / sizeof(double); nZoom++) {
+		for (int nFilter = 0; nFilter < sizeof(s_DownsamplingFilters) / sizeof(EFilterType); nFilter++) {
+			bSuccess &= CheckVariants(sImageName, size, pPixels, nChannels, s_ZoomDown[nZoom], nFilter, nTolerance, simdList);
+		}
+	}
+	for (int nZoom = 0; nZoom < sizeof(s_ZoomUp) / sizeof(double); nZoom++) {
+		bSuccess &= CheckVariants(sImageName, size, pPixels, nChannels, s_ZoomUp[nZoom], 0, nTolerance, simdList);
+	}
+	fflush(stdout);
+	return bSuccess;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Public interface
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CConformanceCheck::Run(LPCTSTR* sImageFiles, int nNumImageFiles, int nTolerance) {
+	std::vector<CBasicProcessing::SIMDArchitecture> simdList = GetSupportedSIMD();
+	if (simdList.empty()) {
+		_tprintf(_T("No SIMD implementation supported on this CPU, nothing to check\n"));
+		return true;
+	}
+
+	bool bSuccess = true;
+	for (int i = 0; i < sizeof(s_SyntheticSizes) / sizeof(CSize); i++) {
+		uint32* pPixels = CreateSyntheticImage(s_SyntheticSizes[i]);
+		if (pPixels == NULL) {
+			_tprintf(_T("FAIL synthetic %dx%d: out of memory\n"), s_SyntheticSizes[i].cx, s_SyntheticSizes[i].cy);
+			bSuccess = false;
+			continue;
+		}
+		bSuccess &= CheckImage(_T("synthetic"), s_SyntheticSizes[i], pPixels, 4, nTolerance, simdList);
+		bSuccess &= CheckColorCorrection(s_SyntheticSizes[i], pPixels, simdList);
+		bSuccess &= CheckRotationAndTrapezoid(s_SyntheticSizes[i], pPixels, 4, simdList);
+		bSuccess &= CheckUnsharpMask(s_SyntheticSizes[i], pPixels, 4, simdList);
+
+		// 24 bpp with padded rows, the odd widths cover the row tail of the 3 channel kernels
+		uint8* p24bppPixels = CreateSynthetic24bppImage(s_SyntheticSizes[i], pPixels);
+		if (p24bppPixels == NULL) {
+			_tprintf(_T("FAIL synthetic %dx%d 24bpp: out of memory\n"), s_SyntheticSizes[i].cx, s_SyntheticSizes[i].cy);
+			bSuccess = false;
+		} else {
+			bSuccess &= CheckRotationAndTrapezoid(s_SyntheticSizes[i], p24bppPixels, 3, simdList);
+			bSuccess &= CheckUnsharpMask(s_SyntheticSizes[i], p24bppPixels, 3, simdList);
+		}
+		delete[] p24bppPixels;
+		delete[] pPixels;
+	}
+
+	CImagePipeline pipeline;
+	for (int i = 0; i < nNumImageFiles; i++) {
+		bool bOutOfMemory;
+		CJPEGImage* pImage = pipeline.Decode(sImageFiles[i], bOutOfMemory);
+		if (pImage == NULL) {
+			_tprintf(_T("FAIL %s: cannot decode image\n"), sImageFiles[i]);
+			bSuccess = false;
+			continue;
+		}
+		bSuccess &= CheckImage(sImageFiles[i], pImage->OrigSize(), pImage->OriginalPixels(), pImage->OriginalChannels(), nTolerance, simdList);
+		delete pImage;
+	}
+
+	_tprintf(bSuccess ? _T("All SIMD variants conform to the reference implementation\n") : _T("Conformance check failed\n"));
+	return bSuccess;
+}
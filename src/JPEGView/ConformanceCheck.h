@@ -0,0 +1,19 @@
+#pragma once
+
+// Conformance check of the SIMD resampling implementations against the scalar reference implementation.
+// SampleDown_HQ_SIMD and SampleUp_HQ_SIMD are run with all SIMD architectures supported by the CPU and compared
+// to SampleDown_HQ and SampleUp_HQ on synthetic images (odd and tiny sizes), optionally on real images,
+// with extreme zoom factors and all filter types. The maximal and mean deviation per channel is reported.
+// The SIMD variants of the LUT, saturation and LDC kernels are checked on the synthetic images, these must be identical.
+// Invoked by the command line tool: JPEGView.exe /cli conformance [-tolerance n] [<image file> ...]
+class CConformanceCheck
+{
+public:
+	// sImageFiles: real images to check in addition to the synthetic images, nNumImageFiles entries
+	// nTolerance: maximal allowed deviation per channel (in 8 bit color values)
+	// Returns true if all variants are within the tolerance
+	static bool Run(LPCTSTR* sImageFiles, int nNumImageFiles, int nTolerance);
+
+private:
+	CConformanceCheck(void);
+};
@@ -182,6 +182,7 @@ void CCropCtl::StartCropping(int nX, int nY) {
 				AbortCropping();
 			}
 		} else {
+			m_pMainDlg->EnsureFullResolution(); // the crop rectangle refers to the original pixels
 			m_bCropping = true;
 			float fX = (float)nX, fY = (float)nY;
 			m_pMainDlg->ScreenToImage(fX, fY);
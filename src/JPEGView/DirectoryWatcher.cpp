@@ -3,6 +3,9 @@
 #include "MessageDef.h"
 #include <process.h>
 
+// Maximal number of changes kept until retrieved by GetFileListChanges()
+static const int MAX_QUEUED_CHANGES = 4096;
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Static helpers
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -19,6 +22,24 @@ static BOOL GetLastModificationTime(LPCTSTR fileName, FILETIME & lastModificatio
 	return FALSE;
 }
 
+// Starts the asynchronous read of the next file name changes in the directory, the event is signaled when completed
+static bool StartReadingChanges(HANDLE hDirectory, void* pBuffer, DWORD nBufferSize, HANDLE hEvent, OVERLAPPED* pOverlapped)
+{
+	memset(pOverlapped, 0, sizeof(OVERLAPPED));
+	pOverlapped->hEvent = hEvent;
+	::ResetEvent(hEvent);
+	return ::ReadDirectoryChangesW(hDirectory, pBuffer, nBufferSize, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME, NULL, pOverlapped, NULL) != FALSE;
+}
+
+static void AddChange(std::vector<CDirectoryChange>& changes, CDirectoryChange::EType eType, const CString& sFileName, LPCTSTR sNewFileName = _T(""))
+{
+	CDirectoryChange change;
+	change.Type = eType;
+	change.FileName = sFileName;
+	change.NewFileName = sNewFileName;
+	changes.push_back(change);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Public
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -30,7 +51,11 @@ CDirectoryWatcher::CDirectoryWatcher(HWND hTargetWindow)
 	::InitializeCriticalSection(&m_lock);
 	m_terminateEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
 	m_newDirectoryEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
+	m_changeEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
 	m_bModificationTimeValid = FALSE;
+	m_bChangesLost = false;
+	m_bWatching = false;
+	m_bTerminate = false;
 
 	m_hThread = (HANDLE)_beginthread(ThreadFunc, 0, this);
 }
@@ -40,6 +65,7 @@ CDirectoryWatcher::~CDirectoryWatcher(void) {
 	::DeleteCriticalSection(&m_lock);
 	::CloseHandle(m_terminateEvent);
 	::CloseHandle(m_newDirectoryEvent);
+	::CloseHandle(m_changeEvent);
 }
 
 void CDirectoryWatcher::Terminate() { 
@@ -81,11 +107,33 @@ void CDirectoryWatcher::SetCurrentDirectory(LPCTSTR directoryName)
 
 	::EnterCriticalSection(&m_lock);
 
-	m_sCurrentDirectory = fullName;
+	// the changes of the same directory are kept, the file list may be older than the new file list
+	bool bNewDirectory = m_sCurrentDirectory.CompareNoCase(fullName) != 0;
+	if (bNewDirectory) {
+		m_sCurrentDirectory = fullName;
+		m_changes.clear();
+		m_bChangesLost = false;
+	}
+	// retry when the directory could not be watched before, e.g. it was not accessible temporarily
+	bool bSetupDirectory = bNewDirectory || !m_bWatching;
 
 	::LeaveCriticalSection(&m_lock);
 
-	::SetEvent(m_newDirectoryEvent);
+	if (bSetupDirectory) {
+		::SetEvent(m_newDirectoryEvent);
+	}
+}
+
+bool CDirectoryWatcher::GetFileListChanges(CString& sDirectory, std::vector<CDirectoryChange>& changes)
+{
+	::EnterCriticalSection(&m_lock);
+	sDirectory = m_sCurrentDirectory;
+	changes.clear();
+	changes.swap(m_changes);
+	bool bChangesKnown = !m_bChangesLost;
+	m_bChangesLost = false;
+	::LeaveCriticalSection(&m_lock);
+	return bChangesKnown;
 }
 
 
@@ -99,24 +147,40 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 	bool bTerminate = false;
 	bool bSetupNewDirectory = true;
 	HANDLE waitHandles[4]{ 0 };
+	int numHandles = 2;
+	HANDLE hDirectory = INVALID_HANDLE_VALUE; // directory handle for ReadDirectoryChangesW()
+	bool bReadPending = false;
+	OVERLAPPED overlapped;
+	CString sWatchedDirectory;
 	do {
 		waitHandles[0] = thisPtr->m_terminateEvent;
 		waitHandles[1] = thisPtr->m_newDirectoryEvent;
-		int numHandles = bSetupNewDirectory ? 2 : 4;
 
 		::EnterCriticalSection(&thisPtr->m_lock);
-		if (bSetupNewDirectory && !thisPtr->m_sCurrentDirectory.IsEmpty()) {
-			waitHandles[2] = ::FindFirstChangeNotification(thisPtr->m_sCurrentDirectory, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME);
-			if (waitHandles[2] != NULL && waitHandles[2] != INVALID_HANDLE_VALUE)
+		if (bSetupNewDirectory) {
+			numHandles = 2;
+			sWatchedDirectory = thisPtr->m_sCurrentDirectory;
+		}
+		if (bSetupNewDirectory && !sWatchedDirectory.IsEmpty()) {
+			hDirectory = ::CreateFile(sWatchedDirectory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+			bReadPending = hDirectory != INVALID_HANDLE_VALUE && StartReadingChanges(hDirectory, thisPtr->m_changeBuffer,
+				sizeof(thisPtr->m_changeBuffer), thisPtr->m_changeEvent, &overlapped);
+			if (bReadPending)
 			{
+				waitHandles[2] = thisPtr->m_changeEvent;
 				numHandles++;
-				waitHandles[3] = ::FindFirstChangeNotification(thisPtr->m_sCurrentDirectory, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
+				waitHandles[3] = ::FindFirstChangeNotification(sWatchedDirectory, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
 				if (waitHandles[3] != NULL && waitHandles[3] != INVALID_HANDLE_VALUE) {
 					numHandles++;
 				}
 			}
 		}
+		if (bSetupNewDirectory) {
+			thisPtr->m_bWatching = bReadPending;
+		}
 		::LeaveCriticalSection(&thisPtr->m_lock);
+		bSetupNewDirectory = false;
 
 		// wait for events on file system or wakeup event
 		DWORD waitStatus = ::WaitForMultipleObjects(numHandles, waitHandles, FALSE, INFINITE);
@@ -132,11 +196,20 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 				bSetupNewDirectory = true;
 				break;
 			case WAIT_OBJECT_0 + 2:
-				// file added or deleted in directory, send message to registered window
-				bSetupNewDirectory = ::FindNextChangeNotification(waitHandles[2]) == FALSE;
+				{
+				// file added, deleted or renamed in directory, queue the changes and send message to registered window
+				DWORD nBytes = 0;
+				bReadPending = false;
+				if (!::GetOverlappedResult(hDirectory, &overlapped, &nBytes, FALSE)) {
+					nBytes = 0; // e.g. ERROR_NOTIFY_ENUM_DIR, the changes are not known
+				}
+				thisPtr->QueueChanges(sWatchedDirectory, nBytes);
+				bReadPending = StartReadingChanges(hDirectory, thisPtr->m_changeBuffer, sizeof(thisPtr->m_changeBuffer), thisPtr->m_changeEvent, &overlapped);
+				bSetupNewDirectory = !bReadPending;
 				::PostMessage(thisPtr->m_hTargetWindow, WM_ACTIVE_DIRECTORY_FILELIST_CHANGED, 0, 0);
-				::WaitForSingleObject(thisPtr->m_terminateEvent, 500); // don't flood the window with change notifications
+				::WaitForSingleObject(thisPtr->m_terminateEvent, 500); // don't flood the window with change notifications, the changes are buffered meanwhile
 				break;
+				}
 			case WAIT_OBJECT_0 + 3:
 				{
 				// file written in directory, check if the displayed file has changed and send message to registered window if yes
@@ -175,10 +248,18 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 		}
 
 		if (bTerminate || bSetupNewDirectory) {
-			if (waitHandles[2] != NULL && waitHandles[2] != INVALID_HANDLE_VALUE) {
-				::FindCloseChangeNotification(waitHandles[2]);
-				waitHandles[2] = NULL;
+			if (hDirectory != INVALID_HANDLE_VALUE) {
+				if (bReadPending) {
+					// the buffer must not be released or reused before the cancelled read has completed
+					DWORD nBytes;
+					::CancelIo(hDirectory);
+					::GetOverlappedResult(hDirectory, &overlapped, &nBytes, TRUE);
+					bReadPending = false;
+				}
+				::CloseHandle(hDirectory);
+				hDirectory = INVALID_HANDLE_VALUE;
 			}
+			waitHandles[2] = NULL;
 			if (waitHandles[3] != NULL && waitHandles[3] != INVALID_HANDLE_VALUE) { 
 				::FindCloseChangeNotification(waitHandles[3]);
 				waitHandles[3] = NULL;
@@ -187,4 +268,59 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 	} while (!bTerminate);
 
 	_endthread();
-}
\ No newline at end of file
+}
+
+void CDirectoryWatcher::QueueChanges(const CString& sDirectory, DWORD nBytes) {
+	::EnterCriticalSection(&m_lock);
+	if (sDirectory.CompareNoCase(m_sCurrentDirectory) != 0) {
+		// changes of the previously watched directory
+	} else if (nBytes == 0) {
+		// buffer overflow
+		m_changes.clear();
+		m_bChangesLost = true;
+	} else if (!m_bChangesLost) {
+		const uint8* pEntry = (const uint8*)m_changeBuffer;
+		CString sRenamedFrom;
+		for (;;) {
+			const FILE_NOTIFY_INFORMATION* pInfo = (const FILE_NOTIFY_INFORMATION*)pEntry;
+			CDirectoryChange change;
+			change.FileName = CString(pInfo->FileName, pInfo->FileNameLength / sizeof(WCHAR));
+			if (!sRenamedFrom.IsEmpty() && pInfo->Action != FILE_ACTION_RENAMED_NEW_NAME) {
+				AddChange(m_changes, CDirectoryChange::Removed, sRenamedFrom);
+				sRenamedFrom.Empty();
+			}
+			switch (pInfo->Action) {
+				case FILE_ACTION_ADDED:
+					AddChange(m_changes, CDirectoryChange::Added, change.FileName);
+					break;
+				case FILE_ACTION_REMOVED:
+					AddChange(m_changes, CDirectoryChange::Removed, change.FileName);
+					break;
+				case FILE_ACTION_RENAMED_OLD_NAME:
+					sRenamedFrom = change.FileName;
+					break;
+				case FILE_ACTION_RENAMED_NEW_NAME:
+					if (sRenamedFrom.IsEmpty()) {
+						AddChange(m_changes, CDirectoryChange::Added, change.FileName);
+					} else {
+						AddChange(m_changes, CDirectoryChange::Renamed, sRenamedFrom, change.FileName);
+						sRenamedFrom.Empty();
+					}
+					break;
+			}
+			if (pInfo->NextEntryOffset == 0) {
+				break;
+			}
+			pEntry += pInfo->NextEntryOffset;
+		}
+		if (!sRenamedFrom.IsEmpty()) {
+			AddChange(m_changes, CDirectoryChange::Removed, sRenamedFrom);
+		}
+		if ((int)m_changes.size() > MAX_QUEUED_CHANGES) {
+			// nobody picks up the changes, a full reload is cheaper now
+			m_changes.clear();
+			m_bChangesLost = true;
+		}
+	}
+	::LeaveCriticalSection(&m_lock);
+}
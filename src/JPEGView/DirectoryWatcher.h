@@ -1,5 +1,19 @@
 #pragma once
 
+#include <vector>
+
+// Change of a file name in the watched directory
+struct CDirectoryChange {
+	enum EType {
+		Added,
+		Removed,
+		Renamed
+	};
+	EType Type;
+	CString FileName; // file name without path, old name when renamed
+	CString NewFileName; // new file name without path, only set when renamed
+};
+
 // Watcher thread for a directory. Sends the two messages WM_DISPLAYED_FILE_CHANGED_ON_DISK and WM_ACTIVE_DIRECTORY_FILELIST_CHANGED
 // to the specified window.
 class CDirectoryWatcher {
@@ -11,6 +25,11 @@ public:
 	void SetCurrentFile(LPCTSTR fileName);
 	void SetCurrentDirectory(LPCTSTR directoryName);
 
+	// Gets and removes the file name changes in the watched directory collected since the last call.
+	// sDirectory receives the watched directory (full path, without trailing backslash).
+	// Returns false if changes were lost (e.g. too many at once), the directory must be enumerated again in this case.
+	bool GetFileListChanges(CString& sDirectory, std::vector<CDirectoryChange>& changes);
+
 	// Kindly terminates the thread by setting the m_terminateEvent
 	void Terminate();
 	// First tries to terminate the thread by setting m_terminateEvent, when no reaction -> kills the thread
@@ -29,5 +48,12 @@ private:
 	BOOL m_bModificationTimeValid;
 	FILETIME m_modificationTimeCurrentFile;
 
+	HANDLE m_changeEvent; // Signaled when ReadDirectoryChangesW() has completed
+	std::vector<CDirectoryChange> m_changes; // protected by m_lock
+	bool m_bChangesLost; // protected by m_lock
+	bool m_bWatching; // protected by m_lock, false when watching m_sCurrentDirectory could not be set up
+	DWORD m_changeBuffer[16384]; // filled by ReadDirectoryChangesW(), 64 KB is the maximum for network drives
+
 	static void  __cdecl ThreadFunc(void* arg);
+	void QueueChanges(const CString& sDirectory, DWORD nBytes);
 };
@@ -114,8 +114,9 @@ void CEXIFDisplayCtl::FillEXIFDataDisplay() {
 	LPCTSTR sComment = NULL;
 	m_pEXIFDisplay->AddPrefix(sPrefix);
 	m_pEXIFDisplay->AddTitle(sFileTitle);
-	m_pEXIFDisplay->AddLine(CNLS::GetString(_T("Image width:")), CurrentImage()->OrigWidth());
-	m_pEXIFDisplay->AddLine(CNLS::GetString(_T("Image height:")), CurrentImage()->OrigHeight());
+	CSize imageSize = CurrentImage()->OrigSizeFullResolution();
+	m_pEXIFDisplay->AddLine(CNLS::GetString(_T("Image width:")), (int)imageSize.cx);
+	m_pEXIFDisplay->AddLine(CNLS::GetString(_T("Image height:")), (int)imageSize.cy);
 	if (!CurrentImage()->IsClipboardImage()) {
 		CEXIFReader* pEXIFReader = CurrentImage()->GetEXIFReader();
 		CRawMetadata* pRawMetaData = CurrentImage()->GetRawMetadata();
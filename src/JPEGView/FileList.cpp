@@ -4,6 +4,8 @@
 #include "Helpers.h"
 #include "DirectoryWatcher.h"
 #include "Shlwapi.h"
+#include <algorithm>
+#include <ppl.h>
 
 ///////////////////////////////////////////////////////////////////////////////////
 // Helpers
@@ -15,17 +17,8 @@ bool CFileDesc::sm_bSortAscending = true;
 Helpers::ENavigationMode CFileList::sm_eMode = Helpers::NM_LoopDirectory;
 
 // Helper to add the current file of filefind object to the list
-static void AddToFileList(std::list<CFileDesc> & fileList, CFindFile & fileFind, LPCTSTR expectedExtension) {
+static void AddToFileList(std::vector<CFileDesc> & fileList, CFindFile & fileFind) {
 	if (!fileFind.IsDirectory()) {
-		if (expectedExtension != NULL) {
-			// compare if the extension is the expected extension
-			// this is required because a strange behavior of CFindFile: If searching for "*.tif", .tiff files are also found
-			CString fileName = fileFind.GetFileName();
-			int lastDot = fileName.ReverseFind(_T('.'));
-			if (_tcsicmp(((LPCTSTR)fileName) + lastDot + 1, expectedExtension) != 0) {
-				return;
-			}
-		}
 		FILETIME lastWriteTime, creationTime;
 		fileFind.GetLastWriteTime(&lastWriteTime);
 		fileFind.GetCreationTime(&creationTime);
@@ -66,13 +59,30 @@ static bool UseLogicalStringCompare() {
 	return s_bUseLogicalStringCompare;
 }
 
+// Compares two file titles, returns a value < 0, 0 or > 0 like strcmp
+static int CompareTitles(LPCTSTR sTitle, LPCTSTR sOtherTitle) {
+	if (UseLogicalStringCompare()) {
+		// If the filename contains numbers, we want to sort the files
+		// according to the numbers to place 'File9' before 'File10'
+		return StrCmpLogicalW(sTitle, sOtherTitle);
+	} else {
+		return _tcsicoll(sTitle, sOtherTitle);
+	}
+}
+
+// Sorts the file list according to the current sorting of CFileDesc, using all processor cores for large lists
+static void SortFileList(std::vector<CFileDesc> & fileList) {
+	UseLogicalStringCompare(); // read the registry once before comparing on several threads
+	concurrency::parallel_sort(fileList.begin(), fileList.end());
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 // CFileDesc
 ///////////////////////////////////////////////////////////////////////////////////
 
 CFileDesc::CFileDesc(const CString & sName, const FILETIME* lastModTime, const FILETIME* creationTime, __int64 fileSize) {
 	m_sName = sName;
-	m_sTitle = (LPCTSTR)m_sName + sName.ReverseFind(_T('\\')) + 1;
+	m_nTitleOffset = sName.ReverseFind(_T('\\')) + 1;
 	memcpy(&m_lastModTime, lastModTime, sizeof(FILETIME));
 	memcpy(&m_creationTime, creationTime, sizeof(FILETIME));
 	m_nRandomOrderNumber = rand();
@@ -80,39 +90,32 @@ CFileDesc::CFileDesc(const CString & sName, const FILETIME* lastModTime, const F
 }
 
 bool CFileDesc::SortAscending(const CFileDesc& other) const {
+	int nCompare = 0;
 	if (sm_eSorting == Helpers::FS_CreationTime || sm_eSorting == Helpers::FS_LastModTime) {
 		const FILETIME* pTime = (sm_eSorting == Helpers::FS_LastModTime) ? &m_lastModTime : &m_creationTime;
 		const FILETIME* pTimeOther = (sm_eSorting == Helpers::FS_LastModTime) ? &(other.m_lastModTime) : &(other.m_creationTime);
-		if (pTime->dwHighDateTime < pTimeOther->dwHighDateTime) {
-			return true;
-		} else if (pTime->dwHighDateTime > pTimeOther->dwHighDateTime) {
-			return false;
-		} else {
-			return pTime->dwLowDateTime < pTimeOther->dwLowDateTime;
-		}
+		nCompare = ::CompareFileTime(pTime, pTimeOther);
 	} else if (sm_eSorting == Helpers::FS_Random) {
-		return m_nRandomOrderNumber < other.m_nRandomOrderNumber;
+		nCompare = (m_nRandomOrderNumber < other.m_nRandomOrderNumber) ? -1 : (m_nRandomOrderNumber > other.m_nRandomOrderNumber) ? 1 : 0;
 	} else if (sm_eSorting == Helpers::FS_FileSize) {
-		return m_fileSize < other.m_fileSize;
-	} else {
-		if (UseLogicalStringCompare()) {
-			// If the filename contains numbers, we want to sort the files
-			// according to the numbers to place 'File9' before 'File10'
-			return StrCmpLogicalW(m_sTitle, other.m_sTitle) < 0;
-		} else {
-			return _tcsicoll(m_sTitle, other.m_sTitle) < 0;
-		}
+		nCompare = (m_fileSize < other.m_fileSize) ? -1 : (m_fileSize > other.m_fileSize) ? 1 : 0;
 	}
+	// files with equal sort key are ordered by name, this gives the same order independent of the order the files were found
+	if (nCompare == 0) {
+		nCompare = CompareTitles(GetTitle(), other.GetTitle());
+	}
+	return nCompare < 0;
 }
 
 bool CFileDesc::operator < (const CFileDesc& other) const {
-	return SortAscending(other) ^ (!sm_bSortAscending);
+	// note: negating SortAscending() for descending order would not be a strict weak ordering as required by std::sort
+	return sm_bSortAscending ? SortAscending(other) : other.SortAscending(*this);
 }
 
 
 void CFileDesc::SetName(LPCTSTR sNewName) {
 	m_sName = sNewName;
-	m_sTitle = (LPCTSTR)m_sName + m_sName.ReverseFind(_T('\\')) + 1;
+	m_nTitleOffset = m_sName.ReverseFind(_T('\\')) + 1;
 }
 
 void CFileDesc::SetModificationDate(const FILETIME& lastModDate) {
@@ -135,6 +138,7 @@ static const TCHAR* csFileEndingsRAW = _T("*.pef;*.dng;*.crw;*.nef;*.cr2;*.mrw;*
 static const int MAX_ENDINGS = 48;
 static int nNumEndings;
 static LPCTSTR* sFileEndings;
+static std::unordered_set<CString, CStringHash> sFileEndingSet; // lower case endings of sFileEndings for fast lookup
 
 __declspec(dllimport) bool __stdcall WICPresent(void);
 
@@ -163,6 +167,9 @@ static void ParseAndAddFileEndings(LPCTSTR sEndings) {
 			}
 			if (_tcslen(sStart) > 2) {
 				sFileEndings[nNumEndings++] = sStart + 2;
+				CString sEndingLC = sStart + 2;
+				sEndingLC.MakeLower();
+				sFileEndingSet.insert(sEndingLC);
 			}
 			sStart = sCurrent;
 		}
@@ -176,6 +183,7 @@ static LPCTSTR* GetSupportedFileEndingList() {
 		sFileEndings = new LPCTSTR[MAX_ENDINGS];
 		for (nNumEndings = 0; nNumEndings < cnNumEndingsInternal; nNumEndings++) {
 			sFileEndings[nNumEndings] = csFileEndingsInternal[nNumEndings];
+			sFileEndingSet.insert(CString(csFileEndingsInternal[nNumEndings]));
 		}
 
 		LPCTSTR sFileEndingsWIC = CSettingsProvider::This().FilesProcessedByWIC();
@@ -197,6 +205,7 @@ CFileList::CFileList(const CString & sInitialFile, CDirectoryWatcher & directory
 	m_sInitialFile = sInitialFile;
 	m_nLevel = nLevel;
 	m_next = m_prev = NULL;
+	m_nIndex = m_nIndexStart = m_nIndexCheckPoint = -1;
 	int nPos = sInitialFile.ReverseFind(_T('\\'));
 	m_sDirectory = (nPos > 0) ? sInitialFile.Left(nPos) : _T(""); // the backslash is stripped away!
 	nPos = sInitialFile.ReverseFind(_T('.'));
@@ -218,20 +227,22 @@ CFileList::CFileList(const CString & sInitialFile, CDirectoryWatcher & directory
 	if (!m_bIsSlideShowList) {
 		if (bImageFile || bIsDirectory) {
 			FindFiles();
-			m_iter = FindFile(sInitialFile);
-			m_iterStart = bWrapAroundFolder ? m_iter : m_fileList.begin();
+			m_nIndex = FindFile(sInitialFile);
+			m_nIndexStart = bWrapAroundFolder ? m_nIndex : FirstIndex();
 		} else {
 			// neither image file nor directory nor list of file names - try to read anyway but normally will fail
 			CFindFile fileFind;
 			if (fileFind.FindFile(sInitialFile)) {
-				AddToFileList(m_fileList, fileFind, NULL);
+				AddToFileList(m_fileList, fileFind);
 			}
-			m_iter = m_iterStart = m_fileList.begin();
+			UpdateNameIndex();
+			m_nIndex = m_nIndexStart = FirstIndex();
 		}
 	} else {
 		sm_eMode = Helpers::NM_LoopDirectory;
-		if (forceSorting) m_fileList.sort();
-		m_iter = m_iterStart = m_fileList.begin();
+		if (forceSorting) SortFileList(m_fileList);
+		UpdateNameIndex();
+		m_nIndex = m_nIndexStart = FirstIndex();
 	}
 }
 
@@ -259,6 +270,8 @@ void CFileList::Reload(LPCTSTR sFileName, bool clearForwardHistory) {
 		sCurrent = Current();
 		if (sCurrent == NULL) {
 			m_fileList.clear();
+			m_nameIndex.clear();
+			m_nIndex = m_nIndexStart = -1;
 			return;
 		}
 	}
@@ -279,12 +292,40 @@ void CFileList::Reload(LPCTSTR sFileName, bool clearForwardHistory) {
 
 	if (!m_bIsSlideShowList) {
 		FindFiles();
-		m_iterStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : m_fileList.begin();
+		m_nIndexStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : FirstIndex();
 	} else {
 		VerifyFiles(); // maybe some of the files got deleted or moved
-		m_iterStart = m_fileList.begin();
+		m_nIndexStart = FirstIndex();
 	}
-	m_iter = FindFile(sCurrentFile); // go again to current file
+	m_nIndex = FindFile(sCurrentFile); // go again to current file
+}
+
+bool CFileList::ApplyDirectoryChanges(LPCTSTR sDirectory, const std::vector<CDirectoryChange>& changes) {
+	// slide show lists are not sorted and contain files of several folders
+	if (m_bIsSlideShowList || m_sDirectory.CompareNoCase(sDirectory) != 0) {
+		return false;
+	}
+	std::vector<CDirectoryChange>::const_iterator iter;
+	for (iter = changes.begin(); iter != changes.end(); iter++) {
+		switch (iter->Type) {
+		case CDirectoryChange::Added:
+			InsertFile(iter->FileName);
+			break;
+		case CDirectoryChange::Removed:
+			RemoveFile(iter->FileName);
+			break;
+		case CDirectoryChange::Renamed: {
+			bool bIsCurrent = m_nIndex >= 0 && _tcsicmp(m_fileList[m_nIndex].GetTitle(), iter->FileName) == 0;
+			RemoveFile(iter->FileName);
+			int nIndex = InsertFile(iter->NewFileName);
+			if (bIsCurrent && nIndex >= 0) {
+				m_nIndex = nIndex;
+			}
+			break;
+		}
+		}
+	}
+	return true;
 }
 
 bool CFileList::CurrentFileExists() const {
@@ -337,22 +378,23 @@ void CFileList::FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName) {
 	if (_tcsicmp(sOldFileName, m_sInitialFile) == 0) {
 		m_sInitialFile = sNewFileName;
 	}
-	std::list<CFileDesc>::iterator iter;
+	std::vector<CFileDesc>::iterator iter;
 	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
 		if (_tcsicmp(sOldFileName, iter->GetName()) == 0) {
 			iter->SetName(sNewFileName);
 		}
 	}
+	UpdateNameIndex();
 }
 
 void CFileList::ModificationTimeChanged() {
-	if (m_iter != m_fileList.end()) {
-		LPCTSTR sName = m_iter->GetName();
+	if (m_nIndex >= 0) {
+		LPCTSTR sName = m_fileList[m_nIndex].GetName();
 		HANDLE hFile = ::CreateFile(sName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
 		if (hFile != NULL) {
 			FILETIME lastModTime;
 			if (::GetFileTime(hFile, NULL, NULL, &lastModTime)) {
-				m_iter->SetModificationDate(lastModTime);
+				m_fileList[m_nIndex].SetModificationDate(lastModTime);
 			}
 			::CloseHandle(hFile);
 		}
@@ -362,14 +404,13 @@ void CFileList::ModificationTimeChanged() {
 CFileList* CFileList::Next() {
 	m_nMarkedIndexShow = -1;
 	if (m_fileList.size() > 0) {
-		std::list<CFileDesc>::iterator iterTemp = m_iter;
-		if (iterTemp == m_fileList.end())
+		if (m_nIndex < 0)
 			return this;
-		iterTemp++;
-		if (iterTemp == m_fileList.end()) {
-			iterTemp = m_fileList.begin();
+		int nIndexNext = m_nIndex + 1;
+		if (nIndexNext == Size()) {
+			nIndexNext = 0;
 		}
-		if (iterTemp == m_iterStart) {
+		if (nIndexNext == m_nIndexStart) {
 			// we are finished with this folder
 			if (!m_bWrapAroundFolder && sm_eMode == Helpers::NM_LoopDirectory) {
 				return this;
@@ -384,7 +425,7 @@ CFileList* CFileList::Next() {
 				}
 			}
 			if (pNextList != this) {
-				// leave current iterator on m_iterStart and return the new list
+				// leave current index on m_nIndexStart and return the new list
 				return pNextList;
 			}
 		}
@@ -401,15 +442,15 @@ CFileList* CFileList::Next() {
 
 CFileList* CFileList::Prev() {
 	m_nMarkedIndexShow = -1;
-	if (m_iter == m_iterStart) {
+	if (m_nIndex == m_nIndexStart) {
 		if (sm_eMode == Helpers::NM_LoopDirectory) {
 			if (!m_bWrapAroundFolder) {
 				return this;
 			}
-			if (m_iter == m_fileList.begin()) {
+			if (m_nIndex == 0) {
 				MoveIterToLast();
-			} else {
-				m_iter--;
+			} else if (m_nIndex > 0) {
+				m_nIndex--;
 			}
 			return this;
 		} else {
@@ -417,25 +458,21 @@ CFileList* CFileList::Prev() {
 		}
 	}
 	if (m_fileList.size() > 0) {
-		if (m_iter == m_fileList.begin()) {
-			m_iter = m_fileList.end();
-			m_iter--;
-		} else {
-			m_iter--;
-		}
+		// from the first file or from no file to the last file
+		m_nIndex = (m_nIndex <= 0) ? Size() - 1 : m_nIndex - 1;
 	}
 	return this;
 }
 
 void CFileList::First() {
 	m_nMarkedIndexShow = -1;
-	m_iter = m_iterStart = m_fileList.begin();
+	m_nIndex = m_nIndexStart = FirstIndex();
 }
 
 void CFileList::Last() {
 	m_nMarkedIndexShow = -1;
 	MoveIterToLast();
-	m_iterStart = m_fileList.begin();
+	m_nIndexStart = FirstIndex();
 }
 
 CFileList* CFileList::AwayFromCurrent() {
@@ -445,7 +482,7 @@ CFileList* CFileList::AwayFromCurrent() {
 		CFileList* pFileList = Prev();
 		if (Current() != NULL && sCurrentFile != NULL && _tcscmp(sCurrentFile, Current()) == 0) {
 			// not moved away, only one image
-			m_iter = m_fileList.end();
+			m_nIndex = -1;
 		}
 		return pFileList;
 	} else {
@@ -454,8 +491,8 @@ CFileList* CFileList::AwayFromCurrent() {
 }
 
 LPCTSTR CFileList::Current() const {
-	if (m_iter != m_fileList.end()) {
-		return m_iter->GetName();
+	if (m_nIndex >= 0) {
+		return m_fileList[m_nIndex].GetName();
 	} else {
 		return NULL;
 	}
@@ -480,21 +517,9 @@ LPCTSTR CFileList::CurrentDirectory() const {
 	}
 }
 
-int CFileList::CurrentIndex() const {
-	int i = 0;
-	std::list<CFileDesc>::const_iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (iter == m_iter) {
-			return i;
-		}
-		i++;
-	}
-	return -1;
-}
-
 const FILETIME* CFileList::CurrentModificationTime() const {
-	if (m_iter != m_fileList.end()) {
-		return &(m_iter->GetLastModTime());
+	if (m_nIndex >= 0) {
+		return &(m_fileList[m_nIndex].GetLastModTime());
 	} else {
 		return NULL;
 	}
@@ -504,7 +529,7 @@ LPCTSTR CFileList::PeekNextPrev(int nIndex, bool bForward, bool bToggle) {
 	if (bToggle) {
 		return (m_nMarkedIndexShow == 0) ? m_sMarkedFile : m_sMarkedFileCurrent;
 	} else {
-		std::list<CFileDesc>::iterator thisIter = m_iter;
+		int nThisIndex = m_nIndex;
 		LPCTSTR sFileName;
 		if (nIndex != 0) {
 			CFileList* pFL = bForward ? Next() : Prev();
@@ -512,18 +537,19 @@ LPCTSTR CFileList::PeekNextPrev(int nIndex, bool bForward, bool bToggle) {
 		} else {
 			sFileName = Current();
 		}
-		m_iter = thisIter;
+		m_nIndex = nThisIndex;
 		return sFileName;
 	}
 }
 
 void CFileList::SetSorting(Helpers::ESorting eSorting, bool sortAscending) {
 	if (eSorting != CFileDesc::GetSorting() || sortAscending != CFileDesc::IsSortedAscending()) {
-		CString sThisFile = (m_iter != m_fileList.end()) ? m_iter->GetName() : "";
+		CString sThisFile = (m_nIndex >= 0) ? m_fileList[m_nIndex].GetName() : "";
 		CFileDesc::SetSorting(eSorting, sortAscending);
-		m_fileList.sort();
-		m_iter = FindFile(sThisFile);
-		m_iterStart = m_bWrapAroundFolder ? m_iter : m_fileList.begin();
+		SortFileList(m_fileList);
+		UpdateNameIndex();
+		m_nIndex = FindFile(sThisFile);
+		m_nIndexStart = m_bWrapAroundFolder ? m_nIndex : FirstIndex();
 	}
 }
 
@@ -543,7 +569,7 @@ void CFileList::SetNavigationMode(Helpers::ENavigationMode eMode) {
 	sm_eMode = eMode;
 	DeleteHistory();
 	m_nLevel = 0;
-	m_iterStart = m_bWrapAroundFolder ? m_iter : m_fileList.begin();
+	m_nIndexStart = m_bWrapAroundFolder ? m_nIndex : FirstIndex();
 }
 
 void CFileList::MarkCurrentFile() {
@@ -622,26 +648,123 @@ void CFileList::DeleteHistory(bool onlyForward) {
 ///////////////////////////////////////////////////////////////////////////////////
 
 void CFileList::MoveIterToLast() {
-	std::list<CFileDesc>::iterator lastIter = m_iter;
-	while (m_iter != m_fileList.end()) {
-		lastIter = m_iter;
-		m_iter++;
+	if (m_nIndex >= 0) {
+		m_nIndex = Size() - 1;
 	}
-	m_iter = lastIter;
 }
 
-std::list<CFileDesc>::iterator CFileList::FindFile(const CString& sName) {
+int CFileList::FindFile(const CString& sName) {
 	int nStart = sName.ReverseFind(_T('\\')) + 1;
 	if (nStart == sName.GetLength()) {
-		return m_fileList.begin();
+		return FirstIndex();
 	}
-	std::list<CFileDesc>::iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (_tcsicmp((LPCTSTR)sName + nStart, iter->GetTitle()) == 0) {
-			return iter;
+	int nIndex = FindTitle((LPCTSTR)sName + nStart);
+	return (nIndex >= 0) ? nIndex : FirstIndex(); // in case the file was not found
+}
+
+int CFileList::FindTitle(LPCTSTR sTitle) {
+	CString sTitleLC = sTitle;
+	sTitleLC.MakeLower();
+	std::unordered_map<CString, int, CStringHash>::const_iterator iter = m_nameIndex.find(sTitleLC);
+	if (iter != m_nameIndex.end() && iter->second < Size() && _tcsicmp(sTitle, m_fileList[iter->second].GetTitle()) == 0) {
+		return iter->second;
+	}
+	// the file entries may have been renamed without updating the index (batch rename)
+	for (int i = 0; i < Size(); i++) {
+		if (_tcsicmp(sTitle, m_fileList[i].GetTitle()) == 0) {
+			UpdateNameIndex();
+			return i;
+		}
+	}
+	return -1;
+}
+
+void CFileList::UpdateNameIndex() {
+	m_nameIndex.clear();
+	m_nameIndex.reserve(m_fileList.size());
+	for (int i = 0; i < Size(); i++) {
+		CString sTitleLC = m_fileList[i].GetTitle();
+		sTitleLC.MakeLower();
+		m_nameIndex.insert(std::make_pair(sTitleLC, i)); // keeps the first file if the title is not unique
+	}
+}
+
+void CFileList::ShiftNameIndex(int nFromIndex, int nDelta) {
+	std::unordered_map<CString, int, CStringHash>::iterator iter;
+	for (iter = m_nameIndex.begin(); iter != m_nameIndex.end(); iter++) {
+		if (iter->second >= nFromIndex) {
+			iter->second += nDelta;
 		}
 	}
-	return m_fileList.begin(); // in case the file was not found
+}
+
+int CFileList::InsertFile(const CString& sTitle) {
+	int nPos = sTitle.ReverseFind(_T('.'));
+	if (nPos < 0 || !IsImageFile(sTitle.Mid(nPos + 1))) {
+		return -1;
+	}
+	CString sName = m_sDirectory + _T('\\') + sTitle;
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!::GetFileAttributesEx(sName, GetFileExInfoStandard, &attributes) || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		return -1;
+	}
+
+	// a file replaced by a file of the same name may have a different sort position
+	int nOldIndex = FindTitle(sTitle);
+	bool bIsCurrent = nOldIndex >= 0 && nOldIndex == m_nIndex;
+	if (nOldIndex >= 0) {
+		RemoveFile(sTitle);
+	}
+
+	CFileDesc thisFile(sName, &attributes.ftLastWriteTime, &attributes.ftCreationTime,
+		((__int64)attributes.nFileSizeHigh << 32) + attributes.nFileSizeLow);
+	int nIndex = (int)(std::upper_bound(m_fileList.begin(), m_fileList.end(), thisFile) - m_fileList.begin());
+	m_fileList.insert(m_fileList.begin() + nIndex, thisFile);
+	// the first file inserted into an empty list becomes the current file
+	if (bIsCurrent || m_nIndex < 0) {
+		m_nIndex = nIndex;
+	} else if (m_nIndex >= nIndex) {
+		m_nIndex++;
+	}
+	// without wrap around, iteration always starts at the first file
+	if (m_bWrapAroundFolder && m_nIndexStart < 0) {
+		m_nIndexStart = nIndex;
+	} else if (m_bWrapAroundFolder && m_nIndexStart >= nIndex) {
+		m_nIndexStart++;
+	} else if (!m_bWrapAroundFolder) {
+		m_nIndexStart = FirstIndex();
+	}
+	// update the index directly, rebuilding it for every change of a large folder is slow
+	ShiftNameIndex(nIndex, 1);
+	CString sTitleLC = sTitle;
+	sTitleLC.MakeLower();
+	m_nameIndex.insert(std::make_pair(sTitleLC, nIndex));
+	return nIndex;
+}
+
+int CFileList::RemoveFile(const CString& sTitle) {
+	int nIndex = FindTitle(sTitle);
+	if (nIndex < 0) {
+		return -1;
+	}
+	m_fileList.erase(m_fileList.begin() + nIndex);
+	// the position stays on the file following the removed file
+	if (m_nIndex > nIndex || m_nIndex >= Size()) {
+		m_nIndex--;
+	}
+	if (!m_bWrapAroundFolder) {
+		m_nIndexStart = FirstIndex();
+	} else if (m_nIndexStart > nIndex || m_nIndexStart >= Size()) {
+		m_nIndexStart--;
+	}
+	CString sTitleLC = sTitle;
+	sTitleLC.MakeLower();
+	std::unordered_map<CString, int, CStringHash>::iterator iter = m_nameIndex.find(sTitleLC);
+	if (iter != m_nameIndex.end() && iter->second == nIndex) {
+		m_nameIndex.erase(iter);
+	}
+	ShiftNameIndex(nIndex + 1, -1);
+	return nIndex;
 }
 
 CFileList* CFileList::WrapToNextImage() {
@@ -766,9 +889,9 @@ CFileList* CFileList::WrapToPrevImage() {
 
 void CFileList::NextInFolder() {
 	if (m_fileList.size() > 0) {
-		m_iter++;
-		if (m_iter == m_fileList.end()) {
-			m_iter = m_fileList.begin();
+		m_nIndex++;
+		if (m_nIndex >= Size()) {
+			m_nIndex = 0;
 		}
 	}
 }
@@ -814,43 +937,46 @@ CFileList* CFileList::TryCreateFileList(const CString& directory, int nNewLevel)
 void CFileList::FindFiles() {
 	m_fileList.clear();
 	if (!m_sDirectory.IsEmpty()) {
-		CFindFile fileFind;
-		LPCTSTR* allFileEndings = GetSupportedFileEndingList();
-		for (int i = 0; i < nNumEndings; i++) {
-			if (fileFind.FindFile(m_sDirectory + _T("\\*.") + allFileEndings[i])) {
-				AddToFileList(m_fileList, fileFind, allFileEndings[i]);
-				while (fileFind.FindNextFile()) {
-					AddToFileList(m_fileList, fileFind, allFileEndings[i]);
+		// enumerate the folder once and filter by file ending, instead of one search per supported file ending
+		GetSupportedFileEndingList();
+		WIN32_FIND_DATA findData;
+		HANDLE hFind = ::FindFirstFileEx(m_sDirectory + _T("\\*"), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+		if (hFind != INVALID_HANDLE_VALUE) {
+			do {
+				if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+					continue;
 				}
-			}
+				LPCTSTR sEnding = _tcsrchr(findData.cFileName, _T('.'));
+				if (sEnding == NULL) {
+					continue;
+				}
+				CString sEndingLC = sEnding + 1;
+				sEndingLC.MakeLower();
+				if (sFileEndingSet.find(sEndingLC) != sFileEndingSet.end()) {
+					CFileDesc thisFile(m_sDirectory + _T('\\') + findData.cFileName, &findData.ftLastWriteTime, &findData.ftCreationTime,
+						((__int64)findData.nFileSizeHigh << 32) + findData.nFileSizeLow);
+					m_fileList.push_back(thisFile);
+				}
+			} while (::FindNextFile(hFind, &findData));
+			::FindClose(hFind);
 		}
 	}
 
-	m_fileList.sort();
+	SortFileList(m_fileList);
+	UpdateNameIndex();
 }
 
 void CFileList::VerifyFiles() {
-	std::list<CFileDesc>::iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (::GetFileAttributes(iter->GetName()) == INVALID_FILE_ATTRIBUTES) {
-			iter = m_fileList.erase(iter);
-			if (iter == m_fileList.end()) {
-				break;
-			}
-		}
-	}
+	m_fileList.erase(std::remove_if(m_fileList.begin(), m_fileList.end(),
+		[](const CFileDesc& file) { return ::GetFileAttributes(file.GetName()) == INVALID_FILE_ATTRIBUTES; }), m_fileList.end());
+	UpdateNameIndex();
 }
 
 bool CFileList::IsImageFile(const CString & sEnding) {
 	CString sEndingLC = sEnding;
 	sEndingLC.MakeLower();
-	LPCTSTR* allFileEndings = GetSupportedFileEndingList();
-	for (int i = 0; i < nNumEndings; i++) {
-		if (allFileEndings[i] == sEndingLC) {
-			return true;
-		}
-	}
-	return false;
+	GetSupportedFileEndingList();
+	return sFileEndingSet.find(sEndingLC) != sFileEndingSet.end();
 }
 
 bool CFileList::TryReadingSlideShowList(const CString & sSlideShowFile) {
@@ -988,7 +1114,7 @@ bool CFileList::TryReadingSlideShowList(const CString & sSlideShowFile) {
 			CFindFile fileFind;
 			CString sPath = bRelativePath ? (m_sDirectory + _T('\\') + pStart) : pStart;
 			if (fileFind.FindFile(sPath)) {
-				AddToFileList(m_fileList, fileFind, NULL);
+				AddToFileList(m_fileList, fileFind);
 			}
 		}
 	} while (nTotalChars < nRealFileSizeChars);
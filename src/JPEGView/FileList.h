@@ -1,8 +1,23 @@
 #pragma once
 
 #include "Helpers.h"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 class CDirectoryWatcher;
+struct CDirectoryChange;
+
+// Hash of strings for the hash containers of the file list, the strings are stored in lower case
+struct CStringHash {
+	size_t operator()(const CString& s) const {
+		size_t nHash = 2166136261U;
+		for (LPCTSTR p = s; *p != 0; p++) {
+			nHash = (nHash ^ (size_t)*p) * 16777619U;
+		}
+		return nHash;
+	}
+};
 
 // Entry in the file list, allowing sorting by different sort criteria
 class CFileDesc 
@@ -27,7 +42,7 @@ public:
 	void SetModificationDate(const FILETIME& lastModDate);
 
 	// File title (without path)
-	LPCTSTR GetTitle() const { return m_sTitle; }
+	LPCTSTR GetTitle() const { return (LPCTSTR)m_sName + m_nTitleOffset; }
 
 	// Gets last modification time
 	const FILETIME& GetLastModTime() const { return m_lastModTime; }
@@ -43,7 +58,7 @@ private:
 	static bool sm_bSortAscending;
 
 	CString m_sName;
-	LPCTSTR m_sTitle;
+	int m_nTitleOffset; // offset of the title in m_sName, an offset stays valid when the object is copied
 	FILETIME m_lastModTime;
 	FILETIME m_creationTime;
 	int m_nRandomOrderNumber;
@@ -69,6 +84,11 @@ public:
 	// Reload file list for given file, if NULL for current file
 	void Reload(LPCTSTR sFileName = NULL, bool clearForwardHistory = true);
 
+	// Updates the file list with the file name changes reported by the directory watcher for the given directory,
+	// the current file and the position in the list are kept. Returns false if the changes cannot be applied
+	// to this list, Reload() must be used instead in this case.
+	bool ApplyDirectoryChanges(LPCTSTR sDirectory, const std::vector<CDirectoryChange>& changes);
+
 	// Tells the file list that a file has been renamed externally
 	void FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName);
 
@@ -98,8 +118,8 @@ public:
 	LPCTSTR PeekNextPrev(int nIndex, bool bForward, bool bToggle);
 	// Number of files in file list (for current directory)
 	int Size() const { return (int)m_fileList.size(); }
-	// Index of current file in file list (zero based)
-	int CurrentIndex() const;
+	// Index of current file in file list (zero based), -1 if none
+	int CurrentIndex() const { return m_nIndex; }
 
 	// Sets the sorting of the file list and resorts the list
 	void SetSorting(Helpers::ESorting eSorting, bool sortAscending);
@@ -120,9 +140,9 @@ public:
 	void ToggleBetweenMarkedAndCurrentFile();
 
 	// Sets a checkpoint on the current image
-	void SetCheckpoint() { m_iterCheckPoint = m_iter; }
+	void SetCheckpoint() { m_nIndexCheckPoint = m_nIndex; }
 	// Check if we are now on another image since the last checkpoint was set
-	bool ChangedSinceCheckpoint() { return m_iterCheckPoint != m_iter; }
+	bool ChangedSinceCheckpoint() { return m_nIndexCheckPoint != m_nIndex; }
 
 	// Returns if the current file list is based on a slide show text file
 	bool IsSlideShowList() const { return m_bIsSlideShowList; }
@@ -140,7 +160,7 @@ public:
 	bool CanOpenCurrentFileForReading() const;
 
 	// Returns the raw file list of the current folder
-	std::list<CFileDesc> & GetFileList() { return m_fileList; }
+	std::vector<CFileDesc> & GetFileList() { return m_fileList; }
 
 	// delete the chain of CFileLists forward and backward and only leave the current node alive
 	void DeleteHistory(bool onlyForward = false);
@@ -157,10 +177,11 @@ private:
 	// filelists for several folders are chained
 	CFileList* m_next;
 	CFileList* m_prev;
-	std::list<CFileDesc> m_fileList;
-	std::list<CFileDesc>::iterator m_iter; // current position in m_fileList
-	std::list<CFileDesc>::iterator m_iterStart; // start of iteration in m_fileList
-	std::list<CFileDesc>::iterator m_iterCheckPoint;
+	std::vector<CFileDesc> m_fileList;
+	std::unordered_map<CString, int, CStringHash> m_nameIndex; // lower case file title to index in m_fileList
+	int m_nIndex; // current position in m_fileList, -1 if none
+	int m_nIndexStart; // start of iteration in m_fileList, -1 if none
+	int m_nIndexCheckPoint;
 
 	CString m_sMarkedFile;
 	CString m_sMarkedFileCurrent;
@@ -171,7 +192,14 @@ private:
 	void MoveIterToLast();
 	void NextInFolder();
 	CFileList* GotoFirstShown();
-	std::list<CFileDesc>::iterator FindFile(const CString& sName);
+	int FirstIndex() const { return m_fileList.empty() ? -1 : 0; }
+	int FindFile(const CString& sName);
+	int FindTitle(LPCTSTR sTitle);
+	void UpdateNameIndex();
+	// Adds nDelta to all indices in the name index that are equal or larger than nFromIndex, after inserting or removing a file
+	void ShiftNameIndex(int nFromIndex, int nDelta);
+	int InsertFile(const CString& sTitle);
+	int RemoveFile(const CString& sTitle);
 	CFileList* FindFileRecursively (const CString& sDirectory, const CString& sFindAfter, 
 		bool bSearchThisFolder, int nLevel, int nRecursion);
 	CFileList* TryCreateFileList(const CString& directory, int nNewLevel);
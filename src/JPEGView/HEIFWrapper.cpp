@@ -3,6 +3,7 @@
 #include "HEIFWrapper.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "Tracer.h"
 
 void * HeifReader::ReadImage(int &width,
 					   int &height,
@@ -21,14 +22,19 @@ void * HeifReader::ReadImage(int &width,
 	unsigned char* pPixelData = NULL;
 	exif_chunk = NULL;
 
+	CTraceSpan parseSpan(TRACE_Parse);
 	heif::Context context;
 	context.read_from_memory_without_copy(buffer, sizebytes);
 	frame_count = context.get_number_of_top_level_images();
 	heif_item_id item_id = context.get_list_of_top_level_image_IDs().at(frame_index);
 	heif::ImageHandle handle = context.get_image_handle(item_id);
+	parseSpan.End();
 	// height = handle.get_height();
 	// width = handle.get_width();
+	// libheif decodes and converts from YCbCr to RGB in one call
+	CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)handle.get_width() * handle.get_height());
 	heif::Image image = handle.decode_image(heif_colorspace_RGB, heif_chroma_interleaved_RGBA);
+	decodeSpan.End();
 	int stride;
 	uint8_t* data = image.get_plane(heif_channel_interleaved, &stride);
 	width = image.get_width(heif_channel_interleaved);
@@ -53,6 +59,7 @@ void * HeifReader::ReadImage(int &width,
 	void* transform = ICCProfileTransform::CreateTransform(iccp.data(), iccp.size(), ICCProfileTransform::FORMAT_RGBA);
 	size_t i, j;
 	if (!ICCProfileTransform::DoTransform(transform, data, pPixelData, width, height, stride=stride)) {
+		CTraceSpan convertSpan(TRACE_ColorConvert, IF_Unknown, (__int64)width * height);
 		unsigned int* o = (unsigned int*)pPixelData;
 		for (i = 0; i < height; i++) {
 			unsigned int* p = (unsigned int*)(data + i * stride);
@@ -369,7 +369,7 @@ void CalcCRCTable(unsigned int crc_table[256]) {
 	 }
 }
 
-void* FindJPEGMarker(void* pJPEGStream, int nStreamLength, unsigned char nMarker) {
+void* FindJPEGMarker(const void* pJPEGStream, int nStreamLength, unsigned char nMarker) {
 	uint8* pStream = (uint8*) pJPEGStream;
 	if (pStream == NULL || nStreamLength < 3 || pStream[0] != 0xFF || pStream[1] != 0xD8) {
 		return NULL; // not a JPEG
@@ -402,7 +402,7 @@ void* FindJPEGMarker(void* pJPEGStream, int nStreamLength, unsigned char nMarker
 	}
 }
 
-void* FindEXIFBlock(void* pJPEGStream, int nStreamLength) {
+void* FindEXIFBlock(const void* pJPEGStream, int nStreamLength) {
 	uint8* pEXIFBlock = (uint8*)Helpers::FindJPEGMarker(pJPEGStream, nStreamLength, 0xE1);
 	if (pEXIFBlock != NULL && strncmp((const char*)(pEXIFBlock + 4), "Exif", 4) != 0) {
 		return NULL;
@@ -410,7 +410,7 @@ void* FindEXIFBlock(void* pJPEGStream, int nStreamLength) {
 	return pEXIFBlock;
 }
 
-__int64 CalculateJPEGFileHash(void* pJPEGStream, int nStreamLength) {
+__int64 CalculateJPEGFileHash(const void* pJPEGStream, int nStreamLength) {
 	uint8* pStream = (uint8*) pJPEGStream;
 	void* pPixelStart = FindJPEGMarker(pJPEGStream, nStreamLength, 0);
 	if (pPixelStart == NULL) {
@@ -443,6 +443,41 @@ __int64 CalculateJPEGFileHash(void* pJPEGStream, int nStreamLength) {
 	return ((__int64)crcValue << 32) + sumValue;
 }
 
+static void UpdateFileContentHash(const uint8* pStream, __int64 nStart, __int64 nEnd, const unsigned int crc_table[256],
+								  uint32& crcValue, unsigned int& sumValue) {
+	for (__int64 nIndex = nStart; nIndex < nEnd; nIndex++) {
+		sumValue += pStream[nIndex];
+		crcValue = crc_table[(crcValue ^ pStream[nIndex]) & 0xff] ^ (crcValue >> 8);
+	}
+}
+
+__int64 CalculateFileContentHash(const void* pData, __int64 nSize) {
+	// the whole head and tail (containing headers and metadata) and this number of blocks of the rest
+	const int nHeadTailBytes = 65536;
+	const int nBlocks = 256;
+	const int nBlockBytes = 256;
+
+	unsigned int crc_table[256];
+	CalcCRCTable(crc_table);
+	uint32 crcValue = 0xffffffff;
+	unsigned int sumValue = (unsigned int)nSize ^ (unsigned int)(nSize >> 32);
+	const uint8* pStream = (const uint8*)pData;
+
+	__int64 nHeadEnd = min(nSize, (__int64)nHeadTailBytes);
+	__int64 nTailStart = max(nHeadEnd, nSize - nHeadTailBytes);
+	UpdateFileContentHash(pStream, 0, nHeadEnd, crc_table, crcValue, sumValue);
+	__int64 nMiddle = nTailStart - nHeadEnd;
+	if (nMiddle > 0) {
+		for (int i = 0; i < nBlocks; i++) {
+			__int64 nBlockStart = nHeadEnd + nMiddle * i / nBlocks;
+			UpdateFileContentHash(pStream, nBlockStart, min(nBlockStart + nBlockBytes, nTailStart), crc_table, crcValue, sumValue);
+		}
+	}
+	UpdateFileContentHash(pStream, nTailStart, nSize, crc_table, crcValue, sumValue);
+
+	return ((__int64)crcValue << 32) + sumValue;
+}
+
 CString TryConvertFromUTF8(uint8* pComment, int nLengthInBytes) {
 	wchar_t* pCommentUnicode = new wchar_t[nLengthInBytes + 1];
 	char* pCommentBack = new char[nLengthInBytes + 1];
@@ -461,7 +496,7 @@ CString TryConvertFromUTF8(uint8* pComment, int nLengthInBytes) {
 	return result;
 }
 
-CString GetJPEGComment(void* pJPEGStream, int nStreamLength) {
+CString GetJPEGComment(const void* pJPEGStream, int nStreamLength) {
 	uint8* pCommentSeg = (uint8*)FindJPEGMarker(pJPEGStream, nStreamLength, 0xFE);
 	if (pCommentSeg == NULL) {
 		return CString("");
@@ -226,21 +226,25 @@ namespace Helpers {
 
 	// Finds a JPEG marker (beginning with 0xFF) in a JPEG stream. 
 	// To find the first non-marker block, set nMarker to zero.
-	void* FindJPEGMarker(void* pJPEGStream, int nStreamLength, unsigned char nMarker);
+	void* FindJPEGMarker(const void* pJPEGStream, int nStreamLength, unsigned char nMarker);
 
 	// Finds the EXIF block in the JPEG bytes stream, NULL if no EXIF block
-	void* FindEXIFBlock(void* pJPEGStream, int nStreamLength);
+	void* FindEXIFBlock(const void* pJPEGStream, int nStreamLength);
 
 	// Calculates a hash value over the given JPEG stream having the given length (in bytes).
 	// All blocks and tables in the JPEG stream are not included into the hash to allow
 	// e.g. commenting the JPEG or changing some EXIF information without changing the hash.
-	__int64 CalculateJPEGFileHash(void* pJPEGStream, int nStreamLength);
+	__int64 CalculateJPEGFileHash(const void* pJPEGStream, int nStreamLength);
+
+	// Calculates a hash value over the content of a file with the given size (in bytes) mapped to memory.
+	// Covers the size, the start and the end of the file and samples of the rest, the file is not read completely.
+	__int64 CalculateFileContentHash(const void* pData, __int64 nSize);
 
 	// try to convert a string from UTF-8. Returns empty string if no valid UTF-8 encoded string.
 	CString TryConvertFromUTF8(uint8* pComment, int nLengthInBytes);
 
 	// Gets the content of the JPEG comment tag, empty string if no comment
-	CString GetJPEGComment(void* pJPEGStream, int nStreamLength);
+	CString GetJPEGComment(const void* pJPEGStream, int nStreamLength);
 
 	// Clears the JPEG comment (by filling with NULL characters)
 	void ClearJPEGComment(void* pJPEGStream, int nStreamLength);
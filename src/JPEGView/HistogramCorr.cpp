@@ -2,6 +2,7 @@
 #include "HistogramCorr.h"
 #include "JPEGImage.h"
 #include "Helpers.h"
+#include "Tracer.h"
 #include <math.h>
 
 float CHistogramCorr::sm_ContrastCorrectionStrength = 0.5f;
@@ -28,6 +29,7 @@ CHistogram::CHistogram(const CJPEGImage & image, bool bUseOrigPixels)
 	m_ChannelGrey{ 0 }
 {
 	const int NUM_VALUES = 50000;
+	CTraceSpan span(TRACE_Histogram, image.GetImageFormat(), (__int64)image.OrigWidth() * image.OrigHeight());
 
 	m_nBMean = m_nGMean = m_nRMean = 0;
 	m_bUseOrigPixels = bUseOrigPixels;
@@ -84,6 +86,7 @@ CHistogram::CHistogram(const void* pPixels, const CSize& size)
 	m_ChannelB{ 0 },
 	m_ChannelGrey{ 0 }
 {
+	CTraceSpan span(TRACE_Histogram, IF_Unknown, (__int64)size.cx * size.cy);
 	m_nBMean = m_nGMean = m_nRMean = 0;
 	m_fNightshot = -1.0f;
 
@@ -2,6 +2,7 @@
 
 #include "ICCProfileTransform.h"
 #include "SettingsProvider.h"
+#include "Tracer.h"
 
 
 #ifndef WINXP
@@ -81,6 +82,7 @@ bool ICCProfileTransform::DoTransform(void* transform, const void* inputBuffer,
 	}
 	if (stride == 0)
 		stride = width * nchannels;
+	CTraceSpan span(TRACE_ICC, IF_Unknown, numPixels);
 	cmsDoTransformLineStride(transform, inputBuffer, outputBuffer, width, height, stride, Helpers::DoPadding(width * nchannels, 4), stride * height, Helpers::DoPadding(width * nchannels, 4) * height);
 	return true;
 }
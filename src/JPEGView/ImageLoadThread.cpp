@@ -23,6 +23,13 @@
 #include "PSDWrapper.h"
 #include "MaxImageDef.h"
 #include "DDSReader.h"
+#include "ParameterDB.h"
+#include "MappedFile.h"
+#include "AnimationDecoder.h"
+#include "PreviewCache.h"
+#include "PagedPixelBuffer.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
 
 using namespace Gdiplus;
 
@@ -122,6 +129,8 @@ static EImageFormat GetBitmapFormat(Gdiplus::Bitmap * pBitmap) {
 static CJPEGImage* ConvertGDIPlusBitmapToJPEGImage(Gdiplus::Bitmap* pBitmap, int nFrameIndex, void* pEXIFData, 
 	__int64 nJPEGHash, bool &isOutOfMemory, bool &isAnimatedGIF) {
 
+	// GDI+ decodes the image when the pixels are accessed
+	CTraceSpan span(TRACE_Decode, IF_Unknown, (__int64)pBitmap->GetWidth() * pBitmap->GetHeight());
 	isOutOfMemory = false;
 	isAnimatedGIF = false;
 	Gdiplus::Status lastStatus = pBitmap->GetLastStatus();
@@ -220,23 +229,63 @@ static CJPEGImage* ConvertGDIPlusBitmapToJPEGImage(Gdiplus::Bitmap* pBitmap, int
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 CImageLoadThread::CImageLoadThread(void) : CWorkThread(true) {
-	m_pLastBitmap = NULL;
 }
 
 CImageLoadThread::~CImageLoadThread(void) {
-	DeleteCachedGDIBitmap();
-	DeleteCachedWebpDecoder();
-	DeleteCachedPngDecoder();
-	DeleteCachedJxlDecoder();
-	DeleteCachedAvifDecoder();
 }
 
-int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished) {
+CImageLoadThread::CRequest::~CRequest() {
+	delete AnimationDecoder;
+}
+
+int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished, int nPriority,
+								CAnimationDecoder* pAnimationDecoder) {
+	CRequest* pRequest = new CRequest(strFileName, nFrameIndex, targetWnd, processParams, eventFinished);
+	pRequest->Priority = nPriority;
+	pRequest->AnimationDecoder = pAnimationDecoder;
+	int nHandle = pRequest->RequestHandle;
+
+	ProcessAsync(pRequest);
+
+	return nHandle;
+}
+
+int CImageLoadThread::AsyncLoadNextFrame(int nPrecedingHandle, LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd,
+										 HANDLE eventFinished, int nPriority) {
 	CRequest* pRequest = new CRequest(strFileName, nFrameIndex, targetWnd, processParams, eventFinished);
+	pRequest->Priority = nPriority;
+	pRequest->PrecedingHandle = nPrecedingHandle;
+	int nHandle = pRequest->RequestHandle;
 
 	ProcessAsync(pRequest);
 
-	return pRequest->RequestHandle;
+	return nHandle;
+}
+
+bool CImageLoadThread::CancelLoad(int nHandle) {
+	Helpers::CAutoCriticalSection criticalSection(m_csList);
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CRequest* pRequest = (CRequest*)(*iter);
+		if (pRequest->RequestHandle == nHandle) {
+			return CancelRequest(pRequest);
+		}
+	}
+	return false;
+}
+
+void CImageLoadThread::SetLoadPriority(int nHandle, int nPriority) {
+	Helpers::CAutoCriticalSection criticalSection(m_csList);
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CRequest* pRequest = (CRequest*)(*iter);
+		if (pRequest->RequestHandle == nHandle) {
+			pRequest->Priority = nPriority;
+			// the thread searches the request to process again
+			::SetEvent(m_wakeUp);
+			return;
+		}
+	}
 }
 
 CImageData CImageLoadThread::GetLoadedImage(int nHandle) {
@@ -259,169 +308,151 @@ CImageData CImageLoadThread::GetLoadedImage(int nHandle) {
 	return CImageData(imageFound, bFailedMemory, bFailedException);
 }
 
-void CImageLoadThread::ReleaseFile(LPCTSTR strFileName) {
-	CReleaseFileRequest* pRequest = new CReleaseFileRequest(strFileName);
-	ProcessAndWait(pRequest);
-}
-
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Protected
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 // Called on the processing thread
 void CImageLoadThread::ProcessRequest(CRequestBase& request) {
-	if (request.Type == CReleaseFileRequest::ReleaseFileRequest) {
-		CReleaseFileRequest& rq = (CReleaseFileRequest&)request;
-		if (rq.FileName == m_sLastFileName) {
-			DeleteCachedGDIBitmap();
-		}
-		if (rq.FileName == m_sLastWebpFileName) {
-			DeleteCachedWebpDecoder();
-		}
-		if (rq.FileName == m_sLastPngFileName) {
-			DeleteCachedPngDecoder();
-		}
-		if (rq.FileName == m_sLastJxlFileName) {
-			DeleteCachedJxlDecoder();
-		}
-		if (rq.FileName == m_sLastAvifFileName) {
-			DeleteCachedAvifDecoder();
-		}
-		return;
-	}
-
 	CRequest& rq = (CRequest&)request;
+	// the decoders and the processing after loading poll the cancel flag of the request to stop early, see CancelLoad()
+	CProcessingThreadPool::SetCancelFlagOfThread(&rq.Cancelled);
 	double dStartTime = Helpers::GetExactTickCount(); 
-	// Get image format and read the image
-	switch (GetImageFormat(rq.FileName)) {
+	__int64 nPreviewFileHash = 0;
+	// Get image format and read the image, the format of an animation is known from its decoder
+	EImageFormat eImageFormat = (rq.AnimationDecoder != NULL) ? rq.AnimationDecoder->GetImageFormat() : GetImageFormat(rq.FileName);
+	CTraceSpan loadSpan(TRACE_Load, eImageFormat);
+	switch (eImageFormat) {
 		case IF_JPEG :
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadJPEGRequest(&rq);
 			break;
 		case IF_WindowsBMP :
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadBMPRequest(&rq);
 			break;
 		case IF_TGA :
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadTGARequest(&rq);
 			break;
 		case IF_WEBP:
-			DeleteCachedGDIBitmap();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadWEBPRequest(&rq);
 			break;
 		case IF_PNG:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadPNGRequest(&rq);
 			break;
 #ifndef WINXP
 		case IF_JXL:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedAvifDecoder();
-			ProcessReadJXLRequest(&rq);
+			if (!ReadPreviewFromCache(&rq, nPreviewFileHash)) {
+				ProcessReadJXLRequest(&rq);
+			}
 			break;
 		case IF_AVIF:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			ProcessReadAVIFRequest(&rq);
+			if (!ReadPreviewFromCache(&rq, nPreviewFileHash)) {
+				ProcessReadAVIFRequest(&rq);
+			}
 			break;
 		case IF_HEIF:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
-			ProcessReadHEIFRequest(&rq);
+			if (!ReadPreviewFromCache(&rq, nPreviewFileHash)) {
+				ProcessReadHEIFRequest(&rq);
+			}
 			break;
 		case IF_PSD:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
-			ProcessReadPSDRequest(&rq);
+			if (!ReadPreviewFromCache(&rq, nPreviewFileHash)) {
+				ProcessReadPSDRequest(&rq);
+			}
 			break;
 		case IF_CameraRAW:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
-			ProcessReadRAWRequest(&rq);
+			if (!ReadPreviewFromCache(&rq, nPreviewFileHash)) {
+				ProcessReadRAWRequest(&rq);
+			}
 			break;
 #endif
 		case IF_QOI:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadQOIRequest(&rq);
 			break;
 		case IF_WIC:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadWICRequest(&rq);
 			break;
 		case IF_DDS:
-			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadDDSRequest(&rq);
 			break;
 		default:
 			// try with GDI+
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			DeleteCachedJxlDecoder();
-			DeleteCachedAvifDecoder();
 			ProcessReadGDIPlusRequest(&rq);
 			break;
 	}
 	// then process the image if read was successful
-	if (rq.Image != NULL) {
+	if (rq.Image != NULL && !rq.Cancelled) {
+		AddPreviewToCache(&rq, nPreviewFileHash);
 		rq.Image->SetLoadTickCount(Helpers::GetExactTickCount() - dStartTime); 
 		if (!ProcessImageAfterLoad(&rq)) {
 			delete rq.Image;
 			rq.Image = NULL;
 			rq.OutOfMemory = true;
+		} else {
+			rq.Image->UsePagedOriginalPixels();
+			rq.Image->StartBuildingPyramid();
+		}
+	}
+	if (rq.AnimationDecoder != NULL) {
+		if (rq.Image != NULL && !rq.AnimationDecoder->IsEmpty()) {
+			// the image keeps the decoder state for loading the next frame, see CJPEGProvider
+			rq.AnimationDecoder->NextFrameIndex = (rq.FrameIndex + 1) % max(1, rq.Image->NumberOfFrames());
+			rq.AnimationDecoder->FrameSize = CSize(rq.Image->InitOrigWidth(), rq.Image->InitOrigHeight());
+			if (rq.Cancelled || !HandOverAnimationDecoder(&rq)) {
+				rq.Image->SetAnimationDecoder(rq.AnimationDecoder);
+			}
+		} else {
+			delete rq.AnimationDecoder;
+		}
+		rq.AnimationDecoder = NULL;
+	}
+	if (rq.Image != NULL) {
+		loadSpan.SetFormat(rq.Image->GetImageFormat());
+		loadSpan.SetPixels((__int64)rq.Image->OrigWidth() * rq.Image->OrigHeight());
+	}
+	if (rq.Cancelled) {
+		// the result of a cancelled request is discarded, release the memory now and do not report a failure
+		delete rq.Image;
+		rq.Image = NULL;
+		rq.OutOfMemory = false;
+		rq.ExceptionError = false;
+	}
+	CProcessingThreadPool::SetCancelFlagOfThread(NULL);
+}
+
+// Called on the processing thread with the request list locked
+bool CImageLoadThread::IsBlocked(const CRequestBase& request) {
+	const CRequest& rq = (const CRequest&)request;
+	if (rq.PrecedingHandle == 0) {
+		return false;
+	}
+	// wait for the preceding frame, if its request has been cancelled the frame is decoded without decoder state
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CRequest* pRequest = (CRequest*)(*iter);
+		if (pRequest->RequestHandle == rq.PrecedingHandle) {
+			return !pRequest->Processed && !pRequest->Deleted;
 		}
 	}
+	return false;
 }
 
 // Called on the processing thread
-void CImageLoadThread::AfterFinishProcess(CRequestBase& request) {
-	if (request.Type == CReleaseFileRequest::ReleaseFileRequest) {
-		return;
+bool CImageLoadThread::HandOverAnimationDecoder(CRequest* request) {
+	Helpers::CAutoCriticalSection criticalSection(m_csList);
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CRequest* pRequest = (CRequest*)(*iter);
+		if (pRequest->PrecedingHandle == request->RequestHandle && !pRequest->Processed && !pRequest->Deleted &&
+			pRequest->AnimationDecoder == NULL && pRequest->FrameIndex == request->AnimationDecoder->NextFrameIndex) {
+			pRequest->AnimationDecoder = request->AnimationDecoder;
+			return true;
+		}
 	}
+	return false;
+}
 
+// Called on the processing thread
+void CImageLoadThread::AfterFinishProcess(CRequestBase& request) {
 	CRequest& rq = (CRequest&)request;
 	if (rq.TargetWnd != NULL) {
 		// post message to window that request has been processed
@@ -433,6 +464,16 @@ void CImageLoadThread::AfterFinishProcess(CRequestBase& request) {
 // Private
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Multiplies the alpha value into each AABBGGRR pixel, blending the image with the transparency color
+static void BlendAlphaWithBackground(void* pPixelData, int nWidth, int nHeight) {
+	CTraceSpan span(TRACE_ColorConvert, IF_Unknown, (__int64)nWidth * nHeight);
+	COLORREF backgroundColor = CSettingsProvider::This().ColorTransparency();
+	uint32* pImage32 = (uint32*)pPixelData;
+	for (int i = 0; i < nWidth * nHeight; i++) {
+		pImage32[i] = Helpers::AlphaBlendBackground(pImage32[i], backgroundColor);
+	}
+}
+
 static void LimitOffsets(CPoint& offsets, CSize clippingSize, const CSize & imageSize) {
 	int nMaxOffsetX = (imageSize.cx - clippingSize.cx)/2;
 	nMaxOffsetX = max(0, nMaxOffsetX);
@@ -442,115 +483,150 @@ static void LimitOffsets(CPoint& offsets, CSize clippingSize, const CSize & imag
 	offsets.y = max(-nMaxOffsetY, min(+nMaxOffsetY, offsets.y));
 }
 
-void CImageLoadThread::DeleteCachedGDIBitmap() {
-	if (m_pLastBitmap != NULL) {
-		delete m_pLastBitmap;
+// Gets the reduction factor (1, 2, 4 or 8) for decoding a JPEG of the given size with DCT scaling or for a cached preview. The reduced
+// image is still at least as large as needed to display it fit to screen on the monitor, in both orientations as the EXIF rotation is
+// not known yet. Returns 1 if the image must be decoded with full resolution.
+static int GetReductionFactor(const CProcessParams& processParams, int nWidth, int nHeight, __int64 nPixelHash) {
+	if (processParams.Zoom >= 0.0) {
+		return 1;
 	}
-	m_pLastBitmap = NULL;
-	m_sLastFileName.Empty();
-}
-
-void CImageLoadThread::DeleteCachedWebpDecoder() {
-	WebpReaderWriter::DeleteCache();
-	m_sLastWebpFileName.Empty();
+	// zoom and offsets in the parameter DB refer to the full resolution image
+	if (CParameterDB::This().FindEntry(nPixelHash) != NULL) {
+		return 1;
+	}
+	int nScreenWidth = max(processParams.TargetWidth, processParams.MonitorSize.cx);
+	int nScreenHeight = max(processParams.TargetHeight, processParams.MonitorSize.cy);
+	double dZoom;
+	CSize fitSize = Helpers::GetImageRect(nWidth, nHeight, nScreenWidth, nScreenHeight, processParams.AutoZoomMode, dZoom);
+	CSize fitSizeRotated = Helpers::GetImageRect(nHeight, nWidth, nScreenWidth, nScreenHeight, processParams.AutoZoomMode, dZoom);
+	int nMinWidth = max(fitSize.cx, fitSizeRotated.cy);
+	int nMinHeight = max(fitSize.cy, fitSizeRotated.cx);
+	for (int nFactor = 8; nFactor > 1; nFactor /= 2) {
+		if ((nWidth + nFactor - 1) / nFactor >= nMinWidth && (nHeight + nFactor - 1) / nFactor >= nMinHeight) {
+			return nFactor;
+		}
+	}
+	return 1;
 }
 
-void CImageLoadThread::DeleteCachedPngDecoder() {
-#ifndef WINXP
-	PngReader::DeleteCache();
-	m_sLastPngFileName.Empty();
-#endif
+bool CImageLoadThread::CreateAnimationDecoder(CRequest* request, EImageFormat eImageFormat, __int64 nMaxFileSize) {
+	if (request->AnimationDecoder != NULL) {
+		return true;
+	}
+	CMappedFile* pFile = new CMappedFile(request->FileName);
+	if (!pFile->IsValid()) {
+		delete pFile;
+		return false;
+	}
+	// Don't read too huge files
+	if (pFile->Size() > nMaxFileSize) {
+		request->OutOfMemory = true;
+		delete pFile;
+		return false;
+	}
+	// the decoder reads from the mapped file, it is deleted again after loading if the image is not animated
+	request->AnimationDecoder = new CAnimationDecoder(request->FileName, eImageFormat, pFile);
+	return true;
 }
 
-void CImageLoadThread::DeleteCachedJxlDecoder() {
-#ifndef WINXP
-	JxlReader::DeleteCache();
-	m_sLastJxlFileName.Empty();
-#endif
+bool CImageLoadThread::ReadPreviewFromCache(CRequest* request, __int64& nPreviewFileHash) {
+	nPreviewFileHash = 0;
+	if (!GetProcessingFlag(request->ProcessParams.ProcFlags, PFLAG_ReducedResolution) || request->ProcessParams.Zoom >= 0.0 ||
+		request->FrameIndex != 0 || !CPreviewCache::This().IsEnabled()) {
+		return false;
+	}
+	nPreviewFileHash = CPreviewCache::CalculateFileHash(request->FileName);
+	CJPEGImage* pImage = CPreviewCache::This().FindPreview(nPreviewFileHash);
+	if (pImage != NULL && CParameterDB::This().FindEntry(pImage->GetPixelHash()) != NULL) {
+		// zoom and offsets in the parameter DB refer to the full resolution image
+		delete pImage;
+		nPreviewFileHash = 0;
+		return false;
+	}
+	request->Image = pImage;
+	return pImage != NULL;
 }
 
-void CImageLoadThread::DeleteCachedAvifDecoder() {
-#ifndef WINXP
-	// prevent crashing when libavif/dav1d fail or missing
-	UINT nPrevErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS);
-	try {
-		AvifReader::DeleteCache();
-	} catch (...) {}
-	SetErrorMode(nPrevErrorMode);
-	m_sLastAvifFileName.Empty();
-#endif
+void CImageLoadThread::AddPreviewToCache(CRequest* request, __int64 nPreviewFileHash) {
+	CJPEGImage* pImage = request->Image;
+	if (nPreviewFileHash == 0 || pImage->IsReducedResolution() || pImage->IsAnimation() || pImage->NumberOfFrames() > 1) {
+		return;
+	}
+	int nReductionFactor = GetReductionFactor(request->ProcessParams, pImage->OrigWidth(), pImage->OrigHeight(), pImage->GetPixelHash());
+	if (nReductionFactor > 1) {
+		CPreviewCache::This().AddPreview(nPreviewFileHash, pImage, nReductionFactor);
+	}
 }
 
 void CImageLoadThread::ProcessReadJPEGRequest(CRequest * request) {
-	HANDLE hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+	CMappedFile file(request->FileName);
+	if (!file.IsValid()) {
 		return;
 	}
 
-	HGLOBAL hFileBuffer = NULL;
-	void* pBuffer = NULL;
 	try {
 		// Don't read too huge files
-		long long nFileSize = Helpers::GetFileSize(hFile);
+		long long nFileSize = file.Size();
 		if (nFileSize > MAX_JPEG_FILE_SIZE) {
 			request->OutOfMemory = true;
-			::CloseHandle(hFile);
 			return;
 		}
-		hFileBuffer  = ::GlobalAlloc(GMEM_MOVEABLE, nFileSize);
-		pBuffer = (hFileBuffer == NULL) ? NULL : ::GlobalLock(hFileBuffer);
-		if (pBuffer == NULL) {
-			if (hFileBuffer) ::GlobalFree(hFileBuffer);
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-		unsigned int nNumBytesRead;
-		if (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD) &nNumBytesRead, NULL) && nNumBytesRead == nFileSize) {
-			bool bUseGDIPlus = CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles();
-			if (bUseGDIPlus) {
-				IStream* pStream = NULL;
-				if (::CreateStreamOnHGlobal(hFileBuffer, FALSE, &pStream) == S_OK) {
-					Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
-					bool isOutOfMemory, isAnimatedGIF;
-					request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, Helpers::FindEXIFBlock(pBuffer, nFileSize),
-						Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), isOutOfMemory, isAnimatedGIF);
-					request->OutOfMemory = request->Image == NULL && isOutOfMemory;
-					if (request->Image != NULL) {
-						request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
-					}
-					pStream->Release();
-					delete pBitmap;
-				} else {
-					request->OutOfMemory = true;
+		const void* pBuffer = file.Data();
+		bool bUseGDIPlus = CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles();
+		if (bUseGDIPlus) {
+			IStream* pStream = file.CreateStream();
+			if (pStream != NULL) {
+				Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
+				bool isOutOfMemory, isAnimatedGIF;
+				request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, Helpers::FindEXIFBlock(pBuffer, (int)nFileSize),
+					Helpers::CalculateJPEGFileHash(pBuffer, (int)nFileSize), isOutOfMemory, isAnimatedGIF);
+				request->OutOfMemory = request->Image == NULL && isOutOfMemory;
+				if (request->Image != NULL) {
+					request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, (int)nFileSize));
 				}
+				pStream->Release();
+				delete pBitmap;
+			} else {
+				request->OutOfMemory = true;
 			}
-			if (!bUseGDIPlus || request->OutOfMemory) {
-				int nWidth, nHeight, nBPP;
-				TJSAMP eChromoSubSampling;
-				bool bOutOfMemory;
-				// int nTicks = ::GetTickCount();
-
-				void* pPixelData = TurboJpeg::ReadImage(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, pBuffer, nFileSize);
-				
-				/*
-				TCHAR buffer[20];
-				_stprintf_s(buffer, 20, _T("%d"), ::GetTickCount() - nTicks);
-				::MessageBox(NULL, CString(_T("Elapsed ticks: ")) + buffer, _T("Time"), MB_OK);
-				*/
-
-				// Color and b/w JPEG is supported
-				if (pPixelData != NULL && (nBPP == 3 || nBPP == 1)) {
-					request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, 
-						Helpers::FindEXIFBlock(pBuffer, nFileSize), nBPP, 
-						Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), IF_JPEG, false, 0, 1, 0);
-					request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
-					request->Image->SetJPEGChromoSampling(eChromoSubSampling);
-				} else if (bOutOfMemory) {
-					request->OutOfMemory = true;
-				} else {
-					// failed, try GDI+
-					delete[] pPixelData;
+		}
+		if (!bUseGDIPlus || request->OutOfMemory) {
+			int nWidth, nHeight, nBPP;
+			TJSAMP eChromoSubSampling;
+			bool bOutOfMemory;
+			__int64 nPixelHash = Helpers::CalculateJPEGFileHash(pBuffer, (int)nFileSize);
+			int nFullWidth, nFullHeight;
+			int nReductionFactor = 1;
+			if (GetProcessingFlag(request->ProcessParams.ProcFlags, PFLAG_ReducedResolution) && CSettingsProvider::This().ScaledJPEGDecoding() &&
+				TurboJpeg::ReadImageSize(nFullWidth, nFullHeight, pBuffer, (int)nFileSize)) {
+				nReductionFactor = GetReductionFactor(request->ProcessParams, nFullWidth, nFullHeight, nPixelHash);
+			}
+			// int nTicks = ::GetTickCount();
+
+			void* pPixelData = TurboJpeg::ReadImage(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, pBuffer, (int)nFileSize,
+				nReductionFactor, &nReductionFactor);
+			
+			/*
+			TCHAR buffer[20];
+			_stprintf_s(buffer, 20, _T("%d"), ::GetTickCount() - nTicks);
+			::MessageBox(NULL, CString(_T("Elapsed ticks: ")) + buffer, _T("Time"), MB_OK);
+			*/
+
+			// Color and b/w JPEG is supported
+			if (pPixelData != NULL && (nBPP == 3 || nBPP == 1)) {
+				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, 
+					Helpers::FindEXIFBlock(pBuffer, (int)nFileSize), nBPP, nPixelHash, IF_JPEG, false, 0, 1, 0);
+				request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, (int)nFileSize));
+				request->Image->SetJPEGChromoSampling(eChromoSubSampling);
+				if (nReductionFactor > 1) {
+					request->Image->SetReducedResolution(nReductionFactor, CSize(nFullWidth, nFullHeight));
+				}
+			} else if (bOutOfMemory) {
+				request->OutOfMemory = true;
+			} else {
+				CPagedPixelBuffer::FreePixels(pPixelData);
+				// failed, try GDI+ if not failed due to cancellation
+				if (!request->Cancelled) {
 					ProcessReadGDIPlusRequest(request);
 				}
 			}
@@ -560,9 +636,6 @@ void CImageLoadThread::ProcessReadJPEGRequest(CRequest * request) {
 		request->Image = NULL;
 		request->ExceptionError = true;
 	}
-	::CloseHandle(hFile);
-	if (pBuffer) ::GlobalUnlock(hFileBuffer);
-	if (hFileBuffer) ::GlobalFree(hFileBuffer);
 }
 
 
@@ -586,232 +659,110 @@ void CImageLoadThread::ProcessReadTGARequest(CRequest * request) {
 }
 
 void CImageLoadThread::ProcessReadWEBPRequest(CRequest * request) {
-	bool bUseCachedDecoder = false;
-	const wchar_t* sFileName;
-	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastWebpFileName) {
-		DeleteCachedWebpDecoder();
-	}
-	else {
-		bUseCachedDecoder = true;
-	}
-
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!CreateAnimationDecoder(request, IF_WEBP, MAX_WEBP_FILE_SIZE)) {
+		return;
 	}
-	char* pBuffer = NULL;
+	// the decoder state of an animation continues with the next frame, the file data is only read for the first frame
+	CAnimationDecoder* pDecoder = request->AnimationDecoder;
 	try {
-		long long nFileSize = 0;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
-			// Don't read too huge files
-			nFileSize = Helpers::GetFileSize(hFile);
-			if (nFileSize > MAX_WEBP_FILE_SIZE) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-
-			pBuffer = new(std::nothrow) char[nFileSize];
-			if (pBuffer == NULL) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
+		int nWidth, nHeight;
+		bool bHasAnimation = false;
+		int nFrameCount = 1;
+		int nFrameTimeMs = 0;
+		int nBPP;
+		void* pEXIFData;
+		uint8* pPixelData = (uint8*)WebpReaderWriter::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory,
+			pDecoder->WebpCache, pDecoder->MappedFile->Data(), (int)pDecoder->MappedFile->Size());
+		if (pPixelData && nBPP == 4) {
+			BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_WEBP, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
 		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight;
-			bool bHasAnimation = bUseCachedDecoder;
-			int nFrameCount = 1;
-			int nFrameTimeMs = 0;
-			int nBPP;
-			void* pEXIFData;
-			uint8* pPixelData = (uint8*)WebpReaderWriter::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
-			if (pPixelData && nBPP == 4) {
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				if (bHasAnimation) {
-					m_sLastWebpFileName = sFileName;
-				}
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_WEBP, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
-			}
-			else {
-				delete[] pPixelData;
-				DeleteCachedWebpDecoder();
-			}
+		else {
+			delete[] pPixelData;
 		}
 	} catch (...) {
 		delete request->Image;
 		request->Image = NULL;
 	}
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		delete[] pBuffer;
-	}
 }
 
 #ifndef WINXP
 void CImageLoadThread::ProcessReadPNGRequest(CRequest* request) {
-	bool bUseCachedDecoder = false;
-	const wchar_t* sFileName;
-	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastPngFileName) {
-		DeleteCachedPngDecoder();
-	}
-	else {
-		bUseCachedDecoder = true;
-	}
-
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!CreateAnimationDecoder(request, IF_PNG, MAX_PNG_FILE_SIZE)) {
+		return;
 	}
-	HGLOBAL hFileBuffer = NULL;
-	void* pBuffer = NULL;
+	// the decoder state of an animation continues with the next frame, the file data is only read for the first frame
+	CAnimationDecoder* pDecoder = request->AnimationDecoder;
+	bool bUseCachedDecoder = pDecoder->PngCache != NULL;
 	try {
-		long long nFileSize;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
-			// Don't read too huge files
-			nFileSize = Helpers::GetFileSize(hFile);
-			if (nFileSize > MAX_PNG_FILE_SIZE) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-			hFileBuffer = ::GlobalAlloc(GMEM_MOVEABLE, nFileSize);
-			pBuffer = (hFileBuffer == NULL) ? NULL : ::GlobalLock(hFileBuffer);
-			if (pBuffer == NULL) {
-				if (hFileBuffer) ::GlobalFree(hFileBuffer);
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-		} else {
-			nFileSize = 0; // to avoid compiler warnings, not used
-		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
-			bool bHasAnimation;
-			uint8* pPixelData = NULL;
-			void* pEXIFData = NULL;
+		const void* pBuffer = pDecoder->MappedFile->Data();
+		size_t nFileSize = (size_t)pDecoder->MappedFile->Size();
+		int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
+		bool bHasAnimation;
+		uint8* pPixelData = NULL;
+		void* pEXIFData = NULL;
 
 #ifndef WINXP
-			// If UseEmbeddedColorProfiles is true and the image isn't animated, we should use GDI+ for better color management
-			bool bUseGDIPlus = CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles();
-			if (bUseCachedDecoder || !bUseGDIPlus || PngReader::MustUseLibpng(pBuffer, nFileSize))
-				pPixelData = (uint8*)PngReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
+		// If UseEmbeddedColorProfiles is true and the image isn't animated, we should use GDI+ for better color management
+		bool bUseGDIPlus = CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles();
+		if (bUseCachedDecoder || !bUseGDIPlus || PngReader::MustUseLibpng(pBuffer, nFileSize))
+			pPixelData = (uint8*)PngReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory,
+				pDecoder->PngCache, pBuffer, nFileSize);
 #endif
 
-			if (pPixelData != NULL) {
-				if (bHasAnimation)
-					m_sLastPngFileName = sFileName;
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_PNG, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+		if (pPixelData != NULL) {
+			BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_PNG, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+		} else if (!request->Cancelled) {
+			// read with GDI+, there is no animation decoder to keep then
+			PngReader::DeleteCache(pDecoder->PngCache);
+			pDecoder->PngCache = NULL;
+
+			IStream* pStream = pDecoder->MappedFile->CreateStream();
+			if (pStream != NULL) {
+				Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
+				bool isOutOfMemory, isAnimatedGIF;
+				pEXIFData = PngReader::GetEXIFBlock(pBuffer, nFileSize);
+				request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, pEXIFData, 0, isOutOfMemory, isAnimatedGIF);
+				request->OutOfMemory = request->Image == NULL && isOutOfMemory;
+				pStream->Release();
+				delete pBitmap;
 			} else {
-				DeleteCachedPngDecoder();
-				
-				IStream* pStream = NULL;
-				if (::CreateStreamOnHGlobal(hFileBuffer, FALSE, &pStream) == S_OK) {
-					Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
-					bool isOutOfMemory, isAnimatedGIF;
-					pEXIFData = PngReader::GetEXIFBlock(pBuffer, nFileSize);
-					request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, pEXIFData, 0, isOutOfMemory, isAnimatedGIF);
-					request->OutOfMemory = request->Image == NULL && isOutOfMemory;
-					pStream->Release();
-					delete pBitmap;
-				} else {
-					request->OutOfMemory = true;
-				}
+				request->OutOfMemory = true;
 			}
-			free(pEXIFData);
 		}
+		free(pEXIFData);
 	}
 	catch (...) {
 		delete request->Image;
 		request->Image = NULL;
 		request->ExceptionError = true;
 	}
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		if (pBuffer) ::GlobalUnlock(hFileBuffer);
-		if (hFileBuffer) ::GlobalFree(hFileBuffer);
-	}
 }
 #endif
 
 #ifndef WINXP
 void CImageLoadThread::ProcessReadJXLRequest(CRequest* request) {
-	bool bUseCachedDecoder = false;
-	const wchar_t* sFileName;
-	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastJxlFileName) {
-		DeleteCachedJxlDecoder();
-	} else {
-		bUseCachedDecoder = true;
-	}
-
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!CreateAnimationDecoder(request, IF_JXL, MAX_JXL_FILE_SIZE)) {
+		return;
 	}
-	char* pBuffer = NULL;
+	// the decoder state of an animation continues with the next frame, the file data is only read for the first frame
+	CAnimationDecoder* pDecoder = request->AnimationDecoder;
 	UINT nPrevErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS);
 	try {
-		long long nFileSize = 0;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
-			// Don't read too huge files
-			nFileSize = Helpers::GetFileSize(hFile);
-			if (nFileSize > MAX_JXL_FILE_SIZE) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-
-			pBuffer = new(std::nothrow) char[nFileSize];
-			if (pBuffer == NULL) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
-			bool bHasAnimation;
-			void* pEXIFData;
-			uint8* pPixelData = (uint8*)JxlReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
-			if (pPixelData != NULL) {
-				if (bHasAnimation)
-					m_sLastJxlFileName = sFileName;
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_JXL, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
-			} else {
-				DeleteCachedJxlDecoder();
-			}
+		int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
+		bool bHasAnimation;
+		void* pEXIFData;
+		uint8* pPixelData = (uint8*)JxlReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory,
+			pDecoder->JxlCache, pDecoder->MappedFile->Data(), (int)pDecoder->MappedFile->Size());
+		if (pPixelData != NULL) {
+			BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_JXL, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
 		}
 	}
 	catch (...) {
@@ -820,73 +771,30 @@ void CImageLoadThread::ProcessReadJXLRequest(CRequest* request) {
 		request->ExceptionError = true;
 	}
 	SetErrorMode(nPrevErrorMode);
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		// delete[] pBuffer;
-	}
 }
 #endif
 
 #ifndef WINXP
 void CImageLoadThread::ProcessReadAVIFRequest(CRequest* request) {
 	bool bSuccess = false;
-	bool bUseCachedDecoder = false;
-	const wchar_t* sFileName;
-	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastAvifFileName) {
-		DeleteCachedAvifDecoder();
-	} else {
-		bUseCachedDecoder = true;
-	}
-
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!CreateAnimationDecoder(request, IF_AVIF, MAX_HEIF_FILE_SIZE)) {
+		return;
 	}
-	char* pBuffer = NULL;
+	// the decoder state of an animation can decode any frame, the file data is only read for the first frame
+	CAnimationDecoder* pDecoder = request->AnimationDecoder;
 	UINT nPrevErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS);
 	try {
-		long long nFileSize = 0;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
-			// Don't read too huge files
-			nFileSize = Helpers::GetFileSize(hFile);
-			if (nFileSize > MAX_HEIF_FILE_SIZE) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-
-			pBuffer = new(std::nothrow) char[nFileSize];
-			if (pBuffer == NULL) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
-			bool bHasAnimation;
-			void* pEXIFData;
-			uint8* pPixelData = (uint8*)AvifReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, request->FrameIndex, 
-				nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
-			if (pPixelData != NULL) {
-				if (bHasAnimation)
-					m_sLastAvifFileName = sFileName;
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_AVIF, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
-				bSuccess = true;
-			} else {
-				DeleteCachedAvifDecoder();
-			}
+		int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
+		bool bHasAnimation;
+		void* pEXIFData;
+		uint8* pPixelData = (uint8*)AvifReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs, pEXIFData,
+			request->OutOfMemory, pDecoder->AvifCache, pDecoder->MappedFile->Data(), (int)pDecoder->MappedFile->Size());
+		if (pPixelData != NULL) {
+			BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_AVIF, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
+			bSuccess = true;
 		}
 	}
 	catch (...) {
@@ -895,55 +803,38 @@ void CImageLoadThread::ProcessReadAVIFRequest(CRequest* request) {
 		request->ExceptionError = true;
 	}
 	SetErrorMode(nPrevErrorMode);
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		delete[] pBuffer;
-	}
-	if (!bSuccess)
+	if (!bSuccess) {
+		// libheif reads the file again, release the decoder before
+		delete request->AnimationDecoder;
+		request->AnimationDecoder = NULL;
 		return ProcessReadHEIFRequest(request);
+	}
 }
 #endif
 
 #ifndef WINXP
 void CImageLoadThread::ProcessReadHEIFRequest(CRequest* request) {
-	HANDLE hFile;
-	hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+	CMappedFile file(request->FileName);
+	if (!file.IsValid()) {
+		return;
+	}
+	// Don't read too huge files
+	if (file.Size() > MAX_HEIF_FILE_SIZE) {
+		request->OutOfMemory = true;
 		return;
 	}
-	char* pBuffer = NULL;
 	UINT nPrevErrorMode = SetErrorMode(SEM_FAILCRITICALERRORS);
 	try {
-		unsigned int nNumBytesRead;
-		// Don't read too huge files
-		long long nFileSize = Helpers::GetFileSize(hFile);
-		if (nFileSize > MAX_HEIF_FILE_SIZE) {
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-
-		pBuffer = new(std::nothrow) char[nFileSize];
-		if (pBuffer == NULL) {
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-		if (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize) {
-			int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
-			nFrameCount = 1;
-			nFrameTimeMs = 0;
-			void* pEXIFData;
-			uint8* pPixelData = (uint8*)HeifReader::ReadImage(nWidth, nHeight, nBPP, nFrameCount, pEXIFData, request->OutOfMemory, request->FrameIndex, pBuffer, nFileSize);
-			if (pPixelData != NULL) {
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_HEIF, false, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
-			}
+		int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
+		nFrameCount = 1;
+		nFrameTimeMs = 0;
+		void* pEXIFData;
+		uint8* pPixelData = (uint8*)HeifReader::ReadImage(nWidth, nHeight, nBPP, nFrameCount, pEXIFData, request->OutOfMemory, request->FrameIndex, file.Data(), (int)file.Size());
+		if (pPixelData != NULL) {
+			BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_HEIF, false, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
 		}
 	} catch(heif::Error he) {
 		// invalid image
@@ -955,13 +846,11 @@ void CImageLoadThread::ProcessReadHEIFRequest(CRequest* request) {
 		request->ExceptionError = true;
 	}
 	SetErrorMode(nPrevErrorMode);
-	::CloseHandle(hFile);
-	delete[] pBuffer;
 }
 
 void CImageLoadThread::ProcessReadPSDRequest(CRequest* request) {
 	request->Image = PsdReader::ReadImage(request->FileName, request->OutOfMemory);
-	if (request->Image == NULL && !request->OutOfMemory) {
+	if (request->Image == NULL && !request->OutOfMemory && !request->Cancelled) {
 		request->Image = PsdReader::ReadThumb(request->FileName, request->OutOfMemory);
 	}
 }
@@ -969,48 +858,29 @@ void CImageLoadThread::ProcessReadPSDRequest(CRequest* request) {
 #endif
 
 void CImageLoadThread::ProcessReadQOIRequest(CRequest* request) {
-	HANDLE hFile;
-	hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+	CMappedFile file(request->FileName);
+	if (!file.IsValid()) {
+		return;
+	}
+	// Don't read too huge files
+	if (file.Size() > MAX_PNG_FILE_SIZE) {
+		request->OutOfMemory = true;
 		return;
 	}
-	char* pBuffer = NULL;
 	try {
-		unsigned int nNumBytesRead;
-		// Don't read too huge files
-		long long nFileSize = Helpers::GetFileSize(hFile);
-		if (nFileSize > MAX_PNG_FILE_SIZE) {
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-
-		pBuffer = new(std::nothrow) char[nFileSize];
-		if (pBuffer == NULL) {
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-		if (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize) {
-			int nWidth, nHeight, nBPP;
-			void* pPixelData = QoiReaderWriter::ReadImage(nWidth, nHeight, nBPP, request->OutOfMemory, pBuffer, nFileSize);
-			if (pPixelData != NULL) {
-				if (nBPP == 4) {
-					// Multiply alpha value into each AABBGGRR pixel
-					uint32* pImage32 = (uint32*)pPixelData;
-					for (int i = 0; i < nWidth * nHeight; i++)
-						*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-				}
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, NULL, nBPP, 0, IF_QOI, false, 0, 1, 0);
+		int nWidth, nHeight, nBPP;
+		void* pPixelData = QoiReaderWriter::ReadImage(nWidth, nHeight, nBPP, request->OutOfMemory, file.Data(), (int)file.Size());
+		if (pPixelData != NULL) {
+			if (nBPP == 4) {
+				BlendAlphaWithBackground(pPixelData, nWidth, nHeight);
 			}
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, NULL, nBPP, 0, IF_QOI, false, 0, 1, 0);
 		}
 	} catch (...) {
 		delete request->Image;
 		request->Image = NULL;
 		request->ExceptionError = true;
 	}
-	::CloseHandle(hFile);
-	delete[] pBuffer;
 }
 
 void CImageLoadThread::ProcessReadRAWRequest(CRequest * request) {
@@ -1025,10 +895,10 @@ void CImageLoadThread::ProcessReadRAWRequest(CRequest * request) {
 			if (fullsize == 2 || fullsize == 3) {
 				request->Image = RawReader::ReadImage(request->FileName, bOutOfMemory, fullsize == 2);
 			}
-			if (request->Image == NULL && fullsize == 2) {
+			if (request->Image == NULL && fullsize == 2 && !request->Cancelled) {
 				request->Image = CReaderRAW::ReadRawImage(request->FileName, bOutOfMemory);
 			}
-			if (request->Image == NULL) {
+			if (request->Image == NULL && !request->Cancelled) {
 				request->Image = RawReader::ReadImage(request->FileName, bOutOfMemory, fullsize == 0 || fullsize == 3);
 			}
 		} catch (...) {
@@ -1040,7 +910,7 @@ void CImageLoadThread::ProcessReadRAWRequest(CRequest * request) {
 #endif
 
 		// Try with dcraw_mod
-		if (request->Image == NULL && fullsize != 1 && fullsize != 2) {
+		if (request->Image == NULL && fullsize != 1 && fullsize != 2 && !request->Cancelled) {
 			request->Image = CReaderRAW::ReadRawImage(request->FileName, bOutOfMemory);
 		}
 	} catch (...) {
@@ -1056,19 +926,18 @@ void CImageLoadThread::ProcessReadGDIPlusRequest(CRequest * request) {
 	const wchar_t* sFileName;
 	sFileName = (const wchar_t*)request->FileName;
 
-	Gdiplus::Bitmap* pBitmap = NULL;
-	if (sFileName == m_sLastFileName) {
-		pBitmap = m_pLastBitmap;
-	} else {
-		DeleteCachedGDIBitmap();
-		m_pLastBitmap = pBitmap = new Gdiplus::Bitmap(sFileName, CSettingsProvider::This().UseEmbeddedColorProfiles());
-		m_sLastFileName = sFileName;
+	// the bitmap is kept with the decoder state of animated GIFs to speed up the animation
+	CAnimationDecoder* pDecoder = request->AnimationDecoder;
+	if (pDecoder == NULL) {
+		pDecoder = request->AnimationDecoder = new CAnimationDecoder(sFileName, IF_GIF, NULL);
+		pDecoder->GDIPlusBitmap = new Gdiplus::Bitmap(sFileName, CSettingsProvider::This().UseEmbeddedColorProfiles());
 	}
 	bool isOutOfMemory, isAnimatedGIF;
-	request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, request->FrameIndex, NULL, 0, isOutOfMemory, isAnimatedGIF);
+	request->Image = ConvertGDIPlusBitmapToJPEGImage(pDecoder->GDIPlusBitmap, request->FrameIndex, NULL, 0, isOutOfMemory, isAnimatedGIF);
 	request->OutOfMemory = request->Image == NULL && isOutOfMemory;
 	if (!isAnimatedGIF) {
-		DeleteCachedGDIBitmap();
+		delete pDecoder;
+		request->AnimationDecoder = NULL;
 	}
 }
 
@@ -1078,12 +947,13 @@ void CImageLoadThread::ProcessReadDDSRequest(CRequest* request) {
 	request->Image = CReaderDDS::ReadDdsImage(sFileName, request->OutOfMemory);
 }
 
+// WIC decodes to 32 bpp, huge images directly into a paged buffer
 static unsigned char* alloc(int sizeInBytes) {
-	return new(std::nothrow) unsigned char[sizeInBytes];
+	return (unsigned char*)CPagedPixelBuffer::AllocatePixels(sizeInBytes, 4);
 }
 
 static void dealloc(unsigned char* buffer) {
-	delete[] buffer;
+	CPagedPixelBuffer::FreePixels(buffer);
 }
 
 typedef unsigned char* Allocator(int sizeInBytes);
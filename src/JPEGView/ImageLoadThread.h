@@ -6,6 +6,7 @@
 #include <gdiplus.h>
 
 class CJPEGImage;
+class CAnimationDecoder;
 
 // returned image data by CImageLoadThread.GetLoadedImage() method
 class CImageData
@@ -38,16 +39,31 @@ public:
 	// received or the event has been signaled.
 	// The file to load is given by its filename (with path) and the frame index (for multiframe images). The
 	// frame index needs to be zero when the image only has one frame.
-	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished);
+	// Requests with higher priority are loaded first.
+	// pAnimationDecoder is the decoder state of the animation to continue decoding with (see CAnimationDecoder), can be NULL.
+	// Ownership of the decoder goes to the request, it is handed over to the loaded image.
+	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished, int nPriority = 0,
+		CAnimationDecoder* pAnimationDecoder = NULL);
+
+	// Asynchronous loading of the frame of an animation following the frame loaded by the request with the given handle.
+	// The request is not processed before the preceding request has finished and continues with its decoder state then,
+	// so several frames of an animation can be decoded ahead in sequence. Parameters and return value as for AsyncLoad().
+	int AsyncLoadNextFrame(int nPrecedingHandle, LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd,
+		HANDLE eventFinished, int nPriority);
+
+	// Removes the request with the given handle from the queue if loading has not started yet. Returns false if the image is
+	// loading or loaded, GetLoadedImage() must be used to get (and delete) the image after the request has finished then.
+	// A request being loaded is cancelled, decoding stops as soon as possible and no image is returned.
+	bool CancelLoad(int nHandle);
+
+	// Changes the priority of the request with the given handle if loading has not started yet
+	void SetLoadPriority(int nHandle, int nPriority);
 
 	// Get loaded image, CImageData::Image is null if not (yet) available - use handle returned by AsyncLoad().
 	// Call after having received the WM_IMAGE_LOAD_COMPLETED message to retrieve the loaded image.
 	// Marks the request for deletion - only call once with the same handle
 	CImageData GetLoadedImage(int nHandle);
 
-	// Releases the cached image file if an image of the specified name is cached
-	void ReleaseFile(LPCTSTR strFileName);
-
 	// Gets the request handle value used for the last request
 	static int GetCurHandleValue() { return m_curHandle; }
 
@@ -63,49 +79,34 @@ private:
 			TargetWnd = wndTarget;
 			RequestHandle = ::InterlockedIncrement((LONG*)&m_curHandle);
 			Image = NULL;
+			AnimationDecoder = NULL;
+			PrecedingHandle = 0;
 			OutOfMemory = false;
 			ExceptionError = false;
 		}
+		~CRequest();
 
 		CString FileName;
 		int FrameIndex;
 		HWND TargetWnd;
 		int RequestHandle;
 		CJPEGImage* Image;
+		CAnimationDecoder* AnimationDecoder; // decoder state of the animation, handed over to the image after loading
+		int PrecedingHandle; // request loading the previous frame of the animation that hands over its decoder state, 0 if none
 		CProcessParams ProcessParams;
 		bool OutOfMemory;  // load caused an out of memory condition
 		bool ExceptionError;  // an unhandled exception caused the load to fail
 	};
 
-	// Request to release image file
-	class CReleaseFileRequest : public CRequestBase {
-	public:
-		CReleaseFileRequest(LPCTSTR strFileName) : CRequestBase() {
-			FileName = strFileName;
-			Type = ReleaseFileRequest;
-		}
-
-		enum { ReleaseFileRequest = 1 };
-
-		CString FileName;
-	};
-
 	static volatile int m_curHandle; // Request handle returned by AsyncLoad()
 
-	Gdiplus::Bitmap* m_pLastBitmap; // Last read GDI+ bitmap, cached to speed up GIF animations
-	CString m_sLastFileName; // Only for GDI+ files
-	CString m_sLastWebpFileName; // Only for animated WebP files
-	CString m_sLastPngFileName; // Only for animated PNG files
-	CString m_sLastJxlFileName; // Only for animated JPEG XL files
-	CString m_sLastAvifFileName; // Only for animated AVIF files
-
 	virtual void ProcessRequest(CRequestBase& request);
 	virtual void AfterFinishProcess(CRequestBase& request);
-	void DeleteCachedGDIBitmap();
-	void DeleteCachedWebpDecoder();
-	void DeleteCachedPngDecoder();
-	void DeleteCachedJxlDecoder();
-	void DeleteCachedAvifDecoder();
+	virtual bool IsBlocked(const CRequestBase& request);
+
+	// Hands the decoder state of the request over to the queued request loading the next frame, see AsyncLoadNextFrame().
+	// Returns false if there is no such request.
+	bool HandOverAnimationDecoder(CRequest* request);
 
 	void ProcessReadJPEGRequest(CRequest * request);
 	void ProcessReadPNGRequest(CRequest * request);
@@ -122,6 +123,15 @@ private:
 	void ProcessReadWICRequest(CRequest* request);
 	void ProcessReadDDSRequest(CRequest* request);
 
+	// Creates the decoder state of the request on the mapped file if the request has none (formats with animations).
+	// Returns false if the file cannot be read or is larger than nMaxFileSize.
+	static bool CreateAnimationDecoder(CRequest* request, EImageFormat eImageFormat, __int64 nMaxFileSize);
+
+	// Reads the preview of an image that is slow to decode from the preview cache if the image is displayed fit to screen.
+	// nPreviewFileHash receives the hash of the file if the preview of the image shall be added to the cache after decoding.
+	bool ReadPreviewFromCache(CRequest* request, __int64& nPreviewFileHash);
+	void AddPreviewToCache(CRequest* request, __int64 nPreviewFileHash);
+
 	static void SetFileDependentProcessParams(CRequest * request);
 	static bool ProcessImageAfterLoad(CRequest * request);
 };
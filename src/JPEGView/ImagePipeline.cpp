@@ -0,0 +1,92 @@
+#include "StdAfx.h"
+#include "ImagePipeline.h"
+#include "ImageLoadThread.h"
+#include "JPEGImage.h"
+#include "SaveImage.h"
+#include "SettingsProvider.h"
+#include "MaxImageDef.h"
+#include "Helpers.h"
+
+///////////////////////////////////////////////////////////////////////////////////
+// Public interface
+///////////////////////////////////////////////////////////////////////////////////
+
+CImagePipeline::CImagePipeline() {
+	m_pLoadThread = new CImageLoadThread();
+	m_hEventFinished = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_dLastDecodeTime = 0.0;
+	m_dLastResizeTime = 0.0;
+	m_dLastSaveTime = 0.0;
+}
+
+CImagePipeline::~CImagePipeline() {
+	delete m_pLoadThread;
+	m_pLoadThread = NULL;
+	::CloseHandle(m_hEventFinished);
+}
+
+CJPEGImage* CImagePipeline::Decode(LPCTSTR sFileName, bool& bOutOfMemory) {
+	double dStartTime = Helpers::GetExactTickCount();
+
+	// The image is only decoded (and rotated by EXIF), it is not resampled to any target size
+	CProcessParams params(0, 0, CSize(0, 0), CRotationParams(0), 0, 1.0, Helpers::ZM_FitToScreenNoZoom, CPoint(0, 0),
+		DefaultProcessingParams(), SetProcessingFlag(DefaultProcessingFlags(), PFLAG_NoProcessingAfterLoad, true));
+	int nHandle = m_pLoadThread->AsyncLoad(sFileName, 0, params, NULL, m_hEventFinished);
+	::WaitForSingleObject(m_hEventFinished, INFINITE);
+	CImageData imageData = m_pLoadThread->GetLoadedImage(nHandle);
+
+	bOutOfMemory = imageData.IsRequestFailedOutOfMemory;
+	m_dLastDecodeTime = Helpers::GetExactTickCount() - dStartTime;
+	return imageData.Image;
+}
+
+bool CImagePipeline::Resize(CJPEGImage* pImage, CSize newSize, EResizeFilter eFilter) {
+	if (pImage == NULL || (newSize.cx <= 0 && newSize.cy <= 0)) {
+		return false;
+	}
+	if (newSize.cx <= 0) {
+		newSize.cx = max(1, Helpers::RoundToInt((double)newSize.cy * pImage->OrigWidth() / pImage->OrigHeight()));
+	} else if (newSize.cy <= 0) {
+		newSize.cy = max(1, Helpers::RoundToInt((double)newSize.cx * pImage->OrigHeight() / pImage->OrigWidth()));
+	}
+
+	double dStartTime = Helpers::GetExactTickCount();
+	bool bSuccess = pImage->ResizeOriginalPixels(eFilter, newSize);
+	m_dLastResizeTime = Helpers::GetExactTickCount() - dStartTime;
+	return bSuccess;
+}
+
+bool CImagePipeline::Save(LPCTSTR sFileName, CJPEGImage* pImage, const CImageProcessingParams& procParams, EProcessingFlags eFlags) {
+	if (pImage == NULL) {
+		return false;
+	}
+	double dStartTime = Helpers::GetExactTickCount();
+	bool bSuccess = CSaveImage::SaveImage(sFileName, pImage, procParams, eFlags, true, false, false);
+	m_dLastSaveTime = Helpers::GetExactTickCount() - dStartTime;
+	return bSuccess;
+}
+
+CImageProcessingParams CImagePipeline::DefaultProcessingParams() {
+	CSettingsProvider& sp = CSettingsProvider::This();
+	return CImageProcessingParams(
+		sp.Contrast(),
+		sp.Gamma(),
+		sp.Saturation(),
+		sp.Sharpen(),
+		0.0, 0.5,
+		sp.BrightenShadows(),
+		sp.DarkenHighlights(),
+		sp.BrightenShadowsSteepness(),
+		sp.CyanRed(),
+		sp.MagentaGreen(),
+		sp.YellowBlue());
+}
+
+EProcessingFlags CImagePipeline::DefaultProcessingFlags() {
+	CSettingsProvider& sp = CSettingsProvider::This();
+	EProcessingFlags eProcFlags = PFLAG_None;
+	eProcFlags = SetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling, sp.HighQualityResampling());
+	eProcFlags = SetProcessingFlag(eProcFlags, PFLAG_AutoContrast, sp.AutoContrastCorrection());
+	eProcFlags = SetProcessingFlag(eProcFlags, PFLAG_LDC, sp.LocalDensityCorrection());
+	return eProcFlags;
+}
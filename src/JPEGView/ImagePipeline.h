@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ProcessParams.h"
+#include "ImageProcessingTypes.h"
+
+class CJPEGImage;
+class CImageLoadThread;
+
+// Headless image pipeline: decodes, resizes, processes and saves images synchronously without needing a window,
+// a message loop or GDI. Uses exactly the same decoders and processing code as the viewer.
+// Used by the command line interface (see CCommandLineTool) to pre-generate previews and to time the pipeline.
+class CImagePipeline
+{
+public:
+	CImagePipeline();
+	~CImagePipeline();
+
+	// Decodes the given file. The caller takes ownership of the returned image.
+	// Returns NULL if the file cannot be decoded, bOutOfMemory is set if decoding failed because of missing memory.
+	// The image is rotated according to EXIF but not processed otherwise.
+	CJPEGImage* Decode(LPCTSTR sFileName, bool& bOutOfMemory);
+
+	// Resizes the original pixels of the image to the given size using the given filter.
+	// If one of the dimensions of newSize is zero, it is calculated from the other dimension keeping the aspect ratio.
+	bool Resize(CJPEGImage* pImage, CSize newSize, EResizeFilter eFilter);
+
+	// Processes the full sized image with the given parameters and saves it, the file format is derived from the file ending
+	bool Save(LPCTSTR sFileName, CJPEGImage* pImage, const CImageProcessingParams& procParams, EProcessingFlags eFlags);
+
+	// Default image processing parameters as set in INI file
+	static CImageProcessingParams DefaultProcessingParams();
+
+	// Default image processing flags as set in INI file
+	static EProcessingFlags DefaultProcessingFlags();
+
+	// Time in milliseconds used for the last decode, resize and save operation
+	double LastDecodeTime() const { return m_dLastDecodeTime; }
+	double LastResizeTime() const { return m_dLastResizeTime; }
+	double LastSaveTime() const { return m_dLastSaveTime; }
+
+private:
+	CImageLoadThread* m_pLoadThread;
+	HANDLE m_hEventFinished;
+	double m_dLastDecodeTime;
+	double m_dLastResizeTime;
+	double m_dLastSaveTime;
+};
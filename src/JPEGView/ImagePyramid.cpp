@@ -0,0 +1,118 @@
+#include "StdAfx.h"
+#include "ImagePyramid.h"
+#include "Helpers.h"
+#include <process.h>
+
+// No more levels are built when one of the dimensions of the next level would be smaller than this
+static const int MIN_LEVEL_SIZE = 64;
+
+// The cancel flag is checked after this number of rows
+static const int CANCEL_CHECK_ROWS = 64;
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CImagePyramid::CImagePyramid(const void* pSourcePixels, CSize sourceSize, int nSourceChannels)
+	: m_csLevels{ 0 }
+{
+	m_pSourcePixels = pSourcePixels;
+	m_sourceSize = sourceSize;
+	m_nSourceChannels = nSourceChannels;
+	memset(m_pLevels, 0, sizeof(m_pLevels));
+	m_nNumLevels = 0;
+	m_bSourceReleased = false;
+	m_bTerminate = false;
+	::InitializeCriticalSection(&m_csLevels);
+
+	m_hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadFunc, this, 0, NULL);
+	if (m_hThread == NULL) {
+		m_bSourceReleased = true;
+	} else {
+		::SetThreadPriority(m_hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	}
+}
+
+CImagePyramid::~CImagePyramid() {
+	m_bTerminate = true;
+	if (m_hThread != NULL) {
+		::WaitForSingleObject(m_hThread, INFINITE);
+		::CloseHandle(m_hThread);
+	}
+	for (int i = 0; i < m_nNumLevels; i++) {
+		delete[] m_pLevels[i];
+	}
+	::DeleteCriticalSection(&m_csLevels);
+}
+
+const void* CImagePyramid::GetLevel(CSize minSize, CSize& levelSize) {
+	Helpers::CAutoCriticalSection criticalSection(m_csLevels);
+	for (int i = m_nNumLevels - 1; i >= 0; i--) {
+		if (m_levelSizes[i].cx >= minSize.cx && m_levelSizes[i].cy >= minSize.cy) {
+			levelSize = m_levelSizes[i];
+			return m_pLevels[i];
+		}
+	}
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int __stdcall CImagePyramid::ThreadFunc(void* arg) {
+	((CImagePyramid*)arg)->BuildLevels();
+	return 0;
+}
+
+void CImagePyramid::BuildLevels() {
+	const void* pPixels = m_pSourcePixels;
+	CSize size = m_sourceSize;
+	int nChannels = m_nSourceChannels;
+	while (m_nNumLevels < MAX_LEVELS && (size.cx + 1) / 2 >= MIN_LEVEL_SIZE && (size.cy + 1) / 2 >= MIN_LEVEL_SIZE) {
+		CSize newSize;
+		void* pLevel = HalveImage(pPixels, size, nChannels, newSize);
+		m_bSourceReleased = true;
+		if (pLevel == NULL) {
+			return;
+		}
+		{
+			Helpers::CAutoCriticalSection criticalSection(m_csLevels);
+			m_pLevels[m_nNumLevels] = pLevel;
+			m_levelSizes[m_nNumLevels] = newSize;
+			m_nNumLevels++;
+		}
+		pPixels = pLevel;
+		size = newSize;
+		nChannels = 4;
+	}
+	m_bSourceReleased = true;
+}
+
+void* CImagePyramid::HalveImage(const void* pPixels, CSize size, int nChannels, CSize& newSize) {
+	newSize = CSize((size.cx + 1) / 2, (size.cy + 1) / 2);
+	uint32* pTarget = new(std::nothrow) uint32[newSize.cx * newSize.cy];
+	if (pTarget == NULL) {
+		return NULL;
+	}
+	int nSourceStride = Helpers::DoPadding(size.cx * nChannels, 4);
+	uint32* pDst = pTarget;
+	for (int j = 0; j < newSize.cy; j++) {
+		if (j % CANCEL_CHECK_ROWS == 0 && m_bTerminate) {
+			delete[] pTarget;
+			return NULL;
+		}
+		const uint8* pRow0 = (const uint8*)pPixels + (__int64)(2 * j) * nSourceStride;
+		const uint8* pRow1 = (2 * j + 1 < size.cy) ? pRow0 + nSourceStride : pRow0;
+		for (int i = 0; i < newSize.cx; i++) {
+			int nOffset0 = 2 * i * nChannels;
+			int nOffset1 = (2 * i + 1 < size.cx) ? nOffset0 + nChannels : nOffset0;
+			uint32 nBlue = (pRow0[nOffset0] + pRow0[nOffset1] + pRow1[nOffset0] + pRow1[nOffset1] + 2) >> 2;
+			uint32 nGreen = (pRow0[nOffset0 + 1] + pRow0[nOffset1 + 1] + pRow1[nOffset0 + 1] + pRow1[nOffset1 + 1] + 2) >> 2;
+			uint32 nRed = (pRow0[nOffset0 + 2] + pRow0[nOffset1 + 2] + pRow1[nOffset0 + 2] + pRow1[nOffset1 + 2] + 2) >> 2;
+			uint32 nAlpha = (nChannels == 4) ? (pRow0[nOffset0 + 3] + pRow0[nOffset1 + 3] + pRow1[nOffset0 + 3] + pRow1[nOffset1 + 3] + 2) >> 2 : 0xFF;
+			*pDst++ = nBlue + (nGreen << 8) + (nRed << 16) + (nAlpha << 24);
+		}
+	}
+	return pTarget;
+}
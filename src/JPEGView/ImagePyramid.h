@@ -0,0 +1,47 @@
+#pragma once
+
+// Multi-resolution pyramid (1/2, 1/4, 1/8, ... of the original size) of an image, built lazily on a background thread.
+// Downsampling to a small target size can start from the smallest level that is still at least as large as the target,
+// so the cost of resampling is proportional to the target size and not to the size of the original image.
+// The levels are 32 bpp BGRA, each level is created from the previous level with a 2x2 box filter.
+// The alpha channel of 4 channel images is averaged too, 3 channel images get opaque levels.
+class CImagePyramid
+{
+public:
+	// The source pixels (3 or 4 channels) are not copied. They are only read until IsSourceReleased() returns true,
+	// the caller must keep them valid until then or delete the pyramid before.
+	// Starts building the levels on a background thread.
+	CImagePyramid(const void* pSourcePixels, CSize sourceSize, int nSourceChannels);
+	// Stops building the levels (waits for the background thread) and frees all levels
+	~CImagePyramid();
+
+	// Gets the smallest level that is at least as large as the given size in both dimensions, levelSize receives its size.
+	// Returns NULL if no such level has been built yet, the original image must be used then.
+	// The returned pixels are valid as long as the pyramid lives.
+	const void* GetLevel(CSize minSize, CSize& levelSize);
+
+	// Returns true if the background thread does no longer read the source pixels
+	bool IsSourceReleased() const { return m_bSourceReleased; }
+
+private:
+	enum { MAX_LEVELS = 16 };
+
+	const void* m_pSourcePixels;
+	CSize m_sourceSize;
+	int m_nSourceChannels;
+	void* m_pLevels[MAX_LEVELS];
+	CSize m_levelSizes[MAX_LEVELS];
+	volatile int m_nNumLevels; // number of levels that are completely built
+	volatile bool m_bSourceReleased;
+	volatile bool m_bTerminate;
+	HANDLE m_hThread;
+	CRITICAL_SECTION m_csLevels;
+
+	static unsigned int __stdcall ThreadFunc(void* arg);
+	void BuildLevels();
+	// Creates one level with half the size of the given image, returns NULL if cancelled or out of memory
+	void* HalveImage(const void* pPixels, CSize size, int nChannels, CSize& newSize);
+
+	CImagePyramid(const CImagePyramid&);
+	CImagePyramid& operator=(const CImagePyramid&);
+};
@@ -10,6 +10,11 @@
 #include "EXIFReader.h"
 #include "RawMetadata.h"
 #include "MaxImageDef.h"
+#include "PagedPixelBuffer.h"
+#include "ImagePyramid.h"
+#include "AsyncResampler.h"
+#include "AnimationDecoder.h"
+#include "Tracer.h"
 #include "libjpeg-turbo\include\turbojpeg.h"
 #include <math.h>
 #include <assert.h>
@@ -18,6 +23,13 @@
 // undefine this flag to investigate which optimization might cause that particular failure (TODO)
 #define AVX_SSE_FREEZE_FALLBACK
 
+// Images with less pixels get no downsampling pyramid, resampling them is fast anyway
+static const int MIN_PYRAMID_PIXELS = 4000000;
+
+// High quality resampling reading less source pixels (or producing less target pixels) is done synchronously in GetDIB(),
+// it is fast enough to not delay the display noticeably
+static const double MIN_ASYNC_RESAMPLE_PIXELS = 4000000;
+
 ///////////////////////////////////////////////////////////////////////////////////
 // Static helpers
 ///////////////////////////////////////////////////////////////////////////////////
@@ -68,12 +80,14 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 	: m_rotationParams{ 0 },
 	m_fColorCorrectionFactorsNull{ 0 }
 {
+	m_pPagedOrigPixels = NULL;
 	if (nChannels == 3 || nChannels == 4) {
 		m_pOrigPixels = pPixels;
+		m_pPagedOrigPixels = CPagedPixelBuffer::TakeOver(pPixels);
 		m_nOriginalChannels = nChannels;
 	} else if (nChannels == 1) {
 		m_pOrigPixels = CBasicProcessing::Convert1To4Channels(nWidth, nHeight, pPixels);
-		delete[] pPixels;
+		CPagedPixelBuffer::FreePixels(pPixels);
 		m_nOriginalChannels = 4;
 	} else {
 		assert(false);
@@ -105,6 +119,12 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 
 	m_nOrigWidth = m_nInitOrigWidth = nWidth;
 	m_nOrigHeight = m_nInitOrigHeight = nHeight;
+	m_nReductionFactor = 1;
+	m_bPagedOrigPixels = m_pPagedOrigPixels != NULL;
+	m_pPyramid = NULL;
+	m_bUsePyramid = false;
+	m_bAsyncResampling = false;
+	m_pAnimationDecoder = NULL;
 	m_pDIBPixels = NULL;
 	m_pDIBPixelsLUTProcessed = NULL;
 	m_pLastDIB = NULL;
@@ -159,8 +179,10 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 }
 
 CJPEGImage::~CJPEGImage(void) {
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = NULL;
+	StopResampleHQAsync(); // stops reading the original pixels
+	delete m_pPyramid; // stops reading the original pixels
+	m_pPyramid = NULL;
+	FreeOriginalPixels();
 	delete[] m_pDIBPixels;
 	m_pDIBPixels = NULL;
 	delete[] m_pDIBPixelsLUTProcessed;
@@ -192,6 +214,8 @@ CJPEGImage::~CJPEGImage(void) {
 	m_pCachedProcessedHistogram = NULL;
 	delete m_pRawMetadata;
 	m_pRawMetadata = NULL;
+	delete m_pAnimationDecoder;
+	m_pAnimationDecoder = NULL;
 }
 
 bool CJPEGImage::CanUseLosslessJPEGTransformations() {
@@ -304,13 +328,20 @@ bool CJPEGImage::ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & uns
 	double dStartTime = Helpers::GetExactTickCount();
 
 	bool bSuccess = false;
+	CSize origSize(m_nOrigWidth, m_nOrigHeight);
+	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+	bool bSIMD = SupportsSIMD(cpu);
 	int16* pGray = CBasicProcessing::Create1Channel16bppGrayscaleImage(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, m_nOriginalChannels);
 	if (pGray != NULL) {
-		int16* pSmoothed = CBasicProcessing::GaussFilter16bpp1Channel(CSize(m_nOrigWidth, m_nOrigHeight), CPoint(0, 0), 
-			CSize(m_nOrigWidth, m_nOrigHeight), unsharpMaskParams.Radius, pGray);
+		int16* pSmoothed = bSIMD ?
+			CBasicProcessing::GaussFilter16bpp1Channel_SIMD(origSize, CPoint(0, 0), origSize, unsharpMaskParams.Radius, pGray, ToSIMDArchitecture(cpu)) :
+			CBasicProcessing::GaussFilter16bpp1Channel(origSize, CPoint(0, 0), origSize, unsharpMaskParams.Radius, pGray);
 		if (pSmoothed != NULL) {
-			bSuccess = NULL != CBasicProcessing::UnsharpMask(CSize(m_nOrigWidth, m_nOrigHeight), CPoint(0,0), CSize(m_nOrigWidth, m_nOrigHeight), 
-				unsharpMaskParams.Amount, unsharpMaskParams.Threshold, pGray, pSmoothed, m_pOrigPixels, m_pOrigPixels, m_nOriginalChannels);
+			bSuccess = NULL != (bSIMD ?
+				CBasicProcessing::UnsharpMask_SIMD(origSize, CPoint(0,0), origSize, unsharpMaskParams.Amount, unsharpMaskParams.Threshold,
+					pGray, pSmoothed, m_pOrigPixels, m_pOrigPixels, m_nOriginalChannels, ToSIMDArchitecture(cpu)) :
+				CBasicProcessing::UnsharpMask(origSize, CPoint(0,0), origSize, unsharpMaskParams.Amount, unsharpMaskParams.Threshold,
+					pGray, pSmoothed, m_pOrigPixels, m_pOrigPixels, m_nOriginalChannels));
 		}
 		delete[] pSmoothed;
 	}
@@ -318,6 +349,9 @@ bool CJPEGImage::ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & uns
 
 	m_dUnsharpMaskTickCount = Helpers::GetExactTickCount() - dStartTime;
 
+	// the pixels have been sharpened in place, the levels of the pyramid must be built again
+	StartBuildingPyramid();
+
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -329,15 +363,18 @@ bool CJPEGImage::RotateOriginalPixels(double dRotation, bool bAutoCrop, bool bKe
 
 	CPoint offset;
 	CSize newSize = GetSizeAfterFreeRotation(CSize(m_nOrigWidth, m_nOrigHeight), dRotation, bAutoCrop, bKeepAspectRatio, offset);
-	void* pRotatedPixels = CBasicProcessing::RotateHQ(offset, newSize, dRotation,
-		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+	void* pRotatedPixels = SupportsSIMD(cpu) ?
+		CBasicProcessing::RotateHQ_SIMD(offset, newSize, dRotation, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels,
+			CSettingsProvider::This().ColorBackground(), ToSIMDArchitecture(cpu)) :
+		CBasicProcessing::RotateHQ(offset, newSize, dRotation,
+			CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
 	if (pRotatedPixels == NULL) return false;
-	delete[] m_pOrigPixels;
 
 	m_nOrigWidth = newSize.cx;
 	m_nOrigHeight = newSize.cy;
 	m_nOriginalChannels = 4;
-	m_pOrigPixels = pRotatedPixels;
+	ReplaceOriginalPixels(pRotatedPixels);
 	MarkAsDestructivelyProcessed();
 
 	m_rotationParams.FreeRotation = fmod(360 * dRotation / (2 * 3.141592653), 360);
@@ -373,15 +410,18 @@ bool CJPEGImage::TrapezoidOriginalPixels(const CTrapezoid& trapezoid, bool bAuto
 	}
 
 	CSize newSize(nXEnd - nXStart + 1, nYEnd - nYStart + 1);
-	void* pTransformedPixels = CBasicProcessing::TrapezoidHQ(CPoint(nXStart, nYStart), newSize, trapezoid, 
-		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+	void* pTransformedPixels = SupportsSIMD(cpu) ?
+		CBasicProcessing::TrapezoidHQ_SIMD(CPoint(nXStart, nYStart), newSize, trapezoid, CSize(m_nOrigWidth, m_nOrigHeight),
+			m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(), ToSIMDArchitecture(cpu)) :
+		CBasicProcessing::TrapezoidHQ(CPoint(nXStart, nYStart), newSize, trapezoid, 
+			CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
 	if (pTransformedPixels == NULL) return false;
-	delete[] m_pOrigPixels;
 
 	m_nOrigWidth = newSize.cx;
 	m_nOrigHeight = newSize.cy;
 	m_nOriginalChannels = 4;
-	m_pOrigPixels = pTransformedPixels;
+	ReplaceOriginalPixels(pTransformedPixels);
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -426,16 +466,18 @@ bool CJPEGImage::ResizeOriginalPixels(EResizeFilter filter, CSize newSize) {
 		}
 		void* pOldPixels = pResizedPixels;
 		pResizedPixels = InternalResize(pResizedPixels, channels, usedFilter, CSize(currentWidth, currentHeight), CSize(oldWidth, oldHeight));
+		// the original pixels are replaced after the last step
+		if (pOldPixels != m_pOrigPixels)
+			delete[] pOldPixels;
 		if (pResizedPixels == NULL)
 			return false;
-		delete[] pOldPixels;
 		channels = 4;
 	}
 
 	m_nOrigWidth = newWidth;
 	m_nOrigHeight = newHeight;
 	m_nOriginalChannels = 4;
-	m_pOrigPixels = pResizedPixels;
+	ReplaceOriginalPixels(pResizedPixels);
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -572,6 +614,33 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
 						  EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType) {
 
+	if (fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535) return NULL;
+
+	CTraceSpan span(TRACE_Resample, m_eImageFormat, (__int64)clippingSize.cx * clippingSize.cy);
+	CResampleParams params;
+	if (GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) && 
+		GetHQResampleParams(fullTargetSize, clippingSize, targetOffset, dSharpen, eResizeType, params)) {
+		return params.Resample();
+	} else {
+		bool bHasRotation = fabs(dRotation) > 1e-3;
+		if (bHasRotation) {
+			// The bicubic preview is fast enough for interactive rotation only with the AVX2 code
+			if (CSettingsProvider::This().AlgorithmImplementation() == Helpers::CPU_AVX2) {
+				return CBasicProcessing::BicubicSampleWithRotation(fullTargetSize, targetOffset, clippingSize, 
+					CSize(m_nOrigWidth, m_nOrigHeight), dRotation, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+					CBasicProcessing::AVX2);
+			}
+			return CBasicProcessing::PointSampleWithRotation(fullTargetSize, targetOffset, clippingSize, 
+				CSize(m_nOrigWidth, m_nOrigHeight), dRotation, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+		} else {
+			return CBasicProcessing::PointSample(fullTargetSize, targetOffset, clippingSize, 
+				CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+		}
+	}
+}
+
+bool CJPEGImage::GetHQResampleParams(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, double dSharpen,
+									 EResizeType eResizeType, CResampleParams& params) {
 	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
 	// NOTE: Hacky workaround... there is probably a very obscure bug in the AVX2 implementation
 	//       which causes WaitForSingleObject to wait indefinitely on SampleUp_HQ_SIMD()
@@ -597,38 +666,115 @@ void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targ
 #endif
 
 	EFilterType filter = CSettingsProvider::This().DownsamplingFilter();
+	if (eResizeType == NoResize && (filter == Filter_Downsampling_Best_Quality || filter == Filter_Downsampling_No_Aliasing)) {
+		return false;
+	}
 
-	if (fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535) return NULL;
+	params.FullTargetSize = fullTargetSize;
+	params.TargetOffset = targetOffset;
+	params.ClippingSize = clippingSize;
+	params.UpSample = eResizeType == UpSample;
+	params.Sharpen = params.UpSample ? 0.0 : dSharpen;
+	params.Filter = filter;
+	params.UseSIMD = SupportsSIMD(cpu);
+	if (params.UseSIMD) {
+		params.SIMD = ToSIMDArchitecture(cpu);
+	}
+	if (params.UpSample) {
+		params.SourcePixels = m_pOrigPixels;
+		params.SourceSize = CSize(m_nOrigWidth, m_nOrigHeight);
+		params.SourceChannels = m_nOriginalChannels;
+	} else {
+		params.SourcePixels = GetDownsamplingSource(fullTargetSize, params.SourceSize, params.SourceChannels);
+	}
+	return true;
+}
 
-	if (GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) && 
-		!(eResizeType == NoResize && (filter == Filter_Downsampling_Best_Quality || filter == Filter_Downsampling_No_Aliasing))) {
-		if (SupportsSIMD(cpu)) {
-			if (eResizeType == UpSample) {
-				return CBasicProcessing::SampleUp_HQ_SIMD(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, ToSIMDArchitecture(cpu));
-			} else {
-				return CBasicProcessing::SampleDown_HQ_SIMD(fullTargetSize, targetOffset, clippingSize,
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, dSharpen, filter, ToSIMDArchitecture(cpu));
-			}
-		} else {
-			if (eResizeType == UpSample) {
-				return CBasicProcessing::SampleUp_HQ(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
-			} else {
-				return CBasicProcessing::SampleDown_HQ(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, dSharpen, filter);
-			}
+bool CJPEGImage::ResampleHQAsync(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset,
+								 const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags, HWND hNotifyWnd, UINT nMessage) {
+	if (!GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) || m_pOrigPixels == NULL ||
+		fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535 || clippingSize.cx <= 0 || clippingSize.cy <= 0) {
+		CancelResampleHQAsync();
+		return false;
+	}
+
+	// Only changing the LUTs needs no resampling, when panning GetDIB() only resamples the newly visible areas
+	bool bFullResample = m_bFirstReprocessing || m_pDIBPixels == NULL || fullTargetSize != m_FullTargetSize ||
+		!GetProcessingFlag(m_eProcFlags, PFLAG_HighQualityResampling) || fabs(imageProcParams.Sharpen - m_imageProcParams.Sharpen) > 1e-2 ||
+		fabs(m_dRotationLQ) > 1e-6 || m_bTrapezoidValid || m_bShowGrid;
+	if (!bFullResample) {
+		CancelResampleHQAsync();
+		return false;
+	}
+
+	// GetDIB() converts to 4 channels before resampling, this must be done before the resampling reads the original pixels
+	if (!m_bFirstReprocessing) {
+		ConvertSrcTo4Channels();
+	}
+
+	CResampleParams params;
+	if (!GetHQResampleParams(fullTargetSize, clippingSize, targetOffset, imageProcParams.Sharpen, 
+		GetResizeType(fullTargetSize, CSize(m_nOrigWidth, m_nOrigHeight)), params)) {
+		CancelResampleHQAsync();
+		return false;
+	}
+	if (m_bAsyncResampling) {
+		if (CAsyncResampler::This().HasResult(this, params)) {
+			return false;
 		}
-	} else {
-		bool bHasRotation = fabs(dRotation) > 1e-3;
-		if (bHasRotation) {
-			return CBasicProcessing::PointSampleWithRotation(fullTargetSize, targetOffset, clippingSize, 
-				CSize(m_nOrigWidth, m_nOrigHeight), dRotation, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
-		} else {
-			return CBasicProcessing::PointSample(fullTargetSize, targetOffset, clippingSize, 
-				CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+		if (CAsyncResampler::This().IsStartedWith(this, params)) {
+			return true;
+		}
+	}
+
+	double dSourcePixels = (double)params.SourceSize.cx * params.SourceSize.cy * clippingSize.cx * clippingSize.cy /
+		((double)fullTargetSize.cx * fullTargetSize.cy);
+	if (max(dSourcePixels, (double)clippingSize.cx * clippingSize.cy) < MIN_ASYNC_RESAMPLE_PIXELS) {
+		CancelResampleHQAsync();
+		return false;
+	}
+
+	m_bAsyncResampling = true;
+	CAsyncResampler::This().Start(this, params, hNotifyWnd, nMessage);
+	return true;
+}
+
+void CJPEGImage::CancelResampleHQAsync() {
+	if (m_bAsyncResampling) {
+		CAsyncResampler::This().Cancel(this, false);
+	}
+}
+
+void* CJPEGImage::TakeResampleHQAsyncResult(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset,
+											EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType) {
+	if (!m_bAsyncResampling || !GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) || fabs(dRotation) > 1e-3 ||
+		fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535) {
+		return NULL;
+	}
+	CResampleParams params;
+	if (!GetHQResampleParams(fullTargetSize, clippingSize, targetOffset, dSharpen, eResizeType, params)) {
+		return NULL;
+	}
+	return CAsyncResampler::This().TakeResult(this, params);
+}
+
+void CJPEGImage::StopResampleHQAsync() {
+	if (m_bAsyncResampling) {
+		CAsyncResampler::This().Cancel(this, true);
+	}
+}
+
+const void* CJPEGImage::GetDownsamplingSource(CSize fullTargetSize, CSize& sourceSize, int& nSourceChannels) {
+	if (m_pPyramid != NULL) {
+		const void* pLevel = m_pPyramid->GetLevel(fullTargetSize, sourceSize);
+		if (pLevel != NULL) {
+			nSourceChannels = 4;
+			return pLevel;
 		}
 	}
+	sourceSize = CSize(m_nOrigWidth, m_nOrigHeight);
+	nSourceChannels = m_nOriginalChannels;
+	return m_pOrigPixels;
 }
 
 void* CJPEGImage::InternalResize(void* pixels, int channels, EResizeFilter filter, CSize targetSize, CSize sourceSize) {
@@ -689,17 +835,22 @@ bool CJPEGImage::Rotate(int nRotation) {
 		return false;
 	}
 
+	// rotating does not change the statistics of the pixels, the LDC is rotated instead of sampling the pixels again
+	CLocalDensityCorr* pRotatedLDC = (m_bLDCOwned && m_pLDC != NULL) ? CLocalDensityCorr::CreateRotated(*m_pLDC, nRotation) : NULL;
 	InvalidateAllCachedPixelData();
 	void* pNewOriginalPixels = CBasicProcessing::Rotate32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, nRotation);
-	if (pNewOriginalPixels == NULL) return false;
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = pNewOriginalPixels;
+	if (pNewOriginalPixels == NULL) {
+		delete pRotatedLDC;
+		return false;
+	}
+	m_pLDC = pRotatedLDC; // if NULL, created again when needed
 	if (nRotation != 180) {
 		// swap width and height
 		int nTemp = m_nOrigWidth;
 		m_nOrigWidth = m_nOrigHeight;
 		m_nOrigHeight = nTemp;
 	}
+	ReplaceOriginalPixels(pNewOriginalPixels);
 	m_rotationParams.Rotation = (m_rotationParams.Rotation + nRotation) % 360;
 
 	m_dLastOpTickCount = Helpers::GetExactTickCount() - dStartTickCount;
@@ -714,11 +865,16 @@ bool CJPEGImage::Mirror(bool bHorizontally) {
 		return false;
 	}
 
+	// same for mirroring as for rotating, see Rotate()
+	CLocalDensityCorr* pMirroredLDC = (m_bLDCOwned && m_pLDC != NULL) ? CLocalDensityCorr::CreateMirrored(*m_pLDC, bHorizontally) : NULL;
 	InvalidateAllCachedPixelData();
 	void* pNewOriginalPixels = CBasicProcessing::Mirror32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, bHorizontally);
-	if (pNewOriginalPixels == NULL) return false;
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = pNewOriginalPixels;
+	if (pNewOriginalPixels == NULL) {
+		delete pMirroredLDC;
+		return false;
+	}
+	m_pLDC = pMirroredLDC;
+	ReplaceOriginalPixels(pNewOriginalPixels);
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -737,10 +893,9 @@ bool CJPEGImage::Crop(CRect cropRect) {
 	if (pNewOriginalPixels == NULL) {
 		return false;
 	}
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = pNewOriginalPixels;
 	m_nOrigWidth = cropRect.Width();
 	m_nOrigHeight = cropRect.Height();
+	ReplaceOriginalPixels(pNewOriginalPixels);
 	m_bCropped = true;
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
@@ -905,6 +1060,45 @@ void CJPEGImage::SetFileDependentProcessParams(LPCTSTR sFileName, CProcessParams
 	m_imageProcParamsInitial = pParams->ImageProcParams;
 }
 
+CSize CJPEGImage::OrigSizeFullResolution() const {
+	if (m_nReductionFactor == 1) {
+		return OrigSize();
+	}
+	bool bSwapped = m_rotationParams.Rotation == 90 || m_rotationParams.Rotation == 270;
+	return bSwapped ? CSize(m_fullResolutionSize.cy, m_fullResolutionSize.cx) : m_fullResolutionSize;
+}
+
+__int64 CJPEGImage::GetMemoryFootprint() const {
+	__int64 nBytes = 0;
+	if (m_pOrigPixels != NULL && m_pPagedOrigPixels == NULL) {
+		nBytes += (__int64)Helpers::DoPadding(m_nOrigWidth * m_nOriginalChannels, 4) * m_nOrigHeight;
+	}
+	if (m_pPyramid != NULL) {
+		// the levels have 1/4 + 1/16 + ... = 1/3 of the original pixels with 4 bytes each
+		nBytes += (__int64)m_nOrigWidth * m_nOrigHeight * 4 / 3;
+	}
+	__int64 nDIBPixels = (__int64)m_ClippingSize.cx * m_ClippingSize.cy;
+	if (m_pDIBPixels != NULL) nBytes += nDIBPixels * 4;
+	if (m_pDIBPixelsLUTProcessed != NULL) nBytes += nDIBPixels * 4;
+	if (m_pGrayImage != NULL) nBytes += nDIBPixels * sizeof(int16);
+	if (m_pSmoothGrayImage != NULL) nBytes += nDIBPixels * sizeof(int16);
+	if (m_pAnimationDecoder != NULL) nBytes += m_pAnimationDecoder->GetMemoryFootprint();
+	return nBytes;
+}
+
+void CJPEGImage::SetAnimationDecoder(CAnimationDecoder* pDecoder) {
+	if (pDecoder != m_pAnimationDecoder) {
+		delete m_pAnimationDecoder;
+		m_pAnimationDecoder = pDecoder;
+	}
+}
+
+CAnimationDecoder* CJPEGImage::DetachAnimationDecoder() {
+	CAnimationDecoder* pDecoder = m_pAnimationDecoder;
+	m_pAnimationDecoder = NULL;
+	return pDecoder;
+}
+
 void CJPEGImage::DIBToOrig(float & fX, float & fY) {
 	float fXo = m_TargetOffset.x + fX;
 	float fYo = m_TargetOffset.y + fY;
@@ -1016,13 +1210,27 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 		// both DIBs are NULL, do normal resampling
 		if (m_pDIBPixels == NULL && m_pDIBPixelsLUTProcessed == NULL) {
 			if (pTrapezoid == NULL) {
-				m_pDIBPixels = Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+				// use the result of the background resampling if it has been started with these parameters
+				m_pDIBPixels = TakeResampleHQAsyncResult(fullTargetSize, clippingSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+				if (m_pDIBPixels == NULL) {
+					m_pDIBPixels = Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+				}
+			} else if (CSettingsProvider::This().AlgorithmImplementation() == Helpers::CPU_AVX2) {
+				// bicubic preview, only fast enough with the AVX2 code
+				m_pDIBPixels = CBasicProcessing::BicubicSampleTrapezoid(fullTargetSize, *pTrapezoid, targetOffset, clippingSize, 
+					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+					CBasicProcessing::AVX2);
 			} else {
 				m_pDIBPixels = CBasicProcessing::PointSampleTrapezoid(fullTargetSize, *pTrapezoid, targetOffset, clippingSize, 
 					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
 			}
 		}
 
+		// only the pages of the original pixels used for the next resampling shall be resident
+		if (m_pPagedOrigPixels != NULL) {
+			m_pPagedOrigPixels->TrimWorkingSet();
+		}
+
 		// if ResampleWithPan() has preserved this DIB, we can reuse it
 		if (m_pDIBPixelsLUTProcessed == NULL) {
 			pDIBUnsharpMasked = ApplyUnsharpMask(pUnsharpMaskParams, false);
@@ -1093,17 +1301,28 @@ void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams
 	if (m_pGrayImage == NULL) {
 		m_pGrayImage = CBasicProcessing::Create1Channel16bppGrayscaleImage(m_ClippingSize.cx, m_ClippingSize.cy, m_pDIBPixels, 4);
 	}
+	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+	bool bSIMD = SupportsSIMD(cpu);
 	if (m_pSmoothGrayImage == NULL) {
-		m_pSmoothGrayImage = CBasicProcessing::GaussFilter16bpp1Channel(m_ClippingSize, CPoint(0, 0), 
-			m_ClippingSize, pUnsharpMaskParams->Radius, m_pGrayImage);
+		m_pSmoothGrayImage = bSIMD ?
+			CBasicProcessing::GaussFilter16bpp1Channel_SIMD(m_ClippingSize, CPoint(0, 0), m_ClippingSize, pUnsharpMaskParams->Radius, m_pGrayImage,
+				ToSIMDArchitecture(cpu)) :
+			CBasicProcessing::GaussFilter16bpp1Channel(m_ClippingSize, CPoint(0, 0), 
+				m_ClippingSize, pUnsharpMaskParams->Radius, m_pGrayImage);
 	}
 	if (m_pGrayImage == NULL || m_pSmoothGrayImage == NULL) {
 		return NULL;
 	}
 
 	uint32* pNewImage = new(std::nothrow) uint32[m_ClippingSize.cx * m_ClippingSize.cy];
-	return (pNewImage == NULL) ? NULL : CBasicProcessing::UnsharpMask(m_ClippingSize, CPoint(0,0), m_ClippingSize, 
-		pUnsharpMaskParams->Amount, pUnsharpMaskParams->Threshold, m_pGrayImage, m_pSmoothGrayImage, m_pDIBPixels, pNewImage, 4);
+	if (pNewImage == NULL) {
+		return NULL;
+	}
+	return bSIMD ?
+		CBasicProcessing::UnsharpMask_SIMD(m_ClippingSize, CPoint(0,0), m_ClippingSize, pUnsharpMaskParams->Amount, pUnsharpMaskParams->Threshold,
+			m_pGrayImage, m_pSmoothGrayImage, m_pDIBPixels, pNewImage, 4, ToSIMDArchitecture(cpu)) :
+		CBasicProcessing::UnsharpMask(m_ClippingSize, CPoint(0,0), m_ClippingSize, 
+			pUnsharpMaskParams->Amount, pUnsharpMaskParams->Threshold, m_pGrayImage, m_pSmoothGrayImage, m_pDIBPixels, pNewImage, 4);
 }
 
 void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags,
@@ -1221,16 +1440,27 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 
 	if (!bNoLUTsApplied || bLDC) {
 		// LUT or/and LDC --> apply correction
+		CTraceSpan span(TRACE_LUT, m_eImageFormat, (__int64)dibSize.cx * dibSize.cy);
 		uint8* pLUT = CHistogramCorr::CombineLUTs(m_pLUTAllChannels, m_pLUTRGB);
+		Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+		bool bSIMD = SupportsSIMD(cpu);
 		if (bLDC) {
-			pCachedTargetDIB = CBasicProcessing::ApplyLDC32bpp(fullTargetSize, targetOffset, dibSize, m_pLDC->GetLDCMapSize(),
-				pSourceDIB, bMustUseSaturationLUTs ? m_pSaturationLUTs : NULL, pLUT, m_pLDC->GetLDCMap(),
-				m_pLDC->GetBlackPt(), m_pLDC->GetWhitePt(), (float)imageProcParams.LightenShadowSteepness);
+			const int32* pSatLUTs = bMustUseSaturationLUTs ? m_pSaturationLUTs : NULL;
+			float fSteepness = (float)imageProcParams.LightenShadowSteepness;
+			pCachedTargetDIB = bSIMD ?
+				CBasicProcessing::ApplyLDC32bpp_SIMD(fullTargetSize, targetOffset, dibSize, m_pLDC->GetLDCMapSize(),
+					pSourceDIB, pSatLUTs, pLUT, m_pLDC->GetLDCMap(), m_pLDC->GetBlackPt(), m_pLDC->GetWhitePt(), fSteepness, ToSIMDArchitecture(cpu)) :
+				CBasicProcessing::ApplyLDC32bpp(fullTargetSize, targetOffset, dibSize, m_pLDC->GetLDCMapSize(),
+					pSourceDIB, pSatLUTs, pLUT, m_pLDC->GetLDCMap(), m_pLDC->GetBlackPt(), m_pLDC->GetWhitePt(), fSteepness);
 		} else {
 			if (bMustUseSaturationLUTs) {
-				pCachedTargetDIB = CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(dibSize.cx, dibSize.cy, pSourceDIB, m_pSaturationLUTs, pLUT);
+				pCachedTargetDIB = bSIMD ?
+					CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp_SIMD(dibSize.cx, dibSize.cy, pSourceDIB, m_pSaturationLUTs, pLUT, ToSIMDArchitecture(cpu)) :
+					CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(dibSize.cx, dibSize.cy, pSourceDIB, m_pSaturationLUTs, pLUT);
 			} else {
-				pCachedTargetDIB = CBasicProcessing::Apply3ChannelLUT32bpp(dibSize.cx, dibSize.cy, pSourceDIB, pLUT);
+				pCachedTargetDIB = bSIMD ?
+					CBasicProcessing::Apply3ChannelLUT32bpp_SIMD(dibSize.cx, dibSize.cy, pSourceDIB, pLUT, ToSIMDArchitecture(cpu)) :
+					CBasicProcessing::Apply3ChannelLUT32bpp(dibSize.cx, dibSize.cy, pSourceDIB, pLUT);
 			}
 		}
 		delete[] pLUT;
@@ -1261,19 +1491,114 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 	return pCachedTargetDIB;
 }
 
+void CJPEGImage::UsePagedOriginalPixels() {
+	if (m_bIsAnimation || m_bIsThumbnailImage || !CPagedPixelBuffer::UsePagedBuffer((__int64)m_nOrigWidth * m_nOrigHeight)) {
+		return;
+	}
+	m_bPagedOrigPixels = true;
+	PageOutOriginalPixels();
+}
+
+void CJPEGImage::StartBuildingPyramid() {
+	if (m_pPyramid != NULL || !CSettingsProvider::This().ResamplingPyramid() || m_bIsAnimation || m_bIsThumbnailImage || m_bPagedOrigPixels ||
+		(__int64)m_nOrigWidth * m_nOrigHeight < MIN_PYRAMID_PIXELS) {
+		return;
+	}
+	m_bUsePyramid = true;
+	m_pPyramid = new CImagePyramid(m_pOrigPixels, CSize(m_nOrigWidth, m_nOrigHeight), m_nOriginalChannels);
+}
+
+void CJPEGImage::ReplaceOriginalPixels(void* pNewPixels, CPagedPixelBuffer* pNewPagedPixels) {
+	StopResampleHQAsync();
+	// The pyramid may still read the old pixels. If it does not, it can be kept, the pixels have been invalidated
+	// before (deleting the pyramid) if the new pixels have a different content.
+	if (m_pPyramid != NULL && !m_pPyramid->IsSourceReleased()) {
+		delete m_pPyramid;
+		m_pPyramid = NULL;
+	}
+	FreeOriginalPixels();
+	m_pOrigPixels = pNewPixels;
+	m_pPagedOrigPixels = pNewPagedPixels;
+	if (m_bPagedOrigPixels) {
+		PageOutOriginalPixels();
+	}
+	if (m_bUsePyramid && m_pPyramid == NULL) {
+		m_pPyramid = new CImagePyramid(m_pOrigPixels, CSize(m_nOrigWidth, m_nOrigHeight), m_nOriginalChannels);
+	}
+}
+
+void CJPEGImage::FreeOriginalPixels() {
+	StopResampleHQAsync();
+	if (m_pPagedOrigPixels != NULL) {
+		delete m_pPagedOrigPixels;
+		m_pPagedOrigPixels = NULL;
+	} else {
+		delete[] m_pOrigPixels;
+	}
+	m_pOrigPixels = NULL;
+}
+
+bool CJPEGImage::PageOutOriginalPixels() {
+	if (m_pOrigPixels == NULL || m_pPagedOrigPixels != NULL) {
+		return m_pPagedOrigPixels != NULL;
+	}
+	__int64 nSizeBytes = (__int64)Helpers::DoPadding(m_nOrigWidth * m_nOriginalChannels, 4) * m_nOrigHeight;
+	CPagedPixelBuffer* pPagedPixels = CPagedPixelBuffer::Create(m_pOrigPixels, nSizeBytes);
+	if (pPagedPixels == NULL) {
+		return false; // keep the pixels in memory
+	}
+	StopResampleHQAsync();
+	delete[] m_pOrigPixels;
+	m_pOrigPixels = pPagedPixels->Pixels();
+	m_pPagedOrigPixels = pPagedPixels;
+	return true;
+}
+
 bool CJPEGImage::ConvertSrcTo4Channels() {
 	if (m_nOriginalChannels == 3) {
+		if (m_pPagedOrigPixels != NULL) {
+			CPagedPixelBuffer* pNewPagedPixels = ConvertPagedSrcTo4Channels();
+			if (pNewPagedPixels != NULL) {
+				m_nOriginalChannels = 4;
+				ReplaceOriginalPixels(pNewPagedPixels->Pixels(), pNewPagedPixels);
+				return true;
+			}
+			// no temporary file, convert in memory
+		}
 		void* pNewOriginalPixels = CBasicProcessing::Convert3To4Channels(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
 		if (pNewOriginalPixels != NULL) {
-			delete[] m_pOrigPixels;
-			m_pOrigPixels = pNewOriginalPixels;
 			m_nOriginalChannels = 4;
+			ReplaceOriginalPixels(pNewOriginalPixels);
 		}
 		return pNewOriginalPixels != NULL;
 	}
 	return true;
 }
 
+CPagedPixelBuffer* CJPEGImage::ConvertPagedSrcTo4Channels() {
+	const int STRIP_HEIGHT = 256;
+	CPagedPixelBuffer* pNewPagedPixels = CPagedPixelBuffer::Create((__int64)m_nOrigWidth * 4 * m_nOrigHeight);
+	if (pNewPagedPixels == NULL) {
+		return NULL;
+	}
+	int nSourceStride = Helpers::DoPadding(m_nOrigWidth * 3, 4);
+	try {
+		for (int nStartY = 0; nStartY < m_nOrigHeight; nStartY += STRIP_HEIGHT) {
+			int nEndY = min(nStartY + STRIP_HEIGHT, m_nOrigHeight);
+			CBasicProcessing::Convert3To4Channels(m_nOrigWidth, nEndY - nStartY, (uint8*)m_pOrigPixels + (__int64)nSourceStride * nStartY,
+				(uint32*)pNewPagedPixels->Pixels() + (__int64)m_nOrigWidth * nStartY);
+			// only the current strip of both buffers is kept in memory
+			m_pPagedOrigPixels->TrimWorkingSet((__int64)nSourceStride * nStartY, (__int64)nSourceStride * (nEndY - nStartY));
+			pNewPagedPixels->TrimWorkingSet((__int64)m_nOrigWidth * 4 * nStartY, (__int64)m_nOrigWidth * 4 * (nEndY - nStartY));
+		}
+	} catch (...) {
+		// disk full or temporary file not writable (EXCEPTION_IN_PAGE_ERROR)
+		delete pNewPagedPixels;
+		return NULL;
+	}
+	return pNewPagedPixels;
+}
+
 EProcessingFlags CJPEGImage::GetProcFlagsIncludeExcludeFolders(LPCTSTR sFileName, EProcessingFlags procFlags) const {
 	EProcessingFlags eFlags = procFlags;
 	CSettingsProvider& sp = CSettingsProvider::This();
@@ -1454,7 +1779,10 @@ void CJPEGImage::MarkAsDestructivelyProcessed() {
 }
 
 void CJPEGImage::InvalidateAllCachedPixelData() {
+	StopResampleHQAsync();
 	m_pLastDIB = NULL;
+	delete m_pPyramid;
+	m_pPyramid = NULL;
 	if (m_bLDCOwned) delete m_pLDC; // LDC mask must be recalculated!
 	m_pLDC = NULL;
 	delete[] m_pDIBPixels; 
@@ -6,6 +6,10 @@ class CHistogram;
 class CLocalDensityCorr;
 class CEXIFReader;
 class CRawMetadata;
+class CPagedPixelBuffer;
+class CImagePyramid;
+class CResampleParams;
+class CAnimationDecoder;
 enum TJSAMP;
 
 // Represents a rectangle to dim out in the image
@@ -74,6 +78,17 @@ public:
 		return GetDIBInternal(fullTargetSize, clippingSize, targetOffset, imageProcParams, eProcFlags, NULL, pTrapezoid, 0.0, bShowGrid, bNotUsed);
 	}
 
+	// Starts the high quality resampling needed for GetDIB() with the given parameters on a background thread if
+	// it is expensive, e.g. when a large image is zoomed. Returns true if the resampling runs in the background,
+	// the caller shall then call GetDIB() without PFLAG_HighQualityResampling to display the image immediately.
+	// nMessage is posted to hNotifyWnd when the resampling has finished, GetDIB() with the same parameters uses the result.
+	// Returns false if GetDIB() can be called directly (resampling not needed, fast or its result is available).
+	bool ResampleHQAsync(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset,
+		const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags, HWND hNotifyWnd, UINT nMessage);
+
+	// Cancels the background resampling started by ResampleHQAsync(), does not wait
+	void CancelResampleHQAsync();
+
 	// Gets a thumbnail of the original image.
 	// The returned thumbnail (32 bpp DIB) has the specified size. 'Size' should not be larger than 400 x 300 pixels
 	void* GetThumbnailDIB(CSize size, const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags);
@@ -160,6 +175,19 @@ public:
 	int InitOrigWidth() const { return m_nInitOrigWidth; }
 	int InitOrigHeight() const { return m_nInitOrigHeight; }
 
+	// Reduction factor (2, 4 or 8) if the JPEG was decoded with reduced resolution (DCT scaling) for fast fit to screen display, 1 otherwise.
+	// The image must be reloaded with full resolution before any operation on the original pixels, see CJPEGProvider::RequestFullResolution()
+	int ReductionFactor() const { return m_nReductionFactor; }
+	bool IsReducedResolution() const { return m_nReductionFactor > 1; }
+	void SetReducedResolution(int nReductionFactor, CSize fullResolutionSize) { m_nReductionFactor = nReductionFactor; m_fullResolutionSize = fullResolutionSize; }
+
+	// Original image size as stored in the image file, also when decoded with reduced resolution. Considers 90 degrees rotations.
+	CSize OrigSizeFullResolution() const;
+
+	// Approximate number of bytes of memory used by the pixels of this image (original pixels, pyramid, cached DIBs and animation decoder).
+	// Original pixels kept in a paged temporary file are not counted.
+	__int64 GetMemoryFootprint() const;
+
 	// Size of DIB - size of resampled section of the original image. If zero, no DIB is currently available.
 	int DIBWidth() const { return m_ClippingSize.cx; }
 	int DIBHeight() const { return m_ClippingSize.cy; }
@@ -201,7 +229,22 @@ public:
 	void* OriginalPixels() { return  m_pOrigPixels; }
 	const void* OriginalPixels() const { return m_pOrigPixels; }
 	// remove original pixels from class - OriginalPixels() will return NULL afterwards
-	void DetachOriginalPixels() { m_pOrigPixels = NULL; }
+	// Not allowed for paged original pixels.
+	void DetachOriginalPixels() { assert(m_pPagedOrigPixels == NULL); m_pOrigPixels = NULL; }
+
+	// Moves the original pixels into a buffer backed by a temporary file if the image is larger than
+	// the PagedPixelStorageMinMP INI setting. Rotations, crops and resizes keep the original pixels paged.
+	// Decoders using CPagedPixelBuffer::AllocatePixels() decode directly into a paged buffer, nothing is copied then.
+	void UsePagedOriginalPixels();
+	// Returns if the original pixels are held in a paged buffer
+	bool HasPagedOriginalPixels() const { return m_pPagedOrigPixels != NULL; }
+
+	// Starts building the downsampling pyramid (1/2, 1/4, ... of the original size) on a background thread if the
+	// image is large enough and the ResamplingPyramid INI setting is enabled. Downsampling starts from the smallest
+	// level larger than the target size, this makes zooming and panning on large images fast.
+	// The pyramid is rebuilt when the original pixels change (e.g. rotation or crop).
+	// Not used for paged original pixels, reading them all again would page in the whole image.
+	void StartBuildingPyramid();
 
 	// returns the number of channels in the OriginalPixels (3 or 4, corresponding to 24 bpp and 32 bpp)
 	int OriginalChannels() const { return m_nOriginalChannels; }
@@ -305,6 +348,16 @@ public:
 	// Defaults to 100ms for frame times <=10, to match behavior of web browsers
 	int FrameTimeMs() const { return m_nFrameTimeMs <= 10 ? 100 : m_nFrameTimeMs; }
 
+	// Sets the decoder state of the animation this frame was decoded with, it continues decoding with the next frame.
+	// Ownership goes to this class.
+	void SetAnimationDecoder(CAnimationDecoder* pDecoder);
+
+	// Gets the decoder state of the animation, NULL if none
+	const CAnimationDecoder* GetAnimationDecoder() const { return m_pAnimationDecoder; }
+
+	// Removes the decoder state of the animation from this image, the caller gets ownership. Returns NULL if none.
+	CAnimationDecoder* DetachAnimationDecoder();
+
 	// Gets if this image was created by pasting from clipboard
 	bool IsClipboardImage() const { return m_eImageFormat == IF_CLIPBOARD; }
 
@@ -349,6 +402,11 @@ private:
 	// Original pixel data - only rotations and crop are done directly on this data because this is non-destructive
 	// The data is not modified in all other cases
 	void* m_pOrigPixels;
+	CPagedPixelBuffer* m_pPagedOrigPixels; // if not NULL, m_pOrigPixels points into this buffer
+	bool m_bPagedOrigPixels; // if true, new original pixels (e.g. after rotation) are paged too
+	CImagePyramid* m_pPyramid; // downsampling pyramid of the original pixels, can be NULL
+	bool m_bUsePyramid; // if true, the pyramid is rebuilt when the original pixels change
+	bool m_bAsyncResampling; // true if the shared CAsyncResampler has been used for this image
 	void* m_pEXIFData;
 	CRawMetadata* m_pRawMetadata;
 	int m_nEXIFSize;
@@ -356,6 +414,8 @@ private:
 	CString m_sJPEGComment;
 	int m_nOrigWidth, m_nOrigHeight; // these may changes by rotation
 	int m_nInitOrigWidth, m_nInitOrigHeight; // original width of image when constructed (before any rotation and crop)
+	int m_nReductionFactor; // 1 if decoded with full resolution
+	CSize m_fullResolutionSize; // size of the image in the file (before any rotation), only set if m_nReductionFactor > 1
 	int m_nOriginalChannels;
 	__int64 m_nPixelHash;
 	EImageFormat m_eImageFormat;
@@ -366,6 +426,7 @@ private:
 	int m_nFrameIndex;
 	int m_nNumberOfFrames;
 	int m_nFrameTimeMs;
+	CAnimationDecoder* m_pAnimationDecoder; // decoder state to continue with the next frame, can be NULL
 
 	// cached thumbnail image, created on first request
 	CJPEGImage* m_pThumbnail;
@@ -457,6 +518,17 @@ private:
 	void* Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
 		EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType);
 
+	// Gets the parameters for high quality resampling to the given target, false if point sampling is used for this target
+	bool GetHQResampleParams(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, double dSharpen,
+		EResizeType eResizeType, CResampleParams& params);
+
+	// Takes the result of the background resampling if it was done with the given parameters, NULL otherwise
+	void* TakeResampleHQAsyncResult(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset,
+		EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType);
+
+	// Cancels the background resampling, waits until it does no longer access the original pixels and discards the result
+	void StopResampleHQAsync();
+
 	// Resize to given target size. Returns resampled DIB. Used when resizing original pixels.
 	void* InternalResize(void* pixels, int channels, EResizeFilter filter, CSize targetSize, CSize sourceSize);
 
@@ -483,6 +555,19 @@ private:
 	// makes sure that the input image (m_pOrigPixels) is a 4 channel BGRA image (converts if necessary)
 	bool ConvertSrcTo4Channels();
 
+	// Converts the paged 3 channel original pixels strip by strip into a new paged 4 channel buffer.
+	// Returns NULL if the paged buffer cannot be created.
+	CPagedPixelBuffer* ConvertPagedSrcTo4Channels();
+
+	// Frees the current original pixels and uses the new pixels instead, pages them if paging is active.
+	// If pNewPagedPixels is not NULL, pNewPixels points into this buffer and the image takes ownership of it.
+	void ReplaceOriginalPixels(void* pNewPixels, CPagedPixelBuffer* pNewPagedPixels = NULL);
+	void FreeOriginalPixels();
+	// Moves the original pixels into a paged buffer, returns false if not possible (the pixels stay in memory then)
+	bool PageOutOriginalPixels();
+	// Source for downsampling to the given target size, either the original pixels or a level of the pyramid
+	const void* GetDownsamplingSource(CSize fullTargetSize, CSize& sourceSize, int& nSourceChannels);
+
 	// Gets the processing flags according to the inclusion/exclusion list in INI file
 	EProcessingFlags GetProcFlagsIncludeExcludeFolders(LPCTSTR sFileName, EProcessingFlags procFlags) const;
 
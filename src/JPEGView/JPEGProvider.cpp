@@ -2,17 +2,23 @@
 #include "JPEGProvider.h"
 #include "JPEGImage.h"
 #include "ImageLoadThread.h"
+#include "AnimationDecoder.h"
 #include "MessageDef.h"
 #include "FileList.h"
 #include "ProcessParams.h"
 #include "BasicProcessing.h"
 
-CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers) {
+// Upper limit for the number of cached requests, independent of the memory budget (e.g. for folders of small icons)
+static const int MAX_CACHED_REQUESTS = 64;
+
+CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads, int nReadAhead, int nAnimationFramesAhead, __int64 nMaxCacheBytes) {
 	m_hHandlerWnd = handlerWnd;
 	m_nNumThread = nNumThreads;
-	m_nNumBuffers = nNumBuffers;
+	m_nAnimationFramesAhead = nAnimationFramesAhead;
+	m_pPrefetchPlanner = new CPrefetchPlanner(nReadAhead);
+	m_nMaxCacheBytes = nMaxCacheBytes;
 	m_nCurrentTimeStamp = 0;
-	m_eOldDirection = FORWARD;
+	m_nReadAheadReady = m_nReadAheadLoading = m_nReadAheadMissed = 0;
 	m_pWorkThreads = new CImageLoadThread*[nNumThreads];
 	for (int i = 0; i < nNumThreads; i++) {
 		m_pWorkThreads[i] = new CImageLoadThread();
@@ -20,13 +26,21 @@ CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers)
 }
 
 CJPEGProvider::~CJPEGProvider(void) {
+#ifdef DEBUG
+	TCHAR buffer[128];
+	_stprintf_s(buffer, 128, _T("Read ahead: %d ready, %d loading, %d missed, planner hit rate %.1f %%\n"),
+		m_nReadAheadReady, m_nReadAheadLoading, m_nReadAheadMissed, m_pPrefetchPlanner->HitRate());
+	::OutputDebugString(buffer);
+#endif
 	for (int i = 0; i < m_nNumThread; i++) {
 		delete m_pWorkThreads[i];
 	}
 	delete[] m_pWorkThreads;
+	delete m_pPrefetchPlanner;
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		delete (*iter)->Image;
+		delete (*iter)->FullResolutionImage;
 		delete *iter;
 	}
 }
@@ -42,19 +56,31 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 
 	// Search if we have the requested image already present or in progress
 	CImageRequest* pRequest = FindRequest(strFileName, nFrameIndex);
-	bool bDirectionChanged = eDirection != m_eOldDirection || eDirection == TOGGLE;
-	bool bRemoveAlsoActiveRequests = bDirectionChanged; // if direction changed, all read-ahead requests are wrongly guessed
 	bool bWasOutOfMemory = false;
-	m_eOldDirection = eDirection;
+	bool bNewRequest = pRequest == NULL;
+
+	// Learn from this navigation and plan the images to read ahead
+	CPrefetchPlanner::CPrefetch prefetches[CPrefetchPlanner::MAX_PREFETCHES];
+	int nNumPrefetches = PlanReadAhead(pFileList, eDirection, prefetches);
 
 	if (pRequest == NULL) {
 		// no request pending for this file, add to request queue and start async
-		pRequest = StartNewRequest(strFileName, nFrameIndex, processParams);
-		// wait with read ahead when direction changed - maybe user just wants to re-see last image
-		if (!bDirectionChanged && eDirection != NONE) {
-			// start parallel if more than one thread
-			StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread - 1, NULL);
-		}
+		pRequest = StartNewRequest(strFileName, nFrameIndex, processParams, CPrefetchPlanner::PRIORITY_CURRENT);
+		m_nReadAheadMissed++;
+	} else if (!pRequest->Ready) {
+		// read ahead request not yet finished, load it before all other requests
+		pRequest->HandlingThread->SetLoadPriority(pRequest->Handle, CPrefetchPlanner::PRIORITY_CURRENT);
+		m_nReadAheadLoading++;
+	} else {
+		m_nReadAheadReady++;
+	}
+	pRequest->IsActive = true;
+
+	// mispredicted read ahead requests must not delay the requested image
+	CancelMispredictedRequests(pFileList, eDirection, prefetches, nNumPrefetches, pRequest);
+	if (bNewRequest) {
+		// start parallel if more than one thread
+		StartPlannedRequests(pFileList, eDirection, processParams, prefetches, min(m_nNumThread - 1, nNumPrefetches), NULL);
 	}
 
 	// wait for request if not yet ready
@@ -65,6 +91,11 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 		::WaitForSingleObject(pRequest->EventFinished, INFINITE);
 		GetLoadedImageFromWorkThread(pRequest);
 	} else {
+		if (pRequest->Image != NULL && pRequest->Image->IsReducedResolution() && !GetProcessingFlag(processParams.ProcFlags, PFLAG_ReducedResolution)) {
+			// cached with reduced resolution but the full resolution is requested
+			RequestFullResolution(pRequest->Image, processParams, true);
+		}
+		UseFullResolutionImage(pRequest);
 		CJPEGImage* pImage = pRequest->Image;
 		if (pImage != NULL) {
 			// make sure the initial parameters are reset as when keep params was on before they are wrong
@@ -95,13 +126,15 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 		}
 	}
 
-	// cleanup stuff no longer used
-	RemoveUnusedImages(bRemoveAlsoActiveRequests);
-	ClearOldestInactiveRequest();
+	// cleanup stuff no longer used, keeping memory for the read ahead images and frames (estimated to have the size of this image)
+	int nAnimationFramesAhead = GetAnimationFramesAhead(pRequest, eDirection);
+	__int64 nImageBytes = (pRequest->Image != NULL) ? pRequest->Image->GetMemoryFootprint() : 0;
+	RemoveUnusedImages(nImageBytes * (nNumPrefetches + nAnimationFramesAhead));
 
-	// check if we shall start new requests (don't start another request if we are short of memory!)
-	if (m_requestList.size() < (unsigned int)m_nNumBuffers && !bDirectionChanged && !bWasOutOfMemory && eDirection != NONE) {
-		StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread, pRequest);
+	// start the planned requests (don't start another request if we are short of memory!)
+	if (!bWasOutOfMemory) {
+		StartAnimationFrameRequests(pRequest, processParams, nAnimationFramesAhead);
+		StartPlannedRequests(pFileList, eDirection, processParams, prefetches, nNumPrefetches, pRequest);
 	}
 
 	bOutOfMemory = pRequest->OutOfMemory;
@@ -166,7 +199,9 @@ bool CJPEGProvider::ClearRequest(CJPEGImage* pImage, bool releaseLockedFile) {
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		if ((*iter)->Image == pImage) {
-			if (releaseLockedFile) m_pWorkThreads[0]->ReleaseFile((*iter)->FileName);
+			if (releaseLockedFile) {
+				ReleaseAnimationDecoders((*iter)->FileName);
+			}
 			// images that are not ready cannot be removed yet
 			if ((*iter)->Ready) {
 				DeleteElementAt(iter);
@@ -188,11 +223,72 @@ void CJPEGProvider::OnImageLoadCompleted(int nHandle) {
 			GetLoadedImageFromWorkThread(*iter);
 			if ((*iter)->Deleted) {
 				// this request was deleted, delete image now
-				ClearRequest((*iter)->Image);
+				DeleteElementAt(iter);
 			}
+			return;
+		}
+		if ((*iter)->FullResolutionHandle == nHandle) {
+			GetFullResolutionImageFromWorkThread(*iter);
+			return;
+		}
+	}
+	std::list<CAbandonedRequest>::iterator iterAbandoned;
+	for (iterAbandoned = m_abandonedRequests.begin(); iterAbandoned != m_abandonedRequests.end(); iterAbandoned++) {
+		if (iterAbandoned->Handle == nHandle) {
+			delete iterAbandoned->HandlingThread->GetLoadedImage(nHandle).Image;
+			::CloseHandle(iterAbandoned->EventFinished);
+			m_abandonedRequests.erase(iterAbandoned);
+			return;
+		}
+	}
+}
+
+void CJPEGProvider::RequestFullResolution(CJPEGImage* pImage, const CProcessParams & processParams, bool bWait) {
+	if (pImage == NULL || !pImage->IsReducedResolution()) {
+		return;
+	}
+	CImageRequest* pRequest = NULL;
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Image == pImage && (*iter)->Ready) {
+			pRequest = *iter;
 			break;
 		}
 	}
+	if (pRequest == NULL || pRequest->FullResolutionImage != NULL || pRequest->FullResolutionFailed) {
+		return;
+	}
+
+	if (pRequest->FullResolutionThread == NULL) {
+#ifdef DEBUG
+		::OutputDebugString(_T("Start full resolution request: ")); ::OutputDebugString(pRequest->FileName); ::OutputDebugString(_T("\n"));
+#endif
+		// The image is processed when displayed, only rotation is needed after loading
+		CProcessParams fullResolutionParams = processParams;
+		fullResolutionParams.ProcFlags = SetProcessingFlag(fullResolutionParams.ProcFlags, PFLAG_ReducedResolution, false);
+		fullResolutionParams.ProcFlags = SetProcessingFlag(fullResolutionParams.ProcFlags, PFLAG_NoProcessingAfterLoad, true);
+		pRequest->FullResolutionEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		pRequest->FullResolutionThread = SearchThreadForNewRequest();
+		pRequest->FullResolutionHandle = pRequest->FullResolutionThread->AsyncLoad(pRequest->FileName, pRequest->FrameIndex,
+			fullResolutionParams, m_hHandlerWnd, pRequest->FullResolutionEvent, CPrefetchPlanner::PRIORITY_CURRENT);
+	}
+	if (bWait) {
+		::WaitForSingleObject(pRequest->FullResolutionEvent, INFINITE);
+		GetFullResolutionImageFromWorkThread(pRequest);
+	}
+}
+
+CJPEGImage* CJPEGProvider::GetFullResolutionImage(CJPEGImage* pImage) {
+	if (pImage == NULL) {
+		return NULL;
+	}
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Image == pImage) {
+			return UseFullResolutionImage(*iter) ? (*iter)->Image : NULL;
+		}
+	}
+	return NULL;
 }
 
 CJPEGProvider::CImageRequest* CJPEGProvider::FindRequest(LPCTSTR strFileName, int nFrameIndex) {
@@ -206,46 +302,217 @@ CJPEGProvider::CImageRequest* CJPEGProvider::FindRequest(LPCTSTR strFileName, in
 }
 
 CJPEGProvider::CImageRequest* CJPEGProvider::StartRequestAndWaitUntilReady(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams) {
-	CImageRequest* pRequest = StartNewRequest(sFileName, nFrameIndex, processParams);
+	CImageRequest* pRequest = StartNewRequest(sFileName, nFrameIndex, processParams, CPrefetchPlanner::PRIORITY_CURRENT);
 	::WaitForSingleObject(pRequest->EventFinished, INFINITE);
 	GetLoadedImageFromWorkThread(pRequest);
 	return pRequest;
 }
 
-void CJPEGProvider::StartNewRequestBundle(CFileList* pFileList, EReadAheadDirection eDirection, 
-										  const CProcessParams & processParams, int nNumRequests, CImageRequest* pLastReadyRequest) {
-	if (nNumRequests == 0 || pFileList == NULL) {
+int CJPEGProvider::PlanReadAhead(CFileList* pFileList, EReadAheadDirection eDirection, CPrefetchPlanner::CPrefetch* pPrefetches) {
+	if (pFileList == NULL || eDirection == NONE) {
+		return 0;
+	}
+	if (eDirection == TOGGLE) {
+		// the other image of the toggle
+		pPrefetches[0].Offset = 1;
+		pPrefetches[0].Priority = CPrefetchPlanner::PRIORITY_READ_AHEAD;
+		return 1;
+	}
+	double dTime = Helpers::GetExactTickCount();
+	int nIndex = pFileList->CurrentIndex();
+#ifdef DEBUG
+	TCHAR buffer[64];
+	_stprintf_s(buffer, 64, _T("Navigate: %d %.0f\n"), nIndex, dTime);
+	::OutputDebugString(buffer);
+#endif
+	m_pPrefetchPlanner->OnNavigate(nIndex, dTime);
+	return m_pPrefetchPlanner->Plan(pPrefetches, CPrefetchPlanner::MAX_PREFETCHES);
+}
+
+void CJPEGProvider::StartPlannedRequests(CFileList* pFileList, EReadAheadDirection eDirection, const CProcessParams & processParams,
+										 const CPrefetchPlanner::CPrefetch* pPrefetches, int nNumPrefetches, CImageRequest* pLastReadyRequest) {
+	if (pFileList == NULL) {
 		return;
 	}
-	for (int i = 0; i < nNumRequests; i++) {
+	// estimate the size of the images read ahead by the size of the last image
+	__int64 nImageBytes = (pLastReadyRequest != NULL && pLastReadyRequest->Image != NULL) ? pLastReadyRequest->Image->GetMemoryFootprint() : 0;
+	__int64 nCacheBytes = GetCacheFootprint();
+	int nNextOffset = (eDirection == BACKWARD) ? -1 : 1;
+	for (int i = 0; i < nNumPrefetches; i++) {
+		if ((int)m_requestList.size() >= MAX_CACHED_REQUESTS || (i > 0 && nCacheBytes + nImageBytes > m_nMaxCacheBytes)) {
+			return;
+		}
+		int nOffset = pPrefetches[i].Offset;
+		bool bForward = nOffset > 0;
+		// the next image in browsing direction can be the next frame of a multiframe image
 		bool bSwitchImage = true;
-		int nFrameIndex = (pLastReadyRequest != NULL) ? Helpers::GetFrameIndex(pLastReadyRequest->Image, eDirection == FORWARD, true, bSwitchImage) : 0;
-		LPCTSTR sFileName = bSwitchImage ? pFileList->PeekNextPrev(i + 1, eDirection == FORWARD, eDirection == TOGGLE) : pFileList->Current();
-		if (sFileName != NULL && FindRequest(sFileName, nFrameIndex) == NULL) {
-			if (GetProcessingFlag(PFLAG_NoProcessingAfterLoad, processParams.ProcFlags)) {
-				// The read ahead threads need this flag to be deleted - we can speculatively process the image with good hit rate
-				CProcessParams paramsCopied = processParams;
-				paramsCopied.ProcFlags = SetProcessingFlag(paramsCopied.ProcFlags, PFLAG_NoProcessingAfterLoad, false);
-				StartNewRequest(sFileName, nFrameIndex, paramsCopied);
+		int nFrameIndex = (pLastReadyRequest != NULL && nOffset == nNextOffset) ? Helpers::GetFrameIndex(pLastReadyRequest->Image, bForward, true, bSwitchImage) : 0;
+		LPCTSTR sFileName = bSwitchImage ? pFileList->PeekNextPrev(abs(nOffset), bForward, eDirection == TOGGLE) : pFileList->Current();
+		if (sFileName == NULL) {
+			continue;
+		}
+		CImageRequest* pRequest = FindRequest(sFileName, nFrameIndex);
+		if (pRequest == NULL) {
+			StartReadAheadRequest(sFileName, nFrameIndex, processParams, pPrefetches[i].Priority);
+			nCacheBytes += nImageBytes;
+		} else if (!pRequest->InUse) {
+			pRequest->IsActive = true;
+			if (!pRequest->Ready) {
+				pRequest->HandlingThread->SetLoadPriority(pRequest->Handle, pPrefetches[i].Priority);
+			}
+		}
+	}
+}
+
+CJPEGProvider::CImageRequest* CJPEGProvider::StartReadAheadRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, int nPriority,
+																   CImageRequest* pPrecedingRequest) {
+	if (GetProcessingFlag(PFLAG_NoProcessingAfterLoad, processParams.ProcFlags)) {
+		// The read ahead threads need this flag to be deleted - we can speculatively process the image with good hit rate
+		CProcessParams paramsCopied = processParams;
+		paramsCopied.ProcFlags = SetProcessingFlag(paramsCopied.ProcFlags, PFLAG_NoProcessingAfterLoad, false);
+		return StartNewRequest(sFileName, nFrameIndex, paramsCopied, nPriority, pPrecedingRequest);
+	} else {
+		return StartNewRequest(sFileName, nFrameIndex, processParams, nPriority, pPrecedingRequest);
+	}
+}
+
+int CJPEGProvider::GetAnimationFramesAhead(CImageRequest* pRequest, EReadAheadDirection eDirection) {
+	CJPEGImage* pImage = pRequest->Image;
+	if (eDirection != FORWARD || pImage == NULL || !pImage->IsAnimation()) {
+		return 0;
+	}
+	return max(0, min(m_nAnimationFramesAhead, pImage->NumberOfFrames() - 1));
+}
+
+void CJPEGProvider::StartAnimationFrameRequests(CImageRequest* pRequest, const CProcessParams & processParams, int nFramesAhead) {
+	if (nFramesAhead <= 0) {
+		return;
+	}
+	__int64 nFrameBytes = pRequest->Image->GetMemoryFootprint();
+	__int64 nCacheBytes = GetCacheFootprint();
+	int nNumFrames = pRequest->Image->NumberOfFrames();
+	CImageRequest* pPrecedingRequest = pRequest;
+	for (int i = 1; i <= nFramesAhead; i++) {
+		int nFrameIndex = (pRequest->FrameIndex + i) % nNumFrames;
+		CImageRequest* pFrameRequest = FindRequest(pRequest->FileName, nFrameIndex);
+		if (pFrameRequest == NULL) {
+			if ((int)m_requestList.size() >= MAX_CACHED_REQUESTS || (i > 1 && nCacheBytes + nFrameBytes > m_nMaxCacheBytes)) {
+				return;
+			}
+			// the frames closer to the displayed frame are needed first
+			pFrameRequest = StartReadAheadRequest(pRequest->FileName, nFrameIndex, processParams, CPrefetchPlanner::PRIORITY_READ_AHEAD - i,
+				pPrecedingRequest);
+			nCacheBytes += nFrameBytes;
+		} else if (!pFrameRequest->InUse) {
+			pFrameRequest->IsActive = true;
+		}
+		pPrecedingRequest = pFrameRequest;
+	}
+}
+
+void CJPEGProvider::CancelMispredictedRequests(CFileList* pFileList, EReadAheadDirection eDirection, const CPrefetchPlanner::CPrefetch* pPrefetches,
+											   int nNumPrefetches, CImageRequest* pCurrentRequest) {
+	if (pFileList == NULL || eDirection == NONE) {
+		return;
+	}
+	CString sPlannedFiles[CPrefetchPlanner::MAX_PREFETCHES];
+	for (int i = 0; i < nNumPrefetches; i++) {
+		sPlannedFiles[i] = pFileList->PeekNextPrev(abs(pPrefetches[i].Offset), pPrefetches[i].Offset > 0, eDirection == TOGGLE);
+	}
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); ) {
+		std::list<CImageRequest*>::iterator iterCurrent = iter++;
+		CImageRequest* pRequest = *iterCurrent;
+		if (pRequest == pCurrentRequest || pRequest->InUse || pRequest->Deleted) {
+			continue;
+		}
+		bool bPlanned = _tcsicmp(pRequest->FileName, pCurrentRequest->FileName) == 0; // other frames of the current image
+		for (int i = 0; i < nNumPrefetches && !bPlanned; i++) {
+			bPlanned = _tcsicmp(pRequest->FileName, sPlannedFiles[i]) == 0;
+		}
+		if (bPlanned) {
+			continue;
+		}
+		// not planned anymore - loaded images are kept in the cache until removed by the LRU strategy, loads not finished are cancelled
+		pRequest->IsActive = false;
+		if (!pRequest->Ready) {
+#ifdef DEBUG
+			::OutputDebugString(_T("Cancel request: ")); ::OutputDebugString(pRequest->FileName); ::OutputDebugString(_T("\n"));
+#endif
+			if (pRequest->HandlingThread->CancelLoad(pRequest->Handle)) {
+				DeleteElementAt(iterCurrent);
 			} else {
-				StartNewRequest(sFileName, nFrameIndex, processParams);
+				// the load stops early, the request is deleted when the thread reports completion
+				pRequest->Deleted = true;
 			}
 		}
 	}
 }
 
-CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams) {
+CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, int nPriority,
+															 CImageRequest* pPrecedingRequest) {
 #ifdef DEBUG
 	::OutputDebugString(_T("Start new request: ")); ::OutputDebugString(sFileName); ::OutputDebugString(_T("\n"));
 #endif
 	CImageRequest* pRequest = new CImageRequest(sFileName, nFrameIndex);
 	m_requestList.push_back(pRequest);
+	if (pPrecedingRequest != NULL && pPrecedingRequest->HandlingThread != NULL) {
+		// the decoder state is handed over on the thread loading the preceding frame when it has finished
+		pRequest->HandlingThread = pPrecedingRequest->HandlingThread;
+		pRequest->Handle = pRequest->HandlingThread->AsyncLoadNextFrame(pPrecedingRequest->Handle, pRequest->FileName, nFrameIndex,
+			processParams, m_hHandlerWnd, pRequest->EventFinished, nPriority);
+		return pRequest;
+	}
 	pRequest->HandlingThread = SearchThreadForNewRequest();
 	pRequest->Handle = pRequest->HandlingThread->AsyncLoad(pRequest->FileName, nFrameIndex,
-		processParams, m_hHandlerWnd, pRequest->EventFinished);
+		processParams, m_hHandlerWnd, pRequest->EventFinished, nPriority, TakeAnimationDecoder(sFileName, nFrameIndex));
 	return pRequest;
 }
 
+CAnimationDecoder* CJPEGProvider::TakeAnimationDecoder(LPCTSTR sFileName, int nFrameIndex) {
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CJPEGImage* pImage = (*iter)->Image;
+		if ((*iter)->Ready && pImage != NULL && pImage->GetAnimationDecoder() != NULL &&
+			pImage->GetAnimationDecoder()->CanDecodeFrame(nFrameIndex) && _tcsicmp((*iter)->FileName, sFileName) == 0) {
+			return pImage->DetachAnimationDecoder();
+		}
+	}
+	return NULL;
+}
+
+void CJPEGProvider::ReleaseAnimationDecoders(LPCTSTR sFileName) {
+	// Cancel the frames still loading first, so that the following frames do not start loading while waiting for the running one
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); ) {
+		std::list<CImageRequest*>::iterator iterCurrent = iter++;
+		CImageRequest* pRequest = *iterCurrent;
+		if (!pRequest->Ready && _tcsicmp(pRequest->FileName, sFileName) == 0 && pRequest->HandlingThread->CancelLoad(pRequest->Handle)) {
+			// not started, the decoder state is deleted with the request of the load thread
+			DeleteElementAt(iterCurrent);
+		}
+	}
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); ) {
+		std::list<CImageRequest*>::iterator iterCurrent = iter++;
+		CImageRequest* pRequest = *iterCurrent;
+		if (_tcsicmp(pRequest->FileName, sFileName) != 0) {
+			continue;
+		}
+		if (!pRequest->Ready) {
+			// being cancelled, the decoder state is deleted together with the discarded image
+			::WaitForSingleObject(pRequest->EventFinished, INFINITE);
+			GetLoadedImageFromWorkThread(pRequest);
+			if (pRequest->Deleted) {
+				DeleteElementAt(iterCurrent);
+				continue;
+			}
+		}
+		if (pRequest->Image != NULL) {
+			delete pRequest->Image->DetachAnimationDecoder();
+		}
+	}
+}
+
 void CJPEGProvider::GetLoadedImageFromWorkThread(CImageRequest* pRequest) {
 	if (pRequest->HandlingThread != NULL) {
 #ifdef DEBUG
@@ -260,6 +527,27 @@ void CJPEGProvider::GetLoadedImageFromWorkThread(CImageRequest* pRequest) {
 	}
 }
 
+bool CJPEGProvider::UseFullResolutionImage(CImageRequest* pRequest) {
+	if (pRequest->FullResolutionImage == NULL) {
+		return false;
+	}
+	delete pRequest->Image;
+	pRequest->Image = pRequest->FullResolutionImage;
+	pRequest->FullResolutionImage = NULL;
+	return true;
+}
+
+void CJPEGProvider::GetFullResolutionImageFromWorkThread(CImageRequest* pRequest) {
+	if (pRequest->FullResolutionThread != NULL) {
+		CImageData imageData = pRequest->FullResolutionThread->GetLoadedImage(pRequest->FullResolutionHandle);
+		pRequest->FullResolutionImage = imageData.Image;
+		pRequest->FullResolutionFailed = imageData.Image == NULL;
+		pRequest->FullResolutionThread = NULL;
+		::CloseHandle(pRequest->FullResolutionEvent);
+		pRequest->FullResolutionEvent = NULL;
+	}
+}
+
 CImageLoadThread* CJPEGProvider::SearchThreadForNewRequest(void) {
 	int nSmallestHandle = INT_MAX;
 	CImageLoadThread* pBestOccupiedThread = NULL;
@@ -285,80 +573,75 @@ CImageLoadThread* CJPEGProvider::SearchThreadForNewRequest(void) {
 	return (pBestOccupiedThread == NULL) ? m_pWorkThreads[0] : pBestOccupiedThread;
 }
 
-void CJPEGProvider::RemoveUnusedImages(bool bRemoveAlsoActiveRequests) {
-	bool bRemoved = false;
-	int nTimeStampToRemove = -2;
-	do {
-		bRemoved = false;
-		int nSmallestTimeStamp = INT_MAX;
-		std::list<CImageRequest*>::iterator iter;
-		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
-			if ((*iter)->InUse == false && (*iter)->Ready && ((*iter)->IsActive == false || bRemoveAlsoActiveRequests || IsDestructivelyProcessed((*iter)->Image))) {
-				// search element with smallest timestamp
-				if ((*iter)->AccessTimeStamp < nSmallestTimeStamp) {
-					nSmallestTimeStamp = (*iter)->AccessTimeStamp;
-				}
-				// remove the readahead images - if we get here with read ahead, the strategy was wrong and
-				// the read ahead image is not used.
-				if ((*iter)->AccessTimeStamp == nTimeStampToRemove || IsDestructivelyProcessed((*iter)->Image)) {
-#ifdef DEBUG
-					::OutputDebugString(_T("Delete request: ")); ::OutputDebugString((*iter)->FileName); ::OutputDebugString(_T("\n"));
-#endif
-					DeleteElementAt(iter);
-					bRemoved = true;
-					break;
-				}
-			}
-		}
-		nTimeStampToRemove = -2;
-		// Make one buffer free for next readahead (except when bRemoveAlsoActiveRequests)
-		int nMaxListSize = bRemoveAlsoActiveRequests ? (unsigned int)m_nNumBuffers : (unsigned int)m_nNumBuffers - 1;
-		if (m_requestList.size() > (unsigned int)nMaxListSize) {
-			// remove element with smallest timestamp
-			if (nSmallestTimeStamp < INT_MAX) {
-				bRemoved = true;
-				nTimeStampToRemove = nSmallestTimeStamp;
-			}
+void CJPEGProvider::RemoveUnusedImages(__int64 nReserveBytes) {
+	// destructively processed images cannot be reused
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); ) {
+		std::list<CImageRequest*>::iterator iterCurrent = iter++;
+		if ((*iterCurrent)->InUse == false && (*iterCurrent)->Ready && IsDestructivelyProcessed((*iterCurrent)->Image)) {
+			DeleteElementAt(iterCurrent);
 		}
-	} while (bRemoved); // repeat until no element could be removed anymore
-}
+	}
 
-void CJPEGProvider::ClearOldestInactiveRequest() {
-	if (m_requestList.size() >= (unsigned int)m_nNumBuffers) {
-		int nFirstHandle = INT_MAX;
-		CImageRequest* pFirstRequest = NULL;
-		std::list<CImageRequest*>::iterator iter;
+	// remove the least recently used images until the cache fits into the memory budget. Read ahead images that have not been
+	// used are removed first (their time stamp is -1) - if they got inactive, they are no longer planned to be read ahead.
+	__int64 nCacheBytes = GetCacheFootprint();
+	while (nCacheBytes + nReserveBytes > m_nMaxCacheBytes || (int)m_requestList.size() > MAX_CACHED_REQUESTS) {
+		std::list<CImageRequest*>::iterator iterOldest = m_requestList.end();
 		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
-			if ((*iter)->IsActive) {
-				// mark very old requests for removal
-				if (CImageLoadThread::GetCurHandleValue() - (*iter)->Handle > m_nNumBuffers) {
-					(*iter)->IsActive = false;
-				}
-				if ((*iter)->Handle < nFirstHandle) {
-					nFirstHandle = (*iter)->Handle;
-					pFirstRequest = *iter;
+			if ((*iter)->InUse == false && (*iter)->Ready && (*iter)->IsActive == false) {
+				if (iterOldest == m_requestList.end() || (*iter)->AccessTimeStamp < (*iterOldest)->AccessTimeStamp) {
+					iterOldest = iter;
 				}
 			}
 		}
-		if (pFirstRequest != NULL) {
-			pFirstRequest->IsActive = false;
-			ClearOldestInactiveRequest();
+		if (iterOldest == m_requestList.end()) {
+			break;
 		}
+#ifdef DEBUG
+		::OutputDebugString(_T("Delete request: ")); ::OutputDebugString((*iterOldest)->FileName); ::OutputDebugString(_T("\n"));
+#endif
+		DeleteElementAt(iterOldest);
+		nCacheBytes = GetCacheFootprint();
 	}
 }
 
+__int64 CJPEGProvider::GetCacheFootprint() {
+	__int64 nBytes = 0;
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Image != NULL) nBytes += (*iter)->Image->GetMemoryFootprint();
+		if ((*iter)->FullResolutionImage != NULL) nBytes += (*iter)->FullResolutionImage->GetMemoryFootprint();
+	}
+	return nBytes;
+}
+
 void CJPEGProvider::DeleteElementAt(std::list<CImageRequest*>::iterator iteratorAt) {
+	DeleteFullResolutionImage(*iteratorAt);
 	delete (*iteratorAt)->Image;
 	delete *iteratorAt;
 	m_requestList.erase(iteratorAt);
 }
 
 void CJPEGProvider::DeleteElement(CImageRequest* pRequest) {
+	DeleteFullResolutionImage(pRequest);
 	delete pRequest->Image;
 	delete pRequest;
 	m_requestList.remove(pRequest);
 }
 
+void CJPEGProvider::DeleteFullResolutionImage(CImageRequest* pRequest) {
+	if (pRequest->FullResolutionThread != NULL) {
+		// still loading, cannot be deleted now
+		CAbandonedRequest abandonedRequest = { pRequest->FullResolutionThread, pRequest->FullResolutionHandle, pRequest->FullResolutionEvent };
+		m_abandonedRequests.push_back(abandonedRequest);
+		pRequest->FullResolutionThread = NULL;
+		pRequest->FullResolutionEvent = NULL;
+	}
+	delete pRequest->FullResolutionImage;
+	pRequest->FullResolutionImage = NULL;
+}
+
 bool CJPEGProvider::IsDestructivelyProcessed(CJPEGImage* pImage) {
 	return pImage != NULL && pImage->IsDestructivelyProcessed();
 }
\ No newline at end of file
@@ -1,12 +1,18 @@
 #pragma once
 
+#include "PrefetchPlanner.h"
+
 class CJPEGImage;
 class CImageLoadThread;
+class CAnimationDecoder;
 class CFileList;
 class CProcessParams;
 
 // Class that reads and processes image files (not only JPEG, any supported format) using read ahead with
-// additional read ahead threads (typically only one).
+// additional read ahead threads. The images to read ahead are planned from the navigation history (see CPrefetchPlanner),
+// read ahead requests no longer planned are cancelled if loading has not started yet.
+// Loaded images are cached within a memory budget, least recently used images are removed first.
+// While an animation plays, the following frames are decoded ahead in sequence, so frames that take long to decode do not stall playback.
 class CJPEGProvider
 {
 public:
@@ -19,9 +25,11 @@ public:
 	};
 
 	// handlerWnd: Window to send the asynchronous message when an image has finished loading (WM_IMAGE_LOAD_COMPLETED)
-	// nNumThreads: Number of read ahead threads to start (should be 1)
-	// nNumBuffers: Number of buffers to use (in most situations nNumThreads+1 is a good choice)
-	CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers);
+	// nNumThreads: Number of read ahead threads to start
+	// nReadAhead: Number of images to read ahead in browsing direction at normal browsing speed
+	// nAnimationFramesAhead: Number of frames of an animation to decode ahead of the displayed frame
+	// nMaxCacheBytes: Memory budget for the cached images
+	CJPEGProvider(HWND handlerWnd, int nNumThreads, int nReadAhead, int nAnimationFramesAhead, __int64 nMaxCacheBytes);
 	~CJPEGProvider(void);
 
 	// Read and process the specified image file.
@@ -63,10 +71,26 @@ public:
 	// Tells the provider that a file has been renamed externally so that pending requests to read this file can be updated.
 	void FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName);
 
+	// Gets the number of requested images that were ready (read ahead), still loading (read ahead too late)
+	// and that were not read ahead since the provider was created
+	void GetReadAheadStatistics(int& nReady, int& nLoading, int& nMissed) const {
+		nReady = m_nReadAheadReady; nLoading = m_nReadAheadLoading; nMissed = m_nReadAheadMissed;
+	}
+
 	// Must be called by the message handler window (see constructor) when the WM_IMAGE_LOAD_COMPLETED
 	// message was received.
 	void OnImageLoadCompleted(int nHandle);
 
+	// Starts loading the full resolution version of an image that was decoded with reduced resolution (see CJPEGImage::IsReducedResolution()).
+	// Does nothing if the image has full resolution or its full resolution version is already loading or loaded.
+	// If bWait is false, the image is loaded in the background and the handler window receives WM_IMAGE_LOAD_COMPLETED when it is ready,
+	// otherwise the method blocks until the image is loaded. In both cases use GetFullResolutionImage() to get the image.
+	void RequestFullResolution(CJPEGImage* pImage, const CProcessParams & processParams, bool bWait);
+
+	// Gets the full resolution version of the given image if it has finished loading (see RequestFullResolution()), NULL otherwise.
+	// The full resolution image replaces the given image in the cache, the given image is deleted and must not be accessed anymore.
+	CJPEGImage* GetFullResolutionImage(CJPEGImage* pImage);
+
 private:
 	// stores a request for loading and processing a JPEG image
 	struct CImageRequest {
@@ -83,6 +107,11 @@ private:
 		int AccessTimeStamp; // LRU handling
 		CImageLoadThread* HandlingThread; // thread that is loading the image, NULL when image is ready
 		HANDLE EventFinished; // event fired when image has finished loading
+		int FullResolutionHandle; // request handle for loading the full resolution version of a reduced resolution image
+		CImageLoadThread* FullResolutionThread; // thread loading the full resolution image, NULL if not loading
+		HANDLE FullResolutionEvent; // event fired when the full resolution image has finished loading, NULL if not loading
+		CJPEGImage* FullResolutionImage; // loaded full resolution image, NULL if not (yet) loaded
+		bool FullResolutionFailed; // true if the full resolution image failed loading, no retry in this case
 
 		CImageRequest(LPCTSTR fileName, int nFrameIndex) {
 			FileName = fileName;
@@ -98,6 +127,11 @@ private:
 			AccessTimeStamp = -1;
 			HandlingThread = NULL;
 			EventFinished = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+			FullResolutionHandle = -1;
+			FullResolutionThread = NULL;
+			FullResolutionEvent = NULL;
+			FullResolutionImage = NULL;
+			FullResolutionFailed = false;
 		}
 
 		~CImageRequest() {
@@ -106,23 +140,53 @@ private:
 		}
 	};
 
+	// full resolution request of a deleted request that is still loading, the loaded image is deleted when ready
+	struct CAbandonedRequest {
+		CImageLoadThread* HandlingThread;
+		int Handle;
+		HANDLE EventFinished;
+	};
+
 	std::list<CImageRequest*> m_requestList;
+	std::list<CAbandonedRequest> m_abandonedRequests;
 	HWND m_hHandlerWnd;
 	CImageLoadThread** m_pWorkThreads;
 	int m_nNumThread; // number of threads in m_pWorkThreads
-	int m_nNumBuffers;
+	int m_nAnimationFramesAhead; // number of frames of an animation decoded ahead of the displayed frame
+	CPrefetchPlanner* m_pPrefetchPlanner;
+	__int64 m_nMaxCacheBytes; // memory budget for the images of all requests
 	int m_nCurrentTimeStamp;
-	EReadAheadDirection m_eOldDirection;
+	int m_nReadAheadReady, m_nReadAheadLoading, m_nReadAheadMissed; // statistics, see GetReadAheadStatistics()
 
 	bool WaitForAsyncRequest(int nHandle, int nMessage);
 	void GetLoadedImageFromWorkThread(CImageRequest* pRequest);
+	void GetFullResolutionImageFromWorkThread(CImageRequest* pRequest);
+	bool UseFullResolutionImage(CImageRequest* pRequest); // replaces the image of the request by its loaded full resolution image
+	void DeleteFullResolutionImage(CImageRequest* pRequest);
 	CImageLoadThread* SearchThreadForNewRequest(void);
-	void RemoveUnusedImages(bool bRemoveAlsoReadAhead);
+	void RemoveUnusedImages(__int64 nReserveBytes);
+	__int64 GetCacheFootprint();
 	CImageRequest* StartRequestAndWaitUntilReady(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
-	CImageRequest* StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
-	void StartNewRequestBundle(CFileList* pFileList, EReadAheadDirection eDirection, const CProcessParams & processParams, int nNumRequests, CImageRequest* pLastReadyRequest);
+	// If pPrecedingRequest is given and still loading, the request continues with its decoder state (next frame of an animation)
+	CImageRequest* StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, int nPriority,
+		CImageRequest* pPrecedingRequest = NULL);
+	// Takes the decoder state of an animation from a loaded frame of the file if it can continue with the given frame, NULL if none
+	CAnimationDecoder* TakeAnimationDecoder(LPCTSTR sFileName, int nFrameIndex);
+	// Deletes the decoder states of the frames of the file, they keep the file open. Frames still loading own the decoder state,
+	// these requests are cancelled and the method waits until they have finished, so the file is closed when it returns.
+	void ReleaseAnimationDecoders(LPCTSTR sFileName);
+	int PlanReadAhead(CFileList* pFileList, EReadAheadDirection eDirection, CPrefetchPlanner::CPrefetch* pPrefetches);
+	void StartPlannedRequests(CFileList* pFileList, EReadAheadDirection eDirection, const CProcessParams & processParams,
+		const CPrefetchPlanner::CPrefetch* pPrefetches, int nNumPrefetches, CImageRequest* pLastReadyRequest);
+	CImageRequest* StartReadAheadRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, int nPriority,
+		CImageRequest* pPrecedingRequest = NULL);
+	// Number of frames to decode ahead of the image of the request, zero if it is no animation
+	int GetAnimationFramesAhead(CImageRequest* pRequest, EReadAheadDirection eDirection);
+	// Starts the requests for the next nFramesAhead frames of the animation, each continuing with the decoder state of the frame before
+	void StartAnimationFrameRequests(CImageRequest* pRequest, const CProcessParams & processParams, int nFramesAhead);
+	void CancelMispredictedRequests(CFileList* pFileList, EReadAheadDirection eDirection, const CPrefetchPlanner::CPrefetch* pPrefetches,
+		int nNumPrefetches, CImageRequest* pCurrentRequest);
 	CImageRequest* FindRequest(LPCTSTR strFileName, int nFrameIndex);
-	void ClearOldestInactiveRequest();
 	void DeleteElementAt(std::list<CImageRequest*>::iterator iteratorAt); // also deletes the request and the image in the request
 	void DeleteElement(CImageRequest* pRequest);
 	bool IsDestructivelyProcessed(CJPEGImage* pImage);
@@ -6,6 +6,8 @@
 #include "resource.h"
 #include "MainDlg.h"
 #include "SettingsProvider.h"
+#include "CommandLineTool.h"
+#include "Tracer.h"
 
 #ifdef DEBUG
 #include <dbghelp.h>
@@ -202,6 +204,14 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 	hRes = _Module.Init(NULL, hInstance);
 	ATLASSERT(SUCCEEDED(hRes));
 
+	// Headless command line tool, does not create any window and does not interfere with running instances
+	if (CCommandLineTool::IsCommandLineToolRequested(lpstrCmdLine)) {
+		int nExitCode = CCommandLineTool::Run();
+		_Module.Term();
+		::CoUninitialize();
+		return nExitCode;
+	}
+
 	CString sStartupFile = ParseCommandLineForStartupFile(lpstrCmdLine);
 	int nAutostartSlideShow = (sStartupFile.GetLength() == 0) ? 0 : ParseCommandLineForAutostart(lpstrCmdLine);
 	bool bForceFullScreen = ParseCommandLineForFullScreen(lpstrCmdLine);
@@ -237,6 +247,12 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 		ULONG_PTR gdiplusToken;
 		Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
 
+		// Record the timing of the load and render stages if requested in the INI file
+		CString sTraceFile = CSettingsProvider::This().TraceFile();
+		if (!sTraceFile.IsEmpty()) {
+			CTracer::Enable();
+		}
+
 		CMainDlg dlgMain(bForceFullScreen);
 
 		dlgMain.SetStartupInfo(sStartupFile, nAutostartSlideShow, eSorting, eTransitionEffect, nTransitionTime, bAutoExit, nDisplayMonitor);
@@ -252,6 +268,10 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 			::ShowCursor(TRUE);
 		}
 
+		if (!sTraceFile.IsEmpty()) {
+			CTracer::WriteChromeTrace(sTraceFile);
+		}
+
 		// Shut down GDI+
 		Gdiplus::GdiplusShutdown(gdiplusToken);
 	}
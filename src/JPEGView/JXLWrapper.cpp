@@ -7,12 +7,13 @@
 #include "jxl/resizable_parallel_runner_cxx.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "Tracer.h"
 
 struct JxlReader::jxl_cache {
 	JxlDecoderPtr decoder;
 	JxlResizableParallelRunnerPtr runner;
 	JxlBasicInfo info;
-	uint8_t* data;
+	const uint8_t* data;
 	size_t data_size;
 	int prev_frame_timestamp;
 	int width;
@@ -21,19 +22,17 @@ struct JxlReader::jxl_cache {
 	std::vector<uint8_t> exif;
 };
 
-JxlReader::jxl_cache JxlReader::cache = { 0 };
-
 // based on https://github.com/libjxl/libjxl/blob/main/examples/decode_oneshot.cc
 // and https://github.com/libjxl/libjxl/blob/main/examples/decode_exif_metadata.cc
-bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector<uint8_t>* pixels, int& xsize,
+bool JxlReader::DecodeJpegXlOneShot(jxl_cache* cache, const uint8_t* jxl, size_t size, std::vector<uint8_t>* pixels, int& xsize,
 	int& ysize, bool& have_animation, int& frame_count, int& frame_time, std::vector<uint8_t>* icc_profile, bool& outOfMemory) {
 
-	if (cache.decoder.get() == NULL) {
-		cache.runner = JxlResizableParallelRunnerMake(nullptr);
+	if (cache->decoder.get() == NULL) {
+		cache->runner = JxlResizableParallelRunnerMake(nullptr);
 
-		cache.decoder = JxlDecoderMake(nullptr);
+		cache->decoder = JxlDecoderMake(nullptr);
 		if (JXL_DEC_SUCCESS !=
-			JxlDecoderSubscribeEvents(cache.decoder.get(), JXL_DEC_BASIC_INFO |
+			JxlDecoderSubscribeEvents(cache->decoder.get(), JXL_DEC_BASIC_INFO |
 				JXL_DEC_COLOR_ENCODING |
 				JXL_DEC_BOX |
 				JXL_DEC_FRAME |
@@ -41,20 +40,20 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 			return false;
 		}
 
-		if (JXL_DEC_SUCCESS != JxlDecoderSetDecompressBoxes(cache.decoder.get(), JXL_TRUE)) {
+		if (JXL_DEC_SUCCESS != JxlDecoderSetDecompressBoxes(cache->decoder.get(), JXL_TRUE)) {
 			return false;
 		}
 
-		if (JXL_DEC_SUCCESS != JxlDecoderSetParallelRunner(cache.decoder.get(),
+		if (JXL_DEC_SUCCESS != JxlDecoderSetParallelRunner(cache->decoder.get(),
 			JxlResizableParallelRunner,
-			cache.runner.get())) {
+			cache->runner.get())) {
 			return false;
 		}
 
-		JxlDecoderSetInput(cache.decoder.get(), jxl, size);
-		JxlDecoderCloseInput(cache.decoder.get());
-		cache.data = (uint8_t*)jxl;
-		cache.data_size = size;
+		JxlDecoderSetInput(cache->decoder.get(), jxl, size);
+		JxlDecoderCloseInput(cache->decoder.get());
+		cache->data = jxl;
+		cache->data_size = size;
 	}
 
 	JxlBasicInfo info;
@@ -64,45 +63,45 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 
 	bool loop_check = false;
 	for (;;) {
-		JxlDecoderStatus status = JxlDecoderProcessInput(cache.decoder.get());
+		JxlDecoderStatus status = JxlDecoderProcessInput(cache->decoder.get());
 
 		if (status == JXL_DEC_ERROR) {
 			return false;
 		} else if (status == JXL_DEC_NEED_MORE_INPUT) {
 			return false;
 		} else if (status == JXL_DEC_BASIC_INFO) {
-			if (JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(cache.decoder.get(), &info)) {
+			if (JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(cache->decoder.get(), &info)) {
 				return false;
 			}
-			cache.info = info;
-			if (cache.info.xsize > MAX_IMAGE_DIMENSION || cache.info.ysize > MAX_IMAGE_DIMENSION)
+			cache->info = info;
+			if (cache->info.xsize > MAX_IMAGE_DIMENSION || cache->info.ysize > MAX_IMAGE_DIMENSION)
 				return false;
-			if (abs((double)cache.info.xsize * cache.info.ysize) > MAX_IMAGE_PIXELS) {
+			if (abs((double)cache->info.xsize * cache->info.ysize) > MAX_IMAGE_PIXELS) {
 				outOfMemory = true;
 				return false;
 			}
 			JxlResizableParallelRunnerSetThreads(
-				cache.runner.get(),
+				cache->runner.get(),
 				JxlResizableParallelRunnerSuggestThreads(info.xsize, info.ysize));
 		} else if (status == JXL_DEC_COLOR_ENCODING) {
 			// Get the ICC color profile of the pixel data
 			size_t icc_size;
 			if (JXL_DEC_SUCCESS !=
 				JxlDecoderGetICCProfileSize(
-					cache.decoder.get(), JXL_COLOR_PROFILE_TARGET_DATA, &icc_size)) {
+					cache->decoder.get(), JXL_COLOR_PROFILE_TARGET_DATA, &icc_size)) {
 				return false;
 			}
 			icc_profile->resize(icc_size);
 			if (JXL_DEC_SUCCESS != JxlDecoderGetColorAsICCProfile(
-				cache.decoder.get(),
+				cache->decoder.get(),
 				JXL_COLOR_PROFILE_TARGET_DATA,
 				icc_profile->data(), icc_profile->size())) {
 				return false;
 			}
 		} else if (status == JXL_DEC_FRAME) {
 			JxlFrameHeader header;
-			JxlDecoderGetFrameHeader(cache.decoder.get(), &header);
-			JxlAnimationHeader animation = cache.info.animation;
+			JxlDecoderGetFrameHeader(cache->decoder.get(), &header);
+			JxlAnimationHeader animation = cache->info.animation;
 			if (animation.tps_numerator)
 				frame_time = (int)(1000.0 * header.duration * animation.tps_denominator / animation.tps_numerator);
 			else
@@ -110,16 +109,16 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 		} else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
 			size_t buffer_size;
 			if (JXL_DEC_SUCCESS !=
-				JxlDecoderImageOutBufferSize(cache.decoder.get(), &format, &buffer_size)) {
+				JxlDecoderImageOutBufferSize(cache->decoder.get(), &format, &buffer_size)) {
 				return false;
 			}
-			if (buffer_size != cache.info.xsize * cache.info.ysize * 4) {
+			if (buffer_size != cache->info.xsize * cache->info.ysize * 4) {
 				return false;
 			}
-			pixels->resize(cache.info.xsize * cache.info.ysize * 4);
+			pixels->resize(cache->info.xsize * cache->info.ysize * 4);
 			void* pixels_buffer = (void*)pixels->data();
 			size_t pixels_buffer_size = pixels->size() * sizeof(uint8_t);
-			if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutBuffer(cache.decoder.get(), &format,
+			if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutBuffer(cache->decoder.get(), &format,
 				pixels_buffer,
 				pixels_buffer_size)) {
 				return false;
@@ -127,9 +126,9 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 		} else if (status == JXL_DEC_FULL_IMAGE) {
 			// Full frame has been decoded
 
-			xsize = cache.info.xsize;
-			ysize = cache.info.ysize;
-			have_animation = cache.info.have_animation;
+			xsize = cache->info.xsize;
+			ysize = cache->info.ysize;
+			have_animation = cache->info.have_animation;
 			if (have_animation) {
 				// TODO: Find a better way to indicate unknown frame count. JPEG XL images do not store number of frames.
 				frame_count = 2;
@@ -143,30 +142,30 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 			if (loop_check)
 				return false; // escape infinite loop
 			loop_check = true;
-			JxlDecoderRewind(cache.decoder.get());
-			JxlDecoderSubscribeEvents(cache.decoder.get(), JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE);
-			JxlDecoderSetInput(cache.decoder.get(), cache.data, cache.data_size);
-			JxlDecoderCloseInput(cache.decoder.get());
+			JxlDecoderRewind(cache->decoder.get());
+			JxlDecoderSubscribeEvents(cache->decoder.get(), JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE);
+			JxlDecoderSetInput(cache->decoder.get(), cache->data, cache->data_size);
+			JxlDecoderCloseInput(cache->decoder.get());
 		} else if (status == JXL_DEC_BOX) {
-			if (!cache.exif.empty()) {
-				size_t remaining = JxlDecoderReleaseBoxBuffer(cache.decoder.get());
-				cache.exif.resize(cache.exif.size() - remaining);
+			if (!cache->exif.empty()) {
+				size_t remaining = JxlDecoderReleaseBoxBuffer(cache->decoder.get());
+				cache->exif.resize(cache->exif.size() - remaining);
 			} else {
 				JxlBoxType type;
 				if (JXL_DEC_SUCCESS !=
-					JxlDecoderGetBoxType(cache.decoder.get(), type, true)) {
+					JxlDecoderGetBoxType(cache->decoder.get(), type, true)) {
 					return false;
 				}
 				if (!memcmp(type, "Exif", 4)) {
-					cache.exif.resize(kChunkSize);
-					JxlDecoderSetBoxBuffer(cache.decoder.get(), cache.exif.data(), cache.exif.size());
+					cache->exif.resize(kChunkSize);
+					JxlDecoderSetBoxBuffer(cache->decoder.get(), cache->exif.data(), cache->exif.size());
 				}
 			}
 		} else if (status == JXL_DEC_BOX_NEED_MORE_OUTPUT) {
-			size_t remaining = JxlDecoderReleaseBoxBuffer(cache.decoder.get());
+			size_t remaining = JxlDecoderReleaseBoxBuffer(cache->decoder.get());
 			output_pos += kChunkSize - remaining;
-			cache.exif.resize(cache.exif.size() + kChunkSize);
-			JxlDecoderSetBoxBuffer(cache.decoder.get(), cache.exif.data() + output_pos, cache.exif.size() - output_pos);
+			cache->exif.resize(cache->exif.size() + kChunkSize);
+			JxlDecoderSetBoxBuffer(cache->decoder.get(), cache->exif.data() + output_pos, cache->exif.size() - output_pos);
 		} else {
 			return false;
 		}
@@ -181,6 +180,7 @@ void* JxlReader::ReadImage(int& width,
 	int& frame_time,
 	void*& exif_chunk,
 	bool& outOfMemory,
+	jxl_cache*& cache,
 	const void* buffer,
 	int sizebytes)
 {
@@ -192,21 +192,32 @@ void* JxlReader::ReadImage(int& width,
 	exif_chunk = NULL;
 
 
+	if (cache == NULL) {
+		cache = new(std::nothrow) jxl_cache();
+		if (cache == NULL) {
+			outOfMemory = true;
+			return NULL;
+		}
+	}
+
 	std::vector<uint8_t> pixels;
 	std::vector<uint8_t> icc_profile;
-	if (!DecodeJpegXlOneShot((const uint8_t*)buffer, sizebytes, &pixels, width, height,
+	CTraceSpan decodeSpan(TRACE_Decode);
+	if (!DecodeJpegXlOneShot(cache, (const uint8_t*)buffer, sizebytes, &pixels, width, height,
 		has_animation, frame_count, frame_time, &icc_profile, outOfMemory)) {
 		return NULL;
 	}
+	decodeSpan.SetPixels((__int64)width * height);
+	decodeSpan.End();
 	int size = width * height * nchannels;
 	pPixelData = new(std::nothrow) unsigned char[size];
 	if (pPixelData == NULL) {
 		outOfMemory = true;
 		return NULL;
 	}
-	if (cache.transform == NULL)
-		cache.transform = ICCProfileTransform::CreateTransform(icc_profile.data(), icc_profile.size(), ICCProfileTransform::FORMAT_RGBA);
-	if (!ICCProfileTransform::DoTransform(cache.transform, pixels.data(), pPixelData, width, height)) {
+	if (cache->transform == NULL)
+		cache->transform = ICCProfileTransform::CreateTransform(icc_profile.data(), icc_profile.size(), ICCProfileTransform::FORMAT_RGBA);
+	if (!ICCProfileTransform::DoTransform(cache->transform, pixels.data(), pPixelData, width, height)) {
 		// RGBA -> BGRA conversion (with little-endian integers)
 		uint32_t* data = (uint32_t*)pixels.data();
 		for (int i = 0; i * sizeof(uint32_t) < size; i++) {
@@ -215,24 +226,27 @@ void* JxlReader::ReadImage(int& width,
 	}
 
 	// Copy Exif data into the format understood by CEXIFReader
-	if (!cache.exif.empty() && cache.exif.size() > 8 && cache.exif.size() < 65532) {
-		exif_chunk = malloc(cache.exif.size() + 6);
+	if (!cache->exif.empty() && cache->exif.size() > 8 && cache->exif.size() < 65532) {
+		exif_chunk = malloc(cache->exif.size() + 6);
 		if (exif_chunk != NULL) {
 			memcpy(exif_chunk, "\xFF\xE1\0\0Exif\0\0", 10);
-			*((unsigned short*)exif_chunk + 1) = _byteswap_ushort(cache.exif.size() + 4);
-			memcpy((uint8_t*)exif_chunk + 10, cache.exif.data() + 4, cache.exif.size() - 4);
+			*((unsigned short*)exif_chunk + 1) = _byteswap_ushort(cache->exif.size() + 4);
+			memcpy((uint8_t*)exif_chunk + 10, cache->exif.data() + 4, cache->exif.size() - 4);
 		}
 	}
 
-	if (!has_animation)
-		DeleteCache();
+	if (!has_animation) {
+		DeleteCache(cache);
+		cache = NULL;
+	}
 
 	return pPixelData;
 }
 
-void JxlReader::DeleteCache() {
-	free(cache.data);
-	ICCProfileTransform::DeleteTransform(cache.transform);
-	// Setting the decoder and runner to 0 (NULL) will automatically destroy them
-	cache = { 0 };
+void JxlReader::DeleteCache(jxl_cache* cache) {
+	if (cache != NULL) {
+		ICCProfileTransform::DeleteTransform(cache->transform);
+		// The decoder and the runner are destroyed with the cache
+		delete cache;
+	}
 }
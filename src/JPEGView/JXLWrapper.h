@@ -6,7 +6,12 @@
 class JxlReader
 {
 public:
+	// Decoder state of an animation, kept from one frame to the next
+	struct jxl_cache;
+
 	// Returns data in 4 byte BGRA
+	// If cache is NULL, the image is read from the buffer. For animations, the first frame is returned and a new decoder state
+	// is created in cache, the following frames are read by passing this state again (buffer and sizebytes are ignored then).
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -15,14 +20,15 @@ public:
 		int& frame_time, // frame duration in milliseconds
 		void*& exif, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
+		jxl_cache*& cache, // decoder state of an animation, must be deleted by the caller with DeleteCache()
 		const void* buffer, // memory address containing jxl compressed data.
 		int sizebytes); // size of jxl compressed data
 
-	static void DeleteCache();
+	// Deletes the decoder state of an animation. The buffer passed to ReadImage() of an animation
+	// is not copied, it must stay valid until this method is called.
+	static void DeleteCache(jxl_cache* cache);
 
 private:
-	struct jxl_cache;
-	static jxl_cache cache;
-	static bool DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector<uint8_t>* pixels, int& xsize,
+	static bool DecodeJpegXlOneShot(jxl_cache* cache, const uint8_t* jxl, size_t size, std::vector<uint8_t>* pixels, int& xsize,
 		int& ysize, bool& have_animation, int& frame_count, int& frame_time, std::vector<uint8_t>* icc_profile, bool& outOfMemory);
 };
@@ -3,6 +3,7 @@
 #include "HistogramCorr.h"
 #include "JPEGImage.h"
 #include "Helpers.h"
+#include "Tracer.h"
 #include <math.h>
 #include <assert.h>
 
@@ -68,6 +69,7 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 	// used as starting image for LDC. This image is then resampled by a factor of 4 in
 	// each dimension.
 	const int NUM_VALUES = 120000;
+	CTraceSpan span(TRACE_Histogram, image.GetImageFormat(), (__int64)image.OrigWidth() * image.OrigHeight());
 
 	m_nLDCWidth = m_nLDCHeight = -1;
 	m_pLDCMap = NULL;
@@ -95,12 +97,19 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 	// The subsampled image has 16 bits per channel and three line interleaved channels B, G, R
 	m_pPointSampledImage = new uint16[m_nPSIWidth*m_nPSIHeight*3];
 
+	// the sampled columns are the same for all lines
+	int* pColumnOffsets = new int[m_nPSIWidth];
+	uint32 nX = 0;
+	for (int i = 0; i < m_nPSIWidth; i++) {
+		pColumnOffsets[i] = (nX >> 16)*nChannels;
+		nX += nIncX;
+	}
+
 	for (int j = 0; j < m_nPSIHeight; j++) {
-		uint32 nX = 0;
 		const uint8* pSrcStart = pSourcePixels + nLineSize*(nY >> 16);
 		uint16* pSubSampImage = m_pPointSampledImage + j*m_nPSIWidth*3;
 		for (int i = 0; i < m_nPSIWidth; i++) {
-			const uint8* pSrc = (nChannels == 3) ? pSrcStart + (nX >> 16)*3 : pSrcStart + (nX >> 16)*4;
+			const uint8* pSrc = pSrcStart + pColumnOffsets[i];
 			channelB[pSrc[0]]++;
 			channelG[pSrc[1]]++;
 			channelR[pSrc[2]]++;
@@ -109,43 +118,12 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 			pSubSampImage[m_nPSIWidth] = pSrc[1];
 			pSubSampImage[m_nPSIWidth*2] = pSrc[2];
 			pSubSampImage++;
-			nX += nIncX;
 		}
 		nY += nIncY;
 	}
+	delete[] pColumnOffsets;
 
-	// Calculate a CRC over the histograms
-	uint32 crc_table[256];
-	Helpers::CalcCRCTable(crc_table);
-	uint32 crcValue = 0xffffffff;
-	uint8* pHistB = (uint8*)&channelB;
-	uint8* pHistG = (uint8*)&channelG;
-	uint8* pHistR = (uint8*)&channelR;
-	for (int n = 0; n < 256*4; n++) {
-		crcValue = crc_table[(crcValue ^ pHistB[n]) & 0xff] ^ (crcValue >> 8);
-		crcValue = crc_table[(crcValue ^ pHistG[n]) & 0xff] ^ (crcValue >> 8);
-		crcValue = crc_table[(crcValue ^ pHistR[n]) & 0xff] ^ (crcValue >> 8);
-	}
-	// The CRC of the histogram of an image rotated by 90, 180 or 270 deg is identical
-	// -> calculate CRC of one line at 1/4 of the image height
-	int nLine = m_nPSIHeight/4;
-	uint8* pLinePtr = (uint8*)(m_pPointSampledImage + nLine*m_nPSIWidth*3);
-	for (int n = 0; n < m_nPSIWidth*2; n++) {
-		crcValue = crc_table[(crcValue ^ *pLinePtr) & 0xff] ^ (crcValue >> 8);
-		pLinePtr++;
-	}
-	// Calculate the sum of all pixels
-	uint32 nSumValue = 0;
-	for (int n = 0; n < 256; n++) {
-		nSumValue += channelB[n]*n + channelG[n]*n + channelR[n]*n;
-	}
-	// finally calculate the hash value, a sum of 0 is invalid (fully black image - no DB entry)
-	// as this is used as a marker
-	if (nSumValue == 0) {
-		m_nPixelHash = 0;
-	} else {
-		m_nPixelHash = ((__int64)crcValue << 32) + nSumValue;
-	}
+	CalculatePixelHash(channelB, channelG, channelR);
 
 	// Calculate grey black and white points
 	int nLimit = (int) (m_nPSIWidth*m_nPSIHeight*0.01);
@@ -163,6 +141,62 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 	}
 }
 
+CLocalDensityCorr::CLocalDensityCorr(const CLocalDensityCorr & ldc, int nRotationCW, bool bMirrorH, bool bMirrorV) {
+	CTraceSpan span(TRACE_Histogram, IF_Unknown, (__int64)ldc.m_nPSIWidth * ldc.m_nPSIHeight);
+
+	m_nLDCWidth = m_nLDCHeight = -1;
+	m_pLDCMap = NULL;
+	m_pLDCMapMultiplied = NULL;
+	m_fIsSunset = m_fMiddleGrey = m_fSunsetPixels = -1.0f;
+	m_fBlackPt = ldc.m_fBlackPt;
+	m_fWhitePt = ldc.m_fWhitePt;
+
+	// both sizes are multiples of 4, so the LDC map of the transformed image has the transformed size
+	int nSrcWidth = ldc.m_nPSIWidth;
+	int nSrcHeight = ldc.m_nPSIHeight;
+	bool bSwapSize = nRotationCW == 90 || nRotationCW == 270;
+	m_nPSIWidth = bSwapSize ? nSrcHeight : nSrcWidth;
+	m_nPSIHeight = bSwapSize ? nSrcWidth : nSrcHeight;
+	m_pPointSampledImage = new uint16[m_nPSIWidth*m_nPSIHeight*3];
+
+	for (int j = 0; j < m_nPSIHeight; j++) {
+		uint16* pTarget = m_pPointSampledImage + j*m_nPSIWidth*3;
+		for (int i = 0; i < m_nPSIWidth; i++) {
+			// position in the source of the target pixel, the inverse of the transformation
+			int nX, nY;
+			switch (nRotationCW) {
+				case 90: nX = j; nY = nSrcHeight - 1 - i; break;
+				case 180: nX = nSrcWidth - 1 - i; nY = nSrcHeight - 1 - j; break;
+				case 270: nX = nSrcWidth - 1 - j; nY = i; break;
+				default: nX = bMirrorH ? nSrcWidth - 1 - i : i; nY = bMirrorV ? nSrcHeight - 1 - j : j; break;
+			}
+			const uint16* pSource = ldc.m_pPointSampledImage + nY*nSrcWidth*3 + nX;
+			pTarget[0] = pSource[0];
+			pTarget[m_nPSIWidth] = pSource[nSrcWidth];
+			pTarget[m_nPSIWidth*2] = pSource[nSrcWidth*2];
+			pTarget++;
+		}
+	}
+
+	m_pHistogramm = new CHistogram(*ldc.m_pHistogramm);
+	CalculatePixelHash(m_pHistogramm->GetChannelB(), m_pHistogramm->GetChannelG(), m_pHistogramm->GetChannelR());
+
+	if (ldc.m_pLDCMap != NULL) {
+		CreateLDCMap();
+	}
+}
+
+CLocalDensityCorr* CLocalDensityCorr::CreateRotated(const CLocalDensityCorr & ldc, int nRotationCW) {
+	if (nRotationCW != 90 && nRotationCW != 180 && nRotationCW != 270) {
+		return NULL;
+	}
+	return new CLocalDensityCorr(ldc, nRotationCW, false, false);
+}
+
+CLocalDensityCorr* CLocalDensityCorr::CreateMirrored(const CLocalDensityCorr & ldc, bool bHorizontally) {
+	return new CLocalDensityCorr(ldc, 0, bHorizontally, !bHorizontally);
+}
+
 CLocalDensityCorr::~CLocalDensityCorr(void) {
 	delete[] m_pPointSampledImage;
 	m_pPointSampledImage = NULL;
@@ -212,6 +246,42 @@ void CLocalDensityCorr::SetLDCAmount(double dLightenShadows, double dDarkenHighl
 // Private
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Calculates the pixel hash from the histograms and the point sampled image
+void CLocalDensityCorr::CalculatePixelHash(const int* pChannelB, const int* pChannelG, const int* pChannelR) {
+	// Calculate a CRC over the histograms
+	uint32 crc_table[256];
+	Helpers::CalcCRCTable(crc_table);
+	uint32 crcValue = 0xffffffff;
+	const uint8* pHistB = (const uint8*)pChannelB;
+	const uint8* pHistG = (const uint8*)pChannelG;
+	const uint8* pHistR = (const uint8*)pChannelR;
+	for (int n = 0; n < 256*4; n++) {
+		crcValue = crc_table[(crcValue ^ pHistB[n]) & 0xff] ^ (crcValue >> 8);
+		crcValue = crc_table[(crcValue ^ pHistG[n]) & 0xff] ^ (crcValue >> 8);
+		crcValue = crc_table[(crcValue ^ pHistR[n]) & 0xff] ^ (crcValue >> 8);
+	}
+	// The CRC of the histogram of an image rotated by 90, 180 or 270 deg is identical
+	// -> calculate CRC of one line at 1/4 of the image height
+	int nLine = m_nPSIHeight/4;
+	uint8* pLinePtr = (uint8*)(m_pPointSampledImage + nLine*m_nPSIWidth*3);
+	for (int n = 0; n < m_nPSIWidth*2; n++) {
+		crcValue = crc_table[(crcValue ^ *pLinePtr) & 0xff] ^ (crcValue >> 8);
+		pLinePtr++;
+	}
+	// Calculate the sum of all pixels
+	uint32 nSumValue = 0;
+	for (int n = 0; n < 256; n++) {
+		nSumValue += pChannelB[n]*n + pChannelG[n]*n + pChannelR[n]*n;
+	}
+	// finally calculate the hash value, a sum of 0 is invalid (fully black image - no DB entry)
+	// as this is used as a marker
+	if (nSumValue == 0) {
+		m_nPixelHash = 0;
+	} else {
+		m_nPixelHash = ((__int64)crcValue << 32) + nSumValue;
+	}
+}
+
 // Second phase construction of LDC map using the point sampled image
 void CLocalDensityCorr::CreateLDCMap() {
 	assert(m_pLDCMap == NULL);
@@ -13,6 +13,13 @@ public:
 	// if only constructed partially this does the rest for creating a fully functional LDC object
 	void VerifyFullyConstructed();
 
+	// Creates the LDC of the image rotated clockwise by 90, 180 or 270 degrees from the LDC of the image. The pixels
+	// are not sampled again, the point sampled image is rotated instead. The histogram and the black and white points
+	// do not depend on the orientation and are taken over, the LDC map and the pixel hash are calculated again.
+	static CLocalDensityCorr* CreateRotated(const CLocalDensityCorr & ldc, int nRotationCW);
+	// Creates the LDC of the image mirrored horizontally or vertically from the LDC of the image, see CreateRotated()
+	static CLocalDensityCorr* CreateMirrored(const CLocalDensityCorr & ldc, bool bHorizontally);
+
 	// Gets the histogram.
 	// The histogram is a side product of the LDC and can be retrieved if needed
 	const CHistogram* GetHistogram() { return m_pHistogramm; }
@@ -51,6 +58,9 @@ public:
 	void* GetPSImageAsDIB();
 
 private:
+	// Transformed copy of the given LDC, see CreateRotated() and CreateMirrored()
+	CLocalDensityCorr(const CLocalDensityCorr & ldc, int nRotationCW, bool bMirrorH, bool bMirrorV);
+
 	CHistogram* m_pHistogramm;
 	int m_nLDCWidth;
 	int m_nLDCHeight;
@@ -70,4 +80,5 @@ private:
 	uint8* MultiplyMap(double dLightenShadows, double dDarkenHighlights);
 	float CheckIfSunset(uint32* pRowBGR, int nHeight);
 	void CreateLDCMap();
+	void CalculatePixelHash(const int* pChannelB, const int* pChannelG, const int* pChannelR);
 };
@@ -53,6 +53,7 @@
 #include "DirectoryWatcher.h"
 #include "DesktopWallpaper.h"
 #include "PrintImage.h"
+#include "Tracer.h"
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 // Constants
@@ -65,8 +66,6 @@ static const double GAMMA_FACTOR = 1.02; // multiplicator for gamma value
 static const double CONTRAST_INC = 0.03; // increment for contrast value
 static const double SHARPEN_INC = 0.05; // increment for sharpen value
 static const double LDC_INC = 0.1; // increment for LDC (lighten shadows and darken highlights)
-static const int NUM_THREADS = 1; // number of readahead threads to use
-static const int READ_AHEAD_BUFFERS = 2; // number of readahead buffers to use (NUM_THREADS+1 is a good choice)
 static const int ZOOM_TIMEOUT = 200; // refinement done after this many milliseconds
 static const int ZOOM_TEXT_TIMEOUT = 1000; // zoom label disappears after this many milliseconds
 
@@ -168,6 +167,37 @@ static EProcessingFlags _SetLandscapeModeFlags(EProcessingFlags eFlags) {
 	}
 }
 
+// Sets the flag allowing to decode JPEGs with reduced resolution or to use cached previews according to the INI file.
+// Only allowed when the image is displayed fit to screen, a zoom factor refers to the full resolution image.
+static EProcessingFlags _SetReducedResolutionFlag(EProcessingFlags eFlags, double dZoom) {
+	return SetProcessingFlag(eFlags, PFLAG_ReducedResolution, dZoom < 0.0 &&
+		(CSettingsProvider::This().ScaledJPEGDecoding() || CSettingsProvider::This().PreviewCacheSizeMB() > 0));
+}
+
+// Returns if the command works on the original pixels or depends on the original image size and thus needs
+// the full resolution image when the current image was decoded with reduced resolution
+static bool IsFullResolutionCommand(int nCommand) {
+	switch (nCommand) {
+		case IDM_SAVE:
+		case IDM_SAVE_ALLOW_NO_PROMPT:
+		case IDM_PRINT:
+		case IDM_COPY_FULL:
+		case IDM_SAVE_PARAM_DB:
+		case IDM_CHANGESIZE:
+		case IDM_MIRROR_H:
+		case IDM_MIRROR_V:
+		case IDM_SET_WALLPAPER_ORIG:
+		case IDM_ZOOM_400:
+		case IDM_ZOOM_200:
+		case IDM_ZOOM_100:
+		case IDM_ZOOM_50:
+		case IDM_ZOOM_25:
+			return true;
+		default:
+			return false;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 // Public
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -258,8 +288,7 @@ CMainDlg::CMainDlg(bool bForceFullScreen) {
 	m_bMouseOn = false;
 	m_bKeepParametersBeforeAnimation = false;
 	m_bIsAnimationPlaying = false;
-	m_nLastAnimationOffset = 0;
-	m_nExpectedNextAnimationTickCount = 0;
+	m_dNextAnimationFrameTime = 0.0;
 	m_bUseLosslessWEBP = false;
 	m_isBeforeFileSelected = true;
 	m_dLastImageDisplayTime = 0.0;
@@ -383,7 +412,7 @@ LRESULT CMainDlg::OnInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 	CProcessingThreadPool::This().CreateThreadPoolThreads();
 
 	// create JPEG provider and request first image - do no processing yet if not in fullscreen mode (as we do not know the size yet)
-	m_pJPEGProvider = new CJPEGProvider(m_hWnd, NUM_THREADS, READ_AHEAD_BUFFERS);	
+	m_pJPEGProvider = new CJPEGProvider(m_hWnd, sp.ReadAheadThreads(), sp.ReadAheadImages(), sp.AnimationFramesAhead(), (__int64)sp.ImageCacheSizeMB() * 1024 * 1024);
 	m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, CJPEGProvider::FORWARD,
 		m_pFileList->Current(), 0, CreateProcessParams(!m_bFullScreenMode), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage);
 	if (m_pCurrentImage != NULL && m_pCurrentImage->IsAnimation()) {
@@ -490,7 +519,11 @@ LRESULT CMainDlg::OnPaint(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, B
 			m_clientRect.Size(), IsAdjustWindowToImage() ? Helpers::ZM_FitToScreenNoZoom : 
 			   (m_isUserFitToScreen ? m_autoZoomFitToScreen : GetAutoZoomMode()), m_dZoom);
 		m_virtualImageSize = newSize;
-		m_dRealizedZoom = (double)newSize.cx / m_pCurrentImage->OrigSize().cx;
+		m_dRealizedZoom = (double)newSize.cx / m_pCurrentImage->OrigSizeFullResolution().cx;
+		if (m_pCurrentImage->IsReducedResolution() && newSize.cx > m_pCurrentImage->OrigWidth()) {
+			// zoomed in beyond the reduced resolution, load full resolution image in the background
+			m_pJPEGProvider->RequestFullResolution(m_pCurrentImage, CreateProcessParams(true), false);
+		}
 		CPoint unlimitedOffsets = m_offsets;
 		m_offsets = Helpers::LimitOffsets(m_offsets, m_clientRect.Size(), newSize);
 		m_DIBOffsets = m_bZoomMode ? (unlimitedOffsets - m_offsets) : CPoint(0, 0);
@@ -510,9 +543,12 @@ LRESULT CMainDlg::OnPaint(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, B
 			pDIBData = m_pTiltCorrectionPanelCtl->GetDIBForPreview(newSize, clippedSize, offsetsInImage, 
 				*m_pImageProcParams, CreateProcessingFlags(false, m_bAutoContrast, m_bAutoContrastSection, m_bLDC, false, m_bLandscapeMode));
 		} else {
-			pDIBData = m_pCurrentImage->GetDIB(newSize, clippedSize, offsetsInImage, 
-				*m_pImageProcParams, 
-				CreateProcessingFlags(m_bHQResampling && !m_bTemporaryLowQ && !m_bZoomMode, m_bAutoContrast, m_bAutoContrastSection, m_bLDC, false, m_bLandscapeMode));
+			EProcessingFlags eProcFlags = CreateProcessingFlags(m_bHQResampling && !m_bTemporaryLowQ && !m_bZoomMode, m_bAutoContrast, m_bAutoContrastSection, m_bLDC, false, m_bLandscapeMode);
+			// Expensive high quality resampling is done in the background, the image is point sampled until it has finished
+			if (m_pCurrentImage->ResampleHQAsync(newSize, clippedSize, offsetsInImage, *m_pImageProcParams, eProcFlags, m_hWnd, WM_RESAMPLE_HQ_READY)) {
+				eProcFlags = SetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling, false);
+			}
+			pDIBData = m_pCurrentImage->GetDIB(newSize, clippedSize, offsetsInImage, *m_pImageProcParams, eProcFlags);
 		}
 
 		// Zoom navigator - check if visible and create exclusion rectangle
@@ -527,6 +563,7 @@ LRESULT CMainDlg::OnPaint(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, B
 
 		// Paint the DIB
 		if (pDIBData != NULL) {
+			CTraceSpan span(TRACE_Blit, m_pCurrentImage->GetImageFormat(), (__int64)clippedSize.cx * clippedSize.cy);
 			BITMAPINFO bmInfo{ 0 };
 			CPoint ptDIBStart = HelpersGUI::DrawDIB32bppWithBlackBorders(dc, bmInfo, pDIBData, backBrush, m_clientRect, clippedSize, m_DIBOffsets);
 			// The DIB is also blitted into the memory DCs of the panels
@@ -602,7 +639,7 @@ void CMainDlg::PaintToDC(CDC& dc) {
 		double dZoom = m_dZoom;
 		CSize newSize = Helpers::GetVirtualImageSize(pCurrentImage->OrigSize(), m_clientRect.Size(), GetAutoZoomMode(), dZoom);
 		CPoint offsets = Helpers::LimitOffsets(GetOffsets(), m_clientRect.Size(), newSize);
-		m_dRealizedZoom = (double)newSize.cx / m_pCurrentImage->OrigSize().cx;
+		m_dRealizedZoom = (double)newSize.cx / m_pCurrentImage->OrigSizeFullResolution().cx;
 
 		// Clip to client rectangle and request the DIB
 		CSize clippedSize(min(m_clientRect.Width(), newSize.cx), min(m_clientRect.Height(), newSize.cy));
@@ -740,6 +777,14 @@ LRESULT CMainDlg::OnLoadFileAsynch(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lPar
 	return 0;
 }
 
+LRESULT CMainDlg::OnResampleHQReady(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
+	// the next paint takes the high quality DIB resampled in the background
+	if (m_pCurrentImage != NULL) {
+		this->Invalidate(FALSE);
+	}
+	return 0;
+}
+
 LRESULT CMainDlg::OnClose(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& bHandled) {
 	GetWindowRect(m_windowRectOnClose);
 	bHandled = FALSE;
@@ -1025,6 +1070,7 @@ LRESULT CMainDlg::OnGetDlgCode(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 LRESULT CMainDlg::OnImageLoadCompleted(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/) {
 	// route to JPEG provider
 	m_pJPEGProvider->OnImageLoadCompleted((int)lParam);
+	SwitchToFullResolutionImage();
 	return 0;
 }
 
@@ -1037,8 +1083,20 @@ LRESULT CMainDlg::OnDisplayedFileChangedOnDisk(UINT /*uMsg*/, WPARAM /*wParam*/,
 }
 
 LRESULT CMainDlg::OnActiveDirectoryFilelistChanged(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
-	if (CSettingsProvider::This().ReloadWhenDisplayedImageChanged() && m_pFileList != NULL && m_pFileList->CurrentFileExists()) {
+	if (m_pFileList == NULL) {
+		return 0;
+	}
+	// the changes are always applied to the file list, otherwise they are lost when retrieved the next time
+	CString sDirectory;
+	std::vector<CDirectoryChange> changes;
+	bool bChangesKnown = m_pDirectoryWatcher->GetFileListChanges(sDirectory, changes);
+	bool bApplied = bChangesKnown && m_pFileList->ApplyDirectoryChanges(sDirectory, changes);
+	if (!bApplied && CSettingsProvider::This().ReloadWhenDisplayedImageChanged() && m_pFileList->CurrentFileExists()) {
+		// the changes are not known, enumerate the folder again
 		m_pFileList->Reload(NULL, false);
+		bApplied = true;
+	}
+	if (bApplied) {
 		Invalidate(FALSE);
 	}
 	return 0;
@@ -1329,6 +1387,9 @@ bool CMainDlg::CloseHelpDlg() {
 void CMainDlg::ExecuteCommand(int nCommand) {
 	CSettingsProvider& sp = CSettingsProvider::This();
 	InvalidateHelpDlg();
+	if (IsFullResolutionCommand(nCommand)) {
+		EnsureFullResolution();
+	}
 	switch (nCommand) {
 		case IDM_HELP:
 			if (m_pHelpDlg == NULL || m_pHelpDlg->IsDestroyed()) {
@@ -2502,6 +2563,10 @@ void CMainDlg::GotoImage(EImagePosition ePos, int nFlags) {
 		MouseOff();
 	}
 
+	if (m_pCurrentImage != NULL && m_pCurrentImage->IsReducedResolution() && m_dZoom > 0.0) {
+		// a kept zoom factor must refer to the full resolution
+		m_dZoom /= m_pCurrentImage->ReductionFactor();
+	}
 	if (nFlags & KEEP_PARAMETERS) {
 		if (!(m_bUserZoom || IsAdjustWindowToImage())) {
 			m_dZoom = -1;
@@ -2791,6 +2856,7 @@ void CMainDlg::ResetZoomToFitScreen(bool bFillWithCrop, bool bAllowEnlarge, bool
 }
 
 void CMainDlg::ResetZoomTo100Percents(bool bZoomToMouse) {
+	EnsureFullResolution(); // 100 % refers to the full resolution image
 	if (m_pCurrentImage != NULL && fabs(m_dZoom - 1) > 0.01) {
 		// the current design (unless changed) cursor always shows in windowed mode, so always zoom to cursor when not fullscreen
 		PerformZoom(1.0, false, bZoomToMouse || !m_bFullScreenMode, true);
@@ -2832,7 +2898,7 @@ CProcessParams CMainDlg::CreateProcessParams(bool bNoProcessingAfterLoad) {
 			eAutoZoomMode,
 			m_offsetKept,
 			_SetLandscapeModeParams(m_bLandscapeMode, *m_pImageProcParamsKept), 
-			SetProcessingFlag(_SetLandscapeModeFlags(m_eProcessingFlagsKept), PFLAG_NoProcessingAfterLoad, bNoProcessingAfterLoad));
+			SetProcessingFlag(_SetReducedResolutionFlag(_SetLandscapeModeFlags(m_eProcessingFlagsKept), m_dZoomKept), PFLAG_NoProcessingAfterLoad, bNoProcessingAfterLoad));
 	} else {
 		m_isUserFitToScreen = false;
 		CSettingsProvider& sp = CSettingsProvider::This();
@@ -2840,7 +2906,7 @@ CProcessParams CMainDlg::CreateProcessParams(bool bNoProcessingAfterLoad) {
 			CMultiMonitorSupport::GetMonitorRect(m_hWnd).Size(),
 			CRotationParams(0), 0, -1, eAutoZoomMode, CPoint(0, 0),
 			_SetLandscapeModeParams(m_bLandscapeMode, GetDefaultProcessingParams()),
-			SetProcessingFlag(_SetLandscapeModeFlags(GetDefaultProcessingFlags(m_bLandscapeMode)), PFLAG_NoProcessingAfterLoad, bNoProcessingAfterLoad));
+			SetProcessingFlag(_SetReducedResolutionFlag(_SetLandscapeModeFlags(GetDefaultProcessingFlags(m_bLandscapeMode)), m_dZoom), PFLAG_NoProcessingAfterLoad, bNoProcessingAfterLoad));
 	}
 }
 
@@ -3039,6 +3105,38 @@ void CMainDlg::AfterNewImageLoaded(bool bSynchronize, bool bAfterStartup, bool n
 	}
 }
 
+void CMainDlg::EnsureFullResolution() {
+	if (m_pCurrentImage != NULL && m_pCurrentImage->IsReducedResolution()) {
+		m_pJPEGProvider->RequestFullResolution(m_pCurrentImage, CreateProcessParams(true), true);
+		SwitchToFullResolutionImage();
+	}
+}
+
+void CMainDlg::SwitchToFullResolutionImage() {
+	if (m_pCurrentImage == NULL || !m_pCurrentImage->IsReducedResolution()) {
+		return;
+	}
+	int nReductionFactor = m_pCurrentImage->ReductionFactor();
+	// the full resolution image is loaded without the rotations the user applied to the reduced resolution image
+	CRotationParams rotationParams = m_pCurrentImage->GetRotationParams();
+	CJPEGImage* pFullResolutionImage = m_pJPEGProvider->GetFullResolutionImage(m_pCurrentImage);
+	if (pFullResolutionImage == NULL) {
+		return;
+	}
+	m_pCurrentImage = pFullResolutionImage;
+	m_pCurrentImage->VerifyRotation(rotationParams);
+	// keep the virtual image size, the offsets are relative to it
+	if (m_dZoom > 0.0) {
+		m_dZoom /= nReductionFactor;
+		m_dStartZoom /= nReductionFactor;
+	}
+	m_dZoomMult = GetZoomMultiplier(m_pCurrentImage, m_clientRect);
+	m_pCropCtl->SetImageSize(m_pCurrentImage->OrigSize());
+	// paint now, coordinate conversions need the DIB of the new image
+	this->Invalidate(FALSE);
+	this->UpdateWindow();
+}
+
 bool CMainDlg::IsAdjustWindowToImage() {
 	return !m_bFullScreenMode && !::IsZoomed(m_hWnd) && m_bAutoFitWndToImage;
 }
@@ -3255,6 +3353,7 @@ void CMainDlg::UpdateWindowTitle() {
 }
 
 bool CMainDlg::PrepareForModalPanel() {
+	EnsureFullResolution();
 	m_pImageProcPanelCtl->SetVisible(false);
 	bool bOldShowNavPanel = m_pNavPanelCtl->IsActive();
 	m_pNavPanelCtl->SetActive(false);
@@ -3487,17 +3586,20 @@ void CMainDlg::StartAnimation() {
 	::SetTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID, nNewFrameTime, NULL);
 	m_pNavPanelCtl->EndNavPanelAnimation();
 	m_nLastSlideShowImageTickCount = ::GetTickCount();
-	m_nLastAnimationOffset = 0;
-	m_nExpectedNextAnimationTickCount = ::GetTickCount() + nNewFrameTime;
+	m_dNextAnimationFrameTime = Helpers::GetExactTickCount() + nNewFrameTime;
 }
 
 void CMainDlg::AdjustAnimationFrameTime() {
-	// restart timer with new frame time
+	// restart timer with new frame time. The frames are scheduled by their durations from the time the previous frame was due,
+	// so the delays of the timer and of painting do not add up. If more than a frame behind, continue from now instead of hurrying.
 	::KillTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID);
-	m_nLastAnimationOffset += ::GetTickCount() - m_nExpectedNextAnimationTickCount;
-	m_nLastAnimationOffset = min(m_nLastAnimationOffset, max(100, m_pCurrentImage->FrameTimeMs())); // prevent offset from getting too big
-	int nNewFrameTime = max(10, m_pCurrentImage->FrameTimeMs() - max(0, m_nLastAnimationOffset));
-	m_nExpectedNextAnimationTickCount = ::GetTickCount() + max(10, m_pCurrentImage->FrameTimeMs());
+	double dFrameTime = max(10, m_pCurrentImage->FrameTimeMs());
+	double dCurrentTime = Helpers::GetExactTickCount();
+	m_dNextAnimationFrameTime += dFrameTime;
+	if (m_dNextAnimationFrameTime < dCurrentTime) {
+		m_dNextAnimationFrameTime = dCurrentTime + dFrameTime;
+	}
+	int nNewFrameTime = max(USER_TIMER_MINIMUM, (int)(m_dNextAnimationFrameTime - dCurrentTime + 0.5));
 	::SetTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID, nNewFrameTime, NULL);
 }
 
@@ -88,6 +88,7 @@ public:
 		MESSAGE_HANDLER(WM_DROPFILES, OnDropFiles)
 		MESSAGE_HANDLER(WM_CLOSE, OnClose)
 		MESSAGE_HANDLER(WM_LOAD_FILE_ASYNCH, OnLoadFileAsynch)
+		MESSAGE_HANDLER(WM_RESAMPLE_HQ_READY, OnResampleHQReady)
 		MESSAGE_HANDLER(WM_COPYDATA, OnAnotherInstanceStarted) 
 		COMMAND_ID_HANDLER(IDOK, OnOK)
 		COMMAND_ID_HANDLER(IDCANCEL, OnCancel)
@@ -130,6 +131,7 @@ public:
 	LRESULT OnDropFiles(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
 	LRESULT OnAnotherInstanceStarted(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
 	LRESULT OnLoadFileAsynch(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
+	LRESULT OnResampleHQReady(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 	LRESULT OnClose(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
 
 	// Called by main()
@@ -209,6 +211,7 @@ public:
 	bool ImageToScreen(float & fX, float & fY);
 	void ExecuteCommand(int nCommand);
 	bool PrepareForModalPanel(); // returns if navigation panel was enabled, turns it off
+	void EnsureFullResolution(); // loads the full resolution image if the current image was decoded with reduced resolution
 	int TrackPopupMenu(CPoint pos, HMENU hMenu);
 	void AdjustWindowToImage(bool bAfterStartup);
 	bool IsAdjustWindowToImage();
@@ -301,8 +304,7 @@ private:
 	bool m_bMouseOn;
 	bool m_bKeepParametersBeforeAnimation;
 	bool m_bIsAnimationPlaying;
-	int m_nLastAnimationOffset;
-	int m_nExpectedNextAnimationTickCount;
+	double m_dNextAnimationFrameTime; // time the next frame of the playing animation is due, see AdjustAnimationFrameTime()
 	int m_nMonitor;
 	WINDOWPLACEMENT m_storedWindowPlacement;
 	CRect m_monitorRect;
@@ -362,6 +364,7 @@ private:
 	void ExchangeProcessingParams();
 	void SaveParameters();
 	void AfterNewImageLoaded(bool bSynchronize, bool bAfterStartup, bool noAdjustWindow);
+	void SwitchToFullResolutionImage();
 	CRect ScreenToDIB(const CSize& sizeDIB, const CRect& rect);
 	void ToggleMonitor();
 	CRect GetZoomTextRect(CRect imageProcessingArea);
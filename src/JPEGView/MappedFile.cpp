@@ -0,0 +1,57 @@
+#include "StdAfx.h"
+#include "MappedFile.h"
+#include "Helpers.h"
+#include "Tracer.h"
+
+CMappedFile::CMappedFile(LPCTSTR sFileName) {
+	// the pages are read when accessed, the time for this is part of the stage accessing the data
+	CTraceSpan span(TRACE_FileRead);
+	m_hMapping = NULL;
+	m_pData = NULL;
+	m_nSize = 0;
+	m_hFile = ::CreateFile(sFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	m_nSize = Helpers::GetFileSize(m_hFile);
+	if (m_nSize <= 0) {
+		return;
+	}
+	m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping == NULL) {
+		return;
+	}
+	m_pData = ::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+}
+
+CMappedFile::~CMappedFile() {
+	if (m_pData != NULL) {
+		::UnmapViewOfFile(m_pData);
+	}
+	if (m_hMapping != NULL) {
+		::CloseHandle(m_hMapping);
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hFile);
+	}
+}
+
+IStream* CMappedFile::CreateStream() const {
+	if (m_pData == NULL) {
+		return NULL;
+	}
+	HGLOBAL hBuffer = ::GlobalAlloc(GMEM_MOVEABLE, (SIZE_T)m_nSize);
+	void* pBuffer = (hBuffer == NULL) ? NULL : ::GlobalLock(hBuffer);
+	if (pBuffer == NULL) {
+		if (hBuffer) ::GlobalFree(hBuffer);
+		return NULL;
+	}
+	memcpy(pBuffer, m_pData, (size_t)m_nSize);
+	::GlobalUnlock(hBuffer);
+	IStream* pStream = NULL;
+	if (::CreateStreamOnHGlobal(hBuffer, TRUE, &pStream) != S_OK) {
+		::GlobalFree(hBuffer);
+		return NULL;
+	}
+	return pStream;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Read-only memory mapped view of a whole file.
+// The decoders read the compressed image data directly from the mapped pages, no copy of the file is made.
+// Reading from a mapped view of a file that vanishes (e.g. on a network drive) raises EXCEPTION_IN_PAGE_ERROR,
+// this is caught by the catch(...) handlers of the callers as the project is compiled with /EHa.
+class CMappedFile
+{
+public:
+	// Opens and maps the file, check IsValid() for success
+	CMappedFile(LPCTSTR sFileName);
+	~CMappedFile();
+
+	// True if the file could be opened and mapped. Empty files cannot be mapped.
+	bool IsValid() const { return m_pData != NULL; }
+
+	// Start of the mapped file data, NULL if not valid
+	const void* Data() const { return m_pData; }
+
+	// Size of the file in bytes, also valid if the file could be opened but not mapped
+	__int64 Size() const { return m_nSize; }
+
+	// Creates a stream on a copy of the file data, for decoders that need an IStream (GDI+).
+	// The caller must release the stream. Returns NULL if out of memory.
+	IStream* CreateStream() const;
+
+private:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const void* m_pData;
+	__int64 m_nSize;
+
+	// not copyable
+	CMappedFile(const CMappedFile&);
+	CMappedFile& operator=(const CMappedFile&);
+};
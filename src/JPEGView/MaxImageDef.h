@@ -2,32 +2,36 @@
 
 // Sizes are in bytes
 
+// JPEG, PNG, WebP, JPEG XL, HEIF/AVIF, QOI, PSD, BMP and TGA files are memory mapped and decoded directly from the mapped pages,
+// for these formats the file size is limited by the address space and not by the available memory.
+// The decoder interfaces use int sizes, so the limit must stay below 2 GB.
+
 #ifdef _WIN64
-const unsigned int MAX_JPEG_FILE_SIZE = 1024 * 1024 * 300;
+const unsigned int MAX_JPEG_FILE_SIZE = 1024 * 1024 * 1024;
 #else
 const unsigned int MAX_JPEG_FILE_SIZE = 1024 * 1024 * 50;
 #endif
 
 #ifdef _WIN64
-const unsigned int MAX_PNG_FILE_SIZE = 1024 * 1024 * 300;
+const unsigned int MAX_PNG_FILE_SIZE = 1024 * 1024 * 1024;
 #else
 const unsigned int MAX_PNG_FILE_SIZE = 1024 * 1024 * 50;
 #endif
 
 #ifdef _WIN64
-const unsigned int MAX_WEBP_FILE_SIZE = 1024 * 1024 * 150;
+const unsigned int MAX_WEBP_FILE_SIZE = 1024 * 1024 * 1024;
 #else
 const unsigned int MAX_WEBP_FILE_SIZE = 1024 * 1024 * 50;
 #endif
 
 #ifdef _WIN64
-const unsigned int MAX_JXL_FILE_SIZE = 1024 * 1024 * 150;
+const unsigned int MAX_JXL_FILE_SIZE = 1024 * 1024 * 1024;
 #else
 const unsigned int MAX_JXL_FILE_SIZE = 1024 * 1024 * 50;
 #endif
 
 #ifdef _WIN64
-const unsigned int MAX_HEIF_FILE_SIZE = 1024 * 1024 * 150;
+const unsigned int MAX_HEIF_FILE_SIZE = 1024 * 1024 * 1024;
 #else
 const unsigned int MAX_HEIF_FILE_SIZE = 1024 * 1024 * 50;
 #endif
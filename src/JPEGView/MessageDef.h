@@ -7,10 +7,13 @@
 // Message posted when the currently shown imae has been changed on disk and needs to be reloaded
 #define WM_DISPLAYED_FILE_CHANGED_ON_DISK (WM_APP + 7)
 
-// Message posted when the files in the current directory have been added or removed and thus the
-// list of images in the directory needs to be reloaded
+// Message posted when the files in the current directory have been added, removed or renamed and thus the
+// list of images in the directory needs to be updated. The changes are retrieved with CDirectoryWatcher::GetFileListChanges()
 #define WM_ACTIVE_DIRECTORY_FILELIST_CHANGED (WM_APP + 8)
 
+// Posted to the main dialog when the high quality resampling of the displayed image, done in the background, has finished
+#define WM_RESAMPLE_HQ_READY (WM_APP + 9)
+
 // Posted to main dialog for asynchronously loading the image with file name CMainDlg::m_sStartupFile
 #define WM_LOAD_FILE_ASYNCH (WM_APP + 24)
 
@@ -5,6 +5,8 @@
 #ifndef WINXP
 #include "png.h"
 #include "MaxImageDef.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
 #include <stdexcept>
 
 // Uncomment to build without APNG support
@@ -66,13 +68,11 @@ struct PngReader::png_cache {
 	unsigned int channels;
 	unsigned int frame_index;
 	png_uint_32 frame_count;
-	void* buffer;
+	const void* buffer;
 	size_t buffer_size;
 	size_t buffer_offset;
 };
 
-PngReader::png_cache PngReader::cache = { 0 };
-
 #ifdef PNG_APNG_SUPPORTED
 void BlendOver(unsigned char** rows_dst, unsigned char** rows_src, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
 {
@@ -108,58 +108,70 @@ void BlendOver(unsigned char** rows_dst, unsigned char** rows_src, unsigned int
 }
 #endif
 
-void* PngReader::ReadNextFrame(void** exif_chunk, png_uint_32* exif_size)
+void* PngReader::ReadNextFrame(png_cache* cache, void** exif_chunk, png_uint_32* exif_size)
 {
 	unsigned int j;
+	if (setjmp(png_jmpbuf(cache->png_ptr)))
+	{
+		// the jump buffer set in BeginReading() is not valid anymore, errors and cancellation while reading the frame end here
+		bool cancelled = CProcessingThreadPool::IsCancelledOnThread();
+		DeleteCacheInternal(cache, false);
+		if (cancelled)
+			return NULL;
+		throw std::runtime_error::runtime_error("Image contains errors.");
+	}
 	if (exif_chunk != NULL && exif_size != NULL) {
-		png_get_eXIf_1(cache.png_ptr, cache.info_ptr, exif_size, (png_bytep*)exif_chunk);
+		png_get_eXIf_1(cache->png_ptr, cache->info_ptr, exif_size, (png_bytep*)exif_chunk);
 	}
 #ifdef PNG_APNG_SUPPORTED
-	if (png_get_valid(cache.png_ptr, cache.info_ptr, PNG_INFO_acTL))
+	if (png_get_valid(cache->png_ptr, cache->info_ptr, PNG_INFO_acTL))
 	{
-		png_read_frame_head(cache.png_ptr, cache.info_ptr);
-		png_get_next_frame_fcTL(cache.png_ptr, cache.info_ptr, &cache.w0, &cache.h0, &cache.x0, &cache.y0, &cache.delay_num, &cache.delay_den, &cache.dop, &cache.bop);
+		png_read_frame_head(cache->png_ptr, cache->info_ptr);
+		png_get_next_frame_fcTL(cache->png_ptr, cache->info_ptr, &cache->w0, &cache->h0, &cache->x0, &cache->y0, &cache->delay_num, &cache->delay_den, &cache->dop, &cache->bop);
 	}
-	if (cache.frame_index == cache.first)
+	if (cache->frame_index == cache->first)
 	{
-		cache.bop = PNG_BLEND_OP_SOURCE;
-		if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-			cache.dop = PNG_DISPOSE_OP_BACKGROUND;
+		cache->bop = PNG_BLEND_OP_SOURCE;
+		if (cache->dop == PNG_DISPOSE_OP_PREVIOUS)
+			cache->dop = PNG_DISPOSE_OP_BACKGROUND;
 	}
 #endif
-	png_read_image(cache.png_ptr, cache.rows_frame);
+	{
+		CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)cache->w0 * cache->h0);
+		png_read_image(cache->png_ptr, cache->rows_frame);
+	}
 
 #ifdef PNG_APNG_SUPPORTED
-	if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-		memcpy(cache.p_temp, cache.p_image, cache.size);
+	if (cache->dop == PNG_DISPOSE_OP_PREVIOUS)
+		memcpy(cache->p_temp, cache->p_image, cache->size);
 
-	if (cache.bop == PNG_BLEND_OP_OVER)
-		BlendOver(cache.rows_image, cache.rows_frame, cache.x0, cache.y0, cache.w0, cache.h0);
+	if (cache->bop == PNG_BLEND_OP_OVER)
+		BlendOver(cache->rows_image, cache->rows_frame, cache->x0, cache->y0, cache->w0, cache->h0);
 	else
 #endif
-		for (j = 0; j < cache.h0; j++)
-			memcpy(cache.rows_image[j + cache.y0] + cache.x0 * 4, cache.rows_frame[j], cache.w0 * 4);
+		for (j = 0; j < cache->h0; j++)
+			memcpy(cache->rows_image[j + cache->y0] + cache->x0 * 4, cache->rows_frame[j], cache->w0 * 4);
 
-	void* pixels = malloc(cache.width * cache.height * cache.channels);
+	void* pixels = malloc(cache->width * cache->height * cache->channels);
 	if (pixels == NULL)
 		return NULL;
-	for (j = 0; j < cache.height; j++)
-		memcpy((char*)pixels + j * cache.width * cache.channels, cache.rows_image[j], cache.width * cache.channels);
+	for (j = 0; j < cache->height; j++)
+		memcpy((char*)pixels + j * cache->width * cache->channels, cache->rows_image[j], cache->width * cache->channels);
 
 #ifdef PNG_APNG_SUPPORTED
-	if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-		memcpy(cache.p_image, cache.p_temp, cache.size);
+	if (cache->dop == PNG_DISPOSE_OP_PREVIOUS)
+		memcpy(cache->p_image, cache->p_temp, cache->size);
 	else
-		if (cache.dop == PNG_DISPOSE_OP_BACKGROUND)
-			for (j = 0; j < cache.h0; j++)
-				memset(cache.rows_image[j + cache.y0] + cache.x0 * 4, 0, cache.w0 * 4);
+		if (cache->dop == PNG_DISPOSE_OP_BACKGROUND)
+			for (j = 0; j < cache->h0; j++)
+				memset(cache->rows_image[j + cache->y0] + cache->x0 * 4, 0, cache->w0 * 4);
 #endif
-	cache.frame_index++;
-	cache.frame_index %= cache.frame_count;
+	cache->frame_index++;
+	cache->frame_index %= cache->frame_count;
 	return pixels;
 }
 
-bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
+bool PngReader::BeginReading(png_cache* cache, const void* buffer, size_t sizebytes, bool& outOfMemory)
 {
 	unsigned int    width, height, channels, rowbytes, size, j;
 	png_bytepp      rows_image;
@@ -168,7 +180,7 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 	unsigned char*  p_frame;
 	unsigned char*  p_temp;
 
-
+	CTraceSpan parseSpan(TRACE_Parse);
 	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	png_infop   info_ptr = png_create_info_struct(png_ptr);
 
@@ -178,7 +190,7 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 
 		if (setjmp(png_jmpbuf(png_ptr)))
 		{
-			PngReader::DeleteCache();
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 			throw std::runtime_error::runtime_error("Image contains errors.");
 		}
 		// skip png signature since we already checked it
@@ -186,18 +198,26 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 		// custom read function so we can read from memory
 		png_rw_ptr read_data_fn = [](png_structp png_ptr, png_bytep outbuffer, png_size_t sizebytes)
 		{
-			png_voidp io_ptr = png_get_io_ptr(png_ptr);
-			if (io_ptr == NULL)
+			png_cache* state = (png_cache*)png_get_io_ptr(png_ptr);
+			if (state == NULL)
 				png_error(png_ptr, "png_get_io_ptr returned NULL");
-			else if (cache.buffer_offset + sizebytes > cache.buffer_size)
+			else if (state->buffer_offset + sizebytes > state->buffer_size)
 				png_error(png_ptr, "Attempted to read out of bounds");
 			else
 			{
-				memcpy(outbuffer, (char*)io_ptr + cache.buffer_offset, sizebytes);
-				cache.buffer_offset += sizebytes;
+				memcpy(outbuffer, (const char*)state->buffer + state->buffer_offset, sizebytes);
+				state->buffer_offset += sizebytes;
 			}
 		};
-		png_set_read_fn(png_ptr, (char*)buffer, read_data_fn);
+		// the data is read from the buffer of the decoder state
+		png_set_read_fn(png_ptr, cache, read_data_fn);
+		// called after each row, stops reading when the load is cancelled
+		png_read_status_ptr read_row_fn = [](png_structp png_ptr, png_uint_32 row, int pass)
+		{
+			if (CProcessingThreadPool::IsCancelledOnThread())
+				png_error(png_ptr, "Reading cancelled");
+		};
+		png_set_read_status_fn(png_ptr, read_row_fn);
 		png_read_info(png_ptr, info_ptr);
 		png_set_expand(png_ptr);
 		png_set_strip_16(png_ptr);
@@ -254,30 +274,30 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 				rows_frame[j] = p_frame + j * rowbytes;
 
 #ifdef PNG_APNG_SUPPORTED
-			cache.bop = bop;
-			// cache.plays = plays
-			cache.delay_den = delay_den;
-			cache.delay_num = delay_num;
-			cache.dop = dop;
-			cache.first = first;
+			cache->bop = bop;
+			// cache->plays = plays
+			cache->delay_den = delay_den;
+			cache->delay_num = delay_num;
+			cache->dop = dop;
+			cache->first = first;
 #endif
-			cache.channels = channels;
-			cache.h0 = h0;
-			cache.height = height;
+			cache->channels = channels;
+			cache->h0 = h0;
+			cache->height = height;
 			// cache ptrs here, only if valid
-			cache.info_ptr = info_ptr;
-			cache.png_ptr = png_ptr;
-			cache.p_image = p_image;
-			cache.p_frame = p_frame;
-			cache.p_temp = p_temp;
-			cache.rows_frame = rows_frame;
-			cache.rows_image = rows_image;
-			cache.size = size;
-			cache.w0 = w0;
-			cache.width = width;
-			cache.x0 = x0;
-			cache.y0 = y0;
-			cache.frame_count = frames;
+			cache->info_ptr = info_ptr;
+			cache->png_ptr = png_ptr;
+			cache->p_image = p_image;
+			cache->p_frame = p_frame;
+			cache->p_temp = p_temp;
+			cache->rows_frame = rows_frame;
+			cache->rows_image = rows_image;
+			cache->size = size;
+			cache->w0 = w0;
+			cache->width = width;
+			cache->x0 = x0;
+			cache->y0 = y0;
+			cache->frame_count = frames;
 			return frames > 0;
 		}
 		free(p_image);
@@ -298,25 +318,28 @@ void* PngReader::ReadImage(int& width,
 	int& frame_time,
 	void*& exif_chunk,
 	bool& outOfMemory,
-	void* buffer,
+	png_cache*& cache,
+	const void* buffer,
 	size_t sizebytes)
 {
 	exif_chunk = NULL;
-	if (!cache.buffer) {
+	if (cache == NULL) {
 		if (sizebytes < 8)
 			return NULL;
-		cache.buffer = malloc(sizebytes-8);
-		if (!cache.buffer)
+		cache = new(std::nothrow) png_cache();
+		if (cache == NULL) {
+			outOfMemory = true;
 			return NULL;
-		// copy everything except the PNG signature (first 8 bytes)
-		memcpy(cache.buffer, (char*)buffer+8, sizebytes-8);
-		cache.buffer_size = sizebytes-8;
+		}
+		// everything except the PNG signature (first 8 bytes), the buffer is not copied
+		cache->buffer = (const char*)buffer+8;
+		cache->buffer_size = sizebytes-8;
 	}
-	buffer = cache.buffer;
-	sizebytes = cache.buffer_size;
-	if (!cache.png_ptr || cache.frame_index == 0) {
-		DeleteCacheInternal(false);
-		if (!buffer || !BeginReading(buffer, sizebytes, outOfMemory)) {
+	buffer = cache->buffer;
+	sizebytes = cache->buffer_size;
+	if (!cache->png_ptr || cache->frame_index == 0) {
+		DeleteCacheInternal(cache, false);
+		if (!buffer || !BeginReading(cache, buffer, sizebytes, outOfMemory)) {
 			return NULL;
 		}
 
@@ -324,22 +347,25 @@ void* PngReader::ReadImage(int& width,
 
 	void* exif = NULL;
 	unsigned int exif_size = 0;
-	bool read_two = cache.frame_index < cache.first;
-	void* pixels = ReadNextFrame(&exif, &exif_size);
-	if (pixels && read_two)
-		pixels = ReadNextFrame(&exif, &exif_size);
+	bool read_two = cache->frame_index < cache->first;
+	void* pixels = ReadNextFrame(cache, &exif, &exif_size);
+	if (pixels && read_two) {
+		// skip the hidden default image
+		free(pixels);
+		pixels = ReadNextFrame(cache, &exif, &exif_size);
+	}
 	
-	width = cache.width;
-	height = cache.height;
-	nchannels = cache.channels;
-	has_animation = (cache.frame_count > 1);
-	frame_count = cache.frame_count;
+	width = cache->width;
+	height = cache->height;
+	nchannels = cache->channels;
+	has_animation = (cache->frame_count > 1);
+	frame_count = cache->frame_count;
 
 	// https://wiki.mozilla.org/APNG_Specification
 	// "If the denominator is 0, it is to be treated as if it were 100"
-	if (!cache.delay_den)
-		cache.delay_den = 100;
-	frame_time = (int)(1000.0 * cache.delay_num / cache.delay_den);
+	if (!cache->delay_den)
+		cache->delay_den = 100;
+	frame_time = (int)(1000.0 * cache->delay_num / cache->delay_den);
 
 	if (exif_size > 8 && exif_size < 65528 && exif != NULL) {
 		exif_chunk = malloc(exif_size + 10);
@@ -350,33 +376,36 @@ void* PngReader::ReadImage(int& width,
 		}
 		
 	}
-	if (!has_animation)
-		DeleteCache();
+	if (!has_animation) {
+		DeleteCache(cache);
+		cache = NULL;
+	}
 	return pixels;
 }
 
-void PngReader::DeleteCacheInternal(bool free_buffer)
+void PngReader::DeleteCacheInternal(png_cache* cache, bool release_buffer)
 {
-	// png_read_end(cache.png_ptr, cache.info_ptr);
-	free(cache.rows_frame);
-	free(cache.rows_image);
-	free(cache.p_temp);
-	free(cache.p_frame);
-	free(cache.p_image);
-	png_destroy_read_struct(&cache.png_ptr, &cache.info_ptr, NULL);
-	void* temp_buffer = cache.buffer;
-	size_t temp_buffer_size = cache.buffer_size;
-	cache = { 0 };
-	if (free_buffer) {
-		free(temp_buffer);
-	} else {
-		cache.buffer = temp_buffer;
-		cache.buffer_size = temp_buffer_size;
+	// png_read_end(cache->png_ptr, cache->info_ptr);
+	free(cache->rows_frame);
+	free(cache->rows_image);
+	free(cache->p_temp);
+	free(cache->p_frame);
+	free(cache->p_image);
+	png_destroy_read_struct(&cache->png_ptr, &cache->info_ptr, NULL);
+	const void* temp_buffer = cache->buffer;
+	size_t temp_buffer_size = cache->buffer_size;
+	*cache = png_cache();
+	if (!release_buffer) {
+		cache->buffer = temp_buffer;
+		cache->buffer_size = temp_buffer_size;
 	}
 }
 
-void PngReader::DeleteCache() {
-	DeleteCacheInternal(true);
+void PngReader::DeleteCache(png_cache* cache) {
+	if (cache != NULL) {
+		DeleteCacheInternal(cache, true);
+		delete cache;
+	}
 }
 
 bool PngReader::MustUseLibpng(const void* bufferIn, size_t sizebytes) {
@@ -417,7 +446,7 @@ bool PngReader::MustUseLibpng(const void* bufferIn, size_t sizebytes) {
 #define PNG_UINT_31_MAX (0x7fffffff)
 #endif
 
-void* PngReader::GetEXIFBlock(void* buffer, size_t sizebytes) {
+void* PngReader::GetEXIFBlock(const void* buffer, size_t sizebytes) {
 	size_t offset = 8; // skip PNG signature
 	while (offset + 7 < sizebytes) {
 		unsigned int chunksize = *(unsigned int*)((char*)buffer + offset);
@@ -5,7 +5,12 @@ class PngReader
 {
 public:
 #ifndef WINXP
+	// Decoder state of an animation, kept from one frame to the next
+	struct png_cache;
+
 	// Returns data in 4 byte BGRA
+	// If cache is NULL, the image is read from the buffer. For animations, the first frame is returned and a new decoder state
+	// is created in cache, the following frames are read by passing this state again (buffer and sizebytes are ignored then).
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -14,23 +19,24 @@ public:
 		int& frame_time, // frame duration in milliseconds
 		void*& exif_chunk, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
-		void* buffer, // memory address containing png compressed data.
+		png_cache*& cache, // decoder state of an animation, must be deleted by the caller with DeleteCache()
+		const void* buffer, // memory address containing png compressed data.
 		size_t sizebytes); // size of png compressed data
 
-	static void DeleteCache();
+	// Deletes the decoder state of an animation. The buffer passed to ReadImage() of an animation
+	// is not copied, it must stay valid until this method is called.
+	static void DeleteCache(png_cache* cache);
 
 	// Returns true if PNG is unsupported by GDI+
 	static bool MustUseLibpng(const void* buffer, size_t sizebytes);
 #endif
 	// Get EXIF Block
-	static void* GetEXIFBlock(void* buffer, size_t sizebytes);
+	static void* GetEXIFBlock(const void* buffer, size_t sizebytes);
 
 #ifndef WINXP
 private:
-	struct png_cache;
-	static png_cache cache;
-	static bool BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory);
-	static void* ReadNextFrame(void** exif_chunk, unsigned int* exif_size);
-	static void DeleteCacheInternal(bool free_buffer);
+	static bool BeginReading(png_cache* cache, const void* buffer, size_t sizebytes, bool& outOfMemory);
+	static void* ReadNextFrame(png_cache* cache, void** exif_chunk, unsigned int* exif_size);
+	static void DeleteCacheInternal(png_cache* cache, bool release_buffer);
 #endif
 };
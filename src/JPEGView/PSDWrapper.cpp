@@ -49,6 +49,11 @@
 #include "TJPEGWrapper.h"
 #include "ICCProfileTransform.h"
 #include "SettingsProvider.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
+#include "MappedFile.h"
+#include "ByteStream.h"
+#include "PagedPixelBuffer.h"
 
 
 #define PSD_HEADER_SIZE 26
@@ -60,100 +65,206 @@ static inline void ThrowIf(bool bShouldThrow) {
 	}
 }
 
-// Read exactly sz bytes of the file into p
-static inline void ReadFromFile(void* dst, HANDLE file, DWORD sz) {
-	unsigned int nNumBytesRead;
-	ThrowIf(!(::ReadFile(file, dst, sz, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == sz));
+// Read exactly sz bytes of the stream into p
+static inline void ReadFromStream(void* dst, CByteStream& stream, unsigned int sz) {
+	ThrowIf(!stream.Read(dst, sz));
 }
 
-// Read and return an unsigned 64-bit int from file
-static inline unsigned long long ReadUInt64FromFile(HANDLE file) {
-	unsigned long long val;
-	ReadFromFile(&val, file, 8);
-	return _byteswap_uint64(val);
+// Return a pointer to the next sz bytes of the stream, the data is not copied
+static inline const char* GetBytesFromStream(CByteStream& stream, unsigned int sz) {
+	const uint8* p = stream.GetBytes(sz);
+	ThrowIf(p == NULL);
+	return (const char*)p;
 }
 
-// Read and return an unsigned int from file
-static inline unsigned int ReadUIntFromFile(HANDLE file) {
-	unsigned int val;
-	ReadFromFile(&val, file, 4);
-	return _byteswap_ulong(val);
+// Read and return an unsigned 64-bit int from stream
+static inline unsigned long long ReadUInt64FromStream(CByteStream& stream) {
+	ThrowIf(stream.Remaining() < 8);
+	return stream.ReadUInt64BE();
 }
 
-// Read and return an unsigned short from file
-static inline unsigned short ReadUShortFromFile(HANDLE file) {
-	unsigned short val;
-	ReadFromFile(&val, file, 2);
-	return _byteswap_ushort(val);
+// Read and return an unsigned int from stream
+static inline unsigned int ReadUIntFromStream(CByteStream& stream) {
+	ThrowIf(stream.Remaining() < 4);
+	return stream.ReadUInt32BE();
 }
 
-// Read and return an unsigned char from file
-static inline unsigned char ReadUCharFromFile(HANDLE file) {
-	unsigned char val;
-	ReadFromFile(&val, file, 1);
-	return val;
+// Read and return an unsigned short from stream
+static inline unsigned short ReadUShortFromStream(CByteStream& stream) {
+	ThrowIf(stream.Remaining() < 2);
+	return stream.ReadUInt16BE();
 }
 
-// Move file pointer by offset from current position
-static inline void SeekFile(HANDLE file, LONG offset) {
-	ThrowIf(::SetFilePointer(file, offset, NULL, FILE_CURRENT) == INVALID_SET_FILE_POINTER);
+// Read and return an unsigned char from stream
+static inline unsigned char ReadUCharFromStream(CByteStream& stream) {
+	ThrowIf(stream.Remaining() < 1);
+	return stream.ReadUInt8();
 }
 
-// Move file pointer to offset from beginning of file
-static inline void SeekFileFromStart(HANDLE file, LONG offset) {
-	ThrowIf(::SetFilePointer(file, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER);
+// Move stream position by offset from current position
+static inline void SeekStream(CByteStream& stream, LONG offset) {
+	ThrowIf(!stream.Skip(offset));
 }
 
-// Get current position in the file
-static inline unsigned int TellFile(HANDLE file) {
-	unsigned int ret = ::SetFilePointer(file, 0, NULL, FILE_CURRENT);
-	ThrowIf(ret == INVALID_SET_FILE_POINTER);
-	return ret;
+// Move stream position to offset from beginning of file
+static inline void SeekStreamFromStart(CByteStream& stream, LONG offset) {
+	ThrowIf(!stream.Seek(offset));
 }
 
+// Decodes one PackBits compressed row of nWidth bytes. Returns false if the source data ends before the row is complete.
+static bool DecodePackBitsRow(const uint8* pSource, const uint8* pSourceEnd, uint8* pTarget, int nWidth) {
+	int nCount = 0;
+	while (nCount < nWidth) {
+		if (pSource >= pSourceEnd) {
+			return false;
+		}
+		int nHeader = *pSource++;
+		if (nHeader > 128) {
+			// run of 257 - nHeader times the next byte
+			if (pSource >= pSourceEnd) {
+				return false;
+			}
+			int nRun = min(257 - nHeader, nWidth - nCount);
+			memset(pTarget + nCount, *pSource++, nRun);
+			nCount += nRun;
+		} else if (nHeader < 128) {
+			// nHeader + 1 literal bytes
+			int nLiteral = nHeader + 1;
+			if (pSourceEnd - pSource < nLiteral) {
+				return false;
+			}
+			memcpy(pTarget + nCount, pSource, min(nLiteral, nWidth - nCount));
+			pSource += nLiteral;
+			nCount += nLiteral;
+		} // 128 is a no-op
+	}
+	return true;
+}
+
+// Decodes strips of rows of the planar image data into the interleaved pixels, all channels of a row are decoded by the same thread.
+// The rows of the channels are located by their start offset in the image data, so each strip can be decoded independently.
+class CRequestPSDDecode : public CProcessingRequest {
+public:
+	CRequestPSDDecode(const char* pImageData, unsigned int nImageDataSize, const unsigned int* pRowOffsets, bool bRLE,
+		CSize imageSize, int nChannels, const int* pChannelMapping, void* pTargetPixels, int nRowSize)
+		: CProcessingRequest(pImageData, imageSize, pTargetPixels, imageSize, CPoint(0, 0), imageSize) {
+		ImageDataSize = nImageDataSize;
+		RowOffsets = pRowOffsets;
+		RLE = bRLE;
+		Channels = nChannels;
+		memcpy(ChannelMapping, pChannelMapping, nChannels * sizeof(int));
+		RowSize = nRowSize;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		int nWidth = SourceSize.cx;
+		uint8* pPlanes = new(std::nothrow) uint8[nWidth * Channels];
+		if (pPlanes == NULL) {
+			return false;
+		}
+		const uint8* pImageData = (const uint8*)SourcePixels;
+		const uint8* pImageDataEnd = pImageData + ImageDataSize;
+		bool bSuccess = true;
+		try {
+			for (int row = offsetY; row < offsetY + sizeY && bSuccess; row++) {
+				// decode the channels into planes ordered by target channel, then interleave
+				for (int channel = 0; channel < Channels && bSuccess; channel++) {
+					const uint8* pSource = pImageData + RowOffsets[channel * SourceSize.cy + row];
+					uint8* pPlane = pPlanes + ChannelMapping[channel] * nWidth;
+					if (RLE) {
+						bSuccess = DecodePackBitsRow(pSource, pImageDataEnd, pPlane, nWidth);
+					} else {
+						memcpy(pPlane, pSource, nWidth);
+					}
+				}
+				if (bSuccess) {
+					InterleaveRow(pPlanes, nWidth, (uint8*)TargetPixels + (size_t)row * RowSize);
+				}
+			}
+		} catch (...) {
+			// the image data is read from the mapped file, the file may vanish while decoding on a pool thread
+			bSuccess = false;
+		}
+		delete[] pPlanes;
+		return bSuccess;
+	}
+
+	unsigned int ImageDataSize;
+	const unsigned int* RowOffsets;
+	bool RLE;
+	int Channels;
+	int ChannelMapping[4];
+	int RowSize;
+
+private:
+	void InterleaveRow(const uint8* pPlanes, int nWidth, uint8* pTarget) {
+		const uint8* pPlane0 = pPlanes;
+		const uint8* pPlane1 = pPlanes + nWidth;
+		const uint8* pPlane2 = pPlanes + 2 * nWidth;
+		const uint8* pPlane3 = pPlanes + 3 * nWidth;
+		if (Channels == 4) {
+			uint32* pTarget32 = (uint32*)pTarget;
+			for (int x = 0; x < nWidth; x++) {
+				pTarget32[x] = pPlane0[x] | (pPlane1[x] << 8) | (pPlane2[x] << 16) | ((uint32)pPlane3[x] << 24);
+			}
+		} else if (Channels == 3) {
+			for (int x = 0; x < nWidth; x++) {
+				pTarget[0] = pPlane0[x];
+				pTarget[1] = pPlane1[x];
+				pTarget[2] = pPlane2[x];
+				pTarget += 3;
+			}
+		} else {
+			memcpy(pTarget, pPlane0, nWidth);
+		}
+	}
+};
+
 CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 {
-	HANDLE hFile;
-	hFile = ::CreateFile(strFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+	// The headers and the image data are read from the mapped file
+	CMappedFile file(strFileName);
+	if (!file.IsValid()) {
 		return NULL;
 	}
-	char* pBuffer = NULL;
+	CByteStream stream(file.Data(), file.Size());
 	void* pPixelData = NULL;
 	void* pEXIFData = NULL;
-	char* pICCProfile = NULL;
+	const char* pICCProfile = NULL;
 	unsigned int nICCProfileSize = 0;
+	unsigned int* pRowOffsets = NULL;
 	void* transform = NULL;
 	CJPEGImage* Image = NULL;
 	try {
-		long long nFileSize = Helpers::GetFileSize(hFile);
+		CTraceSpan parseSpan(TRACE_Parse);
+		long long nFileSize = file.Size();
 		ThrowIf(nFileSize > MAX_PSD_FILE_SIZE);
 
 		// Skip file signature
-		SeekFile(hFile, 4);
+		SeekStream(stream, 4);
 
 		// Read version: 1 for PSD, 2 for PSB
-		unsigned short nVersion = ReadUShortFromFile(hFile);
+		unsigned short nVersion = ReadUShortFromStream(stream);
 		ThrowIf(nVersion != 1 && nVersion != 2);
 
 		// Check reserved bytes
 		char pReserved[6];
-		ReadFromFile(pReserved, hFile, 6);
+		ReadFromStream(pReserved, stream, 6);
 		ThrowIf(memcmp(pReserved, "\0\0\0\0\0\0", 6));
 
 		// Read number of channels
-		unsigned short nRealChannels = ReadUShortFromFile(hFile);
+		unsigned short nRealChannels = ReadUShortFromStream(stream);
 
 		// Read width and height
-		unsigned int nHeight = ReadUIntFromFile(hFile);
-		unsigned int nWidth = ReadUIntFromFile(hFile);
+		unsigned int nHeight = ReadUIntFromStream(stream);
+		unsigned int nWidth = ReadUIntFromStream(stream);
 		if ((double)nHeight * nWidth > MAX_IMAGE_PIXELS) {
 			bOutOfMemory = true;
 		}
 		ThrowIf(bOutOfMemory || max(nHeight, nWidth) > MAX_IMAGE_DIMENSION || !min(nHeight, nWidth));
 
 		// PSD can have bit depths of 1, 2, 4, 8, 16, 32
-		unsigned short nBitDepth = ReadUShortFromFile(hFile);
+		unsigned short nBitDepth = ReadUShortFromStream(stream);
 		// Only 8-bit is supported for now
 		ThrowIf(nBitDepth != 8);
 
@@ -162,7 +273,7 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		// Bitmap = 0; Grayscale = 1; Indexed = 2; RGB = 3; CMYK = 4; Multichannel = 7; Duotone = 8; Lab = 9.
 		// TODO: NegateCMYK
 		unsigned short nChannels = 0;
-		unsigned short nColorMode = ReadUShortFromFile(hFile);
+		unsigned short nColorMode = ReadUShortFromStream(stream);
 		switch (nColorMode) {
 			case MODE_Grayscale:
 			case MODE_Duotone:
@@ -183,11 +294,11 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		ThrowIf(nChannels != 1 && nChannels != 3 && nChannels != 4);
 
 		// Skip color mode data
-		unsigned int nColorDataSize = ReadUIntFromFile(hFile);
-		SeekFile(hFile, nColorDataSize);
+		unsigned int nColorDataSize = ReadUIntFromStream(stream);
+		SeekStream(stream, nColorDataSize);
 
 		// Read resource section size
-		unsigned int nResourceSectionSize = ReadUIntFromFile(hFile);
+		unsigned int nResourceSectionSize = ReadUIntFromStream(stream);
 
 		// This default value should detect alpha channels for PSDs created by programs which don't save alpha identifiers (e.g. Krita, GIMP)
 		bool bUseAlpha = nChannels == 4;
@@ -195,7 +306,7 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		for (;;) {
 			// Resource block signature
 			try {
-				if (ReadUIntFromFile(hFile) != 0x3842494D) { // "8BIM"
+				if (ReadUIntFromStream(stream) != 0x3842494D) { // "8BIM"
 					break;
 				}
 			} catch (...) {
@@ -203,24 +314,21 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 			}
 
 			// Resource ID
-			unsigned short nResourceID = ReadUShortFromFile(hFile);
+			unsigned short nResourceID = ReadUShortFromStream(stream);
 
 			// Skip Pascal string (padded to be even length)
-			unsigned char nStringSize = ReadUCharFromFile(hFile);
-			SeekFile(hFile, nStringSize | 1);
+			unsigned char nStringSize = ReadUCharFromStream(stream);
+			SeekStream(stream, nStringSize | 1);
 
 			// Resource size
-			unsigned int nResourceSize = ReadUIntFromFile(hFile);
+			unsigned int nResourceSize = ReadUIntFromStream(stream);
 
 			// Parse image resources
 			switch (nResourceID) {
 				case 0x040F: // ICC Profile
 					if (nColorMode == MODE_RGB) {
-						pICCProfile = new(std::nothrow) char[nResourceSize];
-					}
-					if (pICCProfile != NULL) {
-						ReadFromFile(pICCProfile, hFile, nResourceSize);
-						SeekFile(hFile, -nResourceSize);
+						pICCProfile = GetBytesFromStream(stream, nResourceSize);
+						SeekStream(stream, -nResourceSize);
 						nICCProfileSize = nResourceSize;
 					}
 					break;
@@ -230,20 +338,20 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 						int i = 0;
 						while (i < nResourceSize / 4) {
 							i++;
-							if (ReadUIntFromFile(hFile) == 0) {
+							if (ReadUIntFromStream(stream) == 0) {
 								bUseAlpha = true;
 								break;
 							}
 						}
-						SeekFile(hFile, -i * 4);
+						SeekStream(stream, -i * 4);
 					}
 					break;
 				case 0x0421: // 0x0421 1057 (Photoshop 6.0) Version Info. 4 bytes version, 1 byte hasRealMergedData, Unicode string : writer name, Unicode string : reader name, 4 bytes file version.
 					if (nResourceSize >= 5) {
-						ReadUIntFromFile(hFile);
+						ReadUIntFromStream(stream);
 						// See https://exiftool.org/forum/index.php?topic=12897.0
-						ThrowIf(!ReadUCharFromFile(hFile));
-						SeekFile(hFile, -5);
+						ThrowIf(!ReadUCharFromStream(stream));
+						SeekStream(stream, -5);
 					}
 					break;
 				case 0x0422: // 0x0422 1058 (Photoshop 7.0) EXIF data 1. See http://www.kodak.com/global/plugins/acrobat/en/service/digCam/exifStandard2.pdf
@@ -253,44 +361,44 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 						if (pEXIFData != NULL) {
 							memcpy(pEXIFData, "\xFF\xE1\0\0Exif\0\0", 10);
 							*((unsigned short*)pEXIFData + 1) = _byteswap_ushort(nResourceSize + 8);
-							ReadFromFile((char*)pEXIFData + 10, hFile, nResourceSize);
-							SeekFile(hFile, -nResourceSize);
+							ReadFromStream((char*)pEXIFData + 10, stream, nResourceSize);
+							SeekStream(stream, -nResourceSize);
 						}
 					}
 					break;
 			}
 
 			// Skip resource data (padded to be even length)
-			SeekFile(hFile, (nResourceSize + 1) & -2);
+			SeekStream(stream, (nResourceSize + 1) & -2);
 		}
 		
 		// Go back to start of file
-		SeekFileFromStart(hFile, PSD_HEADER_SIZE + 4 + nColorDataSize + 4 + nResourceSectionSize);
+		SeekStreamFromStart(stream, PSD_HEADER_SIZE + 4 + nColorDataSize + 4 + nResourceSectionSize);
 
 		// Skip Layer and Mask Info section
 		unsigned long long nLayerSize;
 		if (nVersion == 2) {
-			nLayerSize = ReadUInt64FromFile(hFile);
+			nLayerSize = ReadUInt64FromStream(stream);
 		} else {
-			nLayerSize = ReadUIntFromFile(hFile);
+			nLayerSize = ReadUIntFromStream(stream);
 		}
 		unsigned char nLayerSizeBytes = 4 * nVersion;
-		SeekFile(hFile, nLayerSizeBytes);
-		short nLayerCount = ReadUShortFromFile(hFile);
+		SeekStream(stream, nLayerSizeBytes);
+		short nLayerCount = ReadUShortFromStream(stream);
 		bUseAlpha = bUseAlpha && (nLayerCount <= 0);
-		SeekFile(hFile, nLayerSize - 2 - nLayerSizeBytes);
+		SeekStream(stream, nLayerSize - 2 - nLayerSizeBytes);
 
 		// Compression. 0 = Raw Data, 1 = RLE compressed, 2 = ZIP without prediction, 3 = ZIP with prediction.
-		unsigned short nCompressionMethod = ReadUShortFromFile(hFile);
+		unsigned short nCompressionMethod = ReadUShortFromStream(stream);
 		ThrowIf(nCompressionMethod != COMPRESSION_RLE && nCompressionMethod != COMPRESSION_None);
 
-		unsigned int nImageDataSize = nFileSize - TellFile(hFile);
-		pBuffer = new(std::nothrow) char[nImageDataSize];
-		if (pBuffer == NULL) {
-			bOutOfMemory = true;
-			ThrowIf(true);
-		}
-		ReadFromFile(pBuffer, hFile, nImageDataSize);
+		parseSpan.End();
+
+		// The image data is decoded directly from the mapped file
+		unsigned int nImageDataSize = (unsigned int)stream.Remaining();
+		const char* pBuffer = GetBytesFromStream(stream, nImageDataSize);
+		// Stop here if the load has been cancelled while parsing
+		ThrowIf(CProcessingThreadPool::IsCancelledOnThread());
 
 		if (!bUseAlpha && nColorMode != MODE_CMYK) {
 			nChannels = min(nChannels, 3);
@@ -310,106 +418,61 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		}
 
 		int nRowSize = Helpers::DoPadding(nWidth * nChannels, 4);
-		pPixelData = new(std::nothrow) char[nRowSize * nHeight];
+		pPixelData = CPagedPixelBuffer::AllocatePixels((__int64)nRowSize * nHeight, nChannels);
 		if (pPixelData == NULL) {
 			bOutOfMemory = true;
 			ThrowIf(true);
 		}
 		// TODO: non-8bit, better non-RGB support
 		// non-8bit must first be decompressed as arbitrary data
-		// TODO: continue next row at end of row bytes (to support corrupt images)
-		unsigned char* p = (unsigned char*)pBuffer;
+		CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)nWidth * nHeight);
+		unsigned int nNumRows = nChannels * nHeight;
+		pRowOffsets = new(std::nothrow) unsigned int[nNumRows];
+		if (pRowOffsets == NULL) {
+			bOutOfMemory = true;
+			ThrowIf(true);
+		}
 		if (nCompressionMethod == COMPRESSION_RLE) {
-			// Skip byte counts for scanlines
-			p += nHeight * nRealChannels * 2 * nVersion;
-			unsigned char* pOffset = p;
-			for (unsigned channel = 0; channel < nChannels; channel++) {
-				unsigned rchannel;
-				if (nColorMode == MODE_Lab) {
-					rchannel = channel;
+			// Compute the start of the rows from the byte counts of the scanlines, ordered by channel and row
+			unsigned long long nTableSize = (unsigned long long)nHeight * nRealChannels * 2 * nVersion;
+			ThrowIf(nTableSize > nImageDataSize);
+			unsigned long long nOffset = nTableSize;
+			for (unsigned int i = 0; i < nNumRows; i++) {
+				ThrowIf(nOffset >= nImageDataSize);
+				pRowOffsets[i] = (unsigned int)nOffset;
+				if (nVersion == 2) {
+					nOffset += _byteswap_ulong(*(unsigned int*)(pBuffer + i * 4));
 				} else {
-					rchannel = (-channel - 2) % nChannels;
-				}
-				for (unsigned row = 0; row < nHeight; row++) {
-					p = pOffset;
-
-					for (unsigned count = 0; count < nWidth; ) {
-						unsigned char c;
-						ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-						c = *p;
-						p += 1;
-
-						if (c > 128) {
-							c = ~c + 2;
-
-							ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-							unsigned char value = *p;
-							p += 1;
-
-							for (unsigned i = count; i < count + c; i++) {
-								unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + i * nChannels;
-								unsigned char* pixel = scan + rchannel;
-								ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-								*pixel = value;
-							}
-						} else if (c < 128) {
-							c++;
-
-							for (unsigned i = count; i < count + c; i++) {
-								ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-								unsigned char value = *p;
-								p += 1;
-
-								unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + i * nChannels;
-								unsigned char* pixel = scan + rchannel;
-								ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-								*pixel = value;
-							}
-						}
-
-						count += c;
-					}
-
-					if (nVersion == 2) {
-						pOffset += _byteswap_ulong(*(unsigned int*)(pBuffer + (channel * nHeight + row) * 4));
-					} else {
-						pOffset += _byteswap_ushort(*(unsigned short*)(pBuffer + (channel * nHeight + row) * 2));
-					}
-#ifdef DEBUG
-					if (p != pOffset) {
-						WCHAR buf[100];
-						swprintf(buf, _T("Misaligned scan line bytes (%+d) for channel %d row %d\n"), p - pOffset, channel, row);
-						::OutputDebugString(buf);
-					}
-#endif
+					nOffset += _byteswap_ushort(*(unsigned short*)(pBuffer + i * 2));
 				}
 			}
 		} else { // No compression
-			for (unsigned channel = 0; channel < nChannels; channel++) {
-				unsigned rchannel;
-				if (nColorMode == MODE_Lab) {
-					rchannel = channel;
-				} else {
-					rchannel = (-channel - 2) % nChannels;
-				}
-				for (unsigned row = 0; row < nHeight; row++) {
-					for (unsigned count = 0; count < nWidth; count++) {
-						ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-						unsigned char value = *p;
-						p += 1;
-
-						unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + count * nChannels;
-						unsigned char* pixel = scan + rchannel;
-						ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-						*pixel = value;
-					}
-				}
+			ThrowIf((unsigned long long)nNumRows * nWidth > nImageDataSize);
+			for (unsigned int i = 0; i < nNumRows; i++) {
+				pRowOffsets[i] = i * nWidth;
 			}
 		}
 
+		// Decode the rows of all channels in parallel
+		int nChannelMapping[4];
+		for (unsigned channel = 0; channel < nChannels; channel++) {
+			if (nColorMode == MODE_Lab) {
+				nChannelMapping[channel] = channel;
+			} else {
+				nChannelMapping[channel] = (-channel - 2) % nChannels;
+			}
+		}
+		CSize imageSize(nWidth, nHeight);
+		CRequestPSDDecode request(pBuffer, nImageDataSize, pRowOffsets, nCompressionMethod == COMPRESSION_RLE,
+			imageSize, nChannels, nChannelMapping, pPixelData, nRowSize);
+		ThrowIf(!CProcessingThreadPool::This().Process(&request) || !request.Success);
+
+		decodeSpan.End();
+
 		ICCProfileTransform::DoTransform(transform, pPixelData, pPixelData, nWidth, nHeight, nRowSize);
 
 		if (nChannels == 4) {
+			CTraceSpan convertSpan(TRACE_ColorConvert, IF_Unknown, (__int64)nWidth * nHeight);
 			// Multiply alpha value into each AABBGGRR pixel
 			uint32* pImage32 = (uint32*)pPixelData;
 			// Blend K channel for CMYK images, alpha channel for RGBA images
@@ -423,13 +486,11 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		delete Image;
 		Image = NULL;
 	}
-	::CloseHandle(hFile);
 	if (Image == NULL) {
-		delete[] pPixelData;
+		CPagedPixelBuffer::FreePixels(pPixelData);
 	}
-	delete[] pBuffer;
 	delete[] pEXIFData;
-	delete[] pICCProfile;
+	delete[] pRowOffsets;
 	ICCProfileTransform::DeleteTransform(transform);
 	return Image;
 };
@@ -437,12 +498,13 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 
 CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 {
-	HANDLE hFile;
-	hFile = ::CreateFile(strFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+	// The resources and the embedded JPEG are read from the mapped file
+	CMappedFile file(strFileName);
+	if (!file.IsValid()) {
 		return NULL;
 	}
-	char* pBuffer = NULL;
+	CByteStream stream(file.Data(), file.Size());
+	const char* pBuffer = NULL;
 	void* pPixelData = NULL;
 	void* pEXIFData = NULL;
 	CJPEGImage* Image = NULL;
@@ -452,19 +514,19 @@ CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 
 	try {
 		// Skip file header
-		SeekFile(hFile, PSD_HEADER_SIZE);
+		SeekStream(stream, PSD_HEADER_SIZE);
 
 		// Skip color mode data
-		unsigned int nColorDataSize = ReadUIntFromFile(hFile);
-		SeekFile(hFile, nColorDataSize);
+		unsigned int nColorDataSize = ReadUIntFromStream(stream);
+		SeekStream(stream, nColorDataSize);
 
 		// Skip resource section size
-		ReadUIntFromFile(hFile);
+		ReadUIntFromStream(stream);
 
 		for (;;) {
 			// Resource block signature
 			try {
-				if (ReadUIntFromFile(hFile) != 0x3842494D) { // "8BIM"
+				if (ReadUIntFromStream(stream) != 0x3842494D) { // "8BIM"
 					break;
 				}
 			} catch (...) {
@@ -472,21 +534,21 @@ CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 			}
 
 
-			unsigned short nResourceID = ReadUShortFromFile(hFile);
+			unsigned short nResourceID = ReadUShortFromStream(stream);
 
 			// Skip Pascal string (padded to be even length)
-			unsigned char nStringSize = ReadUCharFromFile(hFile);
-			SeekFile(hFile, nStringSize | 1);
+			unsigned char nStringSize = ReadUCharFromStream(stream);
+			SeekStream(stream, nStringSize | 1);
 
 			// Resource size
-			unsigned int nResourceSize = ReadUIntFromFile(hFile);
+			unsigned int nResourceSize = ReadUIntFromStream(stream);
 
 			// Parse image resources
 			switch (nResourceID) {
 				case 0x0409: // 0x0409 1033 (Photoshop 4.0) Thumbnail resource for Photoshop 4.0 only. See See Thumbnail resource format.
 				case 0x040C: // 0x040C 1036 (Photoshop 5.0) Thumbnail resource (supersedes resource 1033). See See Thumbnail resource format.
 					// Skip thumbnail resource header
-					SeekFile(hFile, 28);
+					SeekStream(stream, 28);
 
 					// Read embedded JPEG thumbnail
 					nJpegSize = nResourceSize - 28;
@@ -495,14 +557,8 @@ CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 						ThrowIf(true);
 					}
 
-					pBuffer = new(std::nothrow) char[nJpegSize];
-					if (pBuffer == NULL) {
-						bOutOfMemory = true;
-						ThrowIf(true);
-					}
-
-					ReadFromFile(pBuffer, hFile, nJpegSize);
-					SeekFile(hFile, -nResourceSize);
+					pBuffer = GetBytesFromStream(stream, nJpegSize);
+					SeekStream(stream, -nResourceSize);
 
 
 					pPixelData = TurboJpeg::ReadImage(nWidth, nHeight, nChannels, eChromoSubSampling, bOutOfMemory, pBuffer, nJpegSize);
@@ -515,15 +571,15 @@ CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 						if (pEXIFData != NULL) {
 							memcpy(pEXIFData, "\xFF\xE1\0\0Exif\0\0", 10);
 							*((unsigned short*)pEXIFData + 1) = _byteswap_ushort(nResourceSize + 8);
-							ReadFromFile((char*)pEXIFData + 10, hFile, nResourceSize);
-							SeekFile(hFile, -nResourceSize);
+							ReadFromStream((char*)pEXIFData + 10, stream, nResourceSize);
+							SeekStream(stream, -nResourceSize);
 						}
 					}
 					break;
 			}
 
 			// Skip resource data (padded to be even length)
-			SeekFile(hFile, (nResourceSize + 1) & -2);
+			SeekStream(stream, (nResourceSize + 1) & -2);
 		}
 
 		if (pPixelData != NULL) {
@@ -537,11 +593,9 @@ CJPEGImage* PsdReader::ReadThumb(LPCTSTR strFileName, bool& bOutOfMemory)
 		delete Image;
 		Image = NULL;
 	}
-	::CloseHandle(hFile);
 	if (Image == NULL) {
-		delete[] pPixelData;
+		CPagedPixelBuffer::FreePixels(pPixelData);
 	}
 	delete[] pEXIFData;
-	delete[] pBuffer;
 	return Image;
 }
@@ -0,0 +1,152 @@
+#include "StdAfx.h"
+#include "PagedPixelBuffer.h"
+#include "SettingsProvider.h"
+#include "Helpers.h"
+
+// Paged buffers allocated with AllocatePixels() and not yet taken over, the decoders only know the pixel pointer
+static std::list<CPagedPixelBuffer*> s_allocatedBuffers;
+static CRITICAL_SECTION s_csAllocatedBuffers;
+
+static struct CAllocatedBuffersInit {
+	CAllocatedBuffersInit() { ::InitializeCriticalSection(&s_csAllocatedBuffers); }
+	~CAllocatedBuffersInit() { ::DeleteCriticalSection(&s_csAllocatedBuffers); }
+} s_allocatedBuffersInit;
+
+// Creates a temporary file that is deleted when the handle is closed, NULL on failure
+static HANDLE CreateTempFile() {
+	TCHAR sTempPath[MAX_PATH];
+	TCHAR sTempFile[MAX_PATH];
+	if (::GetTempPath(MAX_PATH, sTempPath) == 0 || ::GetTempFileName(sTempPath, _T("jpv"), 0, sTempFile) == 0) {
+		return NULL;
+	}
+	HANDLE hFile = ::CreateFile(sTempFile, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		::DeleteFile(sTempFile);
+		return NULL;
+	}
+	return hFile;
+}
+
+CPagedPixelBuffer* CPagedPixelBuffer::Create(__int64 nSizeBytes) {
+#ifdef _WIN64
+	if (nSizeBytes <= 0) {
+		return NULL;
+	}
+	HANDLE hFile = CreateTempFile();
+	if (hFile == NULL) {
+		return NULL;
+	}
+	HANDLE hMapping = ::CreateFileMapping(hFile, NULL, PAGE_READWRITE, (DWORD)(nSizeBytes >> 32), (DWORD)(nSizeBytes & 0xFFFFFFFF), NULL);
+	if (hMapping == NULL) {
+		::CloseHandle(hFile);
+		return NULL;
+	}
+	void* pMappedPixels = ::MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0);
+	if (pMappedPixels == NULL) {
+		::CloseHandle(hMapping);
+		::CloseHandle(hFile);
+		return NULL;
+	}
+	return new CPagedPixelBuffer(hFile, hMapping, pMappedPixels, nSizeBytes);
+#else
+	return NULL;
+#endif
+}
+
+CPagedPixelBuffer* CPagedPixelBuffer::Create(const void* pPixels, __int64 nSizeBytes) {
+	if (pPixels == NULL) {
+		return NULL;
+	}
+	CPagedPixelBuffer* pBuffer = Create(nSizeBytes);
+	if (pBuffer == NULL) {
+		return NULL;
+	}
+	try {
+		memcpy(pBuffer->Pixels(), pPixels, (size_t)nSizeBytes);
+	} catch (...) {
+		// disk full or temporary file not writable (EXCEPTION_IN_PAGE_ERROR)
+		delete pBuffer;
+		return NULL;
+	}
+	pBuffer->TrimWorkingSet();
+	return pBuffer;
+}
+
+bool CPagedPixelBuffer::UsePagedBuffer(__int64 nNumPixels) {
+#ifdef _WIN64
+	int nMinMegaPixels = CSettingsProvider::This().PagedPixelStorageMinMP();
+	return nMinMegaPixels > 0 && nNumPixels >= (__int64)nMinMegaPixels * 1000000;
+#else
+	return false;
+#endif
+}
+
+void* CPagedPixelBuffer::AllocatePixels(__int64 nSizeBytes, int nBytesPerPixel) {
+	if (UsePagedBuffer(nSizeBytes / nBytesPerPixel)) {
+		CPagedPixelBuffer* pBuffer = Create(nSizeBytes);
+		if (pBuffer != NULL) {
+			Helpers::CAutoCriticalSection criticalSection(s_csAllocatedBuffers);
+			s_allocatedBuffers.push_back(pBuffer);
+			return pBuffer->Pixels();
+		}
+		// no temporary file, try to keep the pixels in memory
+	}
+	if (nSizeBytes <= 0 || (unsigned __int64)nSizeBytes > SIZE_MAX) {
+		return NULL;
+	}
+	return new(std::nothrow) uint8[(size_t)nSizeBytes];
+}
+
+void CPagedPixelBuffer::FreePixels(void* pPixels) {
+	if (pPixels == NULL) {
+		return;
+	}
+	CPagedPixelBuffer* pBuffer = TakeOver(pPixels);
+	if (pBuffer != NULL) {
+		delete pBuffer;
+	} else {
+		delete[] (uint8*)pPixels;
+	}
+}
+
+CPagedPixelBuffer* CPagedPixelBuffer::TakeOver(void* pPixels) {
+	if (pPixels == NULL) {
+		return NULL;
+	}
+	Helpers::CAutoCriticalSection criticalSection(s_csAllocatedBuffers);
+	for (std::list<CPagedPixelBuffer*>::iterator iter = s_allocatedBuffers.begin(); iter != s_allocatedBuffers.end(); iter++) {
+		if ((*iter)->Pixels() == pPixels) {
+			CPagedPixelBuffer* pBuffer = *iter;
+			s_allocatedBuffers.erase(iter);
+			return pBuffer;
+		}
+	}
+	return NULL;
+}
+
+CPagedPixelBuffer::CPagedPixelBuffer(HANDLE hFile, HANDLE hMapping, void* pPixels, __int64 nSizeBytes) {
+	m_hFile = hFile;
+	m_hMapping = hMapping;
+	m_pPixels = pPixels;
+	m_nSizeBytes = nSizeBytes;
+}
+
+CPagedPixelBuffer::~CPagedPixelBuffer() {
+	::UnmapViewOfFile(m_pPixels);
+	::CloseHandle(m_hMapping);
+	::CloseHandle(m_hFile);
+}
+
+void CPagedPixelBuffer::TrimWorkingSet() const {
+	// Unlocking pages that are not locked removes them from the working set
+	::VirtualUnlock(m_pPixels, (SIZE_T)m_nSizeBytes);
+}
+
+void CPagedPixelBuffer::TrimWorkingSet(__int64 nOffset, __int64 nBytes) const {
+	nOffset = max(0, min(nOffset, m_nSizeBytes));
+	nBytes = min(nBytes, m_nSizeBytes - nOffset);
+	if (nBytes > 0) {
+		::VirtualUnlock((uint8*)m_pPixels + nOffset, (SIZE_T)nBytes);
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// Pixel memory backed by a temporary file instead of the page file.
+// Used for the original pixels of huge images (e.g. stitched panoramas or scanned maps). The pixels are
+// mapped as one contiguous view, the resampling and processing functions read the rows they need and only
+// these pages are loaded on demand. Pages not used are written to the temporary file by the memory manager
+// instead of exhausting the commit charge, so huge images open in bounded physical memory.
+// Only supported on 64 bit, on 32 bit the address space is too small for images where this makes sense.
+class CPagedPixelBuffer
+{
+public:
+	// Creates a paged buffer of the given size, the content is initialized with zeros.
+	// Returns NULL if the temporary file cannot be created or mapped.
+	static CPagedPixelBuffer* Create(__int64 nSizeBytes);
+
+	// Creates a paged buffer and copies the given pixels into it.
+	// Returns NULL if the temporary file cannot be created or mapped.
+	static CPagedPixelBuffer* Create(const void* pPixels, __int64 nSizeBytes);
+	~CPagedPixelBuffer();
+
+	// True if an image with the given number of pixels shall be stored in a paged buffer (PagedPixelStorageMinMP INI setting)
+	static bool UsePagedBuffer(__int64 nNumPixels);
+
+	// Allocates the pixel memory for a decoder. Huge images (see UsePagedBuffer()) are decoded directly into a paged buffer,
+	// so the full image is never held in memory, else the memory is allocated with new[]. Returns NULL if out of memory.
+	// The memory must be freed with FreePixels() or passed to the CJPEGImage constructor, which takes over paged buffers.
+	static void* AllocatePixels(__int64 nSizeBytes, int nBytesPerPixel);
+
+	// Frees memory allocated with AllocatePixels(), NULL is ignored
+	static void FreePixels(void* pPixels);
+
+	// Takes over the ownership of the paged buffer pPixels points to, allocated with AllocatePixels().
+	// Returns NULL if the memory is not a paged buffer (allocated with new[]).
+	static CPagedPixelBuffer* TakeOver(void* pPixels);
+
+	// Start of the mapped pixels, valid as long as this object lives
+	void* Pixels() const { return m_pPixels; }
+
+	// Size of the buffer in bytes
+	__int64 SizeBytes() const { return m_nSizeBytes; }
+
+	// Removes the pages of the buffer from the working set of the process. Modified pages are written
+	// to the temporary file and read again when accessed the next time.
+	void TrimWorkingSet() const;
+
+	// Same as above for a part of the buffer, e.g. the rows processed last when writing the buffer strip by strip
+	void TrimWorkingSet(__int64 nOffset, __int64 nBytes) const;
+
+private:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	void* m_pPixels;
+	__int64 m_nSizeBytes;
+
+	CPagedPixelBuffer(HANDLE hFile, HANDLE hMapping, void* pPixels, __int64 nSizeBytes);
+	CPagedPixelBuffer(const CPagedPixelBuffer&);
+	CPagedPixelBuffer& operator=(const CPagedPixelBuffer&);
+};
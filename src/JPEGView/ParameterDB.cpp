@@ -12,6 +12,7 @@ const uint32 MAGIC_HEADER_1 = 0xe8d2862a;
 const uint32 MAGIC_HEADER_2 = 0xb651e752;
 const uint32 DB_FILE_VERSION = 2;
 const uint32 MAX_DB_FILE_SIZE = sizeof(CParameterDBEntry)*1024*200; // 6 MB, enough room for 200000 entries
+const int MIN_INDEX_SIZE = 1024;
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Error handling helpers
@@ -92,6 +93,14 @@ static bool CheckHeader(HANDLE hFile, int & nVersion) {
 	return bHeaderOk;
 }
 
+// Home slot of the hash in the index. The pixel hashes are not well distributed in the low bits, mix them first.
+static inline size_t HomeSlot(__int64 nHash, size_t nMask) {
+	unsigned __int64 nValue = (unsigned __int64)nHash;
+	nValue ^= nValue >> 31;
+	nValue *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(nValue >> 32) & nMask;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // CParameterDBEntry
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -376,26 +385,46 @@ bool CParameterDB::DeleteEntry(__int64 nHash) {
 			pEntry->SetHash(nHash);
 			return false;
 		}
+		RemoveFromIndex(nHash);
+		ReleaseEntry(pEntry, nIndex);
 		return true;
 	}
 	return false;
 }
 
 bool CParameterDB::AddEntry(const CParameterDBEntry& newEntry) {
+	if (newEntry.GetHash() == 0) {
+		return false; // a hash of 0 marks a free entry
+	}
+
 	// Acquire lock before modifying the class
 	Helpers::CAutoCriticalSection lock(m_csDBLock);
 
 	int nIndex = -1;
 	CParameterDBEntry* pNewEntry = FindEntryInternal(newEntry.GetHash(), nIndex);
-	if (pNewEntry == NULL) {
+	bool bAllocated = pNewEntry == NULL;
+	if (bAllocated) {
 		pNewEntry = AllocateNewEntry(nIndex);
 	}
 	*pNewEntry = newEntry;
 	if (!SaveToFile(nIndex, *pNewEntry)) {
 		// restore...
 		pNewEntry->SetHash(0);
+		if (bAllocated) {
+			ReleaseEntry(pNewEntry, nIndex);
+		} else {
+			RemoveFromIndex(newEntry.GetHash());
+			ReleaseEntry(pNewEntry, nIndex);
+			if (m_LRUHash == newEntry.GetHash()) {
+				m_LRUHash = 0;
+				m_pLRUEntry = NULL;
+			}
+		}
 		return false;
 	}
+	if (bAllocated) {
+		AddToIndex(newEntry.GetHash(), pNewEntry, nIndex);
+	}
 	m_LRUHash = pNewEntry->GetHash();
 	m_pLRUEntry = pNewEntry;
 	return true;
@@ -430,11 +459,15 @@ bool CParameterDB::MergeParamDB(LPCTSTR sParamDBName) {
 				}
 			} else {
 				// Entry to be merged not in parameter DB
-				pEntry = AllocateNewEntry(notUsed);
+				int nIndex;
+				pEntry = AllocateNewEntry(nIndex);
 				*pEntry = pBlock->Block[i];
+				AddToIndex(nThisHash, pEntry, nIndex);
 			}
 		}
 	}
+	delete[] pBlock->Block;
+	delete pBlock;
 
 	CParameterDBEntry dummy;
 	return SaveToFile(-1, dummy); // this saves all entries
@@ -485,9 +518,11 @@ CParameterDB::CParameterDB(void)
 
 	m_LRUHash = 0;
 	m_pLRUEntry = NULL;
+	m_nIndexedEntries = 0;
+	m_nNumEntries = 0;
 	DBBlock* pBlock = LoadFromFile(GetParamDBName(), true);
 	if (pBlock != NULL) {
-		m_blockList.push_back(pBlock);
+		AddBlock(pBlock);
 	}
 }
 
@@ -497,44 +532,118 @@ CParameterDB::~CParameterDB(void) {
 
 CParameterDBEntry* CParameterDB::FindEntryInternal(__int64 nHash, int& nIndex) {
 	nIndex = -1;
-	std::list<DBBlock*>::iterator iter;
-	for (iter = m_blockList.begin( ); iter != m_blockList.end( ); iter++ ) {
-		DBBlock* pCurrentBlock = *iter;
-		for (int i = 0; i < pCurrentBlock->UsedEntries; i++) {
-			nIndex++;
-			__int64 nThisHash = pCurrentBlock->Block[i].GetHash();
-			if (nThisHash != 0 && nThisHash == nHash) {
-				return &(pCurrentBlock->Block[i]);
-			}
-		}
+	if (nHash == 0 || m_index.empty()) {
+		return NULL;
+	}
+	const IndexSlot& slot = m_index[FindSlot(nHash)];
+	if (slot.Hash == 0) {
+		return NULL;
 	}
-	return NULL;
+	nIndex = slot.Index;
+	return slot.Entry;
 }
 
 CParameterDBEntry* CParameterDB::AllocateNewEntry(int& nIndex) {
 	const int BLOCK_SIZE = 64;
-	// First try to find a free entry, marked by a hash of 0
-	nIndex = -1;
-	std::list<DBBlock*>::iterator iter;
-	for (iter = m_blockList.begin( ); iter != m_blockList.end( ); iter++ ) {
-		DBBlock* pCurrentBlock = *iter;
-		for (int i = 0; i < pCurrentBlock->BlockLen; i++) {
-			nIndex++;
-			if (i >= pCurrentBlock->UsedEntries || pCurrentBlock->Block[i].GetHash() == 0) {
-				pCurrentBlock->UsedEntries = max(i+1, pCurrentBlock->UsedEntries);
-				return &(pCurrentBlock->Block[i]);
+	// First try to reuse a free entry, marked by a hash of 0
+	if (!m_freeEntries.empty()) {
+		IndexSlot freeEntry = m_freeEntries.back();
+		m_freeEntries.pop_back();
+		nIndex = freeEntry.Index;
+		return freeEntry.Entry;
+	}
+	// Append to the last block, create a new block if it is full
+	DBBlock* pBlock = m_blockList.empty() ? NULL : m_blockList.back();
+	if (pBlock == NULL || pBlock->UsedEntries >= pBlock->BlockLen) {
+		pBlock = new DBBlock();
+		pBlock->Block = new CParameterDBEntry[BLOCK_SIZE];
+		pBlock->BlockLen = BLOCK_SIZE;
+		pBlock->UsedEntries = 0;
+		memset(pBlock->Block, 0, sizeof(CParameterDBEntry)*BLOCK_SIZE);
+		m_blockList.push_back(pBlock);
+	}
+	nIndex = m_nNumEntries++;
+	return &(pBlock->Block[pBlock->UsedEntries++]);
+}
+
+void CParameterDB::ReleaseEntry(CParameterDBEntry* pEntry, int nIndex) {
+	IndexSlot freeEntry = { 0, pEntry, nIndex };
+	m_freeEntries.push_back(freeEntry);
+}
+
+void CParameterDB::AddBlock(DBBlock* pBlock) {
+	m_blockList.push_back(pBlock);
+	for (int i = 0; i < pBlock->UsedEntries; i++) {
+		CParameterDBEntry* pEntry = &(pBlock->Block[i]);
+		__int64 nHash = pEntry->GetHash();
+		int nIndex = m_nNumEntries++;
+		int nExistingIndex;
+		if (nHash == 0) {
+			ReleaseEntry(pEntry, nIndex);
+		} else if (FindEntryInternal(nHash, nExistingIndex) == NULL) {
+			AddToIndex(nHash, pEntry, nIndex);
+		} // else duplicate entry, the first entry with this hash is used as before
+	}
+}
+
+int CParameterDB::FindSlot(__int64 nHash) const {
+	size_t nMask = m_index.size() - 1;
+	size_t nSlot = HomeSlot(nHash, nMask);
+	while (m_index[nSlot].Hash != 0 && m_index[nSlot].Hash != nHash) {
+		nSlot = (nSlot + 1) & nMask;
+	}
+	return (int)nSlot;
+}
+
+void CParameterDB::AddToIndex(__int64 nHash, CParameterDBEntry* pEntry, int nIndex) {
+	// keep the load factor below 0.5, probe sequences stay short then
+	if ((m_nIndexedEntries + 1) * 2 > (int)m_index.size()) {
+		std::vector<IndexSlot> oldIndex;
+		oldIndex.swap(m_index);
+		IndexSlot emptySlot = { 0, NULL, -1 };
+		m_index.assign(max((size_t)MIN_INDEX_SIZE, oldIndex.size() * 2), emptySlot);
+		for (std::vector<IndexSlot>::const_iterator iter = oldIndex.begin(); iter != oldIndex.end(); iter++) {
+			if (iter->Hash != 0) {
+				m_index[FindSlot(iter->Hash)] = *iter;
 			}
 		}
 	}
-	// No free entry found, create new block
-	DBBlock* pBlock = new DBBlock();
-	pBlock->Block = new CParameterDBEntry[BLOCK_SIZE];
-	pBlock->BlockLen = BLOCK_SIZE;
-	pBlock->UsedEntries = 1;
-	memset(pBlock->Block, 0, sizeof(CParameterDBEntry)*BLOCK_SIZE);
-	m_blockList.push_back(pBlock);
-	nIndex++;
-	return &(pBlock->Block[0]);
+	IndexSlot& slot = m_index[FindSlot(nHash)];
+	if (slot.Hash == 0) {
+		m_nIndexedEntries++;
+	}
+	slot.Hash = nHash;
+	slot.Entry = pEntry;
+	slot.Index = nIndex;
+}
+
+void CParameterDB::RemoveFromIndex(__int64 nHash) {
+	if (m_index.empty()) {
+		return;
+	}
+	size_t nMask = m_index.size() - 1;
+	size_t nSlot = FindSlot(nHash);
+	if (m_index[nSlot].Hash == 0) {
+		return;
+	}
+	m_nIndexedEntries--;
+	// move the following entries of the probe sequence back into the gap, no tombstones are needed this way
+	size_t nNext = nSlot;
+	for (;;) {
+		nNext = (nNext + 1) & nMask;
+		if (m_index[nNext].Hash == 0) {
+			break;
+		}
+		size_t nHome = HomeSlot(m_index[nNext].Hash, nMask);
+		bool bReachableFromHome = (nSlot <= nNext) ? (nHome > nSlot && nHome <= nNext) : (nHome > nSlot || nHome <= nNext);
+		if (!bReachableFromHome) {
+			m_index[nSlot] = m_index[nNext];
+			nSlot = nNext;
+		}
+	}
+	m_index[nSlot].Hash = 0;
+	m_index[nSlot].Entry = NULL;
+	m_index[nSlot].Index = -1;
 }
 
 CParameterDB::DBBlock* CParameterDB::LoadFromFile(const CString& sParamDBName, bool bConvertOldFormats) {
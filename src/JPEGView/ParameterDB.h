@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ProcessParams.h"
+#include <vector>
 
 #pragma pack(push)
 
@@ -119,15 +120,31 @@ private:
 		int UsedEntries;
 	};
 
+	// Slot of the hash index, also used for the list of free entries
+	struct IndexSlot {
+		__int64 Hash; // 0 for an empty slot
+		CParameterDBEntry* Entry;
+		int Index; // index of the entry in the DB file
+	};
+
 	CRITICAL_SECTION m_csDBLock;
 
 	static CParameterDB* sm_instance;
 	std::list<DBBlock*> m_blockList;
+	std::vector<IndexSlot> m_index; // open addressing with linear probing, size is a power of two
+	int m_nIndexedEntries;
+	std::vector<IndexSlot> m_freeEntries; // entries with hash 0 that can be reused
+	int m_nNumEntries; // number of entries in all blocks, including the free entries
 	__int64 m_LRUHash;
 	CParameterDBEntry* m_pLRUEntry;
 
 	CParameterDBEntry* FindEntryInternal(__int64 nHash, int& nIndex);
 	CParameterDBEntry* AllocateNewEntry(int& nIndex);
+	void ReleaseEntry(CParameterDBEntry* pEntry, int nIndex);
+	void AddBlock(DBBlock* pBlock);
+	int FindSlot(__int64 nHash) const;
+	void AddToIndex(__int64 nHash, CParameterDBEntry* pEntry, int nIndex);
+	void RemoveFromIndex(__int64 nHash);
 	DBBlock* LoadFromFile(const CString& sParamDBName, bool bConvertOldFormats);
 	bool SaveToFile(int nIndex, const CParameterDBEntry & dbEntry);
 	bool ConvertVersion1To2(HANDLE hFile, const CString& sFileName);
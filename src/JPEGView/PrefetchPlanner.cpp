@@ -0,0 +1,152 @@
+#include "StdAfx.h"
+#include "PrefetchPlanner.h"
+#include <algorithm>
+
+// Repeated jumps up to this number of images are read ahead with their stride
+static const int MAX_STRIDE = 16;
+
+// Browsing is fast when the median dwell time is below this time (ms), the images are read further ahead then
+static const double FAST_BROWSING_MS = 400.0;
+
+// The cadence is steady if all recent dwell times are within this fraction of their median
+static const double STEADY_CADENCE_TOLERANCE = 0.15;
+
+static int Sign(int nValue) {
+	return (nValue > 0) ? 1 : ((nValue < 0) ? -1 : 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CPrefetchPlanner::CPrefetchPlanner(int nReadAhead) {
+	m_nReadAhead = nReadAhead;
+	m_nCurrentIndex = -1;
+	m_dLastTimeMs = 0.0;
+	m_nNumSteps = 0;
+	m_nNumPlanned = 0;
+	m_nHits = 0;
+	m_nMisses = 0;
+}
+
+void CPrefetchPlanner::OnNavigate(int nIndex, double dTimeMs) {
+	if (nIndex == m_nCurrentIndex || nIndex < 0) {
+		return;
+	}
+	if (m_nCurrentIndex >= 0) {
+		if (m_nNumPlanned > 0) {
+			int* pEnd = m_nPlannedIndices + m_nNumPlanned;
+			if (std::find(m_nPlannedIndices, pEnd, nIndex) != pEnd) {
+				m_nHits++;
+			} else {
+				m_nMisses++;
+			}
+		}
+		for (int i = HISTORY_SIZE - 1; i > 0; i--) {
+			m_nSteps[i] = m_nSteps[i - 1];
+			m_dDwellTimes[i] = m_dDwellTimes[i - 1];
+		}
+		m_nSteps[0] = nIndex - m_nCurrentIndex;
+		m_dDwellTimes[0] = dTimeMs - m_dLastTimeMs;
+		m_nNumSteps = min(HISTORY_SIZE, m_nNumSteps + 1);
+	}
+	m_nCurrentIndex = nIndex;
+	m_dLastTimeMs = dTimeMs;
+	m_nNumPlanned = 0;
+}
+
+int CPrefetchPlanner::Plan(CPrefetch* pPrefetches, int nMaxPrefetches) {
+	nMaxPrefetches = min(nMaxPrefetches, (int)MAX_PREFETCHES);
+	int nCount = 0;
+	if (m_nReadAhead > 0) {
+		int nStride = GetStride();
+		int nDirection = Sign(nStride);
+		int nAhead = m_nReadAhead;
+		int nBehind = (m_nReadAhead + 1) / 2;
+		if (m_nNumSteps >= 3 && Sign(m_nSteps[0]) != Sign(m_nSteps[1]) && CountDirectionFlips() * 2 >= m_nNumSteps - 1) {
+			// going back and forth, both neighbours are equally likely
+			for (int i = 1; i <= nBehind && nCount + 1 < nMaxPrefetches; i++) {
+				int nPriority = PRIORITY_READ_AHEAD - i;
+				pPrefetches[nCount].Offset = i * nDirection;
+				pPrefetches[nCount++].Priority = nPriority;
+				pPrefetches[nCount].Offset = -i * nDirection;
+				pPrefetches[nCount++].Priority = nPriority;
+			}
+		} else {
+			if (m_nNumSteps >= 2 && GetMedianDwellTime() < FAST_BROWSING_MS) {
+				nAhead = 2 * m_nReadAhead;
+				nBehind = min(nBehind, 1);
+			} else if (IsSteadyCadence()) {
+				nBehind = 0;
+			}
+			for (int i = 1; i <= nAhead && nCount < nMaxPrefetches; i++) {
+				pPrefetches[nCount].Offset = i * nStride;
+				pPrefetches[nCount++].Priority = PRIORITY_READ_AHEAD - i;
+			}
+			// the images behind have lower priority than all images ahead
+			for (int i = 1; i <= nBehind && nCount < nMaxPrefetches; i++) {
+				pPrefetches[nCount].Offset = -i * nDirection;
+				pPrefetches[nCount++].Priority = PRIORITY_READ_AHEAD - nAhead - i;
+			}
+		}
+	}
+	m_nNumPlanned = nCount;
+	for (int i = 0; i < nCount; i++) {
+		m_nPlannedIndices[i] = m_nCurrentIndex + pPrefetches[i].Offset;
+	}
+	return nCount;
+}
+
+double CPrefetchPlanner::HitRate() const {
+	int nTotal = m_nHits + m_nMisses;
+	return (nTotal == 0) ? 0.0 : 100.0 * m_nHits / nTotal;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+int CPrefetchPlanner::GetStride() const {
+	if (m_nNumSteps == 0) {
+		return 1;
+	}
+	// a jump repeated with the same stride is expected to continue
+	if (m_nNumSteps >= 2 && m_nSteps[0] == m_nSteps[1] && abs(m_nSteps[0]) <= MAX_STRIDE) {
+		return m_nSteps[0];
+	}
+	// otherwise single steps in the direction of the last navigation, single jumps (e.g. to the first image) are not repeated
+	return Sign(m_nSteps[0]);
+}
+
+int CPrefetchPlanner::CountDirectionFlips() const {
+	int nFlips = 0;
+	for (int i = 1; i < m_nNumSteps; i++) {
+		if (Sign(m_nSteps[i]) != Sign(m_nSteps[i - 1])) {
+			nFlips++;
+		}
+	}
+	return nFlips;
+}
+
+bool CPrefetchPlanner::IsSteadyCadence() const {
+	if (m_nNumSteps < 3) {
+		return false;
+	}
+	double dMedian = GetMedianDwellTime();
+	for (int i = 0; i < m_nNumSteps; i++) {
+		if (m_nSteps[i] != m_nSteps[0] || fabs(m_dDwellTimes[i] - dMedian) > STEADY_CADENCE_TOLERANCE * dMedian) {
+			return false;
+		}
+	}
+	return true;
+}
+
+double CPrefetchPlanner::GetMedianDwellTime() const {
+	if (m_nNumSteps == 0) {
+		return 0.0;
+	}
+	double dDwellTimes[HISTORY_SIZE];
+	memcpy(dDwellTimes, m_dDwellTimes, m_nNumSteps * sizeof(double));
+	std::sort(dDwellTimes, dDwellTimes + m_nNumSteps);
+	return dDwellTimes[m_nNumSteps / 2];
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Plans which images are read ahead, learned from the recent navigation history in the file list.
+// The planner tracks the browsing direction and its flips, the stride of repeated jumps (e.g. skipping pages) and
+// the time spent on each image (dwell time):
+// - Fast browsing (e.g. holding down a key) reads twice as far ahead, and only one image behind.
+// - A steady cadence (slideshow) reads ahead only in browsing direction.
+// - Frequent direction flips (comparing neighbouring images) read both neighbours with the same priority.
+// The planner only works on indices in the file list, so it can be replayed on recorded navigation traces.
+class CPrefetchPlanner
+{
+public:
+	// A planned read ahead request
+	struct CPrefetch {
+		int Offset; // offset to the current index in the file list, never 0
+		int Priority; // requests with higher priority are loaded first
+	};
+
+	enum {
+		PRIORITY_CURRENT = 100, // priority of the image requested for display
+		PRIORITY_READ_AHEAD = 50, // priority of the most likely read ahead image, decreases with the rank
+		MAX_PREFETCHES = 32 // maximal number of planned requests
+	};
+
+	// nReadAhead: number of images to read ahead in browsing direction when browsing at normal speed
+	CPrefetchPlanner(int nReadAhead);
+
+	// Records a navigation to the given index in the file list at the given time (in milliseconds).
+	// Counts a hit if the index was part of the last plan, a miss otherwise. Staying on the same index is not counted.
+	void OnNavigate(int nIndex, double dTimeMs);
+
+	// Plans the read ahead requests for the current index, ordered by decreasing priority. Returns the number of requests.
+	int Plan(CPrefetch* pPrefetches, int nMaxPrefetches);
+
+	// Number of navigations to an index that was planned to be read ahead and to one that was not
+	int Hits() const { return m_nHits; }
+	int Misses() const { return m_nMisses; }
+	// Hit rate in percent, 0 if there was no counted navigation yet
+	double HitRate() const;
+
+private:
+	enum { HISTORY_SIZE = 8 };
+
+	int m_nReadAhead;
+	int m_nCurrentIndex; // -1 before the first navigation
+	double m_dLastTimeMs;
+	int m_nNumSteps; // number of valid entries in the history
+	int m_nSteps[HISTORY_SIZE]; // index delta of the recent navigations, most recent first
+	double m_dDwellTimes[HISTORY_SIZE]; // time spent on the image before each navigation, most recent first
+	int m_nPlannedIndices[MAX_PREFETCHES];
+	int m_nNumPlanned;
+	int m_nHits;
+	int m_nMisses;
+
+	int GetStride() const; // predicted index delta of the next navigation
+	int CountDirectionFlips() const;
+	bool IsSteadyCadence() const;
+	double GetMedianDwellTime() const;
+};
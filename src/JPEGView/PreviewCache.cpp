@@ -0,0 +1,423 @@
+#include "StdAfx.h"
+#include "PreviewCache.h"
+#include "JPEGImage.h"
+#include "RawMetadata.h"
+#include "BasicProcessing.h"
+#include "TJPEGWrapper.h"
+#include "MappedFile.h"
+#include "PagedPixelBuffer.h"
+#include "SettingsProvider.h"
+#include "Helpers.h"
+#include "libjpeg-turbo\include\turbojpeg.h"
+
+CPreviewCache* CPreviewCache::sm_instance;
+
+static const TCHAR PREVIEW_CACHE_NAME[] = _T("PreviewCache.dat");
+static const TCHAR PREVIEW_CACHE_MUTEX_NAME[] = _T("JPEGViewPreviewCacheMutex");
+static const uint32 PREVIEW_CACHE_MAGIC = 0x43505650;
+static const uint32 PREVIEW_CACHE_VERSION = 2;
+static const int NUM_SETS = 2048;
+static const int WAYS_PER_SET = 4;
+static const int PREVIEW_JPEG_QUALITY = 90;
+
+#pragma pack(push)
+#pragma pack(1)
+
+// Header at the start of the cache file
+struct PreviewCacheHeader {
+	uint32 nMagic;
+	uint32 nVersion;
+	uint32 nNumSets;
+	uint32 nWaysPerSet;
+	__int64 nDataSize; // size of the ring buffer holding the entries
+	__int64 nWritePos; // offset of the next entry in the ring buffer
+	__int64 nSequence; // sequence number of the entry added last
+};
+
+// Index slot, following the header
+struct PreviewCacheSlot {
+	__int64 nFileHash; // 0 if the slot is empty
+	__int64 nSequence; // the slot with the lowest sequence number of a set is replaced first
+	__int64 nOffset; // offset of the entry in the ring buffer
+	uint32 nSize; // size of the entry in bytes
+	uint32 nReserved;
+};
+
+// Entry in the ring buffer, followed by the JPEG stream and the EXIF block
+struct PreviewCacheEntry {
+	__int64 nFileHash;
+	__int64 nPixelHash; // pixel hash of the full image, identifies the image in the parameter DB
+	int32 nImageFormat;
+	int32 nWidth, nHeight; // size of the preview
+	int32 nFullWidth, nFullHeight; // size of the image
+	int32 nReductionFactor;
+	int32 nJPEGSize;
+	int32 nEXIFSize;
+	// camera RAW metadata (without GPS information), only valid if bHasRawMetadata is not 0
+	int32 bHasRawMetadata;
+	char sManufacturer[64];
+	char sModel[64];
+	__int64 nAcquisitionTime; // time_t
+	int32 bFlashFired;
+	double dIsoSpeed;
+	double dExposureTime;
+	double dFocalLength;
+	double dAperture;
+	int32 nOrientation;
+	int32 nRawWidth, nRawHeight;
+};
+
+#pragma pack(pop)
+
+// The ring buffer starts at this offset in the cache file
+static const __int64 DATA_START = Helpers::DoPadding((int)(sizeof(PreviewCacheHeader) + NUM_SETS * WAYS_PER_SET * sizeof(PreviewCacheSlot)), 4096);
+
+// Locks the cache file for all JPEGView processes
+class CPreviewCacheLock {
+public:
+	CPreviewCacheLock(HANDLE hMutex) : m_hMutex(hMutex) {
+		::WaitForSingleObject(m_hMutex, INFINITE); // WAIT_ABANDONED also gives ownership
+	}
+	~CPreviewCacheLock() {
+		::ReleaseMutex(m_hMutex);
+	}
+private:
+	HANDLE m_hMutex;
+};
+
+static __int64 SystemTimeToTimeT(const SYSTEMTIME& systemTime) {
+	FILETIME fileTime;
+	if (!::SystemTimeToFileTime(&systemTime, &fileTime)) {
+		return 0;
+	}
+	LONGLONG time = ((LONGLONG)fileTime.dwHighDateTime << 32) + fileTime.dwLowDateTime;
+	return (time - 116444736000000000) / 10000000;
+}
+
+static void CopyRawMetadata(PreviewCacheEntry& entry, CRawMetadata* pRawMetadata) {
+	entry.bHasRawMetadata = pRawMetadata != NULL;
+	if (pRawMetadata == NULL) {
+		return;
+	}
+	strncpy_s(entry.sManufacturer, sizeof(entry.sManufacturer), CStringA(pRawMetadata->GetManufacturer()), _TRUNCATE);
+	strncpy_s(entry.sModel, sizeof(entry.sModel), CStringA(pRawMetadata->GetModel()), _TRUNCATE);
+	entry.nAcquisitionTime = SystemTimeToTimeT(pRawMetadata->GetAcquisitionTime());
+	entry.bFlashFired = pRawMetadata->IsFlashFired();
+	entry.dIsoSpeed = pRawMetadata->GetIsoSpeed();
+	entry.dExposureTime = pRawMetadata->GetExposureTime();
+	entry.dFocalLength = pRawMetadata->GetFocalLength();
+	entry.dAperture = pRawMetadata->GetAperture();
+	entry.nOrientation = pRawMetadata->GetOrientation();
+	entry.nRawWidth = pRawMetadata->GetWidth();
+	entry.nRawHeight = pRawMetadata->GetHeight();
+}
+
+static CRawMetadata* CreateRawMetadata(PreviewCacheEntry& entry) {
+	if (!entry.bHasRawMetadata) {
+		return NULL;
+	}
+	entry.sManufacturer[sizeof(entry.sManufacturer) - 1] = 0;
+	entry.sModel[sizeof(entry.sModel) - 1] = 0;
+	return new CRawMetadata(entry.sManufacturer, entry.sModel, (time_t)entry.nAcquisitionTime, entry.bFlashFired != 0,
+		entry.dIsoSpeed, entry.dExposureTime, entry.dFocalLength, entry.dAperture, entry.nOrientation, entry.nRawWidth, entry.nRawHeight);
+}
+
+// Creates the JPEG compressed preview of the image, must be freed with TurboJpeg::Free(). NULL if out of memory.
+static void* CompressPreview(CJPEGImage* pImage, CSize previewSize, int& nJPEGSize) {
+	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
+	void* pDIB32bpp;
+	if (cpu >= Helpers::CPU_MMX) {
+		pDIB32bpp = CBasicProcessing::SampleDown_HQ_SIMD(previewSize, CPoint(0, 0), previewSize, pImage->OrigSize(), pImage->OriginalPixels(),
+			pImage->OriginalChannels(), 0.0, Filter_Downsampling_Best_Quality, (cpu == Helpers::CPU_MMX) ? CBasicProcessing::MMX : CBasicProcessing::SSE);
+	} else {
+		pDIB32bpp = CBasicProcessing::SampleDown_HQ(previewSize, CPoint(0, 0), previewSize, pImage->OrigSize(), pImage->OriginalPixels(),
+			pImage->OriginalChannels(), 0.0, Filter_Downsampling_Best_Quality);
+	}
+	if (pDIB32bpp == NULL) {
+		return NULL;
+	}
+	uint8* pDIB24bpp = new(std::nothrow) uint8[Helpers::DoPadding(previewSize.cx * 3, 4) * previewSize.cy];
+	if (pDIB24bpp == NULL) {
+		delete[] pDIB32bpp;
+		return NULL;
+	}
+	CBasicProcessing::Convert32bppTo24bppDIB(previewSize.cx, previewSize.cy, pDIB24bpp, pDIB32bpp, false);
+	delete[] pDIB32bpp;
+	bool bOutOfMemory;
+	void* pJPEGStream = TurboJpeg::Compress(pDIB24bpp, previewSize.cx, previewSize.cy, nJPEGSize, bOutOfMemory, PREVIEW_JPEG_QUALITY);
+	delete[] pDIB24bpp;
+	return pJPEGStream;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CPreviewCache& CPreviewCache::This() {
+	if (sm_instance == NULL) {
+		sm_instance = new CPreviewCache();
+	}
+	return *sm_instance;
+}
+
+__int64 CPreviewCache::CalculateFileHash(LPCTSTR sFileName) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!::GetFileAttributesEx(sFileName, GetFileExInfoStandard, &attributes)) {
+		return 0;
+	}
+	CMappedFile file(sFileName);
+	if (!file.IsValid()) {
+		return 0;
+	}
+	unsigned __int64 nContentHash;
+	try {
+		// includes the file size
+		nContentHash = Helpers::CalculateFileContentHash(file.Data(), file.Size());
+	} catch (...) {
+		// file vanished while reading (EXCEPTION_IN_PAGE_ERROR)
+		return 0;
+	}
+	// The content is only sampled, the last write time changes also if the modified bytes are not sampled.
+	// It is kept when copying files, so copies still find the preview.
+	unsigned __int64 nLastWriteTime = ((unsigned __int64)attributes.ftLastWriteTime.dwHighDateTime << 32) + attributes.ftLastWriteTime.dwLowDateTime;
+	__int64 nHash = (__int64)(nContentHash ^ (nLastWriteTime * 0x9E3779B97F4A7C15));
+	return (nHash == 0) ? 1 : nHash;
+}
+
+CJPEGImage* CPreviewCache::FindPreview(__int64 nFileHash) {
+	if (!IsEnabled() || nFileHash == 0) {
+		return NULL;
+	}
+
+	// Copy the entry, the JPEG stream is decoded without holding the lock
+	PreviewCacheEntry entry;
+	uint8* pJPEGStream = NULL;
+	uint8* pEXIFData = NULL;
+	{
+		CPreviewCacheLock lock(m_hMutex);
+		try {
+			PreviewCacheHeader* pHeader = (PreviewCacheHeader*)m_pBase;
+			PreviewCacheSlot* pSet = (PreviewCacheSlot*)(m_pBase + sizeof(PreviewCacheHeader)) + ((unsigned __int64)nFileHash % NUM_SETS) * WAYS_PER_SET;
+			PreviewCacheSlot* pSlot = NULL;
+			for (int i = 0; i < WAYS_PER_SET; i++) {
+				if (pSet[i].nFileHash == nFileHash) {
+					pSlot = &pSet[i];
+					break;
+				}
+			}
+			if (pSlot == NULL || pSlot->nOffset < 0 || pSlot->nOffset + pSlot->nSize > pHeader->nDataSize) {
+				return NULL;
+			}
+			const uint8* pEntry = m_pBase + DATA_START + pSlot->nOffset;
+			memcpy(&entry, pEntry, sizeof(PreviewCacheEntry));
+			if (entry.nFileHash != nFileHash || entry.nJPEGSize <= 0 || entry.nEXIFSize < 0 ||
+				sizeof(PreviewCacheEntry) + entry.nJPEGSize + entry.nEXIFSize > pSlot->nSize) {
+				return NULL;
+			}
+			pJPEGStream = new(std::nothrow) uint8[entry.nJPEGSize];
+			pEXIFData = (entry.nEXIFSize > 0) ? new(std::nothrow) uint8[entry.nEXIFSize] : NULL;
+			if (pJPEGStream == NULL || (entry.nEXIFSize > 0 && pEXIFData == NULL)) {
+				delete[] pJPEGStream;
+				delete[] pEXIFData;
+				return NULL;
+			}
+			memcpy(pJPEGStream, pEntry + sizeof(PreviewCacheEntry), entry.nJPEGSize);
+			if (pEXIFData != NULL) {
+				memcpy(pEXIFData, pEntry + sizeof(PreviewCacheEntry) + entry.nJPEGSize, entry.nEXIFSize);
+			}
+		} catch (...) {
+			// error reading the cache file (EXCEPTION_IN_PAGE_ERROR)
+			delete[] pJPEGStream;
+			delete[] pEXIFData;
+			return NULL;
+		}
+	}
+
+	int nWidth, nHeight, nBPP;
+	TJSAMP eChromoSubSampling;
+	bool bOutOfMemory;
+	void* pPixels = TurboJpeg::ReadImage(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, pJPEGStream, entry.nJPEGSize);
+	delete[] pJPEGStream;
+	if (pPixels == NULL || nBPP != 3 || nWidth != entry.nWidth || nHeight != entry.nHeight) {
+		CPagedPixelBuffer::FreePixels(pPixels);
+		delete[] pEXIFData;
+		return NULL;
+	}
+	CJPEGImage* pImage = new CJPEGImage(nWidth, nHeight, pPixels, pEXIFData, 3, entry.nPixelHash, (EImageFormat)entry.nImageFormat,
+		false, 0, 1, 0, NULL, false, CreateRawMetadata(entry));
+	delete[] pEXIFData;
+	pImage->SetReducedResolution(entry.nReductionFactor, CSize(entry.nFullWidth, entry.nFullHeight));
+	return pImage;
+}
+
+bool CPreviewCache::AddPreview(__int64 nFileHash, CJPEGImage* pImage, int nReductionFactor) {
+	if (!IsEnabled() || nFileHash == 0 || pImage == NULL || pImage->OriginalPixels() == NULL || pImage->IsReducedResolution() || nReductionFactor < 2) {
+		return false;
+	}
+
+	PreviewCacheEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.nFileHash = nFileHash;
+	entry.nPixelHash = pImage->GetPixelHash();
+	entry.nImageFormat = pImage->GetImageFormat();
+	entry.nWidth = (pImage->OrigWidth() + nReductionFactor - 1) / nReductionFactor;
+	entry.nHeight = (pImage->OrigHeight() + nReductionFactor - 1) / nReductionFactor;
+	entry.nFullWidth = pImage->OrigWidth();
+	entry.nFullHeight = pImage->OrigHeight();
+	entry.nReductionFactor = nReductionFactor;
+	entry.nEXIFSize = (pImage->GetEXIFData() != NULL) ? pImage->GetEXIFDataLength() : 0;
+	CopyRawMetadata(entry, pImage->GetRawMetadata());
+
+	void* pJPEGStream = CompressPreview(pImage, CSize(entry.nWidth, entry.nHeight), entry.nJPEGSize);
+	if (pJPEGStream == NULL) {
+		return false;
+	}
+
+	bool bSuccess = false;
+	{
+		CPreviewCacheLock lock(m_hMutex);
+		try {
+			PreviewCacheHeader* pHeader = (PreviewCacheHeader*)m_pBase;
+			PreviewCacheSlot* pSlots = (PreviewCacheSlot*)(m_pBase + sizeof(PreviewCacheHeader));
+			__int64 nEntrySize = Helpers::DoPadding((int)(sizeof(PreviewCacheEntry) + entry.nJPEGSize + entry.nEXIFSize), 8);
+			// a single entry must not displace a large part of the cache
+			if (nEntrySize <= pHeader->nDataSize / 8) {
+				if (pHeader->nWritePos + nEntrySize > pHeader->nDataSize) {
+					pHeader->nWritePos = 0;
+				}
+				__int64 nStart = pHeader->nWritePos;
+				__int64 nEnd = nStart + nEntrySize;
+
+				// remove the entries that are overwritten and the old entry of this file
+				for (int i = 0; i < NUM_SETS * WAYS_PER_SET; i++) {
+					if (pSlots[i].nFileHash != 0 && (pSlots[i].nFileHash == nFileHash || 
+						(pSlots[i].nOffset < nEnd && pSlots[i].nOffset + pSlots[i].nSize > nStart))) {
+						pSlots[i].nFileHash = 0;
+					}
+				}
+
+				// use an empty slot of the set or replace the oldest one
+				PreviewCacheSlot* pSet = pSlots + ((unsigned __int64)nFileHash % NUM_SETS) * WAYS_PER_SET;
+				PreviewCacheSlot* pSlot = &pSet[0];
+				for (int i = 0; i < WAYS_PER_SET; i++) {
+					if (pSet[i].nFileHash == 0) {
+						pSlot = &pSet[i];
+						break;
+					}
+					if (pSet[i].nSequence < pSlot->nSequence) {
+						pSlot = &pSet[i];
+					}
+				}
+				pSlot->nFileHash = 0;
+
+				uint8* pEntry = m_pBase + DATA_START + nStart;
+				memcpy(pEntry, &entry, sizeof(PreviewCacheEntry));
+				memcpy(pEntry + sizeof(PreviewCacheEntry), pJPEGStream, entry.nJPEGSize);
+				if (entry.nEXIFSize > 0) {
+					memcpy(pEntry + sizeof(PreviewCacheEntry) + entry.nJPEGSize, pImage->GetEXIFData(), entry.nEXIFSize);
+				}
+				pHeader->nWritePos = nEnd;
+				pHeader->nSequence++;
+				pSlot->nOffset = nStart;
+				pSlot->nSize = (uint32)nEntrySize;
+				pSlot->nSequence = pHeader->nSequence;
+				pSlot->nFileHash = nFileHash; // set last, the entry is valid now
+				bSuccess = true;
+			}
+		} catch (...) {
+			// error writing the cache file (EXCEPTION_IN_PAGE_ERROR), e.g. disk full
+			bSuccess = false;
+		}
+	}
+	TurboJpeg::Free(pJPEGStream);
+	return bSuccess;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CPreviewCache::CPreviewCache() {
+	m_hMutex = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pBase = NULL;
+	int nSizeMB = CSettingsProvider::This().PreviewCacheSizeMB();
+	if (nSizeMB > 0 && !OpenCacheFile((__int64)nSizeMB * 1024 * 1024)) {
+		CloseCacheFile();
+	}
+}
+
+CPreviewCache::~CPreviewCache() {
+	CloseCacheFile();
+}
+
+bool CPreviewCache::OpenCacheFile(__int64 nDataSize) {
+	m_hMutex = ::CreateMutex(NULL, FALSE, PREVIEW_CACHE_MUTEX_NAME);
+	if (m_hMutex == NULL) {
+		return false;
+	}
+	::CreateDirectory(Helpers::JPEGViewAppDataPath(), NULL);
+	CString sFileName = CString(Helpers::JPEGViewAppDataPath()) + PREVIEW_CACHE_NAME;
+	m_hFile = ::CreateFile(sFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	CPreviewCacheLock lock(m_hMutex);
+	LARGE_INTEGER fileSize;
+	LARGE_INTEGER requiredSize;
+	requiredSize.QuadPart = DATA_START + nDataSize;
+	if (!::GetFileSizeEx(m_hFile, &fileSize)) {
+		return false;
+	}
+	bool bResized = fileSize.QuadPart != requiredSize.QuadPart;
+	if (bResized) {
+		// fails if another process has mapped the file with another size, the cache is not used then
+		if (!::SetFilePointerEx(m_hFile, requiredSize, NULL, FILE_BEGIN) || !::SetEndOfFile(m_hFile)) {
+			return false;
+		}
+	}
+	m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READWRITE, requiredSize.HighPart, requiredSize.LowPart, NULL);
+	if (m_hMapping == NULL) {
+		return false;
+	}
+	m_pBase = (uint8*)::MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, 0);
+	if (m_pBase == NULL) {
+		return false;
+	}
+	try {
+		PreviewCacheHeader* pHeader = (PreviewCacheHeader*)m_pBase;
+		if (bResized || pHeader->nMagic != PREVIEW_CACHE_MAGIC || pHeader->nVersion != PREVIEW_CACHE_VERSION || pHeader->nNumSets != NUM_SETS ||
+			pHeader->nWaysPerSet != WAYS_PER_SET || pHeader->nDataSize != nDataSize || pHeader->nWritePos < 0 || pHeader->nWritePos > nDataSize) {
+			memset(m_pBase, 0, (size_t)DATA_START);
+			pHeader->nMagic = PREVIEW_CACHE_MAGIC;
+			pHeader->nVersion = PREVIEW_CACHE_VERSION;
+			pHeader->nNumSets = NUM_SETS;
+			pHeader->nWaysPerSet = WAYS_PER_SET;
+			pHeader->nDataSize = nDataSize;
+		}
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+
+void CPreviewCache::CloseCacheFile() {
+	if (m_pBase != NULL) {
+		::UnmapViewOfFile(m_pBase);
+		m_pBase = NULL;
+	}
+	if (m_hMapping != NULL) {
+		::CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	if (m_hMutex != NULL) {
+		::CloseHandle(m_hMutex);
+		m_hMutex = NULL;
+	}
+}
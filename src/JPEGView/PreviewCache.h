@@ -0,0 +1,47 @@
+#pragma once
+
+class CJPEGImage;
+
+// Persistent cache of screen sized previews of images that are slow to decode (e.g. camera RAW, HEIF, PSD).
+// Reopening a folder shows the previews without decoding the images again, the full image is decoded
+// when it is needed (zooming in, saving, editing), as with JPEGs decoded with reduced resolution.
+// The entries are identified by a hash over the sampled file content, the file size and the time of the last
+// modification. So they are independent of the file name and stale entries of modified files are not used,
+// even if the modification is not in the sampled parts of the file.
+// The previews are JPEG compressed and stored in a single file in the AppData folder, which is memory mapped.
+// The file starts with an index (set associative, 4 entries per set) followed by a ring buffer holding the entries.
+// New entries overwrite the oldest ones when the ring buffer is full, so the size of the file is fixed.
+// The cache is shared between JPEGView processes, all accesses are protected by a named mutex.
+class CPreviewCache
+{
+public:
+	// Singleton instance
+	static CPreviewCache& This();
+
+	// Returns if the cache is enabled in the INI file and the cache file could be opened
+	bool IsEnabled() const { return m_pBase != NULL; }
+
+	// Calculates the hash identifying the given file (content, size and last write time), 0 if the file cannot be read
+	static __int64 CalculateFileHash(LPCTSTR sFileName);
+
+	// Gets the preview of the file with the given hash. The returned image has reduced resolution
+	// (see CJPEGImage::IsReducedResolution()). Returns NULL if there is no preview of the file.
+	CJPEGImage* FindPreview(__int64 nFileHash);
+
+	// Adds a preview of the image, being 1/nReductionFactor of the size of the image, for the file with the given hash.
+	// The image must have full resolution. Returns false if the preview could not be added.
+	bool AddPreview(__int64 nFileHash, CJPEGImage* pImage, int nReductionFactor);
+
+private:
+	static CPreviewCache* sm_instance;
+
+	HANDLE m_hMutex;
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	uint8* m_pBase; // start of mapped file, NULL if the cache is disabled
+
+	CPreviewCache();
+	~CPreviewCache();
+	bool OpenCacheFile(__int64 nDataSize);
+	void CloseCacheFile();
+};
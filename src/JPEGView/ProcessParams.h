@@ -11,7 +11,8 @@ enum EProcessingFlags {
 	PFLAG_HighQualityResampling = 8,
 	PFLAG_KeepParams = 16, // Keep parameters between images
 	PFLAG_LandscapeMode = 32,
-	PFLAG_NoProcessingAfterLoad = 64
+	PFLAG_NoProcessingAfterLoad = 64,
+	PFLAG_ReducedResolution = 128 // JPEGs may be decoded with reduced resolution when displayed fit to screen
 };
 
 static inline EProcessingFlags SetProcessingFlag(EProcessingFlags eFlags, EProcessingFlags eFlagToSet, bool bValue) {
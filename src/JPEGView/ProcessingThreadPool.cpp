@@ -1,45 +1,145 @@
 #include "StdAfx.h"
 #include "ProcessingThreadPool.h"
 #include "SettingsProvider.h"
+#include "Helpers.h"
+#include <process.h>
 
 CProcessingThreadPool* CProcessingThreadPool::sm_instance;
 
+// Processing is done in strips to reduce memory consumption and increase cache hit rate.
+// The following constant gives the number of source pixels to process per strip.
+static const uint32 MAX_SRC_PIXELS_PER_STRIP = 1024 * 100;
+
+// Minimal number of strips per participating thread, so that there is something left to steal
+static const int MIN_STRIPS_PER_THREAD = 4;
+
+// Priority (-1 if not set) and cancel flag of the requests processed from a thread, see SetPriorityOfThread() and SetCancelFlagOfThread()
+static __declspec(thread) int tl_nPriority = -1;
+static __declspec(thread) volatile bool* tl_pCancelFlag = NULL;
+
 ///////////////////////////////////////////////////////////////////////////////////
 // Supporting classes
 ///////////////////////////////////////////////////////////////////////////////////
 
-// A request wrapping another request and adding information about the image strip to process.
-class CWrappedRequest : public CRequestBase {
+// A request in the scheduler, with the ranges of strips not yet claimed by the participating threads.
+// Thread slot 0 is the thread calling Process(), slot n is pool thread n - 1.
+class CScheduledRequest {
 public:
-	// nOffset, nSize defines the strip to process: 'nSize' rows, starting at row 'nOffset'
-	CWrappedRequest(CProcessingRequest * pRequest, int nOffset, int nSize, HANDLE hEventFinished) : CRequestBase(hEventFinished) {
-		InnerRequest = pRequest;
-		Offset = nOffset;
-		SizeY = nSize;
+	CScheduledRequest(CProcessingRequest* pRequest, CProcessingThreadPool::EPriority ePriority, volatile bool* pCancelFlag, int nStripHeight, int nNumSlots) {
+		Request = pRequest;
+		Priority = ePriority;
+		CancelFlag = pCancelFlag;
+		StripHeight = nStripHeight;
+		NumStrips = (pRequest->ClippedTargetSize.cy + nStripHeight - 1) / nStripHeight;
+		RemainingStrips = NumStrips;
+		NumSlots = nNumSlots;
+		SlotBegin = new int[nNumSlots];
+		SlotEnd = new int[nNumSlots];
+		for (int i = 0; i < nNumSlots; i++) {
+			SlotBegin[i] = (int)((__int64)NumStrips * i / nNumSlots);
+			SlotEnd[i] = (int)((__int64)NumStrips * (i + 1) / nNumSlots);
+		}
+		EventFinished = ::CreateEvent(0, TRUE, FALSE, NULL);
 	}
 
-	CProcessingRequest* InnerRequest;
-	int Offset;
-	int SizeY;
-};
+	~CScheduledRequest() {
+		::CloseHandle(EventFinished);
+		delete[] SlotBegin;
+		delete[] SlotEnd;
+	}
 
+	// Claims the next strip for the given slot, stealing from the slot with the most strips left if the own range is empty.
+	// Must be called with the request lists locked.
+	bool ClaimStrip(int nSlot, int& nStrip) {
+		if (SlotBegin[nSlot] >= SlotEnd[nSlot]) {
+			int nVictim = -1;
+			int nMaxLeft = 0;
+			for (int i = 0; i < NumSlots; i++) {
+				int nLeft = SlotEnd[i] - SlotBegin[i];
+				if (nLeft > nMaxLeft) {
+					nMaxLeft = nLeft;
+					nVictim = i;
+				}
+			}
+			if (nVictim < 0) {
+				return false;
+			}
+			// steal the back half, the victim continues with the front half
+			int nSteal = (nMaxLeft + 1) / 2;
+			SlotBegin[nSlot] = SlotEnd[nVictim] - nSteal;
+			SlotEnd[nSlot] = SlotEnd[nVictim];
+			SlotEnd[nVictim] -= nSteal;
+		}
+		nStrip = SlotBegin[nSlot]++;
+		return true;
+	}
 
-// Worker thread in thread pool, executing image processing operations on image strips
-class CProcessingThread : public CWorkThread {
-public:
-	CProcessingThread(void) : CWorkThread(false) {}
-	~CProcessingThread(void) {}
+	// True if all strips have been claimed. Must be called with the request lists locked.
+	bool AllClaimed() const {
+		for (int i = 0; i < NumSlots; i++) {
+			if (SlotBegin[i] < SlotEnd[i]) return false;
+		}
+		return true;
+	}
 
-	// Start a processing request on this thread asynchronously, returns immediately
-	void StartProcess(CWrappedRequest* pRequest);
+	// Processes the strip with the given index, signals EventFinished when it was the last strip.
+	// The object must not be accessed by the calling thread after this method returns.
+	void ProcessStrip(int nStrip) {
+		int nOffsetY = nStrip * StripHeight;
+		int nSizeY = min(StripHeight, Request->ClippedTargetSize.cy - nOffsetY);
+		// after a failure or cancellation, the remaining strips are only counted
+		if (CancelFlag != NULL && *CancelFlag) {
+			Request->Success = false;
+		}
+		if (Request->Success && !Request->ProcessStrip(nOffsetY, nSizeY)) {
+			Request->Success = false;
+		}
+		HANDLE hEventFinished = EventFinished;
+		if (::InterlockedDecrement(&RemainingStrips) == 0) {
+			::SetEvent(hEventFinished);
+		}
+	}
 
-	// Processes a request synchronously on the calling thread
-	static void DoProcess(CProcessingRequest* pRequest, int nOffsetY, int nSizeY);
-private:
+	CProcessingRequest* Request;
+	CProcessingThreadPool::EPriority Priority;
+	volatile bool* CancelFlag; // can be NULL
+	int StripHeight;
+	int NumStrips;
+	volatile LONG RemainingStrips;
+	int NumSlots;
+	int* SlotBegin;
+	int* SlotEnd;
+	HANDLE EventFinished;
+};
 
-	virtual void ProcessRequest(CRequestBase& request);
+// Parameters for starting a pool thread
+struct CPoolThreadParams {
+	CProcessingThreadPool* Pool;
+	int ThreadIndex;
 };
 
+// Height of the strips a request is cut into, a multiple of the strip padding
+static int GetStripHeight(CProcessingRequest* pRequest, int nNumThreads) {
+	int nTargetCY = pRequest->ClippedTargetSize.cy;
+	uint32 nNumberOfPixelsInSource = (uint32)((pRequest->SourceSize.cx * (double)pRequest->ClippedTargetSize.cx / pRequest->FullTargetSize.cx) *
+		(pRequest->SourceSize.cy * (double)nTargetCY / pRequest->FullTargetSize.cy));
+	int nStrips = max(1 + (int)(nNumberOfPixelsInSource / MAX_SRC_PIXELS_PER_STRIP), nNumThreads * MIN_STRIPS_PER_THREAD);
+	int nStripHeight = (nTargetCY / nStrips) & ~(pRequest->StripPadding - 1); // must be dividable by 'StripPadding', except last strip
+	return min(nTargetCY, max(nStripHeight, pRequest->StripPadding));
+}
+
+// Processes the request synchronously on the calling thread, in strips
+static void ProcessOnCallingThread(CProcessingRequest* pRequest) {
+	int nSizeY = pRequest->ClippedTargetSize.cy;
+	int nStripHeight = GetStripHeight(pRequest, 1);
+	for (int nOffsetY = 0; nOffsetY < nSizeY; nOffsetY += nStripHeight) {
+		if (CProcessingThreadPool::IsCancelledOnThread() || !pRequest->ProcessStrip(nOffsetY, min(nStripHeight, nSizeY - nOffsetY))) {
+			pRequest->Success = false;
+			break;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 // CProcessingThreadPool
 ///////////////////////////////////////////////////////////////////////////////////
@@ -52,11 +152,22 @@ CProcessingThreadPool& CProcessingThreadPool::This() {
 }
 
 void CProcessingThreadPool::CreateThreadPoolThreads() {
-	m_nNumThreads = CSettingsProvider::This().NumberOfCoresToUse() - 1;
-	if (m_nNumThreads > 0) {
-		m_threads = new CProcessingThread*[m_nNumThreads];
-		for (int i = 0; i < m_nNumThreads; i++) {
-			m_threads[i] = new CProcessingThread();
+	m_nPaintThreadId = ::GetCurrentThreadId();
+	m_bTerminate = false;
+	int nNumThreads = CSettingsProvider::This().NumberOfCoresToUse() - 1;
+	m_nNumThreads = 0;
+	if (nNumThreads > 0) {
+		m_threads = new HANDLE[nNumThreads];
+		for (int i = 0; i < nNumThreads; i++) {
+			CPoolThreadParams* pParams = new CPoolThreadParams();
+			pParams->Pool = this;
+			pParams->ThreadIndex = i;
+			HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadFunc, pParams, 0, NULL);
+			if (hThread == NULL) {
+				delete pParams;
+				break;
+			}
+			m_threads[m_nNumThreads++] = hThread;
 		}
 	} else {
 		m_threads = NULL;
@@ -64,91 +175,120 @@ void CProcessingThreadPool::CreateThreadPoolThreads() {
 }
 
 void CProcessingThreadPool::StopAllThreads() {
+	m_bTerminate = true;
+	if (m_nNumThreads > 0) {
+		::ReleaseSemaphore(m_hWakeUp, m_nNumThreads, NULL);
+		::WaitForMultipleObjects(m_nNumThreads, m_threads, TRUE, INFINITE);
+	}
 	for (int i = 0; i < m_nNumThreads; i++) {
-		m_threads[i]->Terminate();
-		delete m_threads[i];
+		::CloseHandle(m_threads[i]);
 	}
+	delete[] m_threads;
 	m_nNumThreads = 0;
 	m_threads = NULL;
 }
 
 bool CProcessingThreadPool::Process(CProcessingRequest* pRequest) {
+	if (tl_nPriority >= 0) {
+		return Process(pRequest, (EPriority)tl_nPriority);
+	}
+	return Process(pRequest, (::GetCurrentThreadId() == m_nPaintThreadId) ? Priority_Paint : Priority_Background);
+}
+
+bool CProcessingThreadPool::Process(CProcessingRequest* pRequest, EPriority ePriority) {
 	int nTargetCX = pRequest->ClippedTargetSize.cx;
 	int nTargetCY = pRequest->ClippedTargetSize.cy;
-	if (m_nNumThreads == 0) {
-		CProcessingThread::DoProcess(pRequest, 0, nTargetCY);
-	} else {
-		if (nTargetCX * nTargetCY < 100000 || nTargetCY <= 12) {
-			CProcessingThread::DoProcess(pRequest, 0, nTargetCY);
-		} else {
-			// Important: All slices must have a height dividable by 'StripPadding', except the last one
-			int nNumThreadsUsed = m_nNumThreads + 1; // we also use the calling thread, thus +1
-			int nSliceCY;
-			while ((nSliceCY = ~(pRequest->StripPadding - 1) & (nTargetCY / nNumThreadsUsed)) < pRequest->StripPadding) {
-				nNumThreadsUsed--;
-			}
-			int nLastCY = nTargetCY - (nNumThreadsUsed - 1)*nSliceCY;
-			volatile LONG nRequestThreadCounter = nNumThreadsUsed - 1;
-			int nCurrCY = 0;
-			HANDLE eventFinished = ::CreateEvent(0, TRUE, FALSE, NULL);
-			CWrappedRequest** pAllWrappedRequests = new CWrappedRequest*[nNumThreadsUsed-1];
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i] = new CWrappedRequest(pRequest, nCurrCY, nSliceCY, eventFinished);
-				pAllWrappedRequests[i]->EventFinishedCounter = &nRequestThreadCounter;
-				m_threads[i]->StartProcess(pAllWrappedRequests[i]);
-				nCurrCY += nSliceCY;
-			}
-			CProcessingThread::DoProcess(pRequest, nCurrCY, nLastCY);
-			::WaitForSingleObject(eventFinished, INFINITE);
-			::CloseHandle(eventFinished);
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i]->Deleted = true; // thread pool threads will remove the requests from the queue
+	int nNumThreadsUsed = NumberOfThreads();
+	if (nNumThreadsUsed == 1 || nTargetCX * nTargetCY < 100000 || nTargetCY <= 12) {
+		ProcessOnCallingThread(pRequest);
+		return pRequest->Success;
+	}
+
+	CScheduledRequest* pScheduledRequest = new CScheduledRequest(pRequest, ePriority, tl_pCancelFlag, GetStripHeight(pRequest, nNumThreadsUsed), nNumThreadsUsed);
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csRequests);
+		m_requests[ePriority].push_back(pScheduledRequest);
+	}
+	::ReleaseSemaphore(m_hWakeUp, nNumThreadsUsed - 1, NULL);
+
+	// The calling thread only works on its own request, it must not be delayed by requests of other threads
+	int nStrip;
+	while (true) {
+		{
+			Helpers::CAutoCriticalSection criticalSection(m_csRequests);
+			if (!pScheduledRequest->ClaimStrip(0, nStrip)) {
+				break;
 			}
-			delete [] pAllWrappedRequests;
 		}
+		pScheduledRequest->ProcessStrip(nStrip);
+	}
+	::WaitForSingleObject(pScheduledRequest->EventFinished, INFINITE);
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csRequests);
+		m_requests[ePriority].remove(pScheduledRequest);
 	}
+	delete pScheduledRequest;
 	return pRequest->Success;
 }
 
-CProcessingThreadPool::CProcessingThreadPool(void) {
-	m_threads = NULL;
-	m_nNumThreads = 0;
+void CProcessingThreadPool::SetPriorityOfThread(EPriority ePriority) {
+	tl_nPriority = ePriority;
 }
 
+void CProcessingThreadPool::SetCancelFlagOfThread(volatile bool* pCancelFlag) {
+	tl_pCancelFlag = pCancelFlag;
+}
 
-void CProcessingThread::StartProcess(CWrappedRequest* pRequest) {
-	ProcessAsync(pRequest);
+bool CProcessingThreadPool::IsCancelledOnThread() {
+	return tl_pCancelFlag != NULL && *tl_pCancelFlag;
 }
 
-void CProcessingThread::DoProcess(CProcessingRequest* pRequest, int nOffsetY, int nSizeY) {
-	// Processing is done in strips to reduce memory consumption and increase cache hit rate.
-	// The following constant gives the number of pixels to process per strip.
-	const uint32 MAX_SRC_PIXELS_PER_STRIP = 1024 * 100;
-	uint32 nNumberOfPixelsInSource = (uint32)((pRequest->SourceSize.cx * (double)pRequest->ClippedTargetSize.cx / pRequest->FullTargetSize.cx) *
-		(pRequest->SourceSize.cy * (double)nSizeY / pRequest->FullTargetSize.cy));
-	uint32 nStrips = 1 + nNumberOfPixelsInSource / MAX_SRC_PIXELS_PER_STRIP;
-	uint32 nStripHeight = nSizeY / nStrips;
-	uint32 minimalStripHeight = min(16, pRequest->StripPadding);
-
-	if (nStrips > 1) {
-		nStripHeight = nStripHeight & ~(pRequest->StripPadding - 1); // must be dividable by 'StripPadding', except last strip
-		nStripHeight = min(nSizeY, max(nStripHeight, minimalStripHeight));
-	}
-	int nSizeProcessed = 0;
-	int nCurrentSizeY = nStripHeight;
-	while (nSizeProcessed < nSizeY) {
-		int nCurrentOffsetY = nOffsetY + nSizeProcessed;
-		if (!pRequest->ProcessStrip(nCurrentOffsetY, nCurrentSizeY)) {
-			pRequest->Success = false;
+CProcessingThreadPool::CProcessingThreadPool(void) : m_csRequests{ 0 } {
+	m_threads = NULL;
+	m_nNumThreads = 0;
+	m_nMaxThreadsUsed = INT_MAX;
+	m_nPaintThreadId = 0;
+	m_bTerminate = false;
+	::InitializeCriticalSection(&m_csRequests);
+	m_hWakeUp = ::CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+}
+
+unsigned int __stdcall CProcessingThreadPool::ThreadFunc(void* arg) {
+	CPoolThreadParams* pParams = (CPoolThreadParams*)arg;
+	CProcessingThreadPool* pThis = pParams->Pool;
+	int nThreadIndex = pParams->ThreadIndex;
+	delete pParams;
+
+	while (true) {
+		::WaitForSingleObject(pThis->m_hWakeUp, INFINITE);
+		if (pThis->m_bTerminate) {
 			break;
 		}
-		nSizeProcessed += nCurrentSizeY;
-		nCurrentSizeY = min(nStripHeight, nSizeY - nSizeProcessed);
+		// The next strip is picked after each strip, so requests with higher priority preempt the current request
+		CScheduledRequest* pScheduledRequest;
+		int nStrip;
+		while (pThis->GetNextStrip(nThreadIndex, pScheduledRequest, nStrip)) {
+			pScheduledRequest->ProcessStrip(nStrip);
+		}
 	}
+	return 0;
 }
 
-void CProcessingThread::ProcessRequest(CRequestBase& request) {
-	CWrappedRequest* pWrappedRequest = (CWrappedRequest*)&request;
-	DoProcess(pWrappedRequest->InnerRequest, pWrappedRequest->Offset, pWrappedRequest->SizeY);
+bool CProcessingThreadPool::GetNextStrip(int nThreadIndex, CScheduledRequest*& pScheduledRequest, int& nStrip) {
+	if (m_bTerminate) {
+		return false;
+	}
+	int nSlot = nThreadIndex + 1;
+	Helpers::CAutoCriticalSection criticalSection(m_csRequests);
+	for (int nPriority = 0; nPriority < Priority_Count; nPriority++) {
+		std::list<CScheduledRequest*>::iterator iter;
+		for (iter = m_requests[nPriority].begin(); iter != m_requests[nPriority].end(); iter++) {
+			// requests started with less threads (benchmark) do not have a slot for this thread
+			if (nSlot < (*iter)->NumSlots && (*iter)->ClaimStrip(nSlot, nStrip)) {
+				pScheduledRequest = *iter;
+				return true;
+			}
+		}
+	}
+	return false;
 }
-
@@ -2,7 +2,7 @@
 
 #include "WorkThread.h"
 
-class CProcessingThread;
+class CScheduledRequest;
 
 // Request for performing an image processing operation parallel on all thread pool threads
 class CProcessingRequest : public CRequestBase {
@@ -36,28 +36,65 @@ public:
 	bool Success;
 };
 
-// Thread pool for executing processing requests on multiple threads in parallel, processing a strip
-// of the image on each thread.
+// Thread pool for executing processing requests on multiple threads in parallel.
+// Each request is cut into small strips of rows. Initially every participating thread gets a contiguous range of strips,
+// a thread that has finished its range steals half of the remaining strips of the busiest other thread. Thus a slow
+// strip (page faults, a core busy with other work) does not stall the whole request.
+// Several requests can be processed concurrently (e.g. rendering the current image while a read ahead image
+// is processed). Requests have a priority, the pool threads pick the next strip from the requests with the highest
+// priority, so paint work preempts background work after the strip currently processed.
 class CProcessingThreadPool {
 public:
+	enum EPriority {
+		Priority_Paint = 0, // processing for the display, preempts all other work
+		Priority_Background = 1, // e.g. processing of images read ahead
+		Priority_Count = 2
+	};
+
 	// Singleton instance
 	static CProcessingThreadPool& This();
 	// Creation is not thread safe. Call once, before creating additional threads.
+	// Requests processed on the thread calling this method get paint priority, all others background priority.
 	void CreateThreadPoolThreads();
 	// to be called at program termination
 	void StopAllThreads();
 
-	// Processes the request using all thread pool threads and the current thread.
+	// Number of threads used for processing, including the calling thread
+	int NumberOfThreads() const { return min(m_nNumThreads, m_nMaxThreadsUsed - 1) + 1; }
+	// Limits the number of threads used for processing (including the calling thread), used for benchmarking.
+	// Pass a value <= 0 to use all threads of the pool again.
+	void SetMaxNumberOfThreads(int nMaxThreads) { m_nMaxThreadsUsed = (nMaxThreads <= 0) ? INT_MAX : nMaxThreads; }
+
+	// Processes the request using the thread pool threads and the current thread, returns when the request is processed.
 	// Note that the method does NOT take ownership of the passed request object.
-	// The processing work is distributed to the thread pool threads. The pRequest->ProcessStrip()
-	// method is called to process a strip of the image.
+	// The pRequest->ProcessStrip() method is called to process a strip of the image. The method is thread safe,
+	// the priority of the request is derived from the calling thread.
 	bool Process(CProcessingRequest* pRequest);
+	// Same as above with an explicit priority
+	bool Process(CProcessingRequest* pRequest, EPriority ePriority);
+
+	// Sets the priority of all requests processed from the calling thread, overriding the priority derived from the thread
+	static void SetPriorityOfThread(EPriority ePriority);
+	// Sets a flag that cancels the requests processed from the calling thread when it becomes true.
+	// The remaining strips of a cancelled request are not processed and Process() returns false. Pass NULL to reset.
+	static void SetCancelFlagOfThread(volatile bool* pCancelFlag);
+	// Returns if the cancel flag set with SetCancelFlagOfThread() for the calling thread is true.
+	// Lengthy operations not using the thread pool, e.g. the image decoders, poll this to stop early.
+	static bool IsCancelledOnThread();
 private:
 	static CProcessingThreadPool* sm_instance;
 
-	CProcessingThread** m_threads;
+	HANDLE* m_threads;
 	int m_nNumThreads;
+	int m_nMaxThreadsUsed;
+	DWORD m_nPaintThreadId; // requests of this thread get paint priority
+	std::list<CScheduledRequest*> m_requests[Priority_Count]; // requests with strips to process, per priority
+	CRITICAL_SECTION m_csRequests; // protects the request lists and the strip ranges of the requests
+	HANDLE m_hWakeUp; // semaphore waking up the pool threads when requests are added
+	volatile bool m_bTerminate;
 
 	CProcessingThreadPool(void);
+	static unsigned int __stdcall ThreadFunc(void* arg);
+	// Gets the next strip to process for the pool thread with the given index, false if there is nothing to process
+	bool GetNextStrip(int nThreadIndex, CScheduledRequest*& pScheduledRequest, int& nStrip);
 };
-
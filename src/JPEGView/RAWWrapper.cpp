@@ -7,25 +7,37 @@
 #include "TJPEGWrapper.h"
 #include "RawMetadata.h"
 #include "MaxImageDef.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
+
+// LibRaw progress callback, a non-zero return value makes LibRaw abort the processing
+static int CancelProgressCallback(void* /* data */, enum LibRaw_progress /* stage */, int /* iteration */, int /* expected */) {
+	return CProcessingThreadPool::IsCancelledOnThread() ? 1 : 0;
+}
 
 CJPEGImage* RawReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory, bool bGetThumb)
 {
 	unsigned char* pPixelData = NULL;
 
 	LibRaw RawProcessor;
+	RawProcessor.set_progress_handler(CancelProgressCallback, NULL);
+	CTraceSpan parseSpan(TRACE_Parse);
 	if (RawProcessor.open_file(strFileName) != LIBRAW_SUCCESS) {
 		return NULL;
 	}
+	parseSpan.End();
 	int width, height, colors, bps;
 	
 	CJPEGImage* Image = NULL;
 	if (!bGetThumb) {
 		RawProcessor.imgdata.params.output_bps = 8;
 
-		// Must unpack and process first to get accurate info
+		// Must unpack and process first to get accurate info. dcraw_process() demosaics and converts to the output color space.
+		CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)RawProcessor.imgdata.sizes.width * RawProcessor.imgdata.sizes.height);
 		if (RawProcessor.unpack() != LIBRAW_SUCCESS || RawProcessor.dcraw_process() != LIBRAW_SUCCESS) {
 			return NULL;
 		}
+		decodeSpan.End();
 
 		RawProcessor.get_mem_image_format(&width, &height, &colors, &bps);
 
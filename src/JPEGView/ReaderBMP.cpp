@@ -2,8 +2,10 @@
 #include "ReaderBMP.h"
 #include "JPEGImage.h"
 #include "Helpers.h"
-#include "BasicProcessing.h"
 #include "MaxImageDef.h"
+#include "MappedFile.h"
+#include "ByteStream.h"
+#include "PagedPixelBuffer.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 // BITMAP reading
@@ -27,116 +29,121 @@ struct BMINFOHEADER {
 	unsigned int importantcolors;    /* Important colors          */
 };
 
-static void ReadUShort(FILE* file, uint16* pUShort) {
-	fread(pUShort, sizeof(uint16), 1, file);
-}
-
-static void ReadUInt(FILE* file, uint32* pUInt) {
-	fread(pUInt, sizeof(uint32), 1, file);
+// Converts the rows of the image data to the top-down target DIB, the rows are read directly from the mapped file.
+// 8 bpp rows are converted to 32 bpp using the palette (BGR0 format), the other rows are copied.
+static void ConvertRows(const uint8* pSource, uint8* pTarget, const BMINFOHEADER& infoheader, int nSourceStride, int nTargetStride,
+						bool bFlipped, const uint8* pPalette) {
+	uint32 palette32[256];
+	if (infoheader.bits == 8) {
+		for (int i = 0; i < 256; i++) {
+			palette32[i] = pPalette[4 * i] | (pPalette[4 * i + 1] << 8) | (pPalette[4 * i + 2] << 16) | 0xFF000000;
+		}
+	}
+	for (int nLine = 0; nLine < infoheader.height; nLine++) {
+		uint8* pTargetLine = pTarget + (size_t)nTargetStride * (bFlipped ? infoheader.height - 1 - nLine : nLine);
+		if (infoheader.bits == 8) {
+			uint32* pTargetPixel = (uint32*)pTargetLine;
+			for (int i = 0; i < infoheader.width; i++) {
+				pTargetPixel[i] = palette32[pSource[i]];
+			}
+		} else {
+			memcpy(pTargetLine, pSource, nSourceStride);
+		}
+		pSource += nSourceStride;
+	}
 }
 
 CJPEGImage* CReaderBMP::ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory) {
 	BMHEADER header;
 	BMINFOHEADER infoheader;
-	FILE *fptr;
 
 	bOutOfMemory = false;
 
-	/* Open file */
-	if ((fptr = _tfopen(strFileName,_T("rb"))) == NULL) {
+	/* Open file, the headers and the image data are read from the mapped file */
+	CMappedFile file(strFileName);
+	if (!file.IsValid()) {
 		return NULL;
 	}
 
-	/* Read the header */
-	ReadUShort(fptr,&header.type);
-	ReadUInt(fptr,&header.size);
-	ReadUShort(fptr,&header.reserved1);
-	ReadUShort(fptr,&header.reserved2);
-	ReadUInt(fptr,&header.offset);
+	uint8* pDest = NULL;
+	try {
+		CByteStream stream(file.Data(), file.Size());
 
-	/* Read and check the information header */
-	if (fread(&infoheader,sizeof(BMINFOHEADER),1,fptr) != 1) {
-		fclose(fptr);
-		return NULL;
-	}
-	/* Only 24 and 32 bpp */
-	if (infoheader.bits != 24 && infoheader.bits != 32 && infoheader.bits != 8) {
-		fclose(fptr);
-		return NULL;
-	}
-	/* Not too big files */
-	if (infoheader.width > MAX_IMAGE_DIMENSION || infoheader.width <= 0 || abs(infoheader.height) > MAX_IMAGE_DIMENSION) {
-		fclose(fptr);
-		return NULL;
-	}
-	if ((double)infoheader.width * abs(infoheader.height) > MAX_IMAGE_PIXELS) {
-		fclose(fptr);
-		bOutOfMemory = true;
-		return NULL;
-	}
+		/* Read the header */
+		header.type = stream.ReadUInt16();
+		header.size = stream.ReadUInt32();
+		header.reserved1 = stream.ReadUInt16();
+		header.reserved2 = stream.ReadUInt16();
+		header.offset = stream.ReadUInt32();
 
-	// read palette for 8 bpp DIBs
-	uint8 palette[4*256];
-	if (infoheader.bits == 8) {
-		fseek(fptr, infoheader.size + 14, SEEK_SET);
-		if (fread(palette, 256*4, 1, fptr) != 1) {
-			fclose(fptr);
+		/* Read and check the information header */
+		if (!stream.Read(&infoheader, sizeof(BMINFOHEADER))) {
 			return NULL;
 		}
-	}
-
-	/* Seek to the start of the image data */
-	fseek(fptr,header.offset,SEEK_SET);
-
-	// DIBs are normally stored flipped vertically (meaning they are stored bottom-up)
-	bool bFlipped;
-	if (infoheader.height < 0) {
-		infoheader.height = -infoheader.height;
-		bFlipped = false;
-	} else {
-		bFlipped = true;
-	}
-
-	int bytesPerPixel = infoheader.bits/8;
-	int paddedWidth = Helpers::DoPadding(infoheader.width*bytesPerPixel, 4);
-	int fileSizeBytes = infoheader.height*paddedWidth;
-	if (fileSizeBytes <= 0 || fileSizeBytes > MAX_BMP_FILE_SIZE) {
-		fclose(fptr);
-		bOutOfMemory = fileSizeBytes > MAX_BMP_FILE_SIZE;
-		return NULL; // corrupt or manipulated header
-	}
-
-	uint8* pDest = new(std::nothrow) uint8[fileSizeBytes];
-	if (pDest == NULL) {
-		fclose(fptr);
-		bOutOfMemory = true;
-		return NULL;
-	}
-	uint8* pStart = bFlipped ? pDest + paddedWidth*(infoheader.height-1) : pDest;
-	for (int nLine = 0; nLine < infoheader.height; nLine++) {
-		if (paddedWidth != fread(pStart, 1, paddedWidth, fptr)) {
-			delete[] pDest;
-			fclose(fptr);
+		/* Only 24 and 32 bpp */
+		if (infoheader.bits != 24 && infoheader.bits != 32 && infoheader.bits != 8) {
+			return NULL;
+		}
+		/* Not too big files */
+		if (infoheader.width > MAX_IMAGE_DIMENSION || infoheader.width <= 0 || abs(infoheader.height) > MAX_IMAGE_DIMENSION) {
+			return NULL;
+		}
+		if ((double)infoheader.width * abs(infoheader.height) > MAX_IMAGE_PIXELS) {
+			bOutOfMemory = true;
 			return NULL;
 		}
-		pStart = pStart + (bFlipped ? -paddedWidth : paddedWidth);
-	}
 
-	// Convert 8 bpp DIBs
-	if (infoheader.bits == 8) {
-		uint8* pTemp = (uint8*)CBasicProcessing::Convert8bppTo32bppDIB(infoheader.width, infoheader.height, pDest, palette);
-		delete[] pDest;
-		pDest = pTemp;
-		infoheader.bits = 32;
-	}
+		// read palette for 8 bpp DIBs
+		const uint8* pPalette = NULL;
+		if (infoheader.bits == 8) {
+			stream.Seek(infoheader.size + 14);
+			pPalette = stream.GetBytes(256*4);
+			if (pPalette == NULL) {
+				return NULL;
+			}
+		}
 
-	// The CJPEGImage object gets ownership of the memory in pDest
-	CJPEGImage* pImage = (pDest == NULL) ? NULL : new CJPEGImage(infoheader.width, infoheader.height, pDest, NULL, infoheader.bits/8, 
-		0, IF_WindowsBMP, false, 0, 1, 0);
+		/* Seek to the start of the image data */
+		stream.Seek(header.offset);
 
-	fclose(fptr);
+		// DIBs are normally stored flipped vertically (meaning they are stored bottom-up)
+		bool bFlipped;
+		if (infoheader.height < 0) {
+			infoheader.height = -infoheader.height;
+			bFlipped = false;
+		} else {
+			bFlipped = true;
+		}
 
-	bOutOfMemory = pImage == NULL;
+		int bytesPerPixel = infoheader.bits/8;
+		int paddedWidth = Helpers::DoPadding(infoheader.width*bytesPerPixel, 4);
+		int fileSizeBytes = infoheader.height*paddedWidth;
+		if (fileSizeBytes <= 0 || fileSizeBytes > MAX_BMP_FILE_SIZE) {
+			bOutOfMemory = fileSizeBytes > MAX_BMP_FILE_SIZE;
+			return NULL; // corrupt or manipulated header
+		}
+		const uint8* pSource = stream.GetBytes(fileSizeBytes);
+		if (pSource == NULL) {
+			return NULL; // truncated file
+		}
 
-	return pImage;
-}
\ No newline at end of file
+		// 8 bpp DIBs are converted to 32 bpp
+		int targetBits = (infoheader.bits == 8) ? 32 : infoheader.bits;
+		int targetStride = (infoheader.bits == 8) ? infoheader.width*4 : paddedWidth;
+		pDest = (uint8*)CPagedPixelBuffer::AllocatePixels((__int64)targetStride*infoheader.height, targetBits/8);
+		if (pDest == NULL) {
+			bOutOfMemory = true;
+			return NULL;
+		}
+		ConvertRows(pSource, pDest, infoheader, paddedWidth, targetStride, bFlipped, pPalette);
+
+		// The CJPEGImage object gets ownership of the memory in pDest
+		CJPEGImage* pImage = new CJPEGImage(infoheader.width, infoheader.height, pDest, NULL, targetBits/8, 
+			0, IF_WindowsBMP, false, 0, 1, 0);
+		return pImage;
+	} catch (...) {
+		// the file has vanished while reading the mapped data
+		CPagedPixelBuffer::FreePixels(pDest);
+		return NULL;
+	}
+}
@@ -4,6 +4,8 @@
 #include "Helpers.h"
 #include "BasicProcessing.h"
 #include "MaxImageDef.h"
+#include "MappedFile.h"
+#include "ByteStream.h"
 
 // The TGA reader has been adapted and extended from the TGA reader used in an example of the BOINC project
 // http://www.filewatcher.com/p/boinc-server-maker_7.0.27+dfsg-5_armhf.deb.5191030/usr/share/doc/boinc-server-maker/examples/tgalib.h.html
@@ -33,119 +35,30 @@ static bool IsAlphaChannelValid(int width, int height, uint32* pImageData)
 }
 
 
-CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundColor, bool& bOutOfMemory) {
-
-	bOutOfMemory = false;
-
-	WORD width = 0, height = 0;			// The dimensions of the image
-	WORD colormapStart = 0;             // Start of color map after header (in bytes)
-	WORD colormapLen = 0;               // Length of color map in bytes
-	byte colormapBits = 0;              // Bits per color map entry
-	byte length = 0;					// The length in bytes to the pixels
-	byte imageType = 0;					// The image type (RLE, RGB, Alpha...)
-	byte bits = 0;						// The bits per pixel for the image (16, 24, 32)
-	byte attributes = 0;                // Image attributes
-	FILE *pFile = NULL;					// The file pointer
+// Reads the pixel data of the image from the stream into pImageData, converting the pixels to 24 or 32 bpp.
+// Truncated pixel data is not an error, the remaining pixels are not set.
+static void ReadPixels(CByteStream& stream, byte* pImageData, int width, int height, byte imageType, byte bits,
+					   bool isIndexed, const byte* palette, int targetChannels, int targetStride) {
 	int channels = 0;					// The channels of the image (3 = RGA : 4 = RGBA)
 	int stride = 0;						// The stride (channels * width)
 	int i = 0;							// A counter
 
-	// Open a file pointer to the targa file and check if it was found and opened 
-	if((pFile = _tfopen(strFileName, _T("rb"))) == NULL) 
-	{
-		return NULL;
-	}
-
-	// Read in the length in bytes from the header to the pixel data
-	fread(&length, sizeof(byte), 1, pFile);
-	
-	// Jump over one byte
-	fseek(pFile,1,SEEK_CUR); 
-
-	// Read in the imageType (RLE, RGB, etc...)
-	fread(&imageType, sizeof(byte), 1, pFile);
-
-	bool isIndexed = imageType == TGA_INDEXED || imageType == TGA_RLE_INDEXED;
-
-	// Read in palette info
-	fread(&colormapStart, sizeof(WORD), 1, pFile);
-	fread(&colormapLen, sizeof(WORD), 1, pFile);
-	fread(&colormapBits, sizeof(byte), 1, pFile);
-	
-	// Skip past general information we don't care about
-	fseek(pFile, 4, SEEK_CUR); 
-
-	// Read the width, height and bits per pixel (16, 24 or 32)
-	fread(&width,  sizeof(WORD), 1, pFile);
-	fread(&height, sizeof(WORD), 1, pFile);
-	fread(&bits,   sizeof(byte), 1, pFile);
-	fread(&attributes, sizeof(byte), 1, pFile);
-
-	bool flipVertically = ((attributes >> 5) & 1) == 0;
-
-	// check preconditions: 
-	// - image size valid
-	// - supported bits per pixel - only 8, 15, 16, 24 and 32 bits supported
-	// - no strange image attributes
-	// - supported image types - only RGB, mono and indexed
-	// - color map format must be 256 RGB entries
-	if (width <= 0 || height <= 0 || width > MAX_IMAGE_DIMENSION || height > MAX_IMAGE_DIMENSION ||
-		(bits != 8 && bits != 16 && bits != 15 && bits != 24 && bits != 32) ||
-		(imageType != TGA_INDEXED && imageType != TGA_RGB && imageType != TGA_MONO && imageType != TGA_RLE_INDEXED && imageType != TGA_RLE_RGB && imageType != TGA_RLE_MONO) ||
-		((imageType == TGA_MONO || imageType == TGA_RLE_MONO) && bits != 8) ||
-		(isIndexed && (colormapStart != 0 || colormapLen != 256 || colormapBits != 24)))
-	{
-		fclose(pFile);
-		return NULL;
-	}
-
-	// check memory footprint
-	int targetChannels = (bits == 32) ? 4 : 3;
-	int targetStride = Helpers::DoPadding(width * targetChannels, 4);
-	uint32 numberOfBytesRequired = targetStride * height;
-
-	if ((double)width * height > MAX_IMAGE_PIXELS)
-	{
-		bOutOfMemory = true;
-		fclose(pFile);
-		return NULL;
-	}
-	
-	// Allocate memory which will hold our image data
-	byte* pImageData = new(std::nothrow) byte[numberOfBytesRequired];
-	if (pImageData == NULL)
-	{
-		bOutOfMemory = true;
-		fclose(pFile);
-		return NULL;
-	}
-
-	// Now we move the file pointer to the pixel data
-	if (fseek(pFile, length, SEEK_CUR) != 0)
-	{
-		fclose(pFile);
-		return NULL;
-	}
-
-	// read the color map
-	byte palette[768];
-	if (isIndexed)
-	{  
-		fread(&palette, 768, 1, pFile);
-	}
-
 	byte* pImage = pImageData;
 
 	if(imageType == TGA_MONO)
 	{
-		// this is always 8 bpp (checked above)
+		// this is always 8 bpp (checked by the caller)
 		for(int y = 0; y < height; y++)
 		{
+			const byte* pSource = stream.GetBytes(width);
+			if (pSource == NULL)
+			{
+				return;
+			}
 			uint8* pLine = pImage;
 			for(int x = 0; x < width; x++)
 			{
-				byte grey;
-				fread(&grey, sizeof(byte), 1, pFile);
+				byte grey = pSource[x];
 				*pLine++ = grey;
 				*pLine++ = grey;
 				*pLine++ = grey;
@@ -157,11 +70,15 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 	{
 		for(int y = 0; y < height; y++)
 		{
+			const byte* pSource = stream.GetBytes(width);
+			if (pSource == NULL)
+			{
+				return;
+			}
 			uint8* pLine = pImage;
 			for(int x = 0; x < width; x++)
 			{
-				byte index;
-				fread(&index, sizeof(byte), 1, pFile);
+				byte index = pSource[x];
 				*pLine++ = palette[index*3];
 				*pLine++ = palette[index*3 + 1];
 				*pLine++ = palette[index*3 + 2];
@@ -182,7 +99,10 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 			// Load in all the pixel data line by line
 			for(int y = 0; y < height; y++)
 			{
-				fread(pImage, stride, 1, pFile);
+				if (!stream.Read(pImage, stride))
+				{
+					return;
+				}
 				pImage += targetStride;
 			}
 		}
@@ -200,11 +120,16 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 			// Load in all the pixel data pixel by pixel
 			for(int y = 0; y < height; y++)
 			{
+				const byte* pSource = stream.GetBytes(width * 2);
+				if (pSource == NULL)
+				{
+					return;
+				}
 				uint8* pLine = pImage;
 				for(int i = 0; i < width; i++)
 				{
-					// Read in the current pixel
-					fread(&pixel, sizeof(unsigned short), 1, pFile);
+					// Read in the current pixel (little endian)
+					pixel = pSource[2*i] | (pSource[2*i + 1] << 8);
 				
 					// To convert a 16-bit pixel into an R, G, B, we need to
 					// do some masking and such to isolate each color value.
@@ -259,7 +184,11 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 		while(i < numPixels)
 		{
 			// Read in the current color count + 1
-			fread(&rleID, sizeof(byte), 1, pFile);
+			rleID = stream.ReadUInt8();
+			if (stream.Failed())
+			{
+				return;
+			}
 			
 			// Check if we don't have an encoded string of colors
 			bool useSameColor;
@@ -277,7 +206,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				useSameColor = true;
 
 				// Read in the current color, which is the same for a while
-				fread(pColors, sizeof(byte) * channels, 1, pFile);
+				stream.Read(pColors, channels);
 			}
 
 			// Go through and read all the unique colors found
@@ -286,7 +215,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				if (!useSameColor)
 				{
 					// Read in the current color
-					fread(pColors, sizeof(byte) * channels, 1, pFile);
+					stream.Read(pColors, channels);
 				}
 
 				if(bits == 32)
@@ -332,9 +261,113 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				
 		} // end of RLE pixel loop
 	}
+}
+
+CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundColor, bool& bOutOfMemory) {
+
+	bOutOfMemory = false;
+
+	WORD width = 0, height = 0;			// The dimensions of the image
+	WORD colormapStart = 0;             // Start of color map after header (in bytes)
+	WORD colormapLen = 0;               // Length of color map in bytes
+	byte colormapBits = 0;              // Bits per color map entry
+	byte length = 0;					// The length in bytes to the pixels
+	byte imageType = 0;					// The image type (RLE, RGB, Alpha...)
+	byte bits = 0;						// The bits per pixel for the image (16, 24, 32)
+	byte attributes = 0;                // Image attributes
+
+	// Map the targa file and check if it was found and opened, the header and the pixels are read from the mapped file
+	CMappedFile file(strFileName);
+	if (!file.IsValid())
+	{
+		return NULL;
+	}
+	CByteStream stream(file.Data(), file.Size());
+
+	byte* pImageData = NULL;
+	int targetChannels = 0;
+	int targetStride = 0;
+	try
+	{
+		// Read in the length in bytes from the header to the pixel data
+		length = stream.ReadUInt8();
+
+		// Jump over one byte
+		stream.Skip(1);
+
+		// Read in the imageType (RLE, RGB, etc...)
+		imageType = stream.ReadUInt8();
+
+		bool isIndexed = imageType == TGA_INDEXED || imageType == TGA_RLE_INDEXED;
+
+		// Read in palette info
+		colormapStart = stream.ReadUInt16();
+		colormapLen = stream.ReadUInt16();
+		colormapBits = stream.ReadUInt8();
+
+		// Skip past general information we don't care about
+		stream.Skip(4);
+
+		// Read the width, height and bits per pixel (16, 24 or 32)
+		width = stream.ReadUInt16();
+		height = stream.ReadUInt16();
+		bits = stream.ReadUInt8();
+		attributes = stream.ReadUInt8();
+
+		// check preconditions: 
+		// - image size valid
+		// - supported bits per pixel - only 8, 15, 16, 24 and 32 bits supported
+		// - no strange image attributes
+		// - supported image types - only RGB, mono and indexed
+		// - color map format must be 256 RGB entries
+		if (width <= 0 || height <= 0 || width > MAX_IMAGE_DIMENSION || height > MAX_IMAGE_DIMENSION ||
+			(bits != 8 && bits != 16 && bits != 15 && bits != 24 && bits != 32) ||
+			(imageType != TGA_INDEXED && imageType != TGA_RGB && imageType != TGA_MONO && imageType != TGA_RLE_INDEXED && imageType != TGA_RLE_RGB && imageType != TGA_RLE_MONO) ||
+			((imageType == TGA_MONO || imageType == TGA_RLE_MONO) && bits != 8) ||
+			(isIndexed && (colormapStart != 0 || colormapLen != 256 || colormapBits != 24)))
+		{
+			return NULL;
+		}
+
+		// check memory footprint
+		targetChannels = (bits == 32) ? 4 : 3;
+		targetStride = Helpers::DoPadding(width * targetChannels, 4);
+		uint32 numberOfBytesRequired = targetStride * height;
+
+		if ((double)width * height > MAX_IMAGE_PIXELS)
+		{
+			bOutOfMemory = true;
+			return NULL;
+		}
+
+		// Allocate memory which will hold our image data
+		pImageData = new(std::nothrow) byte[numberOfBytesRequired];
+		if (pImageData == NULL)
+		{
+			bOutOfMemory = true;
+			return NULL;
+		}
+
+		// Now we move the stream position to the pixel data
+		stream.Skip(length);
+
+		// read the color map
+		byte palette[768];
+		if (isIndexed)
+		{  
+			stream.Read(palette, 768);
+		}
+
+		ReadPixels(stream, pImageData, width, height, imageType, bits, isIndexed, palette, targetChannels, targetStride);
+	}
+	catch (...)
+	{
+		// the file has vanished while reading the mapped data
+		delete[] pImageData;
+		return NULL;
+	}
 
-	// Close the file pointer that opened the file
-	fclose(pFile);
+	bool flipVertically = ((attributes >> 5) & 1) == 0;
 
 	// If image needs to be flipped, do this inplace
 	if (flipVertically)
@@ -171,6 +171,20 @@ CSettingsProvider::CSettingsProvider(void) {
 	m_nMaxSlideShowFileListSize = GetInt(_T("MaxSlideShowFileListSizeKB"), 200, 100, 10000);
 	m_nSlideShowEffectTimeMs = GetInt(_T("SlideShowEffectTime"), 200, 100, 5000);
 	m_bForceGDIPlus = GetBool(_T("ForceGDIPlus"), false);
+	m_bScaledJPEGDecoding = GetBool(_T("ScaledJPEGDecoding"), true);
+	m_nPagedPixelStorageMinMP = GetInt(_T("PagedPixelStorageMinMP"), 500, 0, 100000);
+	m_bResamplingPyramid = GetBool(_T("ResamplingPyramid"), true);
+	m_nPreviewCacheSizeMB = GetInt(_T("PreviewCacheSizeMB"), 256, 0, 100000);
+	m_nReadAheadImages = GetInt(_T("ReadAheadImages"), 2, 0, 16);
+	m_nReadAheadThreads = GetInt(_T("ReadAheadThreads"), 2, 1, 8);
+	m_nAnimationFramesAhead = GetInt(_T("AnimationFramesAhead"), 4, 1, 16);
+#ifdef _WIN64
+	m_nImageCacheSizeMB = GetInt(_T("ImageCacheSizeMB"), 1024, 64, 65536);
+#else
+	// the address space of the 32 bit version is exhausted by a larger cache
+	m_nImageCacheSizeMB = GetInt(_T("ImageCacheSizeMB"), 512, 64, 512);
+#endif
+	m_sTraceFile = GetString(_T("TraceFile"), _T(""));
 	m_bSingleInstance = GetBool(_T("SingleInstance"), false);
 	m_bSingleFullScreenInstance = GetBool(_T("SingleFullScreenInstance"), true);
 	m_nJPEGSaveQuality = GetInt(_T("JPEGSaveQuality"), 85, 0, 100);
@@ -71,6 +71,15 @@ public:
 	Helpers::ETransitionEffect SlideShowTransitionEffect() { return m_eSlideShowTransitionEffect; }
 	int SlideShowEffectTimeMs() { return m_nSlideShowEffectTimeMs; }
 	bool ForceGDIPlus() { return m_bForceGDIPlus; }
+	bool ScaledJPEGDecoding() { return m_bScaledJPEGDecoding; }
+	int PagedPixelStorageMinMP() { return m_nPagedPixelStorageMinMP; }
+	bool ResamplingPyramid() { return m_bResamplingPyramid; }
+	int PreviewCacheSizeMB() { return m_nPreviewCacheSizeMB; }
+	int ReadAheadImages() { return m_nReadAheadImages; }
+	int ReadAheadThreads() { return m_nReadAheadThreads; }
+	int AnimationFramesAhead() { return m_nAnimationFramesAhead; }
+	int ImageCacheSizeMB() { return m_nImageCacheSizeMB; }
+	LPCTSTR TraceFile() { return m_sTraceFile; }
 	bool SingleInstance() { return m_bSingleInstance; }
 	bool SingleFullScreenInstance() { return m_bSingleFullScreenInstance; }
 	int JPEGSaveQuality() { return m_nJPEGSaveQuality; }
@@ -242,6 +251,15 @@ private:
 	Helpers::ETransitionEffect m_eSlideShowTransitionEffect;
 	int m_nSlideShowEffectTimeMs;
 	bool m_bForceGDIPlus;
+	bool m_bScaledJPEGDecoding;
+	int m_nPagedPixelStorageMinMP;
+	bool m_bResamplingPyramid;
+	int m_nPreviewCacheSizeMB;
+	int m_nReadAheadImages;
+	int m_nReadAheadThreads;
+	int m_nAnimationFramesAhead;
+	int m_nImageCacheSizeMB;
+	CString m_sTraceFile;
 	bool m_bSingleInstance;
 	bool m_bSingleFullScreenInstance;
 	int m_nJPEGSaveQuality;
@@ -2,7 +2,75 @@
 #include "stdafx.h"
 #include "TJPEGWrapper.h"
 #include "libjpeg-turbo\include\turbojpeg.h"
+#include <stdio.h>
+#include <setjmp.h>
+#include "libjpeg-turbo\include\jpeglib.h"
 #include "MaxImageDef.h"
+#include "PagedPixelBuffer.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
+
+// Error manager of the scanline decoder, jumps back to DecompressScanlines() on errors and when the load is cancelled
+struct cancellable_error_mgr {
+	jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
+
+static void ErrorExit(j_common_ptr cinfo) {
+	longjmp(((cancellable_error_mgr*)cinfo->err)->setjmp_buffer, 1);
+}
+
+static void OutputMessage(j_common_ptr /* cinfo */) {
+	// warnings are ignored, as with tj3Decompress8()
+}
+
+// Called by libjpeg while scanning the input and once per scanline
+static void ProgressMonitor(j_common_ptr cinfo) {
+	if (CProcessingThreadPool::IsCancelledOnThread()) {
+		ErrorExit(cinfo);
+	}
+}
+
+// Decompresses to BGR with the libjpeg API instead of tj3Decompress8(). The image is decompressed scanline by scanline
+// so that a cancelled load stops without decoding the rest of the image.
+static bool DecompressScanlines(unsigned char* pPixelData, int nStride, int width, int height, const void* buffer, int sizebytes, int scaleDenom) {
+	jpeg_decompress_struct cinfo;
+	cancellable_error_mgr jerr;
+	jpeg_progress_mgr progress;
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = ErrorExit;
+	jerr.pub.output_message = OutputMessage;
+	if (setjmp(jerr.setjmp_buffer)) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+	jpeg_create_decompress(&cinfo);
+	progress.progress_monitor = ProgressMonitor;
+	cinfo.progress = &progress;
+	jpeg_mem_src(&cinfo, (const unsigned char*)buffer, sizebytes);
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_EXT_BGR;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = scaleDenom;
+	jpeg_start_decompress(&cinfo);
+	if ((int)cinfo.output_width != width || (int)cinfo.output_height != height) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+	// hand over several rows per call, the progress monitor is called once per call
+	const int MAX_ROWS = 16;
+	JSAMPROW pRows[MAX_ROWS];
+	while (cinfo.output_scanline < cinfo.output_height) {
+		int nRows = min(MAX_ROWS, (int)(cinfo.output_height - cinfo.output_scanline));
+		for (int i = 0; i < nRows; i++) {
+			pRows[i] = pPixelData + (size_t)(cinfo.output_scanline + i) * nStride;
+		}
+		jpeg_read_scanlines(&cinfo, pRows, nRows);
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
 
 void * TurboJpeg::ReadImage(int &width,
 					   int &height,
@@ -10,9 +78,14 @@ void * TurboJpeg::ReadImage(int &width,
 					   TJSAMP &chromoSubsampling,
 					   bool &outOfMemory,
 					   const void *buffer,
-					   int sizebytes)
+					   int sizebytes,
+					   int reductionFactor,
+					   int* appliedReductionFactor)
 {
 	outOfMemory = false;
+	if (appliedReductionFactor != NULL) {
+		*appliedReductionFactor = 1;
+	}
 	width = height = 0;
 	nchannels = 3;
 	chromoSubsampling = TJSAMP_420;
@@ -23,19 +96,34 @@ void * TurboJpeg::ReadImage(int &width,
 	}
 
 	unsigned char* pPixelData = NULL;
+	CTraceSpan parseSpan(TRACE_Parse);
 	int nResult = tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes);
+	parseSpan.End();
 	if (nResult == 0) {
 		width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
 		height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
 		chromoSubsampling = (TJSAMP)tj3Get(hDecoder, TJPARAM_SUBSAMP);
+		int scaleDenom = 1;
+		if (reductionFactor > 1) {
+			tjscalingfactor scalingFactor = { 1, reductionFactor };
+			if (tj3SetScalingFactor(hDecoder, scalingFactor) == 0) {
+				width = TJSCALED(width, scalingFactor);
+				height = TJSCALED(height, scalingFactor);
+				scaleDenom = reductionFactor;
+			}
+		}
+		if (appliedReductionFactor != NULL) {
+			*appliedReductionFactor = scaleDenom;
+		}
 		if (abs((double)width * height) > MAX_IMAGE_PIXELS) {
 			outOfMemory = true;
 		} else if (width <= MAX_IMAGE_DIMENSION && height <= MAX_IMAGE_DIMENSION && chromoSubsampling != TJSAMP_UNKNOWN) {
-			pPixelData = new(std::nothrow) unsigned char[TJPAD(width * 3) * height];
+			pPixelData = (unsigned char*)CPagedPixelBuffer::AllocatePixels((__int64)TJPAD(width * 3) * height, 3);
 			if (pPixelData != NULL) {
-				nResult = tj3Decompress8(hDecoder, (unsigned char*)buffer, sizebytes, pPixelData, TJPAD(width * 3), TJPF_BGR);
-				if (nResult != 0) {
-					delete[] pPixelData;
+				// includes the YCbCr to BGR conversion
+				CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)width * height);
+				if (!DecompressScanlines(pPixelData, TJPAD(width * 3), width, height, buffer, sizebytes, scaleDenom)) {
+					CPagedPixelBuffer::FreePixels(pPixelData);
 					pPixelData = NULL;
 				}
 			} else {
@@ -49,6 +137,28 @@ void * TurboJpeg::ReadImage(int &width,
 	return pPixelData;
 }
 
+bool TurboJpeg::ReadImageSize(int &width,
+						 int &height,
+						 const void *buffer,
+						 int sizebytes)
+{
+	width = height = 0;
+	tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+	if (hDecoder == NULL) {
+		return false;
+	}
+
+	bool bSuccess = tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes) == 0;
+	if (bSuccess) {
+		width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+		height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+	}
+
+	tj3Destroy(hDecoder);
+
+	return bSuccess;
+}
+
 void * TurboJpeg::Compress(const void *source,
 					  int width,
 					  int height,
@@ -13,6 +13,14 @@ public:
 						 TJSAMP &chromoSubsampling, // chromo subsampling of image
 						 bool &outOfMemory, // set to true when no memory to read image
 						 const void *buffer, // memory address containing jpeg compressed data.
+						 int sizebytes, // size of jpeg compressed data.
+						 int reductionFactor = 1, // 1, 2, 4 or 8, decodes the image with DCT scaling to 1/reductionFactor of its size. width and height are the reduced size.
+						 int* appliedReductionFactor = NULL); // if not NULL, receives the reduction factor actually applied, 1 if DCT scaling failed
+
+	// Reads the image dimensions from the JPEG header without decompressing the image. Returns false if the header is invalid.
+	static bool ReadImageSize(int &width, // width of the image
+						 int &height, // height of the image
+						 const void *buffer, // memory address containing jpeg compressed data.
 						 int sizebytes); // size of jpeg compressed data.
 
 	// Compress image data into JPEG stream, returns compressed data.
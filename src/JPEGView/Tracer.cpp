@@ -0,0 +1,164 @@
+#include "StdAfx.h"
+#include "Tracer.h"
+#include <stdio.h>
+#include <vector>
+
+// A finished span
+struct CSpanRecord {
+	ETraceStage Stage;
+	EImageFormat Format;
+	__int64 Pixels;
+	__int64 StartTicks;
+	__int64 EndTicks;
+	DWORD ThreadId;
+};
+
+volatile bool CTracer::sm_bEnabled = false;
+
+static std::vector<CSpanRecord> s_spans; // protected by s_csSpans
+static int s_nMaxSpans = 0;
+static int s_nDroppedSpans = 0;
+static CRITICAL_SECTION s_csSpans;
+static __int64 s_nFrequency = 1;
+static __int64 s_nStartTicks = 0; // time zero of the trace
+
+// Innermost span of the thread, used to inherit the image format
+static __declspec(thread) CTraceSpan* tl_pCurrentSpan = NULL;
+
+static const char* s_stageNames[TRACE_Count] = {
+	"Load", "File read", "Parse", "Decode", "Color convert", "ICC transform", "LDC/histogram", "Resample", "LUT", "Blit"
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// CTracer
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+void CTracer::Enable(int nMaxSpans) {
+	if (sm_bEnabled) {
+		return;
+	}
+	::InitializeCriticalSection(&s_csSpans);
+	LARGE_INTEGER frequency, ticks;
+	::QueryPerformanceFrequency(&frequency);
+	::QueryPerformanceCounter(&ticks);
+	s_nFrequency = frequency.QuadPart;
+	s_nStartTicks = ticks.QuadPart;
+	s_nMaxSpans = max(1, nMaxSpans);
+	s_spans.reserve(min(s_nMaxSpans, 65536));
+	sm_bEnabled = true;
+}
+
+__int64 CTracer::GetTicks() {
+	LARGE_INTEGER ticks;
+	::QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+}
+
+void CTracer::AddSpan(ETraceStage eStage, EImageFormat eFormat, __int64 nPixels, __int64 nStartTicks, __int64 nEndTicks) {
+	if (!sm_bEnabled) {
+		return;
+	}
+	CSpanRecord span = { eStage, eFormat, nPixels, nStartTicks, nEndTicks, ::GetCurrentThreadId() };
+	::EnterCriticalSection(&s_csSpans);
+	if ((int)s_spans.size() < s_nMaxSpans) {
+		try {
+			s_spans.push_back(span);
+		} catch (...) {
+			s_nDroppedSpans++;
+		}
+	} else {
+		s_nDroppedSpans++;
+	}
+	::LeaveCriticalSection(&s_csSpans);
+}
+
+LPCSTR CTracer::GetStageName(ETraceStage eStage) {
+	return (eStage >= 0 && eStage < TRACE_Count) ? s_stageNames[eStage] : "Unknown";
+}
+
+LPCSTR CTracer::GetFormatName(EImageFormat eFormat) {
+	switch (eFormat) {
+		case IF_JPEG: return "JPEG";
+		case IF_WindowsBMP: return "BMP";
+		case IF_PNG: return "PNG";
+		case IF_GIF: return "GIF";
+		case IF_TIFF: return "TIFF";
+		case IF_WEBP: return "WebP";
+		case IF_JXL: return "JXL";
+		case IF_HEIF: return "HEIF";
+		case IF_AVIF: return "AVIF";
+		case IF_QOI: return "QOI";
+		case IF_PSD: return "PSD";
+		case IF_WIC: return "WIC";
+		case IF_CLIPBOARD: return "Clipboard";
+		case IF_CameraRAW: return "RAW";
+		case IF_JPEG_Embedded: return "Embedded JPEG";
+		case IF_TGA: return "TGA";
+		case IF_DDS: return "DDS";
+		default: return "Unknown";
+	}
+}
+
+bool CTracer::WriteChromeTrace(LPCTSTR sFileName) {
+	if (!sm_bEnabled) {
+		return false;
+	}
+	std::vector<CSpanRecord> spans;
+	int nDroppedSpans;
+	::EnterCriticalSection(&s_csSpans);
+	try {
+		spans = s_spans;
+	} catch (...) {
+		::LeaveCriticalSection(&s_csSpans);
+		return false;
+	}
+	nDroppedSpans = s_nDroppedSpans;
+	::LeaveCriticalSection(&s_csSpans);
+
+	FILE* pFile = NULL;
+	if (_tfopen_s(&pFile, sFileName, _T("wt")) != 0 || pFile == NULL) {
+		return false;
+	}
+	// Complete events ("ph": "X") with timestamps and durations in microseconds
+	DWORD nProcessId = ::GetCurrentProcessId();
+	fprintf(pFile, "{\n  \"displayTimeUnit\": \"ms\",\n  \"otherData\": { \"droppedSpans\": %d },\n  \"traceEvents\": [\n", nDroppedSpans);
+	fprintf(pFile, "    { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": %u, \"tid\": 0, \"args\": { \"name\": \"JPEGView\" } }", nProcessId);
+	double dMicrosecondsPerTick = 1000000.0 / s_nFrequency;
+	for (std::vector<CSpanRecord>::const_iterator iter = spans.begin(); iter != spans.end(); iter++) {
+		fprintf(pFile, ",\n    { \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %u, \"tid\": %u, \"args\": { \"format\": \"%s\", \"pixels\": %I64d } }",
+			GetStageName(iter->Stage), (iter->Stage < TRACE_Histogram) ? "load" : "render",
+			(iter->StartTicks - s_nStartTicks) * dMicrosecondsPerTick, (iter->EndTicks - iter->StartTicks) * dMicrosecondsPerTick,
+			nProcessId, iter->ThreadId, GetFormatName(iter->Format), iter->Pixels);
+	}
+	fprintf(pFile, "\n  ]\n}\n");
+	bool bSuccess = ferror(pFile) == 0;
+	fclose(pFile);
+	return bSuccess;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// CTraceSpan
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+void CTraceSpan::Begin(ETraceStage eStage, EImageFormat eFormat, __int64 nPixels) {
+	m_eStage = eStage;
+	m_eFormat = eFormat;
+	m_nPixels = nPixels;
+	m_pParent = tl_pCurrentSpan;
+	tl_pCurrentSpan = this;
+	m_nStartTicks = CTracer::GetTicks();
+}
+
+void CTraceSpan::Finish() {
+	__int64 nEndTicks = CTracer::GetTicks();
+	m_bActive = false;
+	EImageFormat eFormat = m_eFormat;
+	for (CTraceSpan* pParent = m_pParent; eFormat == IF_Unknown && pParent != NULL; pParent = pParent->m_pParent) {
+		eFormat = pParent->m_eFormat;
+	}
+	// spans are ended in reverse order of creation, except when ended early with End()
+	if (tl_pCurrentSpan == this) {
+		tl_pCurrentSpan = m_pParent;
+	}
+	CTracer::AddSpan(m_eStage, eFormat, m_nPixels, m_nStartTicks, nEndTicks);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ImageProcessingTypes.h"
+
+// Stages of loading and rendering an image, recorded as spans with CTraceSpan
+enum ETraceStage {
+	TRACE_Load,         // complete load request of the image load thread, contains the other load stages
+	TRACE_FileRead,     // reading the file into memory
+	TRACE_Parse,        // parsing the container and the image headers
+	TRACE_Decode,       // decoding the compressed data, includes the color conversion for decoders doing both in one call
+	TRACE_ColorConvert, // conversion of color space and channel order, alpha blending
+	TRACE_ICC,          // ICC profile transform
+	TRACE_Histogram,    // construction of the LDC map and the histogram
+	TRACE_Resample,     // resampling to the target size
+	TRACE_LUT,          // applying the correction LUTs and the LDC
+	TRACE_Blit,         // painting the processed DIB to the screen
+	TRACE_Count
+};
+
+// Records timed spans of the load and render stages of images and exports them in the Chrome trace event format.
+// The JSON file can be opened with chrome://tracing or https://ui.perfetto.dev, one track per thread.
+// Recording is off until Enable() is called, a CTraceSpan only costs a flag check then.
+class CTracer
+{
+public:
+	// Starts recording. At most nMaxSpans spans are kept, further spans are dropped.
+	// Must be called before other threads create spans.
+	static void Enable(int nMaxSpans = 1000000);
+	static bool IsEnabled() { return sm_bEnabled; }
+
+	// Adds a finished span of the calling thread, the times are performance counter ticks. Thread safe.
+	static void AddSpan(ETraceStage eStage, EImageFormat eFormat, __int64 nPixels, __int64 nStartTicks, __int64 nEndTicks);
+
+	// Writes the spans recorded so far as Chrome trace JSON file. Returns false if the file cannot be written.
+	static bool WriteChromeTrace(LPCTSTR sFileName);
+
+	// Current performance counter ticks
+	static __int64 GetTicks();
+
+	// Names used in the trace file
+	static LPCSTR GetStageName(ETraceStage eStage);
+	static LPCSTR GetFormatName(EImageFormat eFormat);
+
+private:
+	static volatile bool sm_bEnabled;
+	CTracer(void);
+};
+
+// Records the time between construction and destruction (or End()) as span of the given stage on the calling thread.
+// Spans without image format get the format of the enclosing span of the same thread, e.g. an ICC transform during loading.
+class CTraceSpan
+{
+public:
+	CTraceSpan(ETraceStage eStage, EImageFormat eFormat = IF_Unknown, __int64 nPixels = 0) {
+		m_bActive = CTracer::IsEnabled();
+		if (m_bActive) {
+			Begin(eStage, eFormat, nPixels);
+		}
+	}
+	~CTraceSpan() {
+		End();
+	}
+
+	// Format and number of pixels are often only known after the stage has finished
+	void SetFormat(EImageFormat eFormat) { m_eFormat = eFormat; }
+	void SetPixels(__int64 nPixels) { m_nPixels = nPixels; }
+
+	// Ends the span before the object is destroyed
+	void End() {
+		if (m_bActive) {
+			Finish();
+		}
+	}
+
+private:
+	bool m_bActive;
+	ETraceStage m_eStage;
+	EImageFormat m_eFormat;
+	__int64 m_nPixels;
+	__int64 m_nStartTicks;
+	CTraceSpan* m_pParent; // enclosing span of the same thread
+
+	void Begin(ETraceStage eStage, EImageFormat eFormat, __int64 nPixels);
+	void Finish();
+
+	CTraceSpan(const CTraceSpan&);
+	CTraceSpan& operator=(const CTraceSpan&);
+};
@@ -0,0 +1,174 @@
+#include "StdAfx.h"
+#include "ResizeFilter.h"
+#include "UnsharpMaskAVX.h"
+
+#ifdef _WIN64
+
+// Filters one pixel with the given kernel, same as the C++ implementation
+static inline int16 FilterPixel(const FilterKernel* pKernel, const int16* pSourcePixel) {
+	int nPixelValue = 0;
+	for (int n = 0; n < pKernel->FilterLen; n++) {
+		nPixelValue += pKernel->Kernel[n] * pSourcePixel[n];
+	}
+	return (int16)(nPixelValue >> 14);
+}
+
+// Converts the eight int32 values to int16, dropping the upper 16 bits as the C++ implementation does
+static inline __m128i TruncateToInt16(__m256i values) {
+	values = _mm256_srai_epi32(_mm256_slli_epi32(values, 16), 16);
+	return _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+}
+
+// Transposes the 8x8 block of int16 values
+static inline void Transpose8x8(__m128i* pRows) {
+	__m128i t0 = _mm_unpacklo_epi16(pRows[0], pRows[1]);
+	__m128i t1 = _mm_unpackhi_epi16(pRows[0], pRows[1]);
+	__m128i t2 = _mm_unpacklo_epi16(pRows[2], pRows[3]);
+	__m128i t3 = _mm_unpackhi_epi16(pRows[2], pRows[3]);
+	__m128i t4 = _mm_unpacklo_epi16(pRows[4], pRows[5]);
+	__m128i t5 = _mm_unpackhi_epi16(pRows[4], pRows[5]);
+	__m128i t6 = _mm_unpacklo_epi16(pRows[6], pRows[7]);
+	__m128i t7 = _mm_unpackhi_epi16(pRows[6], pRows[7]);
+	__m128i u0 = _mm_unpacklo_epi32(t0, t2);
+	__m128i u1 = _mm_unpackhi_epi32(t0, t2);
+	__m128i u2 = _mm_unpacklo_epi32(t1, t3);
+	__m128i u3 = _mm_unpackhi_epi32(t1, t3);
+	__m128i u4 = _mm_unpacklo_epi32(t4, t6);
+	__m128i u5 = _mm_unpackhi_epi32(t4, t6);
+	__m128i u6 = _mm_unpacklo_epi32(t5, t7);
+	__m128i u7 = _mm_unpackhi_epi32(t5, t7);
+	pRows[0] = _mm_unpacklo_epi64(u0, u4);
+	pRows[1] = _mm_unpackhi_epi64(u0, u4);
+	pRows[2] = _mm_unpacklo_epi64(u1, u5);
+	pRows[3] = _mm_unpackhi_epi64(u1, u5);
+	pRows[4] = _mm_unpacklo_epi64(u2, u6);
+	pRows[5] = _mm_unpackhi_epi64(u2, u6);
+	pRows[6] = _mm_unpacklo_epi64(u3, u7);
+	pRows[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+int ApplyFilter1C16bpp_AVX(int nSourceWidth, int nTargetWidth, int nStartX, int nStartY, int nRunX, int nRunY,
+	const FilterKernelBlock& filter, const int16* pSource, int16* pTarget) {
+
+	// The columns from nInnerStart to nInnerEnd - 1 use the inner (not cut) kernel and are processed in blocks of 8x8 pixels,
+	// the other columns use the C++ code
+	const FilterKernel* pInnerKernel = &(filter.Kernels[0]);
+	int nInnerStart = 0;
+	while (nInnerStart < nRunX && filter.Indices[nInnerStart + nStartX] != pInnerKernel) nInnerStart++;
+	int nInnerEnd = nInnerStart;
+	while (nInnerEnd < nRunX && filter.Indices[nInnerEnd + nStartX] == pInnerKernel) nInnerEnd++;
+	int nNumBlocksX = (nInnerEnd - nInnerStart) >> 3;
+	nInnerEnd = nInnerStart + nNumBlocksX * 8;
+
+	__m256i kernel[MAX_FILTER_LEN];
+	int nFilterLen = pInnerKernel->FilterLen;
+	int nFilterOffset = pInnerKernel->FilterOffset;
+	for (int n = 0; n < nFilterLen; n++) {
+		kernel[n] = _mm256_set1_epi32(pInnerKernel->Kernel[n]);
+	}
+
+	int nNumBlocksY = nRunY >> 3;
+	for (int j = 0; j < nNumBlocksY * 8; j += 8) {
+		const int16* pSourcePixelLines[8];
+		for (int r = 0; r < 8; r++) {
+			pSourcePixelLines[r] = pSource + nStartX + nSourceWidth * (j + r + nStartY);
+		}
+
+		for (int i = 0; i < nRunX; i++) {
+			if (i >= nInnerStart && i < nInnerEnd) {
+				continue; // processed below
+			}
+			const FilterKernel* pKernel = filter.Indices[i + nStartX];
+			int16* pTargetPixel = pTarget + j + i * nTargetWidth;
+			for (int r = 0; r < 8; r++) {
+				pTargetPixel[r] = FilterPixel(pKernel, pSourcePixelLines[r] + i - pKernel->FilterOffset);
+			}
+		}
+
+		for (int i = nInnerStart; i < nInnerEnd; i += 8) {
+			__m128i block[8];
+			for (int r = 0; r < 8; r++) {
+				const int16* pSourcePixel = pSourcePixelLines[r] + i - nFilterOffset;
+				__m256i sum = _mm256_setzero_si256();
+				for (int n = 0; n < nFilterLen; n++) {
+					__m256i pixels = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(pSourcePixel + n)));
+					sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(pixels, kernel[n]));
+				}
+				block[r] = TruncateToInt16(_mm256_srai_epi32(sum, 14));
+			}
+			// rotate: the 8 rows of the block become 8 columns in the target
+			Transpose8x8(block);
+			int16* pTargetPixel = pTarget + j + i * nTargetWidth;
+			for (int c = 0; c < 8; c++) {
+				_mm_storeu_si128((__m128i*)pTargetPixel, block[c]);
+				pTargetPixel += nTargetWidth;
+			}
+		}
+	}
+
+	return nNumBlocksY * 8;
+}
+
+int UnsharpMaskRow_AVX(int nNumPixels, const int16* pGray, const int16* pSmoothedGray, const int16* pThresholdLUT, int nAmount,
+	const uint8* pSource, uint8* pTarget, int nChannels) {
+	// 3 channel pixels are gathered as 32 bit values, thus the last pixel of the row must not be read this way
+	int nNumBlocks = ((nChannels == 3) ? nNumPixels - 1 : nNumPixels) >> 3;
+	if (nNumBlocks <= 0) {
+		return 0;
+	}
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i maxValue = _mm256_set1_epi32(255);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m256i amount = _mm256_set1_epi32(nAmount);
+	const __m256i offsets3Channels = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const __m256i compact3Channels = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int nBytesPerBlock = nChannels * 8;
+
+	for (int i = 0; i < nNumBlocks; i++) {
+		// Note: LUT contains 2^11 entries, subtraction of two 14 bit values can be 15 bit
+		__m256i gray = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)pGray));
+		__m256i smoothed = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)pSmoothedGray));
+		__m256i index = _mm256_srai_epi32(_mm256_sub_epi32(gray, smoothed), 4);
+		__m256i diff = _mm256_i32gather_epi32((const int*)pThresholdLUT, index, 2);
+		diff = _mm256_srai_epi32(_mm256_slli_epi32(diff, 16), 16); // sign extend the int16 LUT entry
+		__m256i sharpen = _mm256_srai_epi32(_mm256_mullo_epi32(diff, amount), 18);
+
+		__m256i pixels = (nChannels == 4) ? _mm256_loadu_si256((const __m256i*)pSource) :
+			_mm256_i32gather_epi32((const int*)pSource, offsets3Channels, 1);
+		__m256i blue = _mm256_and_si256(pixels, mask);
+		__m256i green = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask);
+		__m256i red = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask);
+		blue = _mm256_add_epi32(blue, _mm256_srai_epi32(_mm256_mullo_epi32(sharpen, blue), 8));
+		green = _mm256_add_epi32(green, _mm256_srai_epi32(_mm256_mullo_epi32(sharpen, green), 8));
+		red = _mm256_add_epi32(red, _mm256_srai_epi32(_mm256_mullo_epi32(sharpen, red), 8));
+		blue = _mm256_min_epi32(_mm256_max_epi32(blue, zero), maxValue);
+		green = _mm256_min_epi32(_mm256_max_epi32(green, zero), maxValue);
+		red = _mm256_min_epi32(_mm256_max_epi32(red, zero), maxValue);
+		__m256i result = _mm256_or_si256(_mm256_or_si256(blue, _mm256_slli_epi32(green, 8)), _mm256_slli_epi32(red, 16));
+
+		if (nChannels == 4) {
+			result = _mm256_or_si256(result, _mm256_set1_epi32(0xFF000000));
+			_mm256_storeu_si256((__m256i*)pTarget, result);
+		} else {
+			// write exactly 24 bytes, the pixels behind may not have been read yet when sharpening in place
+			result = _mm256_shuffle_epi8(result, compact3Channels);
+			__m128i low = _mm256_castsi256_si128(result);
+			__m128i high = _mm256_extracti128_si256(result, 1);
+			_mm_storel_epi64((__m128i*)pTarget, low);
+			*((int*)(pTarget + 8)) = _mm_extract_epi32(low, 2);
+			_mm_storel_epi64((__m128i*)(pTarget + 12), high);
+			*((int*)(pTarget + 20)) = _mm_extract_epi32(high, 2);
+		}
+
+		pGray += 8;
+		pSmoothedGray += 8;
+		pSource += nBytesPerBlock;
+		pTarget += nBytesPerBlock;
+	}
+
+	return nNumBlocks * 8;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+struct FilterKernelBlock;
+
+// Used by BasicProcessing.cpp: Applies the Gauss filter in x-direction and rotates, 16 bpp 1 channel image, using AVX2.
+// Same parameters as ApplyFilter1C16bpp() in BasicProcessing.cpp, processes 8 rows at once.
+// Returns the number of rows processed, a multiple of 8. The caller processes the remaining rows.
+// Own compilation unit to be able to compile this with AVX compiler flag.
+int ApplyFilter1C16bpp_AVX(int nSourceWidth, int nTargetWidth, int nStartX, int nStartY, int nRunX, int nRunY,
+	const FilterKernelBlock& filter, const int16* pSource, int16* pTarget);
+
+// Used by BasicProcessing.cpp: Sharpens one row of 3 or 4 channel pixels using AVX2, see UnsharpMask_Core() in BasicProcessing.cpp.
+// pThresholdLUT points to the center of the threshold LUT, the LUT must have one additional element at the end.
+// pSource and pTarget may be identical. Returns the number of pixels processed, a multiple of 8.
+// The caller processes the remaining pixels.
+int UnsharpMaskRow_AVX(int nNumPixels, const int16* pGray, const int16* pSmoothedGray, const int16* pThresholdLUT, int nAmount,
+	const uint8* pSource, uint8* pTarget, int nChannels);
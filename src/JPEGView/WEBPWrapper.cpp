@@ -7,6 +7,11 @@
 #include "MaxImageDef.h"
 #include "Helpers.h"
 #include "ICCProfileTransform.h"
+#include "ProcessingThreadPool.h"
+#include "Tracer.h"
+
+// Size of the compressed data chunks fed to the incremental decoder, the decoding can be cancelled between chunks
+static const int DECODE_CHUNK_SIZE = 1024 * 1024;
 
 struct WebpReaderWriter::webp_cache {
 	WebPAnimDecoder* decoder;
@@ -17,8 +22,6 @@ struct WebpReaderWriter::webp_cache {
 	void* transform;
 };
 
-WebpReaderWriter::webp_cache WebpReaderWriter::cache = { 0 };
-
 void* WebpReaderWriter::ReadImage(int& width,
 	int& height,
 	int& nchannels,
@@ -27,6 +30,7 @@ void* WebpReaderWriter::ReadImage(int& width,
 	int& frame_time,
 	void*& exif_chunk,
 	bool& outOfMemory,
+	webp_cache*& cache,
 	const void* buffer,
 	int sizebytes)
 {
@@ -37,7 +41,8 @@ void* WebpReaderWriter::ReadImage(int& width,
 	outOfMemory = false;
 	exif_chunk = NULL;
 
-	if (!cache.decoder || !cache.data.bytes) {
+	if (cache == NULL) {
+		CTraceSpan parseSpan(TRACE_Parse);
 		if (!WebPGetInfo((const uint8_t*)buffer, sizebytes, &width, &height))
 			return NULL;
 		if (width > MAX_IMAGE_DIMENSION || height > MAX_IMAGE_DIMENSION)
@@ -73,6 +78,7 @@ void* WebpReaderWriter::ReadImage(int& width,
 		}
 		WebPDemuxReleaseChunkIterator(&chunk_iter);
 		WebPDemuxDelete(demuxer);
+		parseSpan.End();
 
 		has_animation = features.has_animation;
 		if (!has_animation) {
@@ -83,7 +89,26 @@ void* WebpReaderWriter::ReadImage(int& width,
 				outOfMemory = true;
 				return NULL;
 			}
-			WebPDecodeBGRAInto((const uint8_t*)buffer, sizebytes, pPixelData, size, nStride);
+			CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)width * height);
+			WebPIDecoder* pDecoder = WebPINewRGB(MODE_BGRA, pPixelData, size, nStride);
+			if (pDecoder != NULL) {
+				VP8StatusCode eStatus = VP8_STATUS_SUSPENDED;
+				for (int nOffset = 0; eStatus == VP8_STATUS_SUSPENDED && nOffset < sizebytes; nOffset += DECODE_CHUNK_SIZE) {
+					if (CProcessingThreadPool::IsCancelledOnThread()) {
+						WebPIDelete(pDecoder);
+						ICCProfileTransform::DeleteTransform(transform);
+						delete[] pPixelData;
+						free(exif_chunk);
+						exif_chunk = NULL;
+						return NULL;
+					}
+					eStatus = WebPIUpdate(pDecoder, (const uint8_t*)buffer, min(sizebytes, nOffset + DECODE_CHUNK_SIZE));
+				}
+				WebPIDelete(pDecoder);
+			} else {
+				WebPDecodeBGRAInto((const uint8_t*)buffer, sizebytes, pPixelData, size, nStride);
+			}
+			decodeSpan.End();
 
 			// ICCP transform in place
 			ICCProfileTransform::DoTransform(transform, pPixelData, pPixelData, width, height);
@@ -92,24 +117,30 @@ void* WebpReaderWriter::ReadImage(int& width,
 			return pPixelData;
 		}
 	
-		// Cache WebP data and decoder to keep track of where we are in the file
-		DeleteCache();
+		// Keep WebP data and decoder to keep track of where we are in the file
+		cache = new(std::nothrow) webp_cache();
+		if (cache == NULL) {
+			ICCProfileTransform::DeleteTransform(transform);
+			free(exif_chunk);
+			exif_chunk = NULL;
+			outOfMemory = true;
+			return NULL;
+		}
 		WebPAnimDecoderOptions anim_config;
 		WebPAnimDecoderOptionsInit(&anim_config);
 		anim_config.color_mode = MODE_BGRA;
-		uint8_t* cached_webp_bytes = new uint8_t[sizebytes];
-		memcpy(cached_webp_bytes, buffer, sizebytes);
-		cache.data.bytes = cached_webp_bytes;
-		cache.data.size = sizebytes;
-		cache.decoder = WebPAnimDecoderNew(&cache.data, &anim_config);
-		cache.width = width;
-		cache.height = height;
-		cache.transform = transform;
+		// The decoder reads from the buffer of the caller, it must stay valid until DeleteCache() is called
+		cache->data.bytes = (const uint8_t*)buffer;
+		cache->data.size = sizebytes;
+		cache->decoder = WebPAnimDecoderNew(&cache->data, &anim_config);
+		cache->width = width;
+		cache->height = height;
+		cache->transform = transform;
 	}
-	WebPAnimDecoder* decoder = cache.decoder;
-	WebPData webp_data = cache.data;
-	width = cache.width;
-	height = cache.height;
+	WebPAnimDecoder* decoder = cache->decoder;
+	width = cache->width;
+	height = cache->height;
+	has_animation = true;
 
 	if (decoder == NULL)
 		return NULL;
@@ -117,20 +148,22 @@ void* WebpReaderWriter::ReadImage(int& width,
 	// Decode frame
 	int timestamp;
 	uint8_t* buf;
+	CTraceSpan decodeSpan(TRACE_Decode, IF_Unknown, (__int64)width * height);
 	if (!WebPAnimDecoderHasMoreFrames(decoder))
 		WebPAnimDecoderReset(decoder);
 	if (!WebPAnimDecoderGetNext(decoder, &buf, &timestamp))
 		return NULL;
+	decodeSpan.End();
 
 	// Set frametime and frame count
 	WebPAnimInfo anim_info;
 	WebPAnimDecoderGetInfo(decoder, &anim_info);
 	frame_count = max(anim_info.frame_count, 1);
 	timestamp = max(timestamp, 0);
-	if (timestamp < cache.prev_frame_timestamp)
-		cache.prev_frame_timestamp = 0;
-	frame_time = timestamp - cache.prev_frame_timestamp;
-	cache.prev_frame_timestamp = timestamp;
+	if (timestamp < cache->prev_frame_timestamp)
+		cache->prev_frame_timestamp = 0;
+	frame_time = timestamp - cache->prev_frame_timestamp;
+	cache->prev_frame_timestamp = timestamp;
 
 	pPixelData = new(std::nothrow) unsigned char[width * height * nchannels];
 	if (pPixelData == NULL) {
@@ -139,7 +172,7 @@ void* WebpReaderWriter::ReadImage(int& width,
 	}
 
 	// Try copying with ICCP transform
-	if (!ICCProfileTransform::DoTransform(cache.transform, buf, pPixelData, width, height)) {
+	if (!ICCProfileTransform::DoTransform(cache->transform, buf, pPixelData, width, height)) {
 		// Copy frame to output buffer directly otherwise
 		memcpy(pPixelData, buf, width * height * nchannels);
 	}
@@ -148,11 +181,12 @@ void* WebpReaderWriter::ReadImage(int& width,
 
 }
 
-void WebpReaderWriter::DeleteCache() {
-	WebPAnimDecoderDelete(cache.decoder);
-	WebPDataClear(&cache.data);
-	ICCProfileTransform::DeleteTransform(cache.transform);
-	cache = { 0 };
+void WebpReaderWriter::DeleteCache(webp_cache* cache) {
+	if (cache != NULL) {
+		WebPAnimDecoderDelete(cache->decoder);
+		ICCProfileTransform::DeleteTransform(cache->transform);
+		delete cache;
+	}
 }
 
 void* WebpReaderWriter::Compress(const void* source,
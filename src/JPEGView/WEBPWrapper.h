@@ -4,7 +4,12 @@
 class WebpReaderWriter
 {
 public:
+	// Decoder state of an animation, kept from one frame to the next
+	struct webp_cache;
+
 	// Returns data in 4 byte BGRA
+	// If cache is NULL, the image is read from the buffer. For animations, the first frame is returned and a new decoder state
+	// is created in cache, the following frames are read by passing this state again (buffer and sizebytes are ignored then).
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -13,10 +18,13 @@ public:
 		int& frame_time, // frame duration in milliseconds
 		void*& exif, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
+		webp_cache*& cache, // decoder state of an animation, must be deleted by the caller with DeleteCache()
 		const void* buffer, // memory address containing webp compressed data.
 		int sizebytes); // size of webp compressed data
 
-	static void DeleteCache();
+	// Deletes the decoder state of an animation. The buffer passed to ReadImage() of an animation
+	// is not copied, it must stay valid until this method is called.
+	static void DeleteCache(webp_cache* cache);
 
 	// Compress image data into WEBP stream, returns compressed data.
 	static void* Compress(const void* buffer, // address of image in memory, format must be 3 bytes per pixel BRGBGR with padding to 4 byte boundary
@@ -27,8 +35,4 @@ public:
 		bool lossless); // use lossless compression if true
 
 	static void FreeMemory(void* pointer);
-
-private:
-	struct webp_cache;
-	static webp_cache cache;
 };
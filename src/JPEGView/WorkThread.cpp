@@ -11,6 +11,7 @@ CWorkThread::CWorkThread(bool bCoInitialize)
 	: m_csList{ 0 }
 {
 	m_bTerminate = false;
+	m_pRequestInProcess = NULL;
 	m_bCoInitialize = bCoInitialize;
 	::InitializeCriticalSection(&m_csList);
 	m_wakeUp = ::CreateEvent(0, TRUE, FALSE, NULL);
@@ -50,6 +51,19 @@ void CWorkThread::ProcessAsync(CRequestBase* pRequest) {
 	::SetEvent(m_wakeUp);
 }
 
+bool CWorkThread::CancelRequest(CRequestBase* pRequest) {
+	::EnterCriticalSection(&m_csList);
+	bool bCancelled = !pRequest->Processed && pRequest != m_pRequestInProcess;
+	if (bCancelled) {
+		m_requestList.remove(pRequest);
+		delete pRequest;
+	} else if (!pRequest->Processed) {
+		pRequest->Cancelled = true;
+	}
+	::LeaveCriticalSection(&m_csList);
+	return bCancelled;
+}
+
 void CWorkThread::Terminate() { 
 	m_bTerminate = true;
 	if (m_hThread != NULL) {
@@ -90,16 +104,17 @@ void CWorkThread::ThreadFunc(void* arg) {
 		// Delete the requests marked for deletion from request queue
 		DeleteAllRequestsMarkedForDeletion(thisPtr);
 
-		// search a request that is not yet processed
+		// search the request with highest priority that is not yet processed and not blocked, the first posted among equal priorities
 		CRequestBase* requestHandled = NULL;
-		int nNumUnprocessedRequests = 0;
 		std::list<CRequestBase*>::iterator iter;
 		for (iter = thisPtr->m_requestList.begin( ); iter != thisPtr->m_requestList.end( ); iter++ ) {
-			if ((*iter)->Processed == false) {
-				requestHandled = *iter;
-				nNumUnprocessedRequests++;
+			if ((*iter)->Processed == false && !thisPtr->IsBlocked(**iter)) {
+				if (requestHandled == NULL || (*iter)->Priority > requestHandled->Priority) {
+					requestHandled = *iter;
+				}
 			}
 		}
+		thisPtr->m_pRequestInProcess = requestHandled;
 
 		::LeaveCriticalSection(&thisPtr->m_csList);
 
@@ -107,6 +122,7 @@ void CWorkThread::ThreadFunc(void* arg) {
 		if (requestHandled != NULL) {
 			thisPtr->ProcessRequest(*requestHandled);
 			requestHandled->Processed = true;
+			thisPtr->m_pRequestInProcess = NULL;
 
 			// signal end of processing
 			if (requestHandled->EventFinished != NULL) {
@@ -122,11 +138,11 @@ void CWorkThread::ThreadFunc(void* arg) {
 			if (!thisPtr->m_bTerminate) {
 				thisPtr->AfterFinishProcess(*requestHandled);
 			}
-			nNumUnprocessedRequests--;
 		}
 
-		// if there are no more requests, sleep until woke up
-		if (nNumUnprocessedRequests == 0 && !thisPtr->m_bTerminate) {
+		// if there are no more requests that can be processed, sleep until woke up. After having processed a request,
+		// the queue is searched again, the request may have unblocked other requests.
+		if (requestHandled == NULL && !thisPtr->m_bTerminate) {
 			::WaitForSingleObject(thisPtr->m_wakeUp, INFINITE);
 			::ResetEvent(thisPtr->m_wakeUp);
 		}
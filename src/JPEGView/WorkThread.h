@@ -10,6 +10,8 @@ public:
 		Processed = false;
 		Deleted = false;
 		Type = 0;
+		Priority = 0;
+		Cancelled = false;
 	}
 
 	CRequestBase() {
@@ -18,13 +20,19 @@ public:
 		Processed = false;
 		Deleted = false;
 		Type = 0;
+		Priority = 0;
+		Cancelled = false;
 	}
 
+	virtual ~CRequestBase() {}
+
 	int Type; // Can be used to set the type of the request, default is 0
 	HANDLE EventFinished; // Event signaled when processing is finished
 	volatile LONG* EventFinishedCounter; // if not NULL, this counter is decremented after having handled the request and the event is not fired until it gets zero
 	volatile bool Processed; // Set to true when processing is finished
 	volatile bool Deleted; // Marks requests for deletion from the request queue
+	volatile int Priority; // Requests with higher priority are processed first, the first posted request first among equal priorities
+	volatile bool Cancelled; // Set when the request is cancelled while being processed, see CWorkThread::CancelRequest()
 };
 
 
@@ -57,17 +65,27 @@ protected:
 	// Ownership of the request object is taken over by the method.
 	void ProcessAsync(CRequestBase* pRequest);
 
+	// Removes the request from the request queue and deletes it if its processing has not started yet, returns true then.
+	// If the request is being processed, its Cancelled flag is set. ProcessRequest() shall poll this flag and return early,
+	// the request is finished as usual afterwards. Returns false if the request is being processed or has been processed.
+	bool CancelRequest(CRequestBase* pRequest);
+
 	// Called in the context of the worker thread to process the request
 	virtual void ProcessRequest(CRequestBase& request) = 0;
 
 	// Called in the context of the worker thread after it has been signaled that the request has been processed
 	virtual void AfterFinishProcess(CRequestBase& request) {}
 
+	// Called in the context of the worker thread with the request list locked. Blocked requests are not processed
+	// until they get unblocked, e.g. when they depend on the result of another request in the queue.
+	virtual bool IsBlocked(const CRequestBase& request) { return false; }
+
 	std::list<CRequestBase*> m_requestList; // list of requests, also contains processed requests not yet removed by client
 	CRITICAL_SECTION m_csList; // the critical section protecting the request list (m_requestList)
 	HANDLE m_wakeUp; // wake up event for the tread (it sleeps while there is nothing to process)
 	HANDLE m_hThread; // working thread
 	volatile bool m_bTerminate; // flags termination for thread
+	CRequestBase* volatile m_pRequestInProcess; // request currently processed by the thread, NULL if none
 
 private:
 	static void  __cdecl ThreadFunc(void* arg);
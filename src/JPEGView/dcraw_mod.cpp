@@ -4,6 +4,7 @@
 #include "TJPEGWrapper.h"
 #include "MaxImageDef.h"
 #include "RawMetadata.h"
+#include "PagedPixelBuffer.h"
 
 #define NODEPS
 #define DJGPP
@@ -10668,7 +10669,7 @@ void CLASS jpeg_thumb(CJPEGImage** Image, bool& bOutOfMemory)
     }
     else
     {
-        delete[] pPixelData;
+        CPagedPixelBuffer::FreePixels(pPixelData);
     }
 
     free(thumb);